@@ -0,0 +1,2447 @@
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "thincloud.h"
+#include "thincloud_broker.h"
+#include "lock_schema.h"
+
+/*
+ * Allocation counting
+ *
+ * malloc and friends are interposed so every allocation made by the SDK
+ * and json-c during a benchmark is counted, on any thread. Requires glibc.
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static atomic_uint_fast64_t allocations = 0;
+static atomic_uint_fast64_t allocatedBytes = 0;
+
+static void count_allocation(size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&allocatedBytes, size, memory_order_relaxed);
+}
+
+void *malloc(size_t size)
+{
+    count_allocation(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    count_allocation(nmemb * size);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count_allocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+/*
+ * Publish stub
+ *
+ * bench is linked with --wrap=aws_iot_mqtt_publish. While stubPublish is
+ * set, publishes are serialized into a packet buffer as the MQTT client
+ * would and dropped, so the send path can be measured without a network.
+ */
+
+extern IoT_Error_t __real_aws_iot_mqtt_publish(AWS_IoT_Client *client, const char *topicName, uint16_t topicNameLen, IoT_Publish_Message_Params *params);
+
+static bool stubPublish = false;
+static uint64_t stubPublishedBytes = 0;
+
+IoT_Error_t __wrap_aws_iot_mqtt_publish(AWS_IoT_Client *client, const char *topicName, uint16_t topicNameLen, IoT_Publish_Message_Params *params)
+{
+    static unsigned char packet[MAX_TOPIC_LENGTH + TC_MAX_PAYLOAD_LENGTH + 16];
+
+    if (!stubPublish)
+    {
+        return __real_aws_iot_mqtt_publish(client, topicName, topicNameLen, params);
+    }
+
+    size_t written = 0;
+    const IoT_Error_t rc = tc_mqtt_serialize_publish(packet, sizeof(packet), topicName, topicNameLen, params->qos, false, 1, params->payload, params->payloadLen, &written);
+    stubPublishedBytes += written;
+
+    return rc;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Reporting
+ *
+ * Every suite prints one JSON document through the report_* functions:
+ *
+ *   {"suite": "batch", "results": [
+ *     {"name": "tc_batch_publish (0 B flush)", "msg_per_s": 812345, ...},
+ *     ...
+ *   ]}
+ *
+ * Failures go to stderr so the document stays parseable.
+ */
+
+static uint32_t reportResults = 0;
+static bool reportOpen = false;
+
+static void report_string(const char *value)
+{
+    putchar('"');
+    for (const char *c = value; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            putchar('\\');
+        }
+        putchar(*c);
+    }
+    putchar('"');
+}
+
+static void report_begin(const char *suite)
+{
+    reportResults = 0;
+    reportOpen = false;
+
+    printf("{\"suite\": ");
+    report_string(suite);
+    printf(", \"results\": [\n");
+}
+
+static void report_close(void)
+{
+    if (reportOpen)
+    {
+        printf("}");
+        reportOpen = false;
+    }
+}
+
+/**
+ * Start a result; report_text and report_value add its fields
+ */
+static void report_result(const char *name)
+{
+    report_close();
+    printf("%s  {\"name\": ", reportResults++ > 0 ? ",\n" : "");
+    report_string(name);
+    reportOpen = true;
+}
+
+static void report_text(const char *key, const char *value)
+{
+    printf(", \"%s\": ", key);
+    report_string(value);
+}
+
+static void report_value(const char *key, double value)
+{
+    // JSON has no infinity or NaN, as from a rate over no elapsed time
+    if (!(value > -1e18 && value < 1e18))
+    {
+        printf(", \"%s\": null", key);
+        return;
+    }
+
+    // Counts print as integers, rates and ratios with two decimals
+    printf(", \"%s\": %.*f", key, value == (double)(int64_t)value ? 0 : 2, value);
+}
+
+static void report_end(void)
+{
+    report_close();
+    printf("%s]}\n", reportResults > 0 ? "\n" : "");
+    fflush(stdout);
+}
+
+/**
+ * Count given on the command line, or fallback
+ */
+static uint32_t count_arg(const char *arg, uint32_t fallback)
+{
+    return arg != NULL ? (uint32_t)strtoul(arg, NULL, 10) : fallback;
+}
+
+#define BENCH_ITERATIONS 200000
+
+static char buffer[4096];
+static json_object *body = NULL;
+static char *relatedIds[] = {"7f8e5b1a-3c5d-4e2f-9a7b-1c2d3e4f5a6b", "0a1b2c3d-4e5f-6a7b-8c9d-0e1f2a3b4c5d"};
+
+typedef struct
+{
+    double nsPerOp;
+    double allocationsPerOp;
+    double bytesPerOp;
+} bench_result;
+
+static bench_result measure(void (*fn)(void), uint32_t iterations)
+{
+    fn();
+
+    const uint64_t allocationsBefore = allocations;
+    const uint64_t bytesBefore = allocatedBytes;
+    const uint64_t start = now_ns();
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        fn();
+    }
+
+    const uint64_t elapsed = now_ns() - start;
+
+    bench_result result;
+    result.nsPerOp = (double)elapsed / iterations;
+    result.allocationsPerOp = (double)(allocations - allocationsBefore) / iterations;
+    result.bytesPerOp = (double)(allocatedBytes - bytesBefore) / iterations;
+
+    return result;
+}
+
+static void report_measurement(const char *name, const bench_result *result)
+{
+    report_result(name);
+    report_value("msg_per_s", 1e9 / result->nsPerOp);
+    report_value("ns_per_op", result->nsPerOp);
+    report_value("allocs_per_op", result->allocationsPerOp);
+    report_value("bytes_per_op", result->bytesPerOp);
+}
+
+static void run(const char *name, void (*fn)(void))
+{
+    const bench_result result = measure(fn, BENCH_ITERATIONS);
+
+    report_measurement(name, &result);
+}
+
+/*
+ * Reference json-c DOM implementations, kept to compare against the
+ * streaming writer and the in-place tokenizer.
+ */
+
+static void dom_commissioning_request(char *out, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize)
+{
+    json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "id", json_object_new_string(requestId));
+    json_object_object_add(obj, "method", json_object_new_string("commission"));
+
+    json_object *params = json_object_new_array();
+    json_object *data = json_object_new_object();
+    json_object *dataObj = json_object_new_object();
+    json_object_object_add(data, "deviceType", json_object_new_string(deviceType));
+    json_object_object_add(data, "physicalId", json_object_new_string(physicalId));
+
+    json_object *relatedDevices = json_object_new_array();
+    for (uint32_t i = 0; i < idsSize; i++)
+    {
+        json_object *deviceIdObj = json_object_new_object();
+        json_object_object_add(deviceIdObj, "deviceId", json_object_new_string(relatedDeviceIds[i]));
+        json_object_array_add(relatedDevices, deviceIdObj);
+    }
+    json_object_object_add(data, "relatedDevices", relatedDevices);
+
+    json_object_object_add(dataObj, "data", data);
+    json_object_array_add(params, dataObj);
+    json_object_object_add(obj, "params", params);
+
+    strcpy(out, json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+    json_object_put(obj);
+}
+
+static void dom_command_response(char *out, const char *requestId, uint16_t statusCode, json_object *responseBody)
+{
+    json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "id", json_object_new_string(requestId));
+
+    json_object *result = json_object_new_object();
+    json_object_object_add(result, "statusCode", json_object_new_int(statusCode));
+    json_object_object_add(result, "body", responseBody);
+    json_object_object_add(obj, "result", result);
+
+    strcpy(out, json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+    json_object_put(obj);
+}
+
+static void dom_service_request(char *out, const char *requestId, const char *method, json_object *params)
+{
+    json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "id", json_object_new_string(requestId));
+    json_object_object_add(obj, "method", json_object_new_string(method));
+    json_object_object_add(obj, "params", params);
+
+    strcpy(out, json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+    json_object_put(obj);
+}
+
+static void dom_command_request(char *requestId, char *method, json_object **params, const char *payload, unsigned int payloadLen)
+{
+    json_tokener *tok = json_tokener_new();
+    json_object *obj = json_tokener_parse_ex(tok, payload, payloadLen);
+
+    strcpy(requestId, json_object_get_string(json_object_object_get(obj, "id")));
+    strcpy(method, json_object_get_string(json_object_object_get(obj, "method")));
+    json_object_deep_copy(json_object_object_get(obj, "params"), params, NULL);
+
+    json_tokener_free(tok);
+    json_object_put(obj);
+}
+
+static void dom_service_response(char *requestId, uint16_t *statusCode, json_object **data, const char *payload, unsigned int payloadLen)
+{
+    json_tokener *tok = json_tokener_new();
+    json_object *obj = json_tokener_parse_ex(tok, payload, payloadLen);
+
+    strcpy(requestId, json_object_get_string(json_object_object_get(obj, "id")));
+    json_object *result = json_object_object_get(obj, "result");
+    *statusCode = json_object_get_int(json_object_object_get(result, "statusCode"));
+    json_object_deep_copy(json_object_object_get(result, "body"), data, NULL);
+
+    json_tokener_free(tok);
+    json_object_put(obj);
+}
+
+/*
+ * Representative inbound payloads
+ */
+
+static const char *commandPayloads[] = {
+    "{\"id\":\"3f2504e0-4f89-11d3-9a0c-0305e82c3301\",\"method\":\"ping\",\"params\":[]}",
+    "{\"id\":\"6fa459ea-ee8a-3ca4-894e-db77e160355e\",\"method\":\"setLockState\",\"params\":[{\"data\":{\"locked\":true,\"source\":\"app\"}}]}",
+    "{\"id\":\"16fd2706-8baf-433b-82eb-8c7fada847da\",\"method\":\"startRoutine\",\"params\":[{\"data\":{\"routineId\":\"b7c6a2e4-1d3f-4a5b-9c8d-7e6f5a4b3c2d\",\"steps\":[{\"deviceId\":\"a1\",\"level\":40},{\"deviceId\":\"b2\",\"level\":100}],\"delay\":1.5}}]}",
+};
+
+#define COMMAND_PAYLOAD_COUNT (sizeof(commandPayloads) / sizeof(commandPayloads[0]))
+
+static const char *servicePayload = "{\"id\":\"3f2504e0-4f89-11d3-9a0c-0305e82c3301\",\"result\":{\"statusCode\":200,\"body\":{\"data\":{\"schedule\":[{\"day\":1,\"on\":\"07:00\",\"off\":\"22:30\"},{\"day\":2,\"on\":\"07:00\",\"off\":\"22:30\"}]}}}}";
+
+static uint32_t payloadIndex = 0;
+
+static void bench_dom_command_request(void)
+{
+    char requestId[TC_ID_LENGTH];
+    char method[64];
+    json_object *params = NULL;
+    const char *payload = commandPayloads[payloadIndex++ % COMMAND_PAYLOAD_COUNT];
+
+    dom_command_request(requestId, method, &params, payload, strlen(payload));
+    json_object_put(params);
+}
+
+static void bench_command_request(void)
+{
+    char requestId[TC_ID_LENGTH];
+    char method[64];
+    json_object *params = NULL;
+    const char *payload = commandPayloads[payloadIndex++ % COMMAND_PAYLOAD_COUNT];
+
+    command_request(requestId, method, &params, payload, strlen(payload));
+    json_object_put(params);
+}
+
+static void bench_command_request_view(void)
+{
+    tc_command_request_view view;
+    const char *payload = commandPayloads[payloadIndex++ % COMMAND_PAYLOAD_COUNT];
+
+    command_request_view(&view, payload, strlen(payload));
+}
+
+static void bench_dom_service_response(void)
+{
+    char requestId[TC_ID_LENGTH];
+    uint16_t statusCode;
+    json_object *data = NULL;
+
+    dom_service_response(requestId, &statusCode, &data, servicePayload, strlen(servicePayload));
+    json_object_put(data);
+}
+
+static void bench_service_response(void)
+{
+    char requestId[TC_ID_LENGTH];
+    uint16_t statusCode;
+    json_object *data = NULL;
+
+    service_response(requestId, &statusCode, &data, servicePayload, strlen(servicePayload));
+    json_object_put(data);
+}
+
+static void bench_service_response_view(void)
+{
+    tc_service_response_view view;
+
+    service_response_view(&view, servicePayload, strlen(servicePayload));
+}
+
+static tc_dispatcher dispatcher;
+static const char *serviceResponseTopic = "thincloud/devices/6fa459ea-ee8a-3ca4-894e-db77e160355e/requests/3f2504e0-4f89-11d3-9a0c-0305e82c3301/response";
+
+static void bench_dispatch_service_response(void)
+{
+    tc_dispatch(&dispatcher, NULL, serviceResponseTopic, strlen(serviceResponseTopic), servicePayload, strlen(servicePayload));
+}
+
+static tc_correlation_table pendingRequests;
+
+static void ignore_service_response(AWS_IoT_Client *client, IoT_Error_t rc, const tc_service_response_view *response, void *userData)
+{
+    (void)client;
+    (void)rc;
+    (void)response;
+    (void)userData;
+}
+
+static void bench_correlate_service_response(void)
+{
+    tc_correlation_insert(&pendingRequests, "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 36, ignore_service_response, NULL, UINT64_MAX, NULL);
+    tc_dispatch(&dispatcher, NULL, serviceResponseTopic, strlen(serviceResponseTopic), servicePayload, strlen(servicePayload));
+}
+
+static tc_context context;
+
+static void bench_command_request_ctx(void)
+{
+    char requestId[TC_ID_LENGTH];
+    char method[64];
+    json_object *params = NULL;
+    const char *payload = commandPayloads[payloadIndex++ % COMMAND_PAYLOAD_COUNT];
+
+    command_request_ctx(&context, requestId, method, &params, payload, strlen(payload));
+    json_object_put(params);
+}
+
+/*
+ * Soak test
+ *
+ * Parses command payloads through a context for a long run and reports
+ * resident memory growth and the per-message latency distribution.
+ */
+
+static long rss_kb(void)
+{
+    long pages = 0;
+    long resident = 0;
+
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+    {
+        return -1;
+    }
+
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+    {
+        resident = -1;
+    }
+
+    fclose(statm);
+
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    const uint32_t x = *(const uint32_t *)a;
+    const uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void soak(const char *arg)
+{
+    const uint32_t count = count_arg(arg, 5000000);
+
+    uint32_t *latencies = malloc(count * sizeof(uint32_t));
+    if (latencies == NULL)
+    {
+        fprintf(stderr, "soak: could not allocate %u samples\n", count);
+        return;
+    }
+
+    memset(latencies, 0, count * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < 10000; i++)
+    {
+        bench_command_request_ctx();
+    }
+
+    const long rssBefore = rss_kb();
+    const uint64_t allocationsBefore = allocations;
+    const uint64_t start = now_ns();
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint64_t t0 = now_ns();
+        bench_command_request_ctx();
+        latencies[i] = (uint32_t)(now_ns() - t0);
+    }
+
+    const uint64_t elapsed = now_ns() - start;
+    const long rssAfter = rss_kb();
+
+    qsort(latencies, count, sizeof(uint32_t), compare_latency);
+
+    report_result("command_request_ctx");
+    report_value("messages", count);
+    report_value("seconds", (double)elapsed / 1e9);
+    report_value("msg_per_s", count * 1e9 / (double)elapsed);
+    report_value("allocs_per_op", (double)(allocations - allocationsBefore) / count);
+    report_value("rss_before_kb", rssBefore);
+    report_value("rss_after_kb", rssAfter);
+    report_value("p50_ns", latencies[count / 2]);
+    report_value("p90_ns", latencies[(uint64_t)count * 90 / 100]);
+    report_value("p99_ns", latencies[(uint64_t)count * 99 / 100]);
+    report_value("p999_ns", latencies[(uint64_t)count * 999 / 1000]);
+    report_value("max_ns", latencies[count - 1]);
+
+    free(latencies);
+}
+
+static tc_topic_cache topicCache;
+static char topic[MAX_TOPIC_LENGTH];
+
+static void bench_command_response_topic(void)
+{
+    command_response_topic(topic, "6fa459ea-ee8a-3ca4-894e-db77e160355e", "3f2504e0-4f89-11d3-9a0c-0305e82c3301");
+    volatile size_t topicLen = strlen(topic);
+    (void)topicLen;
+}
+
+static void bench_topic_cache_command_response(void)
+{
+    uint16_t topicLen;
+    tc_topic_cache_command_response(&topicCache, topic, sizeof(topic), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 36, &topicLen);
+}
+
+static void bench_dom_commissioning_request(void)
+{
+    dom_commissioning_request(buffer, "3f2504e0-4f89-11d3-9a0c-0305e82c3301", "lock", "00:11:22:33:44:55", relatedIds, 2);
+}
+
+static void bench_commissioning_request(void)
+{
+    commissioning_request(buffer, "3f2504e0-4f89-11d3-9a0c-0305e82c3301", "lock", "00:11:22:33:44:55", relatedIds, 2);
+}
+
+static void bench_dom_command_response(void)
+{
+    dom_command_response(buffer, "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 200, json_object_get(body));
+}
+
+static void bench_command_response(void)
+{
+    command_response(buffer, "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 200, false, NULL, json_object_get(body));
+}
+
+static void bench_dom_service_request(void)
+{
+    dom_service_request(buffer, "3f2504e0-4f89-11d3-9a0c-0305e82c3301", REQUEST_METHOD_PUT, json_object_get(body));
+}
+
+static void bench_service_request(void)
+{
+    service_request(buffer, "3f2504e0-4f89-11d3-9a0c-0305e82c3301", REQUEST_METHOD_PUT, json_object_get(body));
+}
+
+/*
+ * Loopback broker stand-in
+ *
+ * A thread drains one end of a socket pair and counts the PUBLISH packets
+ * it receives. The client writes to the other end through a plain socket
+ * network stack that counts write syscalls.
+ */
+
+static int loopbackFds[2];
+static uint64_t loopbackWrites = 0;
+static uint64_t loopbackReceived = 0;
+static uint32_t loopbackRttUs = 0;
+
+static IoT_Error_t loopback_write(Network *network, unsigned char *data, size_t len, Timer *timer, size_t *written)
+{
+    (void)timer;
+
+    const ssize_t sent = send(network->tlsDataParams.server_fd.fd, data, len, MSG_NOSIGNAL);
+    loopbackWrites++;
+
+    if (sent < 0)
+    {
+        return NETWORK_SSL_WRITE_ERROR;
+    }
+
+    *written = (size_t)sent;
+
+    return SUCCESS;
+}
+
+static IoT_Error_t loopback_read(Network *network, unsigned char *data, size_t len, Timer *timer, size_t *read)
+{
+    struct pollfd pfd = {network->tlsDataParams.server_fd.fd, POLLIN, 0};
+    if (poll(&pfd, 1, (int)left_ms(timer)) <= 0)
+    {
+        return NETWORK_SSL_NOTHING_TO_READ;
+    }
+
+    const ssize_t received = recv(network->tlsDataParams.server_fd.fd, data, len, MSG_WAITALL);
+    if (received <= 0)
+    {
+        return NETWORK_SSL_READ_ERROR;
+    }
+
+    *read = (size_t)received;
+
+    return SUCCESS;
+}
+
+static void *loopback_broker(void *arg)
+{
+    static unsigned char chunk[65536];
+    static unsigned char acks[65536];
+    size_t have = 0;
+
+    (void)arg;
+
+    for (;;)
+    {
+        const ssize_t received = recv(loopbackFds[1], chunk + have, sizeof(chunk) - have, 0);
+        if (received <= 0)
+        {
+            break;
+        }
+        have += (size_t)received;
+
+        size_t offset = 0;
+        size_t acksLen = 0;
+        while (have - offset >= 2)
+        {
+            size_t remaining = 0;
+            size_t size = 0;
+            if (tc_mqtt_decode_remaining_length(chunk + offset + 1, have - offset - 1, &remaining, &size) != SUCCESS ||
+                have - offset < 1 + size + remaining)
+            {
+                break;
+            }
+
+            if ((chunk[offset] & 0xF0) == TC_MQTT_PUBLISH)
+            {
+                __atomic_add_fetch(&loopbackReceived, 1, __ATOMIC_RELEASE);
+
+                // Acknowledge QoS1 messages with the packet ID after the topic
+                if (chunk[offset] & TC_MQTT_PUBLISH_QOS1)
+                {
+                    const unsigned char *variable = chunk + offset + 1 + size;
+                    const size_t topicLen = (size_t)variable[0] << 8 | variable[1];
+                    const unsigned char puback[] = {TC_MQTT_PUBACK, 2, variable[2 + topicLen], variable[3 + topicLen]};
+                    memcpy(acks + acksLen, puback, sizeof(puback));
+                    acksLen += sizeof(puback);
+                }
+            }
+            offset += 1 + size + remaining;
+        }
+
+        if (acksLen > 0)
+        {
+            usleep(loopbackRttUs);
+            send(loopbackFds[1], acks, acksLen, MSG_NOSIGNAL);
+        }
+
+        memmove(chunk, chunk + offset, have - offset);
+        have -= offset;
+    }
+
+    return NULL;
+}
+
+static void loopback(const char *name, tc_batch *batch, uint32_t count)
+{
+    static AWS_IoT_Client client;
+    pthread_t broker;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, loopbackFds) != 0)
+    {
+        fprintf(stderr, "loopback: socketpair failed\n");
+        return;
+    }
+    pthread_create(&broker, NULL, loopback_broker, NULL);
+
+    memset(&client, 0, sizeof(client));
+    client.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    client.clientData.commandTimeoutMs = 20000;
+    client.clientData.writeBufSize = AWS_IOT_MQTT_TX_BUF_LEN;
+    client.networkStack.write = loopback_write;
+    client.networkStack.tlsDataParams.server_fd.fd = loopbackFds[0];
+
+    char commandTopic[MAX_TOPIC_LENGTH];
+    uint16_t commandTopicLen = 0;
+    tc_topic_cache_command_response(&topicCache, commandTopic, sizeof(commandTopic), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 36, &commandTopicLen);
+
+    loopbackWrites = 0;
+    loopbackReceived = 0;
+    tc_context_set_batch(&context, batch);
+
+    const uint64_t start = now_ns();
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        tc_context_publish(&context, &client, commandTopic, commandTopicLen, servicePayload, strlen(servicePayload));
+    }
+
+    if (batch != NULL)
+    {
+        tc_batch_flush(batch, &client);
+    }
+
+    shutdown(loopbackFds[0], SHUT_WR);
+    pthread_join(broker, NULL);
+
+    const uint64_t elapsed = now_ns() - start;
+
+    tc_context_set_batch(&context, NULL);
+    close(loopbackFds[0]);
+    close(loopbackFds[1]);
+
+    report_result(name);
+    report_value("msg_per_s", count * 1e9 / (double)elapsed);
+    report_value("writes_per_msg", (double)loopbackWrites / count);
+    report_value("received", (double)loopbackReceived);
+}
+
+static void batch(const char *arg)
+{
+    const uint32_t count = count_arg(arg, 1000000);
+    static unsigned char batchBuffer[65536];
+    const size_t thresholds[] = {4096, 16384, 65536};
+    tc_batch outbound;
+
+    loopback("aws_iot_mqtt_publish", NULL, count);
+
+    for (size_t i = 0; i < sizeof(thresholds) / sizeof(thresholds[0]); i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "tc_batch_publish (%zu B flush)", thresholds[i]);
+
+        tc_batch_init(&outbound, batchBuffer, sizeof(batchBuffer), thresholds[i], 10);
+        loopback(name, &outbound, count);
+    }
+}
+
+static void outbox_run(const char *name, bool sync, uint32_t count)
+{
+    char path[] = "/tmp/tc_bench_outbox_XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        fprintf(stderr, "outbox: mkstemp failed\n");
+        return;
+    }
+    close(fd);
+
+    char commandTopic[MAX_TOPIC_LENGTH];
+    uint16_t commandTopicLen = 0;
+    tc_topic_cache_command_response(&topicCache, commandTopic, sizeof(commandTopic), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 36, &commandTopicLen);
+    const size_t payloadLen = strlen(servicePayload);
+
+    tc_outbox outbox;
+    const size_t recordLen = (TC_OUTBOX_RECORD_HEADER_LENGTH + commandTopicLen + payloadLen + TC_OUTBOX_ALIGNMENT - 1) & ~(size_t)(TC_OUTBOX_ALIGNMENT - 1);
+    if (tc_outbox_open(&outbox, path, (size_t)count * recordLen, sync) != SUCCESS)
+    {
+        fprintf(stderr, "outbox: open failed\n");
+        unlink(path);
+        return;
+    }
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        tc_outbox_append(&outbox, commandTopic, commandTopicLen, servicePayload, payloadLen, QOS0);
+    }
+    const uint64_t appendElapsed = now_ns() - start;
+    const uint32_t appended = tc_outbox_count(&outbox);
+
+    tc_outbox_record record;
+    uint32_t replayed = 0;
+    start = now_ns();
+    while (tc_outbox_peek(&outbox, &record, NULL) == SUCCESS)
+    {
+        replayed += record.payload.len == payloadLen;
+        tc_outbox_pop(&outbox);
+    }
+    const uint64_t replayElapsed = now_ns() - start;
+
+    tc_outbox_close(&outbox);
+    unlink(path);
+
+    report_result(name);
+    report_value("append_msg_per_s", appended * 1e9 / (double)appendElapsed);
+    report_value("append_mb_per_s", appended * (double)recordLen * 1e3 / (double)appendElapsed);
+    report_value("replay_msg_per_s", replayed * 1e9 / (double)replayElapsed);
+    report_value("replayed", replayed);
+    report_value("messages", count);
+}
+
+static void outbox(const char *arg)
+{
+    const uint32_t count = count_arg(arg, 100000);
+
+    outbox_run("tc_outbox", false, count);
+
+    // msync on every append and removal; far slower, so fewer messages
+    outbox_run("tc_outbox (sync)", true, count / 100 > 0 ? count / 100 : 1);
+}
+
+static void qos1(const char *name, uint16_t window, uint32_t count)
+{
+    static tc_inflight_client client;
+    static unsigned char slots[TC_INFLIGHT_MAX_WINDOW * 512];
+    tc_inflight inflight;
+    pthread_t broker;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, loopbackFds) != 0)
+    {
+        fprintf(stderr, "qos1: socketpair failed\n");
+        return;
+    }
+    pthread_create(&broker, NULL, loopback_broker, NULL);
+
+    memset(&client, 0, sizeof(client));
+    client.mqtt.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    client.mqtt.clientData.commandTimeoutMs = 20000;
+    client.mqtt.networkStack.write = loopback_write;
+    client.mqtt.networkStack.read = loopback_read;
+    client.mqtt.networkStack.tlsDataParams.server_fd.fd = loopbackFds[0];
+
+    tc_inflight_init(&inflight, slots, (size_t)window * 512, window, &context.timers, 1000, 3);
+    tc_inflight_attach(&inflight, &client);
+
+    char commandTopic[MAX_TOPIC_LENGTH];
+    uint16_t commandTopicLen = 0;
+    tc_topic_cache_command_response(&topicCache, commandTopic, sizeof(commandTopic), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 36, &commandTopicLen);
+
+    loopbackWrites = 0;
+    loopbackReceived = 0;
+
+    const uint64_t start = now_ns();
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        while (tc_inflight_publish(&inflight, commandTopic, commandTopicLen, servicePayload, strlen(servicePayload), NULL, NULL, NULL) == LIMIT_EXCEEDED_ERROR)
+        {
+            tc_yield(&context, &client.mqtt, 0);
+        }
+    }
+
+    while (tc_inflight_count(&inflight) > 0)
+    {
+        tc_yield(&context, &client.mqtt, 0);
+    }
+
+    const uint64_t elapsed = now_ns() - start;
+
+    tc_inflight_detach(&inflight);
+    shutdown(loopbackFds[0], SHUT_WR);
+    pthread_join(broker, NULL);
+    close(loopbackFds[0]);
+    close(loopbackFds[1]);
+
+    report_result(name);
+    report_value("msg_per_s", count * 1e9 / (double)elapsed);
+    report_value("acknowledged", (double)loopbackReceived);
+}
+
+static void qos(const char *arg)
+{
+    const uint32_t count = count_arg(arg, 10000);
+    const uint16_t windows[] = {1, 8, 32, 64};
+
+    loopbackRttUs = 200;
+
+    for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "tc_inflight_publish (window %u)", windows[i]);
+        qos1(name, windows[i], count);
+    }
+
+    loopbackRttUs = 0;
+}
+
+#define CONTENTION_QUEUE_SLOTS 1024
+
+static tc_client contentionClient;
+static pthread_mutex_t sdkMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t producerSends = 0;
+static bool useQueue = true;
+static uint32_t *sendLatencies = NULL;
+
+static void *contention_producer(void *arg)
+{
+    uint32_t *latencies = sendLatencies + (uintptr_t)arg * producerSends;
+    const char *payload = servicePayload;
+    const size_t payloadLen = strlen(payload);
+    const uint16_t topicLen = (uint16_t)strlen(topic);
+
+    for (uint32_t i = 0; i < producerSends; i++)
+    {
+        const uint64_t start = now_ns();
+
+        if (useQueue)
+        {
+            while (tc_client_publish(&contentionClient, topic, topicLen, payload, payloadLen, QOS0) == LIMIT_EXCEEDED_ERROR)
+            {
+                sched_yield();
+            }
+        }
+        else
+        {
+            pthread_mutex_lock(&sdkMutex);
+            tc_publish(&contentionClient.mqtt, topic, topicLen, payload, payloadLen);
+            pthread_mutex_unlock(&sdkMutex);
+        }
+
+        latencies[i] = (uint32_t)(now_ns() - start);
+    }
+
+    return NULL;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    const uint32_t x = *(const uint32_t *)a;
+    const uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void contention_run(const char *name, bool queue, uint32_t producers, uint32_t count)
+{
+    static tc_send sends[CONTENTION_QUEUE_SLOTS];
+    pthread_t threads[16];
+    pthread_t broker;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, loopbackFds) != 0)
+    {
+        fprintf(stderr, "contention: socketpair failed\n");
+        return;
+    }
+    pthread_create(&broker, NULL, loopback_broker, NULL);
+
+    tc_client_init(&contentionClient, sends, CONTENTION_QUEUE_SLOTS, "localhost", NULL, NULL, NULL, NULL, NULL);
+    contentionClient.mqtt.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    contentionClient.mqtt.clientData.commandTimeoutMs = 20000;
+    contentionClient.mqtt.networkStack.write = loopback_write;
+    contentionClient.mqtt.networkStack.tlsDataParams.server_fd.fd = loopbackFds[0];
+
+    loopbackWrites = 0;
+    loopbackReceived = 0;
+    useQueue = queue;
+    producerSends = count / producers;
+
+    const uint32_t total = producerSends * producers;
+    const uint64_t start = now_ns();
+
+    for (uintptr_t i = 0; i < producers; i++)
+    {
+        pthread_create(&threads[i], NULL, contention_producer, (void *)i);
+    }
+
+    // The consumer is the thread that owns the connection
+    if (queue)
+    {
+        uint32_t sent = 0;
+        while (sent < total)
+        {
+            sent += tc_client_flush(&contentionClient);
+        }
+    }
+
+    for (uint32_t i = 0; i < producers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    const uint64_t elapsed = now_ns() - start;
+
+    shutdown(loopbackFds[0], SHUT_WR);
+    pthread_join(broker, NULL);
+    close(loopbackFds[0]);
+    close(loopbackFds[1]);
+    tc_client_free(&contentionClient);
+
+    qsort(sendLatencies, total, sizeof(sendLatencies[0]), compare_u32);
+
+    report_result(name);
+    report_value("producers", producers);
+    report_value("msg_per_s", total * 1e9 / (double)elapsed);
+    report_value("send_p50_ns", sendLatencies[total / 2]);
+    report_value("send_p99_ns", sendLatencies[(uint64_t)total * 99 / 100]);
+    report_value("send_max_ns", sendLatencies[total - 1]);
+}
+
+static void contention(const char *arg)
+{
+    const uint32_t count = count_arg(arg, 1000000);
+    const uint32_t producers[] = {1, 2, 4, 8, 16};
+
+    tc_topic_cache_command_response(&topicCache, topic, sizeof(topic), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 36, NULL);
+    sendLatencies = malloc(count * sizeof(sendLatencies[0]));
+
+    for (size_t i = 0; i < sizeof(producers) / sizeof(producers[0]); i++)
+    {
+        contention_run("mutex around tc_publish", false, producers[i], count);
+        contention_run("tc_client_publish (MPSC)", true, producers[i], count);
+    }
+
+    free(sendLatencies);
+}
+
+static tc_client wakeupClient;
+static bool wakeupPolling = false;
+static bool wakeupStop = false;
+
+static void *wakeup_consumer(void *arg)
+{
+    (void)arg;
+
+    if (!wakeupPolling)
+    {
+        tc_run(&wakeupClient);
+        return NULL;
+    }
+
+    // The loop from the README example
+    while (!__atomic_load_n(&wakeupStop, __ATOMIC_ACQUIRE))
+    {
+        tc_client_yield(&wakeupClient, 100);
+    }
+
+    return NULL;
+}
+
+static uint64_t cpu_us(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+static void wakeup_run(const char *name, bool polling, uint32_t count)
+{
+    static tc_send sends[64];
+    pthread_t consumer;
+    pthread_t broker;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, loopbackFds) != 0)
+    {
+        fprintf(stderr, "wakeup: socketpair failed\n");
+        return;
+    }
+    pthread_create(&broker, NULL, loopback_broker, NULL);
+
+    tc_client_init(&wakeupClient, sends, 64, "localhost", NULL, NULL, NULL, NULL, NULL);
+    wakeupClient.mqtt.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    wakeupClient.mqtt.clientData.commandTimeoutMs = 20000;
+    wakeupClient.mqtt.networkStack.write = loopback_write;
+    wakeupClient.mqtt.networkStack.read = loopback_read;
+    wakeupClient.mqtt.networkStack.tlsDataParams.server_fd.fd = loopbackFds[0];
+
+    loopbackReceived = 0;
+    wakeupPolling = polling;
+    wakeupStop = false;
+    pthread_create(&consumer, NULL, wakeup_consumer, NULL);
+
+    const char *payload = servicePayload;
+    const size_t payloadLen = strlen(payload);
+    const uint16_t topicLen = (uint16_t)strlen(topic);
+
+    // Sends arrive at random points between yields
+    srand(1);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        usleep((useconds_t)(rand() % 100000));
+
+        const uint64_t start = now_ns();
+        tc_client_publish(&wakeupClient, topic, topicLen, payload, payloadLen, QOS0);
+        while (__atomic_load_n(&loopbackReceived, __ATOMIC_ACQUIRE) <= i)
+        {
+            sched_yield();
+        }
+        sendLatencies[i] = (uint32_t)((now_ns() - start) / 1000);
+    }
+
+    // Nothing to send for a second
+    const uint64_t idleStart = cpu_us();
+    sleep(1);
+    const uint64_t idleCpu = cpu_us() - idleStart;
+
+    __atomic_store_n(&wakeupStop, true, __ATOMIC_RELEASE);
+    tc_stop(&wakeupClient);
+    pthread_join(consumer, NULL);
+
+    shutdown(loopbackFds[0], SHUT_WR);
+    pthread_join(broker, NULL);
+    close(loopbackFds[0]);
+    close(loopbackFds[1]);
+    tc_client_free(&wakeupClient);
+
+    qsort(sendLatencies, count, sizeof(sendLatencies[0]), compare_u32);
+
+    report_result(name);
+    report_value("send_p50_us", sendLatencies[count / 2]);
+    report_value("send_p99_us", sendLatencies[(uint64_t)count * 99 / 100]);
+    report_value("send_max_us", sendLatencies[count - 1]);
+    report_value("idle_cpu_us_per_s", (double)idleCpu);
+}
+
+static void wakeup(const char *arg)
+{
+    const uint32_t count = count_arg(arg, 200);
+
+    tc_topic_cache_command_response(&topicCache, topic, sizeof(topic), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 36, NULL);
+    sendLatencies = malloc(count * sizeof(sendLatencies[0]));
+
+    wakeup_run("tc_client_yield(100) loop", true, count);
+    wakeup_run("tc_run", false, count);
+
+    free(sendLatencies);
+}
+
+#define METHOD_COUNT 64
+#define METHOD_SEQUENCE 4096
+
+static char methodNames[METHOD_COUNT][32];
+static tc_command_method methods[METHOD_COUNT];
+static tc_method_table methodTable;
+static tc_slice methodSequence[METHOD_SEQUENCE];
+static uint32_t methodCursor = 0;
+static uint64_t methodCalls = 0;
+
+static void count_method(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, void *userData)
+{
+    (void)client;
+    (void)deviceId;
+    (void)request;
+    (void)userData;
+
+    methodCalls++;
+}
+
+static void bench_strcmp_methods(void)
+{
+    const tc_slice method = methodSequence[methodCursor++ & (METHOD_SEQUENCE - 1)];
+
+    // What command_request and an if/strcmp chain do
+    char name[32];
+    memcpy(name, method.data, method.len);
+    name[method.len] = '\0';
+
+    for (uint32_t i = 0; i < METHOD_COUNT; i++)
+    {
+        if (strcmp(name, methodNames[i]) == 0)
+        {
+            methods[i].handler(NULL, method, NULL, methods[i].userData);
+            break;
+        }
+    }
+}
+
+static void bench_method_table(void)
+{
+    const tc_slice method = methodSequence[methodCursor++ & (METHOD_SEQUENCE - 1)];
+
+    const tc_command_method *found = tc_method_table_find(&methodTable, method);
+    if (found != NULL)
+    {
+        found->handler(NULL, method, NULL, found->userData);
+    }
+}
+
+static void method_dispatch(const char *arg)
+{
+    (void)arg;
+
+    const char *verbs[] = {"get", "set", "start", "stop", "reset", "list", "update", "delete"};
+    const char *nouns[] = {"Status", "Config", "Routine", "Schedule", "Firmware", "Scene", "Users", "Logs"};
+
+    for (uint32_t i = 0; i < METHOD_COUNT; i++)
+    {
+        snprintf(methodNames[i], sizeof(methodNames[i]), "%s%s", verbs[i / 8], nouns[i % 8]);
+        methods[i] = (tc_command_method){methodNames[i], count_method, NULL};
+    }
+
+    const uint64_t start = now_ns();
+    tc_method_table_init(&methodTable, methods, METHOD_COUNT);
+    report_result("tc_method_table_init (64 methods)");
+    report_value("us", (double)(now_ns() - start) / 1000);
+
+    srand(1);
+    for (uint32_t i = 0; i < METHOD_SEQUENCE; i++)
+    {
+        const char *name = methodNames[rand() % METHOD_COUNT];
+        methodSequence[i] = (tc_slice){name, strlen(name)};
+    }
+
+    run("if/strcmp chain (64 methods)", bench_strcmp_methods);
+    run("tc_method_table (64 methods)", bench_method_table);
+}
+
+/*
+ * Request IDs
+ *
+ * Compares generating a UUID request ID with snprintf and rand() against
+ * tc_context_request_id, and times parsing one and finding it in a full
+ * correlation table.
+ */
+
+#define ID_SEQUENCE 4096
+
+static char idText[TC_ID_LENGTH];
+static char idSequence[ID_SEQUENCE][TC_ID_LENGTH];
+static uint32_t idCursor = 0;
+static volatile uint64_t idSink = 0;
+
+static void bench_snprintf_request_id(void)
+{
+    snprintf(idText, sizeof(idText), "%04x%04x-%04x-4%03x-%04x-%04x%04x%04x", rand() & 0xffff, rand() & 0xffff, rand() & 0xffff, rand() & 0xfff, (rand() & 0x3fff) | 0x8000, rand() & 0xffff, rand() & 0xffff, rand() & 0xffff);
+    idSink += (uint8_t)idText[0];
+}
+
+static void bench_context_request_id(void)
+{
+    tc_context_request_id(&context, idText);
+    idSink += (uint8_t)idText[0];
+}
+
+static void bench_uuid_parse(void)
+{
+    tc_uuid id = {0, 0};
+    tc_uuid_parse(idSequence[idCursor++ & (ID_SEQUENCE - 1)], TC_UUID_TEXT_LENGTH, &id);
+    idSink += id.lo;
+}
+
+static void bench_correlation_find(void)
+{
+    const char *requestId = idSequence[idCursor++ % (TC_MAX_PENDING_REQUESTS - 1)];
+    idSink += tc_correlation_find(&pendingRequests, (tc_slice){requestId, TC_UUID_TEXT_LENGTH}) != NULL;
+}
+
+static void request_ids(const char *arg)
+{
+    (void)arg;
+
+    report_result("tc_pending_request");
+    report_value("bytes", sizeof(tc_pending_request));
+
+    srand(1);
+    run("snprintf + rand()", bench_snprintf_request_id);
+    run("tc_context_request_id", bench_context_request_id);
+
+    tc_correlation_init(&pendingRequests, NULL);
+    for (uint32_t i = 0; i < ID_SEQUENCE; i++)
+    {
+        tc_context_request_id(&context, idSequence[i]);
+        if (i < TC_MAX_PENDING_REQUESTS - 1)
+        {
+            tc_correlation_insert(&pendingRequests, idSequence[i], TC_UUID_TEXT_LENGTH, ignore_service_response, NULL, UINT64_MAX, NULL);
+        }
+    }
+
+    run("tc_uuid_parse", bench_uuid_parse);
+    run("tc_correlation_find (full table)", bench_correlation_find);
+}
+
+/*
+ * Statistics
+ *
+ * Compares dispatching and sending with and without statistics attached,
+ * and times a snapshot.
+ */
+
+static tc_stats stats;
+static tc_stats_report statsReport;
+static AWS_IoT_Client statsClient;
+
+static void bench_stats_send(void)
+{
+    send_command_response_ctx(&context, &statsClient, "6fa459ea-ee8a-3ca4-894e-db77e160355e", "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 200, false, NULL, NULL, QOS0);
+}
+
+static void bench_stats_snapshot(void)
+{
+    tc_stats_snapshot(&stats, &statsReport);
+}
+
+static void stats_overhead(const char *arg)
+{
+    (void)arg;
+
+    const char *filter = "thincloud/devices/6fa459ea-ee8a-3ca4-894e-db77e160355e/requests/+/response";
+    tc_dispatcher_init(&dispatcher);
+    tc_topic_trie_insert(&dispatcher.trie, filter, strlen(filter), TC_ROUTE_SERVICE_RESPONSE);
+    tc_stats_init(&stats);
+    memset(&statsClient, 0, sizeof(statsClient));
+    stubPublish = true;
+
+    run("tc_dispatch", bench_dispatch_service_response);
+    run("send_command_response_ctx", bench_stats_send);
+
+    tc_dispatcher_set_stats(&dispatcher, &stats);
+    tc_context_set_stats(&context, &stats);
+
+    run("tc_dispatch with stats", bench_dispatch_service_response);
+    run("send_command_response_ctx with stats", bench_stats_send);
+    run("tc_stats_snapshot", bench_stats_snapshot);
+
+    stubPublish = false;
+    tc_context_set_stats(&context, NULL);
+}
+
+/*
+ * Tracing
+ *
+ * Sends command responses and delivers service responses through the
+ * dispatcher's subscription handler. Built with TC_ENABLE_TRACE, as
+ * bench_trace is, it also dumps the trace for tools/tc_trace.py.
+ */
+
+static IoT_Publish_Message_Params traceParams;
+
+static void bench_trace_handler(void)
+{
+    tc_dispatcher_handler(NULL, (char *)serviceResponseTopic, (uint16_t)strlen(serviceResponseTopic), &traceParams, &dispatcher);
+}
+
+static void trace(const char *arg)
+{
+    const char *path = arg != NULL ? arg : "trace.bin";
+    const char *filter = "thincloud/devices/6fa459ea-ee8a-3ca4-894e-db77e160355e/requests/+/response";
+    tc_dispatcher_init(&dispatcher);
+    tc_topic_trie_insert(&dispatcher.trie, filter, strlen(filter), TC_ROUTE_SERVICE_RESPONSE);
+    memset(&statsClient, 0, sizeof(statsClient));
+    traceParams.payload = (void *)servicePayload;
+    traceParams.payloadLen = strlen(servicePayload);
+    stubPublish = true;
+
+    run("tc_dispatcher_handler", bench_trace_handler);
+    run("send_command_response_ctx", bench_stats_send);
+
+    stubPublish = false;
+
+    report_result("tc_trace_dump");
+    report_text("path", path);
+
+#ifdef TC_ENABLE_TRACE
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || tc_trace_dump(fd) != SUCCESS)
+    {
+        fprintf(stderr, "Could not write %s\n", path);
+        report_text("status", "failed");
+    }
+    else
+    {
+        report_text("status", "written");
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+#else
+    // Build bench_trace to write the trace
+    report_text("status", "compiled out");
+#endif
+}
+
+/*
+ * CBOR
+ *
+ * Converts the representative payloads to CBOR, reports the size of each
+ * message in both formats, and compares building and scanning them.
+ */
+
+static char cborCommandPayloads[COMMAND_PAYLOAD_COUNT][512];
+static size_t cborCommandLens[COMMAND_PAYLOAD_COUNT];
+static char cborServicePayload[512];
+static size_t cborServiceLen = 0;
+static tc_context cborContext;
+
+static size_t json_to_cbor(const char *json, char *out, size_t outLen)
+{
+    json_object *obj = json_tokener_parse(json);
+    tc_cbor_writer writer;
+    tc_cbor_writer_init(&writer, out, outLen);
+    tc_cbor_object(&writer, obj);
+    json_object_put(obj);
+
+    return writer.length;
+}
+
+static void report_sizes(const char *name, size_t jsonLen, size_t cborLen)
+{
+    char sizeName[64];
+    snprintf(sizeName, sizeof(sizeName), "%s size", name);
+
+    report_result(sizeName);
+    report_value("json_bytes", (double)jsonLen);
+    report_value("cbor_bytes", (double)cborLen);
+    report_value("smaller_percent", 100.0 * ((double)jsonLen - (double)cborLen) / (double)jsonLen);
+}
+
+static void bench_commissioning_request_cbor(void)
+{
+    commissioning_request_cbor_n(buffer, sizeof(buffer), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", "lock", "00:11:22:33:44:55", relatedIds, 2, NULL);
+}
+
+static void bench_command_response_cbor(void)
+{
+    command_response_cbor_n(buffer, sizeof(buffer), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 200, false, NULL, json_object_get(body), NULL);
+}
+
+static void bench_service_request_cbor(void)
+{
+    service_request_cbor_n(buffer, sizeof(buffer), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", REQUEST_METHOD_PUT, json_object_get(body), NULL);
+}
+
+static void bench_command_request_cbor_view(void)
+{
+    tc_command_request_view view;
+    const uint32_t index = payloadIndex++ % COMMAND_PAYLOAD_COUNT;
+
+    command_request_cbor_view(&view, cborCommandPayloads[index], cborCommandLens[index]);
+}
+
+static void bench_command_request_cbor_ctx(void)
+{
+    char requestId[TC_ID_LENGTH];
+    char method[64];
+    json_object *params = NULL;
+    const uint32_t index = payloadIndex++ % COMMAND_PAYLOAD_COUNT;
+
+    command_request_ctx(&cborContext, requestId, method, &params, cborCommandPayloads[index], (unsigned int)cborCommandLens[index]);
+    json_object_put(params);
+}
+
+static void bench_service_response_cbor_view(void)
+{
+    tc_service_response_view view;
+
+    service_response_cbor_view(&view, cborServicePayload, cborServiceLen);
+}
+
+static void cbor(const char *arg)
+{
+    (void)arg;
+
+    tc_context_init(&cborContext);
+    tc_context_set_format(&cborContext, TC_FORMAT_CBOR);
+
+    size_t jsonLen = 0;
+    size_t cborLen = 0;
+
+    commissioning_request_n(buffer, sizeof(buffer), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", "lock", "00:11:22:33:44:55", relatedIds, 2, &jsonLen);
+    commissioning_request_cbor_n(buffer, sizeof(buffer), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", "lock", "00:11:22:33:44:55", relatedIds, 2, &cborLen);
+    report_sizes("commissioning_request", jsonLen, cborLen);
+
+    command_response_n(buffer, sizeof(buffer), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 200, false, NULL, json_object_get(body), &jsonLen);
+    command_response_cbor_n(buffer, sizeof(buffer), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", 200, false, NULL, json_object_get(body), &cborLen);
+    report_sizes("command_response", jsonLen, cborLen);
+
+    service_request_n(buffer, sizeof(buffer), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", REQUEST_METHOD_PUT, json_object_get(body), &jsonLen);
+    service_request_cbor_n(buffer, sizeof(buffer), "3f2504e0-4f89-11d3-9a0c-0305e82c3301", REQUEST_METHOD_PUT, json_object_get(body), &cborLen);
+    report_sizes("service_request", jsonLen, cborLen);
+
+    for (uint32_t i = 0; i < COMMAND_PAYLOAD_COUNT; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "command request %u", i + 1);
+        cborCommandLens[i] = json_to_cbor(commandPayloads[i], cborCommandPayloads[i], sizeof(cborCommandPayloads[i]));
+        report_sizes(name, strlen(commandPayloads[i]), cborCommandLens[i]);
+    }
+
+    cborServiceLen = json_to_cbor(servicePayload, cborServicePayload, sizeof(cborServicePayload));
+    report_sizes("service response", strlen(servicePayload), cborServiceLen);
+
+    run("commissioning_request", bench_commissioning_request);
+    run("commissioning_request_cbor_n", bench_commissioning_request_cbor);
+    run("command_response", bench_command_response);
+    run("command_response_cbor_n", bench_command_response_cbor);
+    run("service_request", bench_service_request);
+    run("service_request_cbor_n", bench_service_request_cbor);
+    run("command_request_view", bench_command_request_view);
+    run("command_request_cbor_view", bench_command_request_cbor_view);
+    run("command_request_ctx (JSON)", bench_command_request_ctx);
+    run("command_request_ctx (CBOR)", bench_command_request_cbor_ctx);
+    run("service_response_view", bench_service_response_view);
+    run("service_response_cbor_view", bench_service_response_cbor_view);
+
+    tc_context_free(&cborContext);
+}
+
+/*
+ * Typed messages
+ *
+ * Reads the startRoutine command's fields once from a json-c copy of its
+ * params, the way handlers do with command_request, and once through the
+ * parser generated from lock_schema.json.
+ */
+
+static volatile size_t typedSum = 0;
+
+static void bench_typed_dom(void)
+{
+    char method[64];
+    json_object *params = NULL;
+    const char *payload = commandPayloads[2];
+
+    command_request(NULL, method, &params, payload, strlen(payload));
+
+    json_object *data = json_object_object_get(json_object_array_get_idx(params, 0), "data");
+    size_t sum = strlen(json_object_get_string(json_object_object_get(data, "routineId")));
+    json_object *steps = json_object_object_get(data, "steps");
+    for (size_t i = 0; i < json_object_array_length(steps); i++)
+    {
+        json_object *step = json_object_array_get_idx(steps, i);
+        sum += strlen(json_object_get_string(json_object_object_get(step, "deviceId")));
+        sum += (size_t)json_object_get_int64(json_object_object_get(step, "level"));
+    }
+    sum += (size_t)json_object_get_double(json_object_object_get(data, "delay"));
+
+    json_object_put(params);
+    typedSum += sum;
+}
+
+static void bench_typed_generated(void)
+{
+    tc_command_request_view view;
+    lock_start_routine_params params;
+    const char *payload = commandPayloads[2];
+
+    command_request_view(&view, payload, strlen(payload));
+    lock_start_routine_params_parse(&view, &params);
+
+    size_t sum = strlen(params.routineId);
+    for (uint32_t i = 0; i < params.stepsCount; i++)
+    {
+        sum += strlen(params.steps[i].deviceId);
+        sum += (size_t)params.steps[i].level;
+    }
+    sum += (size_t)params.delay;
+
+    typedSum += sum;
+}
+
+static void typed(const char *arg)
+{
+    (void)arg;
+
+    run("command_request + json_object_get", bench_typed_dom);
+    run("generated lock_start_routine_params", bench_typed_generated);
+}
+
+/*
+ * Compression
+ *
+ * Builds config dump and log excerpt payloads of 256 B to 16 KB, and
+ * reports the compression ratio with and without the preset dictionary
+ * and the CPU cost of compressing and decompressing each KB.
+ */
+
+#define COMPRESS_BYTES (64u * 1024u * 1024u)
+
+static char compressSource[16384 + 512];
+static char compressPacked[16384 + 1024];
+static char compressUnpacked[16384 + 512];
+
+static size_t config_payload(char *out, size_t size)
+{
+    uint32_t seed = 1;
+    size_t len = (size_t)sprintf(out, "{\"id\":\"3f2504e0-4f89-11d3-9a0c-0305e82c3301\",\"method\":\"PUT\",\"params\":[{\"data\":{\"zones\":[");
+
+    for (uint32_t zone = 0; len + 120 < size; zone++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        len += (size_t)sprintf(out + len, "%s{\"zone\":%u,\"name\":\"Zone %u\",\"brightness\":%u,\"enabled\":%s,\"schedule\":{\"on\":\"%02u:%02u\",\"off\":\"22:30\"}}",
+                               zone > 0 ? "," : "", zone, zone, (seed >> 16) % 101, (seed & 0x100) ? "true" : "false", (seed >> 8) % 12, (seed >> 4) % 60);
+    }
+
+    len += (size_t)sprintf(out + len, "]}}]}");
+    return len;
+}
+
+static size_t log_payload(char *out, size_t size)
+{
+    static const char *events[] = {"lock state changed to locked by keypad user", "lock state changed to unlocked by app user", "battery level reported at", "door sensor reported open for seconds"};
+    uint32_t seed = 7;
+    size_t len = (size_t)sprintf(out, "{\"id\":\"3f2504e0-4f89-11d3-9a0c-0305e82c3301\",\"result\":{\"statusCode\":200,\"body\":{\"data\":{\"log\":[");
+
+    for (uint32_t entry = 0; len + 120 < size; entry++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        len += (size_t)sprintf(out + len, "%s{\"ts\":%u,\"level\":\"%s\",\"message\":\"%s %u\"}",
+                               entry > 0 ? "," : "", 1700000000u + entry * 37u + (seed >> 24), (seed & 0x300) ? "info" : "warn", events[(seed >> 12) % 4], (seed >> 16) % 100);
+    }
+
+    len += (size_t)sprintf(out + len, "]}}}}");
+    return len;
+}
+
+static double compress_ns_per_kb(const tc_lz_dictionary *dictionary, size_t len, bool decompress, size_t *packedLen)
+{
+    size_t written = 0;
+    tc_lz_pack(dictionary, compressSource, len, compressPacked, sizeof(compressPacked), packedLen);
+
+    const uint32_t iterations = COMPRESS_BYTES / (uint32_t)len;
+    const uint64_t start = now_ns();
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        if (decompress)
+        {
+            tc_lz_unpack(dictionary, compressPacked, *packedLen, compressUnpacked, sizeof(compressUnpacked), &written);
+        }
+        else
+        {
+            tc_lz_pack(dictionary, compressSource, len, compressPacked, sizeof(compressPacked), &written);
+        }
+    }
+
+    return (double)(now_ns() - start) / ((double)iterations * (double)len / 1024.0);
+}
+
+static void compress(const char *arg)
+{
+    (void)arg;
+    static const size_t sizes[] = {256, 1024, 4096, 16384};
+    static const struct
+    {
+        const char *name;
+        size_t (*build)(char *out, size_t size);
+    } shapes[] = {{"config dump", config_payload}, {"log excerpt", log_payload}};
+
+    for (size_t shape = 0; shape < sizeof(shapes) / sizeof(shapes[0]); shape++)
+    {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            const size_t len = shapes[shape].build(compressSource, sizes[i]);
+            size_t packedLen = 0;
+            size_t dictionaryLen = 0;
+
+            compress_ns_per_kb(NULL, len, false, &packedLen);
+            const double packNs = compress_ns_per_kb(&tc_lz_thincloud_dictionary, len, false, &dictionaryLen);
+            const double unpackNs = compress_ns_per_kb(&tc_lz_thincloud_dictionary, len, true, &dictionaryLen);
+
+            report_result(shapes[shape].name);
+            report_value("bytes", (double)len);
+            report_value("ratio", (double)len / (double)packedLen);
+            report_value("dictionary_ratio", (double)len / (double)dictionaryLen);
+            report_value("pack_ns_per_kb", packNs);
+            report_value("unpack_ns_per_kb", unpackNs);
+        }
+    }
+}
+
+/*
+ * Structural scanning
+ *
+ * Builds service responses whose bodies range from 100 B to 1 MB, either
+ * of log entries, which are mostly short tokens, or of base64 firmware
+ * chunks, which are mostly long strings. Each is scanned with
+ * service_response_view under each block kernel the CPU supports, and
+ * parsed with json-c.
+ */
+
+#define SCAN_BYTES (64u * 1024u * 1024u)
+
+static char *scanPayload = NULL;
+static size_t scanLen = 0;
+static volatile size_t scanSum = 0;
+
+static size_t scan_payload(char *out, size_t size, bool chunks)
+{
+    static const char *messages[] = {"lock state changed to locked by keypad user", "door sensor reported open", "firmware update \\\"2.4.1\\\" downloaded", "battery level reported"};
+    static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint32_t seed = 3;
+    size_t len = (size_t)sprintf(out, "{\"id\":\"3f2504e0-4f89-11d3-9a0c-0305e82c3301\",\"result\":{\"statusCode\":200,\"body\":{\"data\":{\"%s\":[", chunks ? "chunks" : "log");
+
+    for (uint32_t entry = 0; entry == 0 || len + 160 < size; entry++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        if (!chunks)
+        {
+            len += (size_t)sprintf(out + len, "%s{\"ts\":%u,\"level\":\"%s\",\"message\":\"%s\",\"value\":%d.%u,\"ok\":%s}",
+                                   entry > 0 ? "," : "", 1700000000u + entry * 37u, (seed & 0x300) ? "info" : "warn", messages[(seed >> 12) % 4],
+                                   (int)((seed >> 16) % 200) - 100, (seed >> 8) % 10, (seed & 0x10) ? "true" : "null");
+            continue;
+        }
+
+        len += (size_t)sprintf(out + len, "%s{\"offset\":%u,\"data\":\"", entry > 0 ? "," : "", entry * 3072u);
+        for (size_t i = 0; i < 4096 && len + 160 < size; i++)
+        {
+            seed = seed * 1103515245u + 12345u;
+            out[len++] = base64[seed >> 26];
+        }
+        len += (size_t)sprintf(out + len, "\"}");
+    }
+
+    len += (size_t)sprintf(out + len, "]}}}}");
+    return len;
+}
+
+static void bench_scan_view(void)
+{
+    tc_service_response_view view;
+    service_response_view(&view, scanPayload, scanLen);
+    scanSum += view.body.len;
+}
+
+static void bench_scan_json_c(void)
+{
+    json_tokener *tok = json_tokener_new();
+    json_object *obj = json_tokener_parse_ex(tok, scanPayload, (int)scanLen);
+    scanSum += obj != NULL;
+    json_object_put(obj);
+    json_tokener_free(tok);
+}
+
+static double scan_mb_per_s(void (*fn)(void))
+{
+    fn();
+
+    const uint32_t iterations = (uint32_t)(SCAN_BYTES / scanLen / (fn == bench_scan_json_c ? 8 : 1)) + 1;
+    const uint64_t start = now_ns();
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        fn();
+    }
+
+    return (double)scanLen * iterations / ((double)(now_ns() - start) / 1e9) / 1e6;
+}
+
+static void scan(const char *arg)
+{
+    static const size_t sizes[] = {100, 1000, 10000, 100000, 1000000};
+    static const char *kernels[] = {"scalar_mb_per_s", "sse2_mb_per_s", "avx2_mb_per_s"};
+
+    (void)arg;
+
+    tc_scan_set_max_isa(TC_SCAN_AVX2);
+    const tc_scan_isa widest = tc_scan_supported();
+
+    scanPayload = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1] + 256);
+
+    // MB/s scanned by service_response_view under each kernel, and parsed by json-c
+    for (int chunks = 0; chunks < 2; chunks++)
+    {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            scanLen = scan_payload(scanPayload, sizes[i], chunks);
+            report_result(chunks ? "chunks" : "log");
+            report_value("bytes", (double)scanLen);
+            for (int isa = TC_SCAN_SCALAR; isa <= (int)widest; isa++)
+            {
+                tc_scan_set_max_isa((tc_scan_isa)isa);
+                report_value(kernels[isa], scan_mb_per_s(bench_scan_view));
+            }
+            report_value("json_c_mb_per_s", scan_mb_per_s(bench_scan_json_c));
+        }
+    }
+
+    tc_scan_set_max_isa(TC_SCAN_AVX2);
+    free(scanPayload);
+}
+
+/*
+ * End to end
+ *
+ * tc_init, tc_connect, commissioning, service requests and commands run
+ * unchanged against the loopback broker, over TCP and over a Unix
+ * socket. Inbound messages are read as tc_run does: poll the socket,
+ * then yield for a tick.
+ */
+
+#define E2E_WINDOW 64
+
+static tc_broker e2eBroker;
+static AWS_IoT_Client e2eClient;
+static tc_dispatcher e2eDispatcher;
+static tc_uuid_generator e2eIds;
+static char e2eDeviceId[TC_ID_LENGTH];
+static uint32_t e2eResponses = 0;
+static uint32_t e2eCommands = 0;
+static uint64_t e2eCommandResponses = 0;
+
+static void e2e_commissioning_response(AWS_IoT_Client *client, tc_slice registration, tc_slice requestId, const tc_commissioning_response_view *response, void *userData)
+{
+    (void)client;
+    (void)registration;
+    (void)requestId;
+    (void)userData;
+
+    snprintf(e2eDeviceId, sizeof(e2eDeviceId), "%.*s", (int)response->deviceId.len, response->deviceId.data);
+    e2eResponses++;
+}
+
+static void e2e_service_response(AWS_IoT_Client *client, tc_slice deviceId, tc_slice requestId, const tc_service_response_view *response, void *userData)
+{
+    (void)client;
+    (void)deviceId;
+    (void)requestId;
+    (void)response;
+    (void)userData;
+
+    e2eResponses++;
+}
+
+static void e2e_command_request(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, void *userData)
+{
+    char commandId[TC_ID_LENGTH];
+
+    (void)deviceId;
+    (void)userData;
+
+    snprintf(commandId, sizeof(commandId), "%.*s", (int)request->requestId.len, request->requestId.data);
+    send_command_response_ctx(&context, client, e2eDeviceId, commandId, 200, false, NULL, NULL, QOS0);
+    e2eCommands++;
+}
+
+static void e2e_observe(tc_broker *broker, const char *publishedTopic, uint16_t topicLen, const char *payload, size_t payloadLen, void *userData)
+{
+    static const char filter[] = "thincloud/devices/+/command/+/response";
+
+    (void)broker;
+    (void)payload;
+    (void)payloadLen;
+    (void)userData;
+
+    if (tc_broker_filter_matches(filter, sizeof(filter) - 1, publishedTopic, topicLen))
+    {
+        __atomic_add_fetch(&e2eCommandResponses, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static bool e2e_wait(const uint32_t *counter, uint32_t expected)
+{
+    while (*counter < expected)
+    {
+        struct pollfd pfd = {e2eClient.networkStack.tlsDataParams.server_fd.fd, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) <= 0 || aws_iot_mqtt_yield(&e2eClient, 1) != SUCCESS)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void e2e_report_latencies(const char *name, const char *what, uint32_t count)
+{
+    qsort(sendLatencies, count, sizeof(sendLatencies[0]), compare_u32);
+
+    report_result(what);
+    report_text("transport", name);
+    report_value("p50_us", sendLatencies[count / 2]);
+    report_value("p99_us", sendLatencies[(uint64_t)count * 99 / 100]);
+    report_value("max_us", sendLatencies[count - 1]);
+}
+
+static void e2e_run(const char *name, bool unixSocket, uint32_t count)
+{
+    char path[64];
+    char requestId[TC_UUID_TEXT_LENGTH + 1];
+
+    snprintf(path, sizeof(path), "/tmp/tc_bench_%d.sock", (int)getpid());
+
+    tc_broker_init(&e2eBroker);
+    if ((unixSocket ? tc_broker_listen_unix(&e2eBroker, path) : tc_broker_listen_tcp(&e2eBroker, 0)) != SUCCESS)
+    {
+        fprintf(stderr, "%s: listen failed\n", name);
+        tc_broker_stop(&e2eBroker);
+        return;
+    }
+    tc_broker_set_service_response(&e2eBroker, 200, "{\"data\":{\"locked\":true}}");
+    tc_broker_set_publish_handler(&e2eBroker, e2e_observe, NULL);
+    tc_broker_start(&e2eBroker);
+
+    uint64_t start = now_ns();
+    tc_init(&e2eClient, tc_broker_address(&e2eBroker), "", "", "", NULL, NULL);
+    tc_broker_network_init(&e2eClient.networkStack);
+    IoT_Error_t rc = tc_connect(&e2eClient, "bench", false);
+    const uint64_t connectNs = now_ns() - start;
+
+    tc_dispatcher_init(&e2eDispatcher);
+    if (rc == SUCCESS)
+    {
+        rc = tc_dispatcher_subscribe_commissioning_responses(&e2eDispatcher, &e2eClient, e2e_commissioning_response, NULL, QOS0);
+    }
+
+    e2eResponses = 0;
+    start = now_ns();
+    if (rc == SUCCESS)
+    {
+        tc_uuid_generate_text(&e2eIds, requestId);
+        rc = send_commissioning_request(&e2eClient, requestId, "lock", "123456", relatedIds, 2);
+    }
+    if (rc != SUCCESS || !e2e_wait(&e2eResponses, 1))
+    {
+        fprintf(stderr, "%s: connecting and commissioning failed (%d)\n", name, rc);
+        tc_broker_stop(&e2eBroker);
+        return;
+    }
+    const uint64_t commissionNs = now_ns() - start;
+
+    report_result("tc_init + tc_connect");
+    report_text("transport", name);
+    report_value("us", connectNs / 1e3);
+    report_result("commissioning round trip");
+    report_text("transport", name);
+    report_value("us", commissionNs / 1e3);
+
+    tc_dispatcher_subscribe_service_responses(&e2eDispatcher, &e2eClient, e2eDeviceId, e2e_service_response, NULL, QOS0);
+    tc_dispatcher_subscribe_command_requests(&e2eDispatcher, &e2eClient, e2eDeviceId, e2e_command_request, NULL, QOS0);
+
+    // One request in flight
+    e2eResponses = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        tc_uuid_generate_text(&e2eIds, requestId);
+
+        start = now_ns();
+        send_service_request(&e2eClient, requestId, e2eDeviceId, REQUEST_METHOD_GET, NULL);
+        e2e_wait(&e2eResponses, i + 1);
+        sendLatencies[i] = (uint32_t)((now_ns() - start) / 1000);
+    }
+    e2e_report_latencies(name, "service request round trip", count);
+
+    // A window of requests in flight
+    e2eResponses = 0;
+    start = now_ns();
+    for (uint32_t i = 0; i < count; i += E2E_WINDOW)
+    {
+        const uint32_t window = count - i < E2E_WINDOW ? count - i : E2E_WINDOW;
+        for (uint32_t j = 0; j < window; j++)
+        {
+            tc_uuid_generate_text(&e2eIds, requestId);
+            send_service_request(&e2eClient, requestId, e2eDeviceId, REQUEST_METHOD_GET, NULL);
+        }
+        e2e_wait(&e2eResponses, i + window);
+    }
+    report_result("service requests, 64 in flight");
+    report_text("transport", name);
+    report_value("msg_per_s", count * 1e9 / (double)(now_ns() - start));
+
+    // The broker commands the device and waits for its response
+    e2eCommands = 0;
+    const uint64_t observed = __atomic_load_n(&e2eCommandResponses, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        tc_uuid_generate_text(&e2eIds, requestId);
+
+        start = now_ns();
+        tc_broker_send_command(&e2eBroker, e2eDeviceId, requestId, "lock", "{\"locked\":true}");
+        e2e_wait(&e2eCommands, i + 1);
+        while (__atomic_load_n(&e2eCommandResponses, __ATOMIC_ACQUIRE) < observed + i + 1)
+        {
+            sched_yield();
+        }
+        sendLatencies[i] = (uint32_t)((now_ns() - start) / 1000);
+    }
+    e2e_report_latencies(name, "command round trip", count);
+
+    // Command responses alone, as fast as the client sends them
+    char commandTopic[MAX_TOPIC_LENGTH];
+    uint16_t commandTopicLen = 0;
+    tc_topic_cache_init(&topicCache, e2eDeviceId);
+    tc_topic_cache_command_response(&topicCache, commandTopic, sizeof(commandTopic), requestId, TC_UUID_TEXT_LENGTH, &commandTopicLen);
+
+    const uint64_t sent = __atomic_load_n(&e2eCommandResponses, __ATOMIC_ACQUIRE);
+    start = now_ns();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        tc_context_publish_qos(&context, &e2eClient, commandTopic, commandTopicLen, servicePayload, strlen(servicePayload), QOS0);
+    }
+    while (__atomic_load_n(&e2eCommandResponses, __ATOMIC_ACQUIRE) < sent + count)
+    {
+        sched_yield();
+    }
+    report_result("command responses to broker");
+    report_text("transport", name);
+    report_value("msg_per_s", count * 1e9 / (double)(now_ns() - start));
+
+    aws_iot_mqtt_disconnect(&e2eClient);
+    tc_broker_stop(&e2eBroker);
+}
+
+static void e2e(const char *arg)
+{
+    const uint32_t count = count_arg(arg, 2000);
+
+    sendLatencies = malloc(count * sizeof(sendLatencies[0]));
+    tc_uuid_generator_seed(&e2eIds, 1);
+
+    e2e_run("tcp", false, count);
+    e2e_run("unix", true, count);
+
+    free(sendLatencies);
+}
+
+/*
+ * API suite
+ *
+ * Runs each public topic builder, marshaller, unmarshaller and send
+ * function over a corpus of payloads and prints ns/op, allocations/op
+ * and heap bytes/op as JSON. Sends go through the publish stub.
+ */
+
+static const char *apiDeviceIds[] = {
+    "6fa459ea-ee8a-3ca4-894e-db77e160355e",
+    "0a1b2c3d-4e5f-6a7b-8c9d-0e1f2a3b4c5d",
+    "7f8e5b1a-3c5d-4e2f-9a7b-1c2d3e4f5a6b",
+};
+
+static const char *apiRequestIds[] = {
+    "3f2504e0-4f89-11d3-9a0c-0305e82c3301",
+    "16fd2706-8baf-433b-82eb-8c7fada847da",
+    "b7c6a2e4-1d3f-4a5b-9c8d-7e6f5a4b3c2d",
+    "886313e1-3b8a-5372-9b90-0c9aee199e5d",
+};
+
+static const char *apiBodies[] = {
+    "{\"data\":{\"locked\":true,\"battery\":87,\"firmware\":\"2.4.1\"}}",
+    "{\"data\":{\"schedule\":[{\"day\":1,\"on\":\"07:00\",\"off\":\"22:30\"},{\"day\":2,\"on\":\"07:00\",\"off\":\"22:30\"},{\"day\":3,\"on\":\"07:00\",\"off\":\"22:30\"},{\"day\":4,\"on\":\"07:00\",\"off\":\"22:30\"},{\"day\":5,\"on\":\"07:00\",\"off\":\"23:30\"}]}}",
+    "{\"data\":{\"events\":[{\"ts\":1571097600,\"type\":\"unlock\",\"source\":\"keypad\",\"user\":3},{\"ts\":1571101200,\"type\":\"lock\",\"source\":\"auto\"},{\"ts\":1571104800,\"type\":\"jammed\",\"source\":\"motor\",\"retries\":2},{\"ts\":1571108400,\"type\":\"battery\",\"level\":86}]}}",
+};
+
+static const char *apiServiceResponses[] = {
+    "{\"id\":\"3f2504e0-4f89-11d3-9a0c-0305e82c3301\",\"result\":{\"statusCode\":200,\"body\":{\"data\":{\"schedule\":[{\"day\":1,\"on\":\"07:00\",\"off\":\"22:30\"},{\"day\":2,\"on\":\"07:00\",\"off\":\"22:30\"}]}}}}",
+    "{\"id\":\"16fd2706-8baf-433b-82eb-8c7fada847da\",\"result\":{\"statusCode\":200,\"body\":{\"data\":{\"locked\":false}}}}",
+    "{\"id\":\"b7c6a2e4-1d3f-4a5b-9c8d-7e6f5a4b3c2d\",\"result\":{\"statusCode\":404}}",
+};
+
+static const char *apiCommissioningResponses[] = {
+    "{\"id\":\"3f2504e0-4f89-11d3-9a0c-0305e82c3301\",\"result\":{\"statusCode\":201,\"body\":{\"deviceId\":\"6fa459ea-ee8a-3ca4-894e-db77e160355e\"}}}",
+    "{\"id\":\"16fd2706-8baf-433b-82eb-8c7fada847da\",\"result\":{\"statusCode\":409,\"body\":{\"deviceId\":\"0a1b2c3d-4e5f-6a7b-8c9d-0e1f2a3b4c5d\"}}}",
+};
+
+#define API_COUNT(corpus) (sizeof(corpus) / sizeof(corpus[0]))
+#define API_PICK(corpus) (corpus[apiCursor % API_COUNT(corpus)])
+
+static json_object *apiBodyObjects[API_COUNT(apiBodies)];
+static AWS_IoT_Client apiClient;
+static tc_context apiCborContext;
+static uint32_t apiCursor = 0;
+
+static void api_commission_request_topic(void)
+{
+    apiCursor++;
+    commission_request_topic(topic, "lock", "00:11:22:33:44:55");
+}
+
+static void api_commission_response_topic(void)
+{
+    apiCursor++;
+    commission_response_topic(topic, "lock", "00:11:22:33:44:55", API_PICK(apiRequestIds));
+}
+
+static void api_command_request_topic(void)
+{
+    apiCursor++;
+    command_request_topic(topic, API_PICK(apiDeviceIds));
+}
+
+static void api_command_response_topic(void)
+{
+    apiCursor++;
+    command_response_topic(topic, API_PICK(apiDeviceIds), API_PICK(apiRequestIds));
+}
+
+static void api_service_request_topic(void)
+{
+    apiCursor++;
+    service_request_topic(topic, API_PICK(apiDeviceIds));
+}
+
+static void api_service_response_topic(void)
+{
+    apiCursor++;
+    service_response_topic(topic, API_PICK(apiDeviceIds), API_PICK(apiRequestIds));
+}
+
+static void api_topic_cache_command_response(void)
+{
+    uint16_t topicLen;
+    apiCursor++;
+    tc_topic_cache_command_response(&topicCache, topic, sizeof(topic), API_PICK(apiRequestIds), TC_UUID_TEXT_LENGTH, &topicLen);
+}
+
+static void api_topic_cache_service_response(void)
+{
+    uint16_t topicLen;
+    apiCursor++;
+    tc_topic_cache_service_response(&topicCache, topic, sizeof(topic), API_PICK(apiRequestIds), TC_UUID_TEXT_LENGTH, &topicLen);
+}
+
+static void api_commissioning_request(void)
+{
+    apiCursor++;
+    commissioning_request(buffer, API_PICK(apiRequestIds), "lock", "00:11:22:33:44:55", relatedIds, apiCursor % 3);
+}
+
+static void api_command_response(void)
+{
+    apiCursor++;
+    command_response(buffer, API_PICK(apiRequestIds), 200, false, NULL, json_object_get(API_PICK(apiBodyObjects)));
+}
+
+static void api_command_response_error(void)
+{
+    apiCursor++;
+    command_response(buffer, API_PICK(apiRequestIds), 500, true, "Motor jammed", NULL);
+}
+
+static void api_service_request(void)
+{
+    apiCursor++;
+    service_request(buffer, API_PICK(apiRequestIds), REQUEST_METHOD_PUT, json_object_get(API_PICK(apiBodyObjects)));
+}
+
+static void api_command_response_cbor(void)
+{
+    apiCursor++;
+    tc_marshal_command_response(TC_FORMAT_CBOR, buffer, sizeof(buffer), API_PICK(apiRequestIds), 200, false, NULL, json_object_get(API_PICK(apiBodyObjects)), NULL);
+}
+
+static void api_service_request_cbor(void)
+{
+    apiCursor++;
+    tc_marshal_service_request(TC_FORMAT_CBOR, buffer, sizeof(buffer), API_PICK(apiRequestIds), REQUEST_METHOD_PUT, json_object_get(API_PICK(apiBodyObjects)), NULL);
+}
+
+static void api_command_request(void)
+{
+    char requestId[TC_ID_LENGTH];
+    char method[64];
+    json_object *params = NULL;
+    const char *payload = commandPayloads[apiCursor++ % COMMAND_PAYLOAD_COUNT];
+
+    command_request(requestId, method, &params, payload, strlen(payload));
+    json_object_put(params);
+}
+
+static void api_command_request_ctx(void)
+{
+    char requestId[TC_ID_LENGTH];
+    char method[64];
+    json_object *params = NULL;
+    const char *payload = commandPayloads[apiCursor++ % COMMAND_PAYLOAD_COUNT];
+
+    command_request_ctx(&context, requestId, method, &params, payload, strlen(payload));
+    json_object_put(params);
+}
+
+static void api_command_request_view(void)
+{
+    tc_command_request_view view;
+    const char *payload = commandPayloads[apiCursor++ % COMMAND_PAYLOAD_COUNT];
+
+    command_request_view(&view, payload, strlen(payload));
+}
+
+static void api_service_response(void)
+{
+    char requestId[TC_ID_LENGTH];
+    uint16_t statusCode;
+    json_object *data = NULL;
+    apiCursor++;
+    const char *payload = API_PICK(apiServiceResponses);
+
+    service_response(requestId, &statusCode, &data, payload, strlen(payload));
+    json_object_put(data);
+}
+
+static void api_service_response_ctx(void)
+{
+    char requestId[TC_ID_LENGTH];
+    uint16_t statusCode;
+    json_object *data = NULL;
+    apiCursor++;
+    const char *payload = API_PICK(apiServiceResponses);
+
+    service_response_ctx(&context, requestId, &statusCode, &data, payload, strlen(payload));
+    json_object_put(data);
+}
+
+static void api_service_response_view(void)
+{
+    tc_service_response_view view;
+    apiCursor++;
+    const char *payload = API_PICK(apiServiceResponses);
+
+    service_response_view(&view, payload, strlen(payload));
+}
+
+static void api_commissioning_response(void)
+{
+    // commissioning_response takes a mutable payload
+    static char payload[256];
+    char deviceId[TC_ID_LENGTH];
+    char requestId[TC_ID_LENGTH];
+    uint16_t statusCode;
+    apiCursor++;
+    const size_t payloadLen = strlen(API_PICK(apiCommissioningResponses));
+    memcpy(payload, API_PICK(apiCommissioningResponses), payloadLen);
+
+    commissioning_response(deviceId, &statusCode, requestId, payload, (uint16_t)payloadLen);
+}
+
+static void api_commissioning_response_view(void)
+{
+    tc_commissioning_response_view view;
+    apiCursor++;
+    const char *payload = API_PICK(apiCommissioningResponses);
+
+    commissioning_response_view(&view, payload, strlen(payload));
+}
+
+static void api_send_commissioning_request(void)
+{
+    apiCursor++;
+    send_commissioning_request(&apiClient, API_PICK(apiRequestIds), "lock", "00:11:22:33:44:55", relatedIds, 2);
+}
+
+static void api_send_command_response(void)
+{
+    apiCursor++;
+    send_command_response(&apiClient, API_PICK(apiDeviceIds), API_PICK(apiRequestIds), 200, false, NULL, json_object_get(API_PICK(apiBodyObjects)));
+}
+
+static void api_send_service_request(void)
+{
+    apiCursor++;
+    send_service_request(&apiClient, API_PICK(apiRequestIds), API_PICK(apiDeviceIds), REQUEST_METHOD_GET, json_object_get(API_PICK(apiBodyObjects)));
+}
+
+static void api_send_command_response_cbor(void)
+{
+    apiCursor++;
+    send_command_response_ctx(&apiCborContext, &apiClient, API_PICK(apiDeviceIds), API_PICK(apiRequestIds), 200, false, NULL, json_object_get(API_PICK(apiBodyObjects)), QOS0);
+}
+
+typedef struct
+{
+    const char *group;
+    const char *name;
+    void (*fn)(void);
+} api_benchmark;
+
+static const api_benchmark apiBenchmarks[] = {
+    {"topic", "commission_request_topic", api_commission_request_topic},
+    {"topic", "commission_response_topic", api_commission_response_topic},
+    {"topic", "command_request_topic", api_command_request_topic},
+    {"topic", "command_response_topic", api_command_response_topic},
+    {"topic", "service_request_topic", api_service_request_topic},
+    {"topic", "service_response_topic", api_service_response_topic},
+    {"topic", "tc_topic_cache_command_response", api_topic_cache_command_response},
+    {"topic", "tc_topic_cache_service_response", api_topic_cache_service_response},
+    {"marshal", "commissioning_request", api_commissioning_request},
+    {"marshal", "command_response", api_command_response},
+    {"marshal", "command_response (error)", api_command_response_error},
+    {"marshal", "service_request", api_service_request},
+    {"marshal", "tc_marshal_command_response (cbor)", api_command_response_cbor},
+    {"marshal", "tc_marshal_service_request (cbor)", api_service_request_cbor},
+    {"unmarshal", "command_request", api_command_request},
+    {"unmarshal", "command_request_ctx", api_command_request_ctx},
+    {"unmarshal", "command_request_view", api_command_request_view},
+    {"unmarshal", "service_response", api_service_response},
+    {"unmarshal", "service_response_ctx", api_service_response_ctx},
+    {"unmarshal", "service_response_view", api_service_response_view},
+    {"unmarshal", "commissioning_response", api_commissioning_response},
+    {"unmarshal", "commissioning_response_view", api_commissioning_response_view},
+    {"send", "send_commissioning_request", api_send_commissioning_request},
+    {"send", "send_command_response", api_send_command_response},
+    {"send", "send_service_request", api_send_service_request},
+    {"send", "send_command_response_ctx (cbor)", api_send_command_response_cbor},
+};
+
+static void api(const char *arg)
+{
+    const uint32_t iterations = count_arg(arg, BENCH_ITERATIONS);
+
+    tc_topic_cache_init(&topicCache, apiDeviceIds[0]);
+    tc_context_init(&apiCborContext);
+    tc_context_set_format(&apiCborContext, TC_FORMAT_CBOR);
+    memset(&apiClient, 0, sizeof(apiClient));
+
+    for (uint32_t i = 0; i < API_COUNT(apiBodies); i++)
+    {
+        apiBodyObjects[i] = json_tokener_parse(apiBodies[i]);
+    }
+
+    stubPublish = true;
+    stubPublishedBytes = 0;
+
+    for (uint32_t i = 0; i < API_COUNT(apiBenchmarks); i++)
+    {
+        const bench_result result = measure(apiBenchmarks[i].fn, iterations);
+
+        report_measurement(apiBenchmarks[i].name, &result);
+        report_text("group", apiBenchmarks[i].group);
+    }
+
+    report_result("stub publishes");
+    report_value("iterations", iterations);
+    report_value("published_bytes", (double)stubPublishedBytes);
+
+    stubPublish = false;
+
+    for (uint32_t i = 0; i < API_COUNT(apiBodies); i++)
+    {
+        json_object_put(apiBodyObjects[i]);
+    }
+    tc_context_free(&apiCborContext);
+}
+
+/*
+ * json-c DOM comparison, the default suite
+ */
+
+static void dom(const char *arg)
+{
+    (void)arg;
+
+    const char *filters[] = {"thincloud/devices/6fa459ea-ee8a-3ca4-894e-db77e160355e/command", "thincloud/devices/6fa459ea-ee8a-3ca4-894e-db77e160355e/requests/+/response", "thincloud/registration/+/requests/+/response"};
+    tc_dispatcher_init(&dispatcher);
+    for (int i = 0; i < (int)(sizeof(filters) / sizeof(filters[0])); i++)
+    {
+        tc_topic_trie_insert(&dispatcher.trie, filters[i], strlen(filters[i]), i);
+    }
+
+    run("command_response_topic + strlen", bench_command_response_topic);
+    run("tc_topic_cache_command_response", bench_topic_cache_command_response);
+    run("commissioning_request (json-c DOM)", bench_dom_commissioning_request);
+    run("commissioning_request", bench_commissioning_request);
+    run("command_response (json-c DOM)", bench_dom_command_response);
+    run("command_response", bench_command_response);
+    run("service_request (json-c DOM)", bench_dom_service_request);
+    run("service_request", bench_service_request);
+    run("command_request (json-c DOM)", bench_dom_command_request);
+    run("command_request", bench_command_request);
+    run("command_request_ctx", bench_command_request_ctx);
+    run("command_request_view", bench_command_request_view);
+    run("service_response (json-c DOM)", bench_dom_service_response);
+    run("service_response", bench_service_response);
+    run("service_response_view", bench_service_response_view);
+    run("tc_dispatch (service response)", bench_dispatch_service_response);
+
+    // Fill the correlation table to one below capacity so the benchmark
+    // measures lookups at full load
+    tc_correlation_init(&pendingRequests, NULL);
+    for (uint32_t i = 0; i < TC_MAX_PENDING_REQUESTS - 1; i++)
+    {
+        char requestId[TC_ID_LENGTH];
+        const int len = snprintf(requestId, sizeof(requestId), "%08x-0000-4000-8000-%012x", i * 2654435761u, i);
+        tc_correlation_insert(&pendingRequests, requestId, (size_t)len, ignore_service_response, NULL, UINT64_MAX, NULL);
+    }
+    dispatcher.pending = &pendingRequests;
+    run("tc_dispatch (pending request)", bench_correlate_service_response);
+}
+
+/*
+ * Subcommands
+ *
+ * ./bench <suite> [argument] runs one suite, ./bench on its own the
+ * first. The argument is a message count, or trace's output path.
+ */
+
+typedef struct
+{
+    const char *name;
+    void (*run)(const char *arg);
+} bench_suite;
+
+static const bench_suite suites[] = {
+    {"dom", dom},
+    {"api", api},
+    {"soak", soak},
+    {"batch", batch},
+    {"contention", contention},
+    {"qos1", qos},
+    {"outbox", outbox},
+    {"wakeup", wakeup},
+    {"stats", stats_overhead},
+    {"trace", trace},
+    {"e2e", e2e},
+    {"methods", method_dispatch},
+    {"ids", request_ids},
+    {"scan", scan},
+    {"typed", typed},
+    {"compress", compress},
+    {"cbor", cbor},
+};
+
+int main(int argc, char **argv)
+{
+    const char *name = argc > 1 ? argv[1] : suites[0].name;
+    const bench_suite *suite = NULL;
+
+    for (size_t i = 0; i < sizeof(suites) / sizeof(suites[0]); i++)
+    {
+        if (strcmp(name, suites[i].name) == 0)
+        {
+            suite = &suites[i];
+            break;
+        }
+    }
+
+    if (suite == NULL)
+    {
+        fprintf(stderr, "Unknown suite %s. Suites:", name);
+        for (size_t i = 0; i < sizeof(suites) / sizeof(suites[0]); i++)
+        {
+            fprintf(stderr, " %s", suites[i].name);
+        }
+        fprintf(stderr, "\n");
+        return 1;
+    }
+
+    tc_context_init(&context);
+    tc_topic_cache_init(&topicCache, "6fa459ea-ee8a-3ca4-894e-db77e160355e");
+
+    body = json_object_new_object();
+    json_object *data = json_object_new_object();
+    json_object_object_add(data, "locked", json_object_new_boolean(true));
+    json_object_object_add(data, "battery", json_object_new_int(87));
+    json_object_object_add(data, "firmware", json_object_new_string("2.4.1"));
+    json_object_object_add(body, "data", data);
+
+    report_begin(suite->name);
+    suite->run(argc > 2 ? argv[2] : NULL);
+    report_end();
+
+    json_object_put(body);
+    tc_context_free(&context);
+
+    return 0;
+}
@@ -0,0 +1,215 @@
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include "thincloud.hpp"
+
+/*
+ * Allocation counting
+ *
+ * malloc and friends are interposed so every allocation made by the
+ * wrapper, the SDK and json-c during a benchmark is counted, on any
+ * thread. operator new goes through malloc in libstdc++. Requires glibc.
+ */
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t nmemb, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static std::atomic<uint64_t> allocations{0};
+
+extern "C" void *malloc(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t nmemb, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#define BENCH_ITERATIONS 200000
+
+static const char *deviceId = "6fa459ea-ee8a-3ca4-894e-db77e160355e";
+static const char *requestId = "3f2504e0-4f89-11d3-9a0c-0305e82c3301";
+static const char *commandPayload = "{\"id\":\"6fa459ea-ee8a-3ca4-894e-db77e160355e\",\"method\":\"setLockState\",\"params\":[{\"data\":{\"locked\":true,\"source\":\"app\"}}]}";
+static const char *servicePayload = "{\"id\":\"3f2504e0-4f89-11d3-9a0c-0305e82c3301\",\"result\":{\"statusCode\":200,\"body\":{\"data\":{\"on\":\"07:00\",\"off\":\"22:30\"}}}}";
+
+static char topic[MAX_TOPIC_LENGTH];
+static char payload[TC_MAX_PAYLOAD_LENGTH];
+static size_t payloadLen = 0;
+static thincloud::message message;
+static volatile size_t sink = 0;
+
+static double run(const char *name, void (*fn)(void))
+{
+    fn();
+
+    const uint64_t allocationsBefore = allocations.load(std::memory_order_relaxed);
+    const uint64_t start = now_ns();
+
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        fn();
+    }
+
+    const uint64_t elapsed = now_ns() - start;
+    const double allocationsPerOp = (double)(allocations.load(std::memory_order_relaxed) - allocationsBefore) / BENCH_ITERATIONS;
+
+    printf("%-40s %10.1f ns/op %8.2f allocs/op\n", name, (double)elapsed / BENCH_ITERATIONS, allocationsPerOp);
+
+    return allocationsPerOp;
+}
+
+static void c_parse_command_request(void)
+{
+    tc_command_request_view view;
+    command_request_view(&view, commandPayload, strlen(commandPayload));
+    sink += view.method.len;
+}
+
+static void cpp_parse_command_request(void)
+{
+    thincloud::command_request request;
+    request.parse(commandPayload);
+    sink += request.method().size();
+}
+
+static void c_parse_service_response(void)
+{
+    tc_service_response_view view;
+    service_response_view(&view, servicePayload, strlen(servicePayload));
+    sink += view.body.len;
+}
+
+static void cpp_parse_service_response(void)
+{
+    thincloud::service_response response;
+    response.parse(servicePayload);
+    sink += response.body().size();
+}
+
+static void c_command_response(void)
+{
+    command_response_topic_n(topic, sizeof(topic), deviceId, requestId, NULL);
+    command_response_n(payload, sizeof(payload), requestId, 200, false, NULL, NULL, &payloadLen);
+}
+
+static void cpp_command_response(void)
+{
+    message.command_response(deviceId, requestId, 200);
+}
+
+static void c_service_request(void)
+{
+    json_object *params = json_object_new_object();
+    service_request_topic_n(topic, sizeof(topic), deviceId, NULL);
+    service_request_n(payload, sizeof(payload), requestId, REQUEST_METHOD_GET, params, &payloadLen);
+}
+
+static void cpp_service_request(void)
+{
+    message.service_request(deviceId, requestId, REQUEST_METHOD_GET, thincloud::json::object());
+}
+
+static void c_commissioning_request(void)
+{
+    commission_request_topic_n(topic, sizeof(topic), "lock", "56789", NULL);
+    commissioning_request_n(payload, sizeof(payload), requestId, "lock", "56789", NULL, 0, &payloadLen);
+}
+
+static void cpp_commissioning_request(void)
+{
+    message.commissioning_request(requestId, "lock", "56789");
+}
+
+// Compile every member of the client wrapper
+template class thincloud::client<4>;
+
+static bool same_message(void)
+{
+    return message.topic() == std::string_view(topic) && message.payload() == std::string_view(payload, payloadLen);
+}
+
+int main()
+{
+    // The wrapper must produce the same bytes as the C API
+    c_command_response();
+    cpp_command_response();
+    const bool sameCommandResponse = same_message();
+    c_service_request();
+    cpp_service_request();
+    const bool sameServiceRequest = same_message();
+    c_commissioning_request();
+    cpp_commissioning_request();
+    const bool sameCommissioningRequest = same_message();
+
+    // IDs longer than a UUID pass through, and payloads follow the message's format
+    const char *childId = "gateway-7/child-lock-0123456789abcdefghijklmnopqrstuvwxyz";
+    command_response_topic_n(topic, sizeof(topic), childId, childId, NULL);
+    tc_marshal_command_response(TC_FORMAT_CBOR, payload, sizeof(payload), childId, 500, true, const_cast<char *>("jammed"), NULL, &payloadLen);
+    thincloud::message cbor(TC_FORMAT_CBOR);
+    cbor.command_error(childId, childId, 500, "jammed");
+    const bool sameCbor = cbor.topic() == std::string_view(topic) && cbor.payload() == std::string_view(payload, payloadLen);
+
+    if (!sameCommandResponse || !sameServiceRequest || !sameCommissioningRequest || !sameCbor)
+    {
+        printf("C++ wrapper output differs from the C API\n");
+        return 1;
+    }
+
+    const struct
+    {
+        const char *name;
+        void (*c)(void);
+        void (*cpp)(void);
+    } pairs[] = {
+        {"parse command request", c_parse_command_request, cpp_parse_command_request},
+        {"parse service response", c_parse_service_response, cpp_parse_service_response},
+        {"build command response", c_command_response, cpp_command_response},
+        {"build service request", c_service_request, cpp_service_request},
+        {"build commissioning request", c_commissioning_request, cpp_commissioning_request},
+    };
+
+    int failed = 0;
+    char name[64];
+
+    for (const auto &pair : pairs)
+    {
+        snprintf(name, sizeof(name), "C   %s", pair.name);
+        const double c = run(name, pair.c);
+        snprintf(name, sizeof(name), "C++ %s", pair.name);
+        const double cpp = run(name, pair.cpp);
+
+        if (cpp > c)
+        {
+            printf("    %.2f extra allocs/op\n", cpp - c);
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
@@ -0,0 +1,1046 @@
+/*
+ * Generated by tools/tc_codegen.py from lock_schema.json. Do not edit.
+ */
+
+#ifndef THINCLOUD_GENERATED_LOCK_
+#define THINCLOUD_GENERATED_LOCK_
+
+#include "thincloud.h"
+
+/**
+ * @brief Fields of a step
+ */
+typedef struct
+{
+    char deviceId[37];
+    int64_t level;
+    uint32_t present;
+} lock_step;
+
+#define LOCK_STEP_DEVICE_ID (1u << 0)
+#define LOCK_STEP_LEVEL (1u << 1)
+
+/**
+ * @brief Fields of a scheduleEntry
+ */
+typedef struct
+{
+    int64_t day;
+    char on[6];
+    char off[6];
+    uint32_t present;
+} lock_schedule_entry;
+
+#define LOCK_SCHEDULE_ENTRY_DAY (1u << 0)
+#define LOCK_SCHEDULE_ENTRY_ON (1u << 1)
+#define LOCK_SCHEDULE_ENTRY_OFF (1u << 2)
+
+/**
+ * @brief Fields of setLockState command params
+ */
+typedef struct
+{
+    bool locked;
+    char source[16];
+    uint32_t present;
+} lock_set_lock_state_params;
+
+#define LOCK_SET_LOCK_STATE_PARAMS_LOCKED (1u << 0)
+#define LOCK_SET_LOCK_STATE_PARAMS_SOURCE (1u << 1)
+
+/**
+ * @brief Fields of setLockState command response body
+ */
+typedef struct
+{
+    bool locked;
+    int64_t battery;
+    uint32_t present;
+} lock_set_lock_state_body;
+
+#define LOCK_SET_LOCK_STATE_BODY_LOCKED (1u << 0)
+#define LOCK_SET_LOCK_STATE_BODY_BATTERY (1u << 1)
+
+/**
+ * @brief Fields of options of startRoutine command params
+ */
+typedef struct
+{
+    bool repeat;
+    char tags[4][16];
+    uint32_t tagsCount;
+    uint32_t present;
+} lock_start_routine_params_options;
+
+#define LOCK_START_ROUTINE_PARAMS_OPTIONS_REPEAT (1u << 0)
+#define LOCK_START_ROUTINE_PARAMS_OPTIONS_TAGS (1u << 1)
+
+/**
+ * @brief Fields of startRoutine command params
+ */
+typedef struct
+{
+    char routineId[37];
+    lock_step steps[8];
+    uint32_t stepsCount;
+    double delay;
+    lock_start_routine_params_options options;
+    uint32_t present;
+} lock_start_routine_params;
+
+#define LOCK_START_ROUTINE_PARAMS_ROUTINE_ID (1u << 0)
+#define LOCK_START_ROUTINE_PARAMS_STEPS (1u << 1)
+#define LOCK_START_ROUTINE_PARAMS_DELAY (1u << 2)
+#define LOCK_START_ROUTINE_PARAMS_OPTIONS (1u << 3)
+
+/**
+ * @brief Fields of schedule service request params
+ */
+typedef struct
+{
+    lock_schedule_entry schedule[7];
+    uint32_t scheduleCount;
+    uint32_t present;
+} lock_schedule_request;
+
+#define LOCK_SCHEDULE_REQUEST_SCHEDULE (1u << 0)
+
+/**
+ * @brief Fields of schedule service response body
+ */
+typedef struct
+{
+    lock_schedule_entry schedule[7];
+    uint32_t scheduleCount;
+    uint32_t present;
+} lock_schedule_response;
+
+#define LOCK_SCHEDULE_RESPONSE_SCHEDULE (1u << 0)
+
+/**
+ * @brief Read a step
+ */
+IoT_Error_t lock_step_read(tc_json_reader *reader, lock_step *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    IoT_Error_t rc = tc_json_object_begin(reader);
+    tc_slice key;
+    bool hasMember = false;
+
+    while (rc == SUCCESS)
+    {
+        rc = tc_json_object_next(reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        if (tc_json_skip_null(reader))
+        {
+            continue;
+        }
+
+        // Members are matched by length first, then by name
+        switch (key.len)
+        {
+        case 5:
+            if (memcmp(key.data, "level", 5) == 0)
+            {
+                rc = tc_json_read_int(reader, &out->level);
+                out->present |= LOCK_STEP_LEVEL;
+                continue;
+            }
+            break;
+        case 8:
+            if (memcmp(key.data, "deviceId", 8) == 0)
+            {
+                rc = tc_json_read_string(reader, out->deviceId, sizeof(out->deviceId));
+                out->present |= LOCK_STEP_DEVICE_ID;
+                continue;
+            }
+            break;
+        }
+
+        rc = tc_json_skip_value(reader, reader->depth);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Write a step
+ */
+void lock_step_write(tc_json_writer *writer, const lock_step *in)
+{
+    tc_json_begin_object(writer);
+    if (in->present & LOCK_STEP_DEVICE_ID)
+    {
+        tc_json_key(writer, "deviceId");
+        tc_json_string(writer, in->deviceId);
+    }
+    if (in->present & LOCK_STEP_LEVEL)
+    {
+        tc_json_key(writer, "level");
+        tc_json_int(writer, in->level);
+    }
+    tc_json_end_object(writer);
+}
+
+/**
+ * @brief Read a scheduleEntry
+ */
+IoT_Error_t lock_schedule_entry_read(tc_json_reader *reader, lock_schedule_entry *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    IoT_Error_t rc = tc_json_object_begin(reader);
+    tc_slice key;
+    bool hasMember = false;
+
+    while (rc == SUCCESS)
+    {
+        rc = tc_json_object_next(reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        if (tc_json_skip_null(reader))
+        {
+            continue;
+        }
+
+        // Members are matched by length first, then by name
+        switch (key.len)
+        {
+        case 2:
+            if (memcmp(key.data, "on", 2) == 0)
+            {
+                rc = tc_json_read_string(reader, out->on, sizeof(out->on));
+                out->present |= LOCK_SCHEDULE_ENTRY_ON;
+                continue;
+            }
+            break;
+        case 3:
+            if (memcmp(key.data, "day", 3) == 0)
+            {
+                rc = tc_json_read_int(reader, &out->day);
+                out->present |= LOCK_SCHEDULE_ENTRY_DAY;
+                continue;
+            }
+            if (memcmp(key.data, "off", 3) == 0)
+            {
+                rc = tc_json_read_string(reader, out->off, sizeof(out->off));
+                out->present |= LOCK_SCHEDULE_ENTRY_OFF;
+                continue;
+            }
+            break;
+        }
+
+        rc = tc_json_skip_value(reader, reader->depth);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Write a scheduleEntry
+ */
+void lock_schedule_entry_write(tc_json_writer *writer, const lock_schedule_entry *in)
+{
+    tc_json_begin_object(writer);
+    if (in->present & LOCK_SCHEDULE_ENTRY_DAY)
+    {
+        tc_json_key(writer, "day");
+        tc_json_int(writer, in->day);
+    }
+    if (in->present & LOCK_SCHEDULE_ENTRY_ON)
+    {
+        tc_json_key(writer, "on");
+        tc_json_string(writer, in->on);
+    }
+    if (in->present & LOCK_SCHEDULE_ENTRY_OFF)
+    {
+        tc_json_key(writer, "off");
+        tc_json_string(writer, in->off);
+    }
+    tc_json_end_object(writer);
+}
+
+/**
+ * @brief Read setLockState command params
+ */
+IoT_Error_t lock_set_lock_state_params_read(tc_json_reader *reader, lock_set_lock_state_params *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    IoT_Error_t rc = tc_json_object_begin(reader);
+    tc_slice key;
+    bool hasMember = false;
+
+    while (rc == SUCCESS)
+    {
+        rc = tc_json_object_next(reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        if (tc_json_skip_null(reader))
+        {
+            continue;
+        }
+
+        // Members are matched by length first, then by name
+        switch (key.len)
+        {
+        case 6:
+            if (memcmp(key.data, "locked", 6) == 0)
+            {
+                rc = tc_json_read_bool(reader, &out->locked);
+                out->present |= LOCK_SET_LOCK_STATE_PARAMS_LOCKED;
+                continue;
+            }
+            if (memcmp(key.data, "source", 6) == 0)
+            {
+                rc = tc_json_read_string(reader, out->source, sizeof(out->source));
+                out->present |= LOCK_SET_LOCK_STATE_PARAMS_SOURCE;
+                continue;
+            }
+            break;
+        }
+
+        rc = tc_json_skip_value(reader, reader->depth);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Write setLockState command params
+ */
+void lock_set_lock_state_params_write(tc_json_writer *writer, const lock_set_lock_state_params *in)
+{
+    tc_json_begin_object(writer);
+    if (in->present & LOCK_SET_LOCK_STATE_PARAMS_LOCKED)
+    {
+        tc_json_key(writer, "locked");
+        tc_json_bool(writer, in->locked);
+    }
+    if (in->present & LOCK_SET_LOCK_STATE_PARAMS_SOURCE)
+    {
+        tc_json_key(writer, "source");
+        tc_json_string(writer, in->source);
+    }
+    tc_json_end_object(writer);
+}
+
+/**
+ * @brief Read setLockState command response body
+ */
+IoT_Error_t lock_set_lock_state_body_read(tc_json_reader *reader, lock_set_lock_state_body *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    IoT_Error_t rc = tc_json_object_begin(reader);
+    tc_slice key;
+    bool hasMember = false;
+
+    while (rc == SUCCESS)
+    {
+        rc = tc_json_object_next(reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        if (tc_json_skip_null(reader))
+        {
+            continue;
+        }
+
+        // Members are matched by length first, then by name
+        switch (key.len)
+        {
+        case 6:
+            if (memcmp(key.data, "locked", 6) == 0)
+            {
+                rc = tc_json_read_bool(reader, &out->locked);
+                out->present |= LOCK_SET_LOCK_STATE_BODY_LOCKED;
+                continue;
+            }
+            break;
+        case 7:
+            if (memcmp(key.data, "battery", 7) == 0)
+            {
+                rc = tc_json_read_int(reader, &out->battery);
+                out->present |= LOCK_SET_LOCK_STATE_BODY_BATTERY;
+                continue;
+            }
+            break;
+        }
+
+        rc = tc_json_skip_value(reader, reader->depth);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Write setLockState command response body
+ */
+void lock_set_lock_state_body_write(tc_json_writer *writer, const lock_set_lock_state_body *in)
+{
+    tc_json_begin_object(writer);
+    if (in->present & LOCK_SET_LOCK_STATE_BODY_LOCKED)
+    {
+        tc_json_key(writer, "locked");
+        tc_json_bool(writer, in->locked);
+    }
+    if (in->present & LOCK_SET_LOCK_STATE_BODY_BATTERY)
+    {
+        tc_json_key(writer, "battery");
+        tc_json_int(writer, in->battery);
+    }
+    tc_json_end_object(writer);
+}
+
+/**
+ * @brief Read options of startRoutine command params
+ */
+IoT_Error_t lock_start_routine_params_options_read(tc_json_reader *reader, lock_start_routine_params_options *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    IoT_Error_t rc = tc_json_object_begin(reader);
+    tc_slice key;
+    bool hasMember = false;
+
+    while (rc == SUCCESS)
+    {
+        rc = tc_json_object_next(reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        if (tc_json_skip_null(reader))
+        {
+            continue;
+        }
+
+        // Members are matched by length first, then by name
+        switch (key.len)
+        {
+        case 4:
+            if (memcmp(key.data, "tags", 4) == 0)
+            {
+                bool hasElement = false;
+                rc = tc_json_array_begin(reader);
+                while (rc == SUCCESS)
+                {
+                    rc = tc_json_array_next(reader, &hasElement);
+                    if (rc != SUCCESS || !hasElement)
+                    {
+                        break;
+                    }
+
+                    if (out->tagsCount == 4)
+                    {
+                        rc = LIMIT_EXCEEDED_ERROR;
+                        break;
+                    }
+
+                    rc = tc_json_read_string(reader, out->tags[out->tagsCount], sizeof(out->tags[out->tagsCount]));
+                    out->tagsCount++;
+                }
+                out->present |= LOCK_START_ROUTINE_PARAMS_OPTIONS_TAGS;
+                continue;
+            }
+            break;
+        case 6:
+            if (memcmp(key.data, "repeat", 6) == 0)
+            {
+                rc = tc_json_read_bool(reader, &out->repeat);
+                out->present |= LOCK_START_ROUTINE_PARAMS_OPTIONS_REPEAT;
+                continue;
+            }
+            break;
+        }
+
+        rc = tc_json_skip_value(reader, reader->depth);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Write options of startRoutine command params
+ */
+void lock_start_routine_params_options_write(tc_json_writer *writer, const lock_start_routine_params_options *in)
+{
+    tc_json_begin_object(writer);
+    if (in->present & LOCK_START_ROUTINE_PARAMS_OPTIONS_REPEAT)
+    {
+        tc_json_key(writer, "repeat");
+        tc_json_bool(writer, in->repeat);
+    }
+    if (in->present & LOCK_START_ROUTINE_PARAMS_OPTIONS_TAGS)
+    {
+        tc_json_key(writer, "tags");
+        tc_json_begin_array(writer);
+        for (uint32_t i = 0; i < in->tagsCount && i < 4; i++)
+        {
+            tc_json_string(writer, in->tags[i]);
+        }
+        tc_json_end_array(writer);
+    }
+    tc_json_end_object(writer);
+}
+
+/**
+ * @brief Read startRoutine command params
+ */
+IoT_Error_t lock_start_routine_params_read(tc_json_reader *reader, lock_start_routine_params *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    IoT_Error_t rc = tc_json_object_begin(reader);
+    tc_slice key;
+    bool hasMember = false;
+
+    while (rc == SUCCESS)
+    {
+        rc = tc_json_object_next(reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        if (tc_json_skip_null(reader))
+        {
+            continue;
+        }
+
+        // Members are matched by length first, then by name
+        switch (key.len)
+        {
+        case 5:
+            if (memcmp(key.data, "steps", 5) == 0)
+            {
+                bool hasElement = false;
+                rc = tc_json_array_begin(reader);
+                while (rc == SUCCESS)
+                {
+                    rc = tc_json_array_next(reader, &hasElement);
+                    if (rc != SUCCESS || !hasElement)
+                    {
+                        break;
+                    }
+
+                    if (out->stepsCount == 8)
+                    {
+                        rc = LIMIT_EXCEEDED_ERROR;
+                        break;
+                    }
+
+                    rc = lock_step_read(reader, &out->steps[out->stepsCount]);
+                    out->stepsCount++;
+                }
+                out->present |= LOCK_START_ROUTINE_PARAMS_STEPS;
+                continue;
+            }
+            if (memcmp(key.data, "delay", 5) == 0)
+            {
+                rc = tc_json_read_double(reader, &out->delay);
+                out->present |= LOCK_START_ROUTINE_PARAMS_DELAY;
+                continue;
+            }
+            break;
+        case 7:
+            if (memcmp(key.data, "options", 7) == 0)
+            {
+                rc = lock_start_routine_params_options_read(reader, &out->options);
+                out->present |= LOCK_START_ROUTINE_PARAMS_OPTIONS;
+                continue;
+            }
+            break;
+        case 9:
+            if (memcmp(key.data, "routineId", 9) == 0)
+            {
+                rc = tc_json_read_string(reader, out->routineId, sizeof(out->routineId));
+                out->present |= LOCK_START_ROUTINE_PARAMS_ROUTINE_ID;
+                continue;
+            }
+            break;
+        }
+
+        rc = tc_json_skip_value(reader, reader->depth);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Write startRoutine command params
+ */
+void lock_start_routine_params_write(tc_json_writer *writer, const lock_start_routine_params *in)
+{
+    tc_json_begin_object(writer);
+    if (in->present & LOCK_START_ROUTINE_PARAMS_ROUTINE_ID)
+    {
+        tc_json_key(writer, "routineId");
+        tc_json_string(writer, in->routineId);
+    }
+    if (in->present & LOCK_START_ROUTINE_PARAMS_STEPS)
+    {
+        tc_json_key(writer, "steps");
+        tc_json_begin_array(writer);
+        for (uint32_t i = 0; i < in->stepsCount && i < 8; i++)
+        {
+            lock_step_write(writer, &in->steps[i]);
+        }
+        tc_json_end_array(writer);
+    }
+    if (in->present & LOCK_START_ROUTINE_PARAMS_DELAY)
+    {
+        tc_json_key(writer, "delay");
+        tc_json_double(writer, in->delay);
+    }
+    if (in->present & LOCK_START_ROUTINE_PARAMS_OPTIONS)
+    {
+        tc_json_key(writer, "options");
+        lock_start_routine_params_options_write(writer, &in->options);
+    }
+    tc_json_end_object(writer);
+}
+
+/**
+ * @brief Read schedule service request params
+ */
+IoT_Error_t lock_schedule_request_read(tc_json_reader *reader, lock_schedule_request *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    IoT_Error_t rc = tc_json_object_begin(reader);
+    tc_slice key;
+    bool hasMember = false;
+
+    while (rc == SUCCESS)
+    {
+        rc = tc_json_object_next(reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        if (tc_json_skip_null(reader))
+        {
+            continue;
+        }
+
+        // Members are matched by length first, then by name
+        switch (key.len)
+        {
+        case 8:
+            if (memcmp(key.data, "schedule", 8) == 0)
+            {
+                bool hasElement = false;
+                rc = tc_json_array_begin(reader);
+                while (rc == SUCCESS)
+                {
+                    rc = tc_json_array_next(reader, &hasElement);
+                    if (rc != SUCCESS || !hasElement)
+                    {
+                        break;
+                    }
+
+                    if (out->scheduleCount == 7)
+                    {
+                        rc = LIMIT_EXCEEDED_ERROR;
+                        break;
+                    }
+
+                    rc = lock_schedule_entry_read(reader, &out->schedule[out->scheduleCount]);
+                    out->scheduleCount++;
+                }
+                out->present |= LOCK_SCHEDULE_REQUEST_SCHEDULE;
+                continue;
+            }
+            break;
+        }
+
+        rc = tc_json_skip_value(reader, reader->depth);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Write schedule service request params
+ */
+void lock_schedule_request_write(tc_json_writer *writer, const lock_schedule_request *in)
+{
+    tc_json_begin_object(writer);
+    if (in->present & LOCK_SCHEDULE_REQUEST_SCHEDULE)
+    {
+        tc_json_key(writer, "schedule");
+        tc_json_begin_array(writer);
+        for (uint32_t i = 0; i < in->scheduleCount && i < 7; i++)
+        {
+            lock_schedule_entry_write(writer, &in->schedule[i]);
+        }
+        tc_json_end_array(writer);
+    }
+    tc_json_end_object(writer);
+}
+
+/**
+ * @brief Read schedule service response body
+ */
+IoT_Error_t lock_schedule_response_read(tc_json_reader *reader, lock_schedule_response *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    IoT_Error_t rc = tc_json_object_begin(reader);
+    tc_slice key;
+    bool hasMember = false;
+
+    while (rc == SUCCESS)
+    {
+        rc = tc_json_object_next(reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        if (tc_json_skip_null(reader))
+        {
+            continue;
+        }
+
+        // Members are matched by length first, then by name
+        switch (key.len)
+        {
+        case 8:
+            if (memcmp(key.data, "schedule", 8) == 0)
+            {
+                bool hasElement = false;
+                rc = tc_json_array_begin(reader);
+                while (rc == SUCCESS)
+                {
+                    rc = tc_json_array_next(reader, &hasElement);
+                    if (rc != SUCCESS || !hasElement)
+                    {
+                        break;
+                    }
+
+                    if (out->scheduleCount == 7)
+                    {
+                        rc = LIMIT_EXCEEDED_ERROR;
+                        break;
+                    }
+
+                    rc = lock_schedule_entry_read(reader, &out->schedule[out->scheduleCount]);
+                    out->scheduleCount++;
+                }
+                out->present |= LOCK_SCHEDULE_RESPONSE_SCHEDULE;
+                continue;
+            }
+            break;
+        }
+
+        rc = tc_json_skip_value(reader, reader->depth);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Write schedule service response body
+ */
+void lock_schedule_response_write(tc_json_writer *writer, const lock_schedule_response *in)
+{
+    tc_json_begin_object(writer);
+    if (in->present & LOCK_SCHEDULE_RESPONSE_SCHEDULE)
+    {
+        tc_json_key(writer, "schedule");
+        tc_json_begin_array(writer);
+        for (uint32_t i = 0; i < in->scheduleCount && i < 7; i++)
+        {
+            lock_schedule_entry_write(writer, &in->schedule[i]);
+        }
+        tc_json_end_array(writer);
+    }
+    tc_json_end_object(writer);
+}
+
+/**
+ * @brief Decode setLockState command params from a command request
+ * 
+ * @param[in]   view  Scanned command request.
+ * @param[out]  out   Decoded fields.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if a string does not fit,
+ *         LIMIT_EXCEEDED_ERROR if an array does not fit, negative value otherwise
+ */
+IoT_Error_t lock_set_lock_state_params_parse(const tc_command_request_view *view, lock_set_lock_state_params *out)
+{
+    tc_slice data;
+    IoT_Error_t rc = tc_data_slice(view->params, &data);
+    if (rc != SUCCESS || data.data == NULL)
+    {
+        memset(out, 0, sizeof(*out));
+        return rc;
+    }
+
+    tc_json_reader reader;
+    tc_json_reader_init(&reader, data.data, data.len);
+
+    rc = lock_set_lock_state_params_read(&reader, out);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    return tc_json_reader_finish(&reader);
+}
+
+/**
+ * @brief Marshal a setLockState command response into a bounded buffer
+ * 
+ * @param[out]  buffer      Pointer to a string buffer to write to.
+ * @param[in]   bufferLen   Size of buffer, including room for the null character.
+ * @param[in]   requestId   Command request's ID.
+ * @param[in]   statusCode  Command's response status.
+ * @param[in]   body        Optional. Response body.
+ * @param[out]  written     Optional. Length of the message, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         a negative value otherwise
+ */
+IoT_Error_t lock_set_lock_state_response_n(char *buffer, size_t bufferLen, const char *requestId, uint16_t statusCode, const lock_set_lock_state_body *body, size_t *written)
+{
+    tc_json_writer writer;
+    tc_json_writer_init(&writer, buffer, bufferLen);
+
+    tc_json_begin_object(&writer);
+    if (requestId != NULL)
+    {
+        tc_json_key(&writer, "id");
+        tc_json_string(&writer, requestId);
+    }
+    tc_json_key(&writer, "result");
+    tc_json_begin_object(&writer);
+    tc_json_key(&writer, "statusCode");
+    tc_json_int(&writer, statusCode);
+    if (body != NULL)
+    {
+        tc_json_key(&writer, "body");
+        tc_json_begin_object(&writer);
+        tc_json_key(&writer, "data");
+        lock_set_lock_state_body_write(&writer, body);
+        tc_json_end_object(&writer);
+    }
+    tc_json_end_object(&writer);
+    tc_json_end_object(&writer);
+
+    const IoT_Error_t rc = tc_json_writer_finish(&writer);
+    if (written != NULL)
+    {
+        *written = writer.length;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Decode startRoutine command params from a command request
+ * 
+ * @param[in]   view  Scanned command request.
+ * @param[out]  out   Decoded fields.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if a string does not fit,
+ *         LIMIT_EXCEEDED_ERROR if an array does not fit, negative value otherwise
+ */
+IoT_Error_t lock_start_routine_params_parse(const tc_command_request_view *view, lock_start_routine_params *out)
+{
+    tc_slice data;
+    IoT_Error_t rc = tc_data_slice(view->params, &data);
+    if (rc != SUCCESS || data.data == NULL)
+    {
+        memset(out, 0, sizeof(*out));
+        return rc;
+    }
+
+    tc_json_reader reader;
+    tc_json_reader_init(&reader, data.data, data.len);
+
+    rc = lock_start_routine_params_read(&reader, out);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    return tc_json_reader_finish(&reader);
+}
+
+/**
+ * @brief Marshal a schedule service request into a bounded buffer
+ * 
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   requestId  Unique ID for the request.
+ * @param[in]   params     Request parameters.
+ * @param[out]  written    Optional. Length of the message, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         a negative value otherwise
+ */
+IoT_Error_t lock_schedule_request_n(char *buffer, size_t bufferLen, const char *requestId, const lock_schedule_request *params, size_t *written)
+{
+    tc_json_writer writer;
+    tc_json_writer_init(&writer, buffer, bufferLen);
+
+    tc_json_begin_object(&writer);
+    if (requestId != NULL)
+    {
+        tc_json_key(&writer, "id");
+        tc_json_string(&writer, requestId);
+    }
+    tc_json_key(&writer, "method");
+    tc_json_string(&writer, REQUEST_METHOD_PUT);
+    tc_json_key(&writer, "params");
+    tc_json_begin_object(&writer);
+    tc_json_key(&writer, "data");
+    lock_schedule_request_write(&writer, params);
+    tc_json_end_object(&writer);
+    tc_json_end_object(&writer);
+
+    const IoT_Error_t rc = tc_json_writer_finish(&writer);
+    if (written != NULL)
+    {
+        *written = writer.length;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Decode schedule service response body from a service response
+ * 
+ * @param[in]   view  Scanned service response.
+ * @param[out]  out   Decoded fields.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if a string does not fit,
+ *         LIMIT_EXCEEDED_ERROR if an array does not fit, negative value otherwise
+ */
+IoT_Error_t lock_schedule_response_parse(const tc_service_response_view *view, lock_schedule_response *out)
+{
+    tc_slice data;
+    IoT_Error_t rc = tc_data_slice(view->body, &data);
+    if (rc != SUCCESS || data.data == NULL)
+    {
+        memset(out, 0, sizeof(*out));
+        return rc;
+    }
+
+    tc_json_reader reader;
+    tc_json_reader_init(&reader, data.data, data.len);
+
+    rc = lock_schedule_response_read(&reader, out);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    return tc_json_reader_finish(&reader);
+}
+
+/**
+ * @brief Handler of ping commands
+ */
+typedef void (*lock_ping_handler)(AWS_IoT_Client *client, tc_slice deviceId, tc_slice requestId, void *userData);
+
+/**
+ * @brief Handler of setLockState commands
+ */
+typedef void (*lock_set_lock_state_handler)(AWS_IoT_Client *client, tc_slice deviceId, tc_slice requestId, const lock_set_lock_state_params *params, void *userData);
+
+/**
+ * @brief Handler of startRoutine commands
+ */
+typedef void (*lock_start_routine_handler)(AWS_IoT_Client *client, tc_slice deviceId, tc_slice requestId, const lock_start_routine_params *params, void *userData);
+
+/**
+ * @brief Typed handlers of lock commands
+ * 
+ * Unset handlers are skipped. onError, when set, is called for unknown
+ * methods with FAILURE and for params that fail to decode.
+ */
+typedef struct
+{
+    lock_ping_handler ping;
+    lock_set_lock_state_handler setLockState;
+    lock_start_routine_handler startRoutine;
+    void (*onError)(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, IoT_Error_t rc, void *userData);
+    void *userData;
+} lock_command_handlers;
+
+/**
+ * @brief Decode a command request and call its method's typed handler
+ * 
+ * A tc_command_request_handler for tc_dispatcher_subscribe_command_requests.
+ * userData is a lock_command_handlers.
+ */
+void lock_command_handler(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, void *userData)
+{
+    const lock_command_handlers *handlers = (const lock_command_handlers *)userData;
+    const tc_slice method = request->method;
+    IoT_Error_t rc = FAILURE;
+
+    switch (method.len)
+    {
+    case 4:
+        if (memcmp(method.data, "ping", 4) == 0)
+        {
+            rc = SUCCESS;
+            if (handlers->ping != NULL)
+            {
+                handlers->ping(client, deviceId, request->requestId, handlers->userData);
+            }
+            break;
+        }
+        break;
+    case 12:
+        if (memcmp(method.data, "setLockState", 12) == 0)
+        {
+            lock_set_lock_state_params params;
+            rc = lock_set_lock_state_params_parse(request, &params);
+            if (rc == SUCCESS && handlers->setLockState != NULL)
+            {
+                handlers->setLockState(client, deviceId, request->requestId, &params, handlers->userData);
+            }
+            break;
+        }
+        if (memcmp(method.data, "startRoutine", 12) == 0)
+        {
+            lock_start_routine_params params;
+            rc = lock_start_routine_params_parse(request, &params);
+            if (rc == SUCCESS && handlers->startRoutine != NULL)
+            {
+                handlers->startRoutine(client, deviceId, request->requestId, &params, handlers->userData);
+            }
+            break;
+        }
+        break;
+    }
+
+    if (rc != SUCCESS && handlers->onError != NULL)
+    {
+        handlers->onError(client, deviceId, request, rc, handlers->userData);
+    }
+}
+
+#endif /* THINCLOUD_GENERATED_LOCK_ */
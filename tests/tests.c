@@ -1,4 +1,11 @@
+#include <locale.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
 #include "thincloud.h"
+#include "thincloud_broker.h"
+#include "lock_schema.h"
 #include "greatest.h"
 
 SUITE(thincloud);
@@ -93,6 +100,207 @@ TEST should_build_service_response_topic(void)
     PASS();
 }
 
+TEST should_build_bounded_topic(void)
+{
+    char topic[MAX_TOPIC_LENGTH];
+    size_t topicLen = 0;
+
+    IoT_Error_t rc = service_response_topic_n(topic, sizeof(topic), "123456", "7890", &topicLen);
+
+    ASSERT_EQ(SUCCESS, rc);
+    ASSERT_STR_EQ("thincloud/devices/123456/requests/7890/response", topic);
+    ASSERT_EQ(strlen(topic), topicLen);
+
+    rc = service_response_topic_n(topic, 16, "123456", "7890", &topicLen);
+
+    ASSERT_EQ(MAX_SIZE_ERROR, rc);
+    ASSERT_EQ(strlen("thincloud/devices/123456/requests/7890/response"), topicLen);
+
+    PASS();
+}
+
+TEST should_build_topics_from_cache(void)
+{
+    tc_topic_cache cache;
+    char topic[MAX_TOPIC_LENGTH];
+    uint16_t topicLen = 0;
+
+    ASSERT_EQ(SUCCESS, tc_topic_cache_init(&cache, "123456"));
+
+    ASSERT_EQ(SUCCESS, tc_topic_cache_command_response(&cache, topic, sizeof(topic), "7890", 4, &topicLen));
+    ASSERT_STR_EQ("thincloud/devices/123456/command/7890/response", topic);
+    ASSERT_EQ(strlen(topic), topicLen);
+
+    ASSERT_EQ(SUCCESS, tc_topic_cache_service_response(&cache, topic, sizeof(topic), "7890", 4, &topicLen));
+    ASSERT_STR_EQ("thincloud/devices/123456/requests/7890/response", topic);
+
+    ASSERT_EQ(SUCCESS, tc_topic_cache_command_request(&cache, topic, sizeof(topic), &topicLen));
+    ASSERT_STR_EQ("thincloud/devices/123456/command", topic);
+
+    ASSERT_EQ(SUCCESS, tc_topic_cache_service_request(&cache, topic, sizeof(topic), &topicLen));
+    ASSERT_STR_EQ("thincloud/devices/123456/requests", topic);
+    ASSERT_EQ(strlen(topic), topicLen);
+
+    ASSERT_EQ(MAX_SIZE_ERROR, tc_topic_cache_command_response(&cache, topic, 40, "7890", 4, &topicLen));
+
+    PASS();
+}
+
+TEST should_build_send_topics_from_context_cache(void)
+{
+    tc_context context;
+    ASSERT_EQ(SUCCESS, tc_context_init(&context));
+
+    char topic[MAX_TOPIC_LENGTH];
+    size_t topicLen = 0;
+
+    ASSERT_EQ(SUCCESS, tc_context_command_response_topic(&context, topic, sizeof(topic), "123456", "7890", &topicLen));
+    ASSERT_STR_EQ("thincloud/devices/123456/command/7890/response", topic);
+    ASSERT_EQ(strlen(topic), topicLen);
+    ASSERT_STR_EQ("thincloud/devices/123456/", context.topics.prefix);
+
+    ASSERT_EQ(SUCCESS, tc_context_service_request_topic(&context, topic, sizeof(topic), "123456", &topicLen));
+    ASSERT_STR_EQ("thincloud/devices/123456/requests", topic);
+
+    // Another device replaces the cached prefix
+    ASSERT_EQ(SUCCESS, tc_context_service_request_topic(&context, topic, sizeof(topic), "12345", &topicLen));
+    ASSERT_STR_EQ("thincloud/devices/12345/requests", topic);
+    ASSERT_EQ(strlen(topic), topicLen);
+
+    ASSERT_EQ(NULL_VALUE_ERROR, tc_context_command_response_topic(&context, topic, sizeof(topic), "12345", NULL, &topicLen));
+    ASSERT_EQ(NULL_VALUE_ERROR, tc_context_service_request_topic(&context, topic, sizeof(topic), NULL, &topicLen));
+
+    // Without a context topics are built directly
+    ASSERT_EQ(SUCCESS, tc_context_service_request_topic(NULL, topic, sizeof(topic), "123456", &topicLen));
+    ASSERT_STR_EQ("thincloud/devices/123456/requests", topic);
+
+    tc_context_free(&context);
+
+    PASS();
+}
+
+TEST should_match_topic_filters(void)
+{
+    tc_topic_trie trie;
+    tc_topic_match match;
+    tc_topic_trie_init(&trie);
+
+    const char *command = "thincloud/devices/+/command";
+    const char *response = "thincloud/devices/+/requests/+/response";
+    const char *all = "thincloud/registration/#";
+
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&trie, command, strlen(command), 1));
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&trie, response, strlen(response), 2));
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&trie, all, strlen(all), 3));
+
+    const char *topic = "thincloud/devices/123456/requests/7890/response";
+    ASSERT(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+    ASSERT_EQ(2, match.route);
+    ASSERT_EQ(2, match.captureCount);
+    ASSERT(TC_SLICE_EQUALS(match.captures[0], "123456"));
+    ASSERT(TC_SLICE_EQUALS(match.captures[1], "7890"));
+
+    topic = "thincloud/registration/lock_123456/requests/7890/response";
+    ASSERT(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+    ASSERT_EQ(3, match.route);
+    ASSERT(TC_SLICE_EQUALS(match.captures[0], "lock_123456/requests/7890/response"));
+    ASSERT_EQ(6, match.segmentCount);
+    ASSERT(TC_SLICE_EQUALS(match.segments[2], "lock_123456"));
+    ASSERT(TC_SLICE_EQUALS(match.segments[4], "7890"));
+    ASSERT(TC_SLICE_EQUALS(match.segments[5], "response"));
+
+    topic = "thincloud/devices/123456/command/7890/response";
+    ASSERT_FALSE(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+
+    topic = "thincloud/devices/123456";
+    ASSERT_FALSE(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+
+    PASS();
+}
+
+TEST should_backtrack_from_failed_literal_branches(void)
+{
+    tc_topic_trie trie;
+    tc_topic_match match;
+    tc_topic_trie_init(&trie);
+
+    const char *command = "thincloud/devices/+/command";
+    const char *response = "thincloud/devices/abc/requests/+/response";
+    const char *all = "thincloud/devices/abc/#";
+
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&trie, command, strlen(command), 1));
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&trie, response, strlen(response), 2));
+
+    const char *topic = "thincloud/devices/abc/command";
+    ASSERT(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+    ASSERT_EQ(1, match.route);
+    ASSERT_EQ(1, match.captureCount);
+    ASSERT(TC_SLICE_EQUALS(match.captures[0], "abc"));
+    ASSERT(TC_SLICE_EQUALS(match.segments[3], "command"));
+
+    topic = "thincloud/devices/xyz/command";
+    ASSERT(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+    ASSERT_EQ(1, match.route);
+
+    topic = "thincloud/devices/abc/requests/7890/response";
+    ASSERT(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+    ASSERT_EQ(2, match.route);
+    ASSERT_EQ(1, match.captureCount);
+    ASSERT(TC_SLICE_EQUALS(match.captures[0], "7890"));
+
+    topic = "thincloud/devices/abc/requests/7890";
+    ASSERT_FALSE(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+
+    // '#' is tried last, and also matches its parent level
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&trie, all, strlen(all), 3));
+
+    ASSERT(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+    ASSERT_EQ(3, match.route);
+    ASSERT_EQ(1, match.captureCount);
+    ASSERT(TC_SLICE_EQUALS(match.captures[0], "requests/7890"));
+    ASSERT_EQ(5, match.segmentCount);
+    ASSERT(TC_SLICE_EQUALS(match.segments[3], "requests"));
+    ASSERT(TC_SLICE_EQUALS(match.segments[4], "7890"));
+
+    // Both match; the literal branch is preferred
+    topic = "thincloud/devices/abc/command";
+    ASSERT(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+    ASSERT_EQ(3, match.route);
+
+    topic = "thincloud/devices/abc";
+    ASSERT(tc_topic_trie_match(&trie, topic, strlen(topic), &match));
+    ASSERT_EQ(3, match.route);
+
+    PASS();
+}
+
+static bool broker_matches(const char *filter, const char *topic)
+{
+    return tc_broker_filter_matches(filter, strlen(filter), topic, strlen(topic));
+}
+
+TEST should_match_broker_filters(void)
+{
+    ASSERT(broker_matches("thincloud/devices/+/command", "thincloud/devices/123456/command"));
+    ASSERT(broker_matches("thincloud/registration/+/requests/+/response", "thincloud/registration/lock_123456/requests/7890/response"));
+    ASSERT(broker_matches("thincloud/#", "thincloud/devices/123456/command"));
+    ASSERT(broker_matches("thincloud/#", "thincloud"));
+    ASSERT(broker_matches("thincloud/+", "thincloud/"));
+    ASSERT(broker_matches("$SYS/#", "$SYS/uptime"));
+
+    ASSERT_FALSE(broker_matches("thincloud/devices/+/command", "thincloud/devices/123456/command/7890/response"));
+    ASSERT_FALSE(broker_matches("thincloud/devices/+", "thincloud/devices"));
+    ASSERT_FALSE(broker_matches("thincloud/device", "thincloud/devices"));
+    ASSERT_FALSE(broker_matches("#", "$SYS/uptime"));
+
+    ASSERT(tc_broker_filter_valid("thincloud/+/requests/#", 22));
+    ASSERT_FALSE(tc_broker_filter_valid("thincloud/#/requests", 20));
+    ASSERT_FALSE(tc_broker_filter_valid("thincloud/devices+", 18));
+    ASSERT_FALSE(tc_broker_filter_valid("", 0));
+
+    PASS();
+}
+
 TEST should_build_commission_request(void)
 {
     char buffer[256];
@@ -224,29 +432,2322 @@ TEST should_process_service_response(void)
     PASS();
 }
 
-SUITE(tc_topics)
+TEST should_ignore_bytes_after_legacy_messages(void)
 {
-    RUN_TEST(should_build_commission_topic);
-    RUN_TEST(should_fail_commission_topic_on_null_inputs);
-    RUN_TEST(should_build_commission_response_topic);
-    RUN_TEST(should_build_command_request_topic);
-    RUN_TEST(should_build_command_response_topic);
-    RUN_TEST(should_build_service_request_topic);
-    RUN_TEST(should_build_service_response_topic);
+    char deviceId[TC_ID_LENGTH];
+    char requestId[TC_ID_LENGTH];
+    char method[64];
+    uint16_t statusCode = 0;
+
+    // Lengths that count the null character, and trailing bytes, as json-c accepted
+    char commission[] = "{\"id\":\"1234\",\"result\":{\"statusCode\":200,\"deviceId\":\"5678\"}}\n";
+    ASSERT_EQ_FMT(SUCCESS, commissioning_response(deviceId, &statusCode, requestId, commission, sizeof(commission)), "%d");
+    ASSERT_STR_EQ("5678", deviceId);
+
+    json_object *params = NULL;
+    const char request[] = "{\"id\":\"1234\",\"method\":\"ping\",\"params\":[]} x";
+    ASSERT_EQ_FMT(SUCCESS, command_request(requestId, method, &params, request, sizeof(request)), "%d");
+    ASSERT_STR_EQ("ping", method);
+    json_object_put(params);
+
+    json_object *data = NULL;
+    const char response[] = "{\"id\":\"1234\",\"result\":{\"statusCode\":204}}";
+    ASSERT_EQ_FMT(SUCCESS, service_response(requestId, &statusCode, &data, response, sizeof(response)), "%d");
+    ASSERT_EQ(204, statusCode);
+
+    // Incomplete messages still fail
+    ASSERT_EQ_FMT(JSON_PARSE_ERROR, service_response(requestId, &statusCode, &data, response, sizeof(response) - 3), "%d");
+
+    // Views stay strict
+    tc_command_request_view view;
+    ASSERT_EQ_FMT(JSON_PARSE_ERROR, command_request_view(&view, request, sizeof(request)), "%d");
+
+    PASS();
 }
 
-SUITE(tc_unmarshal)
+TEST should_convert_legacy_status_codes(void)
 {
-    RUN_TEST(should_build_commission_request);
-    RUN_TEST(should_build_command_response);
-    RUN_TEST(should_build_service_request);
+    char deviceId[TC_ID_LENGTH];
+    char requestId[TC_ID_LENGTH];
+    uint16_t statusCode = 0;
+    json_object *data = NULL;
+
+    // Strings and doubles convert as json_object_get_int did
+    char quoted[] = "{\"id\":\"1234\",\"result\":{\"statusCode\":\"200\",\"deviceId\":\"5678\"}}";
+    ASSERT_EQ_FMT(SUCCESS, commissioning_response(deviceId, &statusCode, requestId, quoted, strlen(quoted)), "%d");
+    ASSERT_EQ(200, statusCode);
+
+    const char fractional[] = "{\"id\":\"1234\",\"result\":{\"statusCode\":404.0}}";
+    ASSERT_EQ_FMT(SUCCESS, service_response(requestId, &statusCode, &data, fractional, strlen(fractional)), "%d");
+    ASSERT_EQ(404, statusCode);
+
+    const char word[] = "{\"id\":\"1234\",\"result\":{\"statusCode\":\"ok\"}}";
+    ASSERT_EQ_FMT(SUCCESS, service_response(requestId, &statusCode, &data, word, strlen(word)), "%d");
+    ASSERT_EQ(0, statusCode);
+
+    // A response without a result leaves the status code alone
+    statusCode = 500;
+    char error[] = "{\"id\":\"1234\",\"error\":{\"message\":\"failed\"}}";
+    ASSERT_EQ_FMT(SUCCESS, commissioning_response(deviceId, &statusCode, requestId, error, strlen(error)), "%d");
+    ASSERT_EQ(500, statusCode);
+    ASSERT_EQ_FMT(SUCCESS, service_response(requestId, &statusCode, &data, error, strlen(error)), "%d");
+    ASSERT_EQ(500, statusCode);
+    ASSERT_EQ(NULL, data);
+
+    PASS();
 }
 
-SUITE(tc_marshal)
+TEST should_view_command_request_in_place(void)
 {
-    RUN_TEST(should_process_commissioning_response);
-    RUN_TEST(should_process_command_request);
-    RUN_TEST(should_process_service_response);
+    const char *request = "{\"id\":\"1234\", \"method\" : \"startRoutine\",\"params\":[{\"data\":{\"foo\":\"bar\"}}]}";
+
+    tc_command_request_view view;
+    const IoT_Error_t rc = command_request_view(&view, request, strlen(request));
+
+    ASSERT_EQ_FMT(SUCCESS, rc, "%d");
+
+    ASSERT(TC_SLICE_EQUALS(view.requestId, "1234"));
+    ASSERT(TC_SLICE_EQUALS(view.method, "startRoutine"));
+    ASSERT(TC_SLICE_EQUALS(view.params, "[{\"data\":{\"foo\":\"bar\"}}]"));
+    ASSERT(view.method.data > request && view.method.data < request + strlen(request));
+
+    PASS();
+}
+
+TEST should_view_service_response_in_place(void)
+{
+    const char *response = "{\"id\":\"1234\",\"result\":{\"statusCode\":404,\"body\":{\"foo\":[1,2.5e3,true,null]}}}";
+
+    tc_service_response_view view;
+    const IoT_Error_t rc = service_response_view(&view, response, strlen(response));
+
+    ASSERT_EQ_FMT(SUCCESS, rc, "%d");
+
+    ASSERT(TC_SLICE_EQUALS(view.requestId, "1234"));
+    ASSERT_EQ(404, view.statusCode);
+    ASSERT(TC_SLICE_EQUALS(view.body, "{\"foo\":[1,2.5e3,true,null]}"));
+
+    PASS();
+}
+
+TEST should_fail_view_on_malformed_payload(void)
+{
+    const char *truncated = "{\"id\":\"1234\",\"result\":{\"statusCode\":200";
+    const char *trailing = "{\"id\":\"1234\"} x";
+    const char *unquoted = "{\"id\":1234,method:\"ping\"}";
+
+    tc_commissioning_response_view view;
+    tc_command_request_view commandView;
+
+    ASSERT_EQ_FMT(JSON_PARSE_ERROR, commissioning_response_view(&view, truncated, strlen(truncated)), "%d");
+    ASSERT_EQ_FMT(JSON_PARSE_ERROR, command_request_view(&commandView, trailing, strlen(trailing)), "%d");
+    ASSERT_EQ_FMT(JSON_PARSE_ERROR, command_request_view(&commandView, unquoted, strlen(unquoted)), "%d");
+
+    PASS();
+}
+
+TEST should_unescape_string_values(void)
+{
+    char requestId[TC_ID_LENGTH];
+    char method[64];
+
+    const char *request = "{\"id\":\"12\\/34\",\"method\":\"caf\\u00e9\\n\"}";
+
+    const IoT_Error_t rc = command_request(requestId, method, NULL, request, strlen(request));
+
+    ASSERT_EQ_FMT(SUCCESS, rc, "%d");
+    ASSERT_STR_EQ("12/34", requestId);
+    ASSERT_STR_EQ("caf\xc3\xa9\n", method);
+
+    PASS();
+}
+
+static int freedParams = 0;
+
+static void count_freed_params(json_object *obj, void *userdata)
+{
+    (void)obj;
+    *(int *)userdata += 1;
+}
+
+TEST should_reuse_pooled_tokeners(void)
+{
+    tc_context context;
+    ASSERT_EQ_FMT(SUCCESS, tc_context_init(&context), "%d");
+    tc_context_set_userdata(&context, &freedParams, count_freed_params);
+
+    const char *request = "{\"id\":\"1234\",\"method\":\"ping\",\"params\":{\"foo\":\"bar\"}}";
+
+    for (int i = 0; i < 3; i++)
+    {
+        char requestId[TC_ID_LENGTH];
+        char method[64];
+        json_object *params = NULL;
+
+        const IoT_Error_t rc = command_request_ctx(&context, requestId, method, &params, request, strlen(request));
+
+        ASSERT_EQ_FMT(SUCCESS, rc, "%d");
+        ASSERT_EQ(1, context.idleTokeners);
+        ASSERT_STR_EQ("bar", json_object_get_string(json_object_object_get(params, "foo")));
+
+        json_object_put(params);
+    }
+
+    ASSERT_EQ(3, freedParams);
+
+    const char *invalid = "{\"id\":\"1234\",\"result\":{\"statusCode\":200,\"body\":{\"foo\":}}}";
+    json_object *data = NULL;
+    ASSERT_EQ_FMT(JSON_PARSE_ERROR, service_response_ctx(&context, NULL, NULL, &data, invalid, strlen(invalid)), "%d");
+    ASSERT_EQ(1, context.idleTokeners);
+
+    tc_context_free(&context);
+    ASSERT_EQ(0, context.idleTokeners);
+
+    // Without a context each thread keeps one tokener
+    json_tokener *threadTokener = NULL;
+    for (int i = 0; i < 2; i++)
+    {
+        json_object *params = NULL;
+        ASSERT_EQ_FMT(SUCCESS, command_request(NULL, NULL, &params, request, strlen(request)), "%d");
+        json_object_put(params);
+
+        ASSERT(pthread_getspecific(tc_json_tokener_key) != NULL);
+        ASSERT(threadTokener == NULL || threadTokener == pthread_getspecific(tc_json_tokener_key));
+        threadTokener = (json_tokener *)pthread_getspecific(tc_json_tokener_key);
+    }
+
+    PASS();
+}
+
+static int dispatchedCommands = 0;
+
+static void count_command_request(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, void *userData)
+{
+    (void)client;
+    (void)userData;
+
+    if (TC_SLICE_EQUALS(deviceId, "123456") && TC_SLICE_EQUALS(request->method, "startRoutine"))
+    {
+        dispatchedCommands++;
+    }
+}
+
+TEST should_dispatch_by_topic(void)
+{
+    tc_dispatcher dispatcher;
+    ASSERT_EQ(SUCCESS, tc_dispatcher_init(&dispatcher));
+
+    const char *filter = "thincloud/devices/123456/command";
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&dispatcher.trie, filter, strlen(filter), TC_ROUTE_COMMAND_REQUEST));
+    dispatcher.onCommandRequest = count_command_request;
+
+    const char *topic = "thincloud/devices/123456/command";
+    const char *request = "{\"id\":\"1234\",\"method\":\"startRoutine\",\"params\":[]}";
+
+    dispatchedCommands = 0;
+
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatch(&dispatcher, NULL, topic, strlen(topic), request, strlen(request)), "%d");
+    ASSERT_EQ(1, dispatchedCommands);
+
+    topic = "thincloud/devices/123456/requests/7890/response";
+    ASSERT_EQ_FMT(INVALID_TOPIC_TYPE_ERROR, tc_dispatch(&dispatcher, NULL, topic, strlen(topic), request, strlen(request)), "%d");
+
+    topic = "thincloud/devices/123456/command";
+    ASSERT_EQ_FMT(JSON_PARSE_ERROR, tc_dispatch(&dispatcher, NULL, topic, strlen(topic), "{\"id\":", 6), "%d");
+    ASSERT_EQ(1, dispatchedCommands);
+
+    // A filter the client could not subscribe to is not routed
+    AWS_IoT_Client client;
+    memset(&client, 0, sizeof(client));
+    for (int i = 0; i < AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS; i++)
+    {
+        client.clientData.messageHandlers[i].topicName = "taken";
+    }
+
+    ASSERT(tc_dispatcher_subscribe_service_responses(&dispatcher, &client, "123456", NULL, NULL, QOS0) != SUCCESS);
+
+    topic = "thincloud/devices/123456/requests/7890/response";
+    ASSERT_EQ_FMT(INVALID_TOPIC_TYPE_ERROR, tc_dispatch(&dispatcher, NULL, topic, strlen(topic), request, strlen(request)), "%d");
+
+    PASS();
+}
+
+TEST should_round_trip_compressed_payloads(void)
+{
+    char request[1024];
+    int requestLen = snprintf(request, sizeof(request), "{\"id\":\"1234\",\"method\":\"startRoutine\",\"params\":[");
+    for (int i = 0; i < 12; i++)
+    {
+        requestLen += snprintf(request + requestLen, sizeof(request) - requestLen, "%s{\"data\":{\"zone\":%d,\"brightness\":80,\"on\":\"07:00\"}}", i > 0 ? "," : "", i);
+    }
+    requestLen += snprintf(request + requestLen, sizeof(request) - requestLen, "]}");
+
+    char packed[1024];
+    char unpacked[1024];
+    size_t packedLen = 0;
+    size_t unpackedLen = 0;
+    ASSERT_FALSE(tc_lz_is_packed(request, requestLen));
+
+    ASSERT_EQ_FMT(SUCCESS, tc_lz_pack(NULL, request, requestLen, packed, sizeof(packed), &packedLen), "%d");
+    ASSERT(packedLen < (size_t)requestLen / 2);
+    ASSERT(tc_lz_is_packed(packed, packedLen));
+    ASSERT_EQ_FMT(SUCCESS, tc_lz_unpack(NULL, packed, packedLen, unpacked, sizeof(unpacked), &unpackedLen), "%d");
+    ASSERT_EQ((size_t)requestLen, unpackedLen);
+    ASSERT_MEM_EQ(request, unpacked, unpackedLen);
+
+    size_t withDictionaryLen = 0;
+    ASSERT_EQ_FMT(SUCCESS, tc_lz_pack(&tc_lz_thincloud_dictionary, request, requestLen, packed, sizeof(packed), &withDictionaryLen), "%d");
+    ASSERT(withDictionaryLen < packedLen);
+    ASSERT_EQ_FMT(FAILURE, tc_lz_unpack(NULL, packed, withDictionaryLen, unpacked, sizeof(unpacked), &unpackedLen), "%d");
+    ASSERT_EQ_FMT(MAX_SIZE_ERROR, tc_lz_unpack(&tc_lz_thincloud_dictionary, packed, withDictionaryLen, unpacked, requestLen - 1, &unpackedLen), "%d");
+    ASSERT_EQ_FMT(JSON_PARSE_ERROR, tc_lz_unpack(&tc_lz_thincloud_dictionary, packed, withDictionaryLen - 1, unpacked, sizeof(unpacked), &unpackedLen), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_lz_unpack(&tc_lz_thincloud_dictionary, packed, withDictionaryLen, unpacked, sizeof(unpacked), &unpackedLen), "%d");
+    ASSERT_MEM_EQ(request, unpacked, unpackedLen);
+
+    tc_dispatcher dispatcher;
+    ASSERT_EQ(SUCCESS, tc_dispatcher_init(&dispatcher));
+    const char *topic = "thincloud/devices/123456/command";
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&dispatcher.trie, topic, strlen(topic), TC_ROUTE_COMMAND_REQUEST));
+    dispatcher.onCommandRequest = count_command_request;
+    dispatchedCommands = 0;
+
+    ASSERT_EQ_FMT(NULL_VALUE_ERROR, tc_dispatch(&dispatcher, NULL, topic, strlen(topic), packed, withDictionaryLen), "%d");
+    tc_dispatcher_set_compression(&dispatcher, &tc_lz_thincloud_dictionary, unpacked, sizeof(unpacked));
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatch(&dispatcher, NULL, topic, strlen(topic), packed, withDictionaryLen), "%d");
+    ASSERT_EQ(1, dispatchedCommands);
+
+    tc_context context;
+    ASSERT_EQ(SUCCESS, tc_context_init(&context));
+    tc_context_set_compression(&context, 256, &tc_lz_thincloud_dictionary, unpacked, sizeof(unpacked));
+
+    char method[32];
+    ASSERT_EQ_FMT(SUCCESS, command_request_ctx(&context, NULL, method, NULL, packed, withDictionaryLen), "%d");
+    ASSERT_STR_EQ("startRoutine", method);
+
+    // Small messages are sent as is
+    const char *small = "{\"id\":\"1234\"}";
+    ASSERT_EQ_FMT(SUCCESS, tc_context_compress(&context, small, strlen(small), packed, sizeof(packed), &packedLen), "%d");
+    ASSERT_EQ(strlen(small), packedLen);
+    ASSERT_MEM_EQ(small, packed, packedLen);
+
+    ASSERT_EQ_FMT(SUCCESS, tc_context_compress(&context, request, requestLen, packed, sizeof(packed), &packedLen), "%d");
+    ASSERT_EQ(withDictionaryLen, packedLen);
+
+    tc_context_free(&context);
+
+    PASS();
+}
+
+static int typedRoutines = 0;
+
+static void count_routine(AWS_IoT_Client *client, tc_slice deviceId, tc_slice requestId, const lock_start_routine_params *params, void *userData)
+{
+    (void)client;
+    (void)deviceId;
+    (void)userData;
+
+    if (TC_SLICE_EQUALS(requestId, "1234") && params->stepsCount == 2)
+    {
+        typedRoutines++;
+    }
+}
+
+static void count_error(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, IoT_Error_t rc, void *userData)
+{
+    (void)client;
+    (void)deviceId;
+    (void)request;
+
+    *(IoT_Error_t *)userData = rc;
+}
+
+TEST should_decode_typed_messages(void)
+{
+    const char *request = "{\"id\":\"1234\",\"method\":\"startRoutine\",\"params\":[{\"data\":{\"routineId\":\"r\\u00e9\",\"extra\":{\"a\":[1]},"
+                          "\"steps\":[{\"deviceId\":\"a1\",\"level\":40},{\"level\":-7,\"deviceId\":null}],\"delay\":1.5,\"options\":{\"tags\":[\"x\",\"y\"]}}}]}";
+    tc_command_request_view view;
+    ASSERT_EQ_FMT(SUCCESS, command_request_view(&view, request, strlen(request)), "%d");
+
+    lock_start_routine_params params;
+    ASSERT_EQ_FMT(SUCCESS, lock_start_routine_params_parse(&view, &params), "%d");
+    ASSERT_STR_EQ("r\xc3\xa9", params.routineId);
+    ASSERT_EQ(2, params.stepsCount);
+    ASSERT_STR_EQ("a1", params.steps[0].deviceId);
+    ASSERT_EQ(40, params.steps[0].level);
+    ASSERT_EQ(-7, params.steps[1].level);
+    ASSERT_EQ(LOCK_STEP_LEVEL, params.steps[1].present);
+    ASSERT_EQ(1.5, params.delay);
+    ASSERT_EQ(2, params.options.tagsCount);
+    ASSERT_STR_EQ("y", params.options.tags[1]);
+    ASSERT_EQ(LOCK_START_ROUTINE_PARAMS_OPTIONS_TAGS, params.options.present);
+
+    // Too many elements, a string that does not fit and a mistyped value
+    const char *invalid[] = {
+        "{\"id\":\"1234\",\"method\":\"startRoutine\",\"params\":[{\"data\":{\"steps\":[{},{},{},{},{},{},{},{},{}]}}]}",
+        "{\"id\":\"1234\",\"method\":\"setLockState\",\"params\":[{\"data\":{\"source\":\"0123456789abcdef\"}}]}",
+        "{\"id\":\"1234\",\"method\":\"setLockState\",\"params\":[{\"data\":{\"locked\":\"yes\"}}]}",
+    };
+    const IoT_Error_t errors[] = {LIMIT_EXCEEDED_ERROR, MAX_SIZE_ERROR, JSON_PARSE_ERROR};
+
+    lock_set_lock_state_params lockState;
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        ASSERT_EQ_FMT(SUCCESS, command_request_view(&view, invalid[i], strlen(invalid[i])), "%d");
+        ASSERT_EQ_FMT(errors[i], i == 0 ? lock_start_routine_params_parse(&view, &params) : lock_set_lock_state_params_parse(&view, &lockState), "%d");
+    }
+
+    // Commands are routed to their typed handler
+    IoT_Error_t handlerError = SUCCESS;
+    lock_command_handlers handlers = {0};
+    handlers.startRoutine = count_routine;
+    handlers.onError = count_error;
+    handlers.userData = &handlerError;
+    typedRoutines = 0;
+
+    ASSERT_EQ_FMT(SUCCESS, command_request_view(&view, request, strlen(request)), "%d");
+    lock_command_handler(NULL, view.requestId, &view, &handlers);
+    ASSERT_EQ(1, typedRoutines);
+    ASSERT_EQ_FMT(SUCCESS, handlerError, "%d");
+
+    const char *unknown = "{\"id\":\"1234\",\"method\":\"reboot\",\"params\":[]}";
+    ASSERT_EQ_FMT(SUCCESS, command_request_view(&view, unknown, strlen(unknown)), "%d");
+    lock_command_handler(NULL, view.requestId, &view, &handlers);
+    ASSERT_EQ_FMT(FAILURE, handlerError, "%d");
+
+    char buffer[512];
+    size_t written = 0;
+    lock_set_lock_state_body body = {0};
+    body.locked = true;
+    body.present = LOCK_SET_LOCK_STATE_BODY_LOCKED;
+    ASSERT_EQ_FMT(SUCCESS, lock_set_lock_state_response_n(buffer, sizeof(buffer), "1234", 200, &body, &written), "%d");
+    ASSERT_STR_EQ("{\"id\":\"1234\",\"result\":{\"statusCode\":200,\"body\":{\"data\":{\"locked\":true}}}}", buffer);
+    ASSERT_EQ(strlen(buffer), written);
+
+    lock_schedule_request schedule = {0};
+    schedule.schedule[0].day = 1;
+    strcpy(schedule.schedule[0].on, "07:00");
+    schedule.schedule[0].present = LOCK_SCHEDULE_ENTRY_DAY | LOCK_SCHEDULE_ENTRY_ON;
+    schedule.scheduleCount = 1;
+    schedule.present = LOCK_SCHEDULE_REQUEST_SCHEDULE;
+    ASSERT_EQ_FMT(SUCCESS, lock_schedule_request_n(buffer, sizeof(buffer), "5678", &schedule, &written), "%d");
+    ASSERT_STR_EQ("{\"id\":\"5678\",\"method\":\"PUT\",\"params\":{\"data\":{\"schedule\":[{\"day\":1,\"on\":\"07:00\"}]}}}", buffer);
+
+    const char *response = "{\"id\":\"5678\",\"result\":{\"statusCode\":200,\"body\":{\"data\":{\"schedule\":[{\"day\":2,\"on\":\"07:00\",\"off\":\"22:30\"}]}}}}";
+    tc_service_response_view responseView;
+    ASSERT_EQ_FMT(SUCCESS, service_response_view(&responseView, response, strlen(response)), "%d");
+
+    lock_schedule_response scheduleResponse;
+    ASSERT_EQ_FMT(SUCCESS, lock_schedule_response_parse(&responseView, &scheduleResponse), "%d");
+    ASSERT_EQ(1, scheduleResponse.scheduleCount);
+    ASSERT_EQ(2, scheduleResponse.schedule[0].day);
+    ASSERT_STR_EQ("22:30", scheduleResponse.schedule[0].off);
+
+    PASS();
+}
+
+static void count_method(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, void *userData)
+{
+    (void)client;
+    (void)deviceId;
+    (void)request;
+
+    *(int *)userData += 1;
+}
+
+TEST should_find_methods_through_perfect_hash(void)
+{
+    static char names[64][16];
+    static tc_command_method methods[64];
+    static tc_method_table table;
+    int calls[64] = {0};
+
+    for (int i = 0; i < 64; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "method%d", i * 7);
+        methods[i] = (tc_command_method){names[i], count_method, &calls[i]};
+    }
+
+    ASSERT_EQ_FMT(SUCCESS, tc_method_table_init(&table, methods, 64), "%d");
+
+    for (int i = 0; i < 64; i++)
+    {
+        ASSERT_EQ(&methods[i], tc_method_table_find(&table, (tc_slice){names[i], strlen(names[i])}));
+    }
+    ASSERT_EQ(NULL, tc_method_table_find(&table, (tc_slice){"method1", 7}));
+    ASSERT_EQ(NULL, tc_method_table_find(&table, (tc_slice){"", 0}));
+
+    const char *request = "{\"id\":\"1234\",\"method\":\"method21\",\"params\":[]}";
+    tc_command_request_view view;
+    ASSERT_EQ(SUCCESS, command_request_view(&view, request, strlen(request)));
+    tc_method_table_handler(NULL, (tc_slice){"123456", 6}, &view, &table);
+    ASSERT_EQ(1, calls[3]);
+
+    int unknown = 0;
+    tc_method_table_set_unknown(&table, count_method, &unknown);
+    view.method = (tc_slice){"reboot", 6};
+    tc_method_table_handler(NULL, (tc_slice){"123456", 6}, &view, &table);
+    ASSERT_EQ(1, unknown);
+
+    methods[1].name = names[0];
+    ASSERT_EQ_FMT(FAILURE, tc_method_table_init(&table, methods, 64), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_method_table_init(&table, methods, 1), "%d");
+    ASSERT_EQ(&methods[0], tc_method_table_find(&table, (tc_slice){names[0], strlen(names[0])}));
+
+    PASS();
+}
+
+static int completedRequests = 0;
+static int timedOutRequests = 0;
+
+static void count_service_response(AWS_IoT_Client *client, IoT_Error_t rc, const tc_service_response_view *response, void *userData)
+{
+    (void)client;
+    (void)userData;
+
+    if (rc == SUCCESS && response != NULL && response->statusCode == 200)
+    {
+        completedRequests++;
+    }
+    else if (rc == MQTT_REQUEST_TIMEOUT_ERROR && response == NULL)
+    {
+        timedOutRequests++;
+    }
+}
+
+static tc_correlation_table pendingRequests;
+
+TEST should_correlate_pending_requests(void)
+{
+    char requestId[TC_ID_LENGTH];
+    tc_correlation_init(&pendingRequests, NULL);
+
+    for (int i = 0; i < TC_MAX_PENDING_REQUESTS; i++)
+    {
+        const int len = snprintf(requestId, sizeof(requestId), "request-%d", i);
+        ASSERT_EQ_FMT(SUCCESS, tc_correlation_insert(&pendingRequests, requestId, (size_t)len, count_service_response, NULL, (uint64_t)(i % 2), NULL), "%d");
+    }
+
+    ASSERT_EQ_FMT(LIMIT_EXCEEDED_ERROR, tc_correlation_insert(&pendingRequests, "extra", 5, count_service_response, NULL, 0, NULL), "%d");
+    ASSERT_EQ(NULL, tc_correlation_find(&pendingRequests, (tc_slice){"extra", 5}));
+
+    tc_pending_request *request = tc_correlation_find(&pendingRequests, (tc_slice){"request-42", 10});
+    ASSERT(request != NULL);
+    tc_correlation_id(request, requestId);
+    ASSERT_STR_EQ("request-42", requestId);
+
+    tc_correlation_remove(&pendingRequests, request);
+    ASSERT_EQ(NULL, tc_correlation_find(&pendingRequests, (tc_slice){"request-42", 10}));
+    ASSERT(tc_correlation_find(&pendingRequests, (tc_slice){"request-43", 10}) != NULL);
+
+    timedOutRequests = 0;
+
+    ASSERT_EQ(TC_MAX_PENDING_REQUESTS / 2 - 1, tc_correlation_expire(&pendingRequests, NULL, 0));
+    ASSERT_EQ(TC_MAX_PENDING_REQUESTS / 2 - 1, timedOutRequests);
+    ASSERT_EQ(TC_MAX_PENDING_REQUESTS / 2, tc_correlation_count(&pendingRequests));
+
+    for (int i = 1; i < TC_MAX_PENDING_REQUESTS; i += 2)
+    {
+        const int len = snprintf(requestId, sizeof(requestId), "request-%d", i);
+        ASSERT(tc_correlation_find(&pendingRequests, (tc_slice){requestId, (size_t)len}) != NULL);
+    }
+
+    PASS();
+}
+
+static void *request_id_on_thread(void *arg)
+{
+    tc_client_request_id(NULL, (char *)arg);
+
+    return tc_uuid_thread_generator();
+}
+
+TEST should_generate_and_parse_uuids(void)
+{
+    tc_uuid_generator generator;
+    tc_uuid_generator_seed(&generator, 42);
+
+    char text[TC_UUID_TEXT_LENGTH + 1];
+    tc_uuid id;
+    tc_uuid parsed;
+
+    for (int i = 0; i < 100; i++)
+    {
+        tc_uuid_generate(&generator, &id);
+        tc_uuid_format(&id, text);
+
+        ASSERT_EQ(TC_UUID_TEXT_LENGTH, strlen(text));
+        ASSERT_EQ('4', text[14]);
+        ASSERT(strchr("89ab", text[19]) != NULL);
+        ASSERT(tc_uuid_parse(text, TC_UUID_TEXT_LENGTH, &parsed));
+        ASSERT(tc_uuid_equals(&id, &parsed));
+    }
+
+    const char *canonical = "3f2504e0-4f89-11d3-9a0c-0305e82c3301";
+    ASSERT(tc_uuid_parse("3F2504E0-4F89-11D3-9A0C-0305E82C3301", TC_UUID_TEXT_LENGTH, &id));
+    ASSERT_EQ(0x3f2504e04f8911d3ULL, id.hi);
+    ASSERT_EQ(0x9a0c0305e82c3301ULL, id.lo);
+    tc_uuid_format(&id, text);
+    ASSERT_STR_EQ(canonical, text);
+
+    ASSERT_FALSE(tc_uuid_parse("3f2504e0-4f89-11d3-9a0c-0305e82c330g", TC_UUID_TEXT_LENGTH, &id));
+    ASSERT_FALSE(tc_uuid_parse("3f2504e0-4f89-11d3-9a0c-0305e82c33:1", TC_UUID_TEXT_LENGTH, &id));
+    ASSERT_FALSE(tc_uuid_parse("3f2504e04f89-11d3-9a0c-0305e82c3301-", TC_UUID_TEXT_LENGTH, &id));
+    ASSERT_FALSE(tc_uuid_parse(canonical, TC_UUID_TEXT_LENGTH - 1, &id));
+
+    // Each thread draws request IDs from a generator of its own
+    char threadId[TC_ID_LENGTH];
+    void *threadGenerator = NULL;
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, request_id_on_thread, threadId));
+    ASSERT_EQ(0, pthread_join(thread, &threadGenerator));
+    ASSERT(tc_uuid_parse(threadId, strlen(threadId), &id));
+    ASSERT(threadGenerator != tc_uuid_thread_generator());
+    ASSERT_EQ(tc_uuid_thread_generator(), tc_uuid_thread_generator());
+
+    tc_correlation_init(&pendingRequests, NULL);
+    ASSERT_EQ(SUCCESS, tc_correlation_insert(&pendingRequests, canonical, TC_UUID_TEXT_LENGTH, count_service_response, NULL, UINT64_MAX, NULL));
+    ASSERT_EQ(FAILURE, tc_correlation_insert(&pendingRequests, canonical, TC_UUID_TEXT_LENGTH, count_service_response, NULL, UINT64_MAX, NULL));
+    ASSERT_EQ(SUCCESS, tc_correlation_insert(&pendingRequests, "0123456789abcdef", 16, count_service_response, NULL, UINT64_MAX, NULL));
+    ASSERT_EQ(SUCCESS, tc_correlation_insert(&pendingRequests, "0123456789abcdefg", 17, count_service_response, NULL, UINT64_MAX, NULL));
+    ASSERT_EQ(SUCCESS, tc_correlation_insert(&pendingRequests, "gateway-7/child-lock-0123456789abcd", 35, count_service_response, NULL, UINT64_MAX, NULL));
+    ASSERT_EQ(SUCCESS, tc_correlation_insert(&pendingRequests, "3f2504e0-4f89-11d3-9a0c-0305e82c330g", TC_UUID_TEXT_LENGTH, count_service_response, NULL, UINT64_MAX, NULL));
+    ASSERT_EQ(MAX_SIZE_ERROR, tc_correlation_insert(&pendingRequests, "gateway-7/child-lock-0123456789abcdef", 37, count_service_response, NULL, UINT64_MAX, NULL));
+    ASSERT_EQ(MAX_SIZE_ERROR, tc_correlation_insert(&pendingRequests, "", 0, count_service_response, NULL, UINT64_MAX, NULL));
+
+    tc_pending_request *request = tc_correlation_find(&pendingRequests, (tc_slice){"3F2504E0-4F89-11D3-9A0C-0305E82C3301", TC_UUID_TEXT_LENGTH});
+    ASSERT(request != NULL);
+    char requestId[TC_ID_LENGTH];
+    tc_correlation_id(request, requestId);
+    ASSERT_STR_EQ(canonical, requestId);
+
+    request = tc_correlation_find(&pendingRequests, (tc_slice){"0123456789abcdef", 16});
+    ASSERT(request != NULL);
+    tc_correlation_id(request, requestId);
+    ASSERT_STR_EQ("0123456789abcdef", requestId);
+
+    // Longer IDs keep their text, and IDs sharing their first 16 bytes stay apart
+    request = tc_correlation_find(&pendingRequests, (tc_slice){"gateway-7/child-lock-0123456789abcd", 35});
+    ASSERT(request != NULL);
+    tc_correlation_id(request, requestId);
+    ASSERT_STR_EQ("gateway-7/child-lock-0123456789abcd", requestId);
+
+    request = tc_correlation_find(&pendingRequests, (tc_slice){"3f2504e0-4f89-11d3-9a0c-0305e82c330g", TC_UUID_TEXT_LENGTH});
+    ASSERT(request != NULL);
+    tc_correlation_id(request, requestId);
+    ASSERT_STR_EQ("3f2504e0-4f89-11d3-9a0c-0305e82c330g", requestId);
+
+    ASSERT(tc_correlation_find(&pendingRequests, (tc_slice){"0123456789abcdefg", 17}) != tc_correlation_find(&pendingRequests, (tc_slice){"0123456789abcdef", 16}));
+    ASSERT_EQ(NULL, tc_correlation_find(&pendingRequests, (tc_slice){"gateway-7/child-lock-0123456789abcD", 35}));
+    ASSERT_EQ(NULL, tc_correlation_find(&pendingRequests, (tc_slice){"0123456789abcde", 15}));
+    ASSERT_EQ(NULL, tc_correlation_find(&pendingRequests, (tc_slice){"3f2504e0-4f89-11d3-9a0c-0305e82c3302", TC_UUID_TEXT_LENGTH}));
+
+    PASS();
+}
+
+TEST should_dispatch_to_pending_request(void)
+{
+    tc_dispatcher dispatcher;
+    ASSERT_EQ(SUCCESS, tc_dispatcher_init(&dispatcher));
+
+    const char *filter = "thincloud/devices/123456/requests/+/response";
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&dispatcher.trie, filter, strlen(filter), TC_ROUTE_SERVICE_RESPONSE));
+
+    tc_correlation_init(&pendingRequests, NULL);
+    dispatcher.pending = &pendingRequests;
+
+    ASSERT_EQ(SUCCESS, tc_correlation_insert(&pendingRequests, "7890", 4, count_service_response, NULL, UINT64_MAX, NULL));
+
+    const char *topic = "thincloud/devices/123456/requests/7890/response";
+    const char *response = "{\"id\":\"7890\",\"result\":{\"statusCode\":200}}";
+
+    completedRequests = 0;
+
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatch(&dispatcher, NULL, topic, strlen(topic), response, strlen(response)), "%d");
+    ASSERT_EQ(1, completedRequests);
+    ASSERT_EQ(0, tc_correlation_count(&pendingRequests));
+
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatch(&dispatcher, NULL, topic, strlen(topic), response, strlen(response)), "%d");
+    ASSERT_EQ(1, completedRequests);
+
+    PASS();
+}
+
+static tc_timer_wheel timerWheel;
+static tc_timer timers[512];
+static int lateTimers = 0;
+
+static void check_timer_expiry(tc_timer *timer, void *data)
+{
+    (void)data;
+
+    if (timer->expires != timerWheel.now)
+    {
+        lateTimers++;
+    }
+}
+
+TEST should_fire_timers_on_time(void)
+{
+    uint32_t seed = 12345;
+    uint32_t scheduled = 0;
+
+    tc_timer_wheel_init(&timerWheel, 1000);
+    lateTimers = 0;
+
+    for (int i = 0; i < 512; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        tc_timer_init(&timers[i], check_timer_expiry, NULL);
+        tc_timer_schedule(&timerWheel, &timers[i], 1001 + (seed >> 8) % (1 << 20));
+        scheduled++;
+    }
+
+    for (int i = 0; i < 512; i += 8)
+    {
+        tc_timer_cancel(&timerWheel, &timers[i]);
+        scheduled--;
+    }
+    ASSERT_EQ(scheduled, timerWheel.count);
+
+    uint32_t fired = 0;
+    uint64_t now = 1000;
+    while (timerWheel.count > 0)
+    {
+        seed = seed * 1103515245 + 12345;
+        now += (seed >> 8) % 5000;
+        fired += tc_timer_wheel_advance(&timerWheel, now);
+    }
+
+    ASSERT_EQ(scheduled, fired);
+    ASSERT_EQ(0, lateTimers);
+
+    PASS();
+}
+
+TEST should_retransmit_until_timeout(void)
+{
+    tc_timer_wheel_init(&timerWheel, 0);
+    tc_correlation_init(&pendingRequests, &timerWheel);
+
+    tc_pending_request *request = NULL;
+    tc_retry_buffer *buffer = NULL;
+    const tc_retry_policy policy = {2, 1000};
+
+    ASSERT_EQ(SUCCESS, tc_correlation_insert(&pendingRequests, "7890", 4, count_service_response, NULL, 100, &request));
+    ASSERT_EQ(SUCCESS, tc_correlation_retry(&pendingRequests, request, NULL, 100, &policy, &buffer));
+
+    const char *topic = "thincloud/devices/123456/requests";
+    memcpy(buffer->topic, topic, strlen(topic));
+    buffer->topicLen = (uint16_t)strlen(topic);
+    buffer->payloadLen = 0;
+
+    timedOutRequests = 0;
+
+    // First timeout retransmits with a jittered 200ms timeout
+    tc_timer_wheel_advance(&timerWheel, 100);
+    ASSERT_EQ(0, timedOutRequests);
+    ASSERT(request->deadline > 200 && request->deadline <= 300);
+
+    // Second timeout retransmits with a jittered 400ms timeout
+    tc_timer_wheel_advance(&timerWheel, request->deadline);
+    ASSERT_EQ(0, timedOutRequests);
+    ASSERT_EQ(0, request->retriesLeft);
+
+    tc_timer_wheel_advance(&timerWheel, 1000);
+    ASSERT_EQ(1, timedOutRequests);
+    ASSERT_EQ(0, tc_correlation_count(&pendingRequests));
+    ASSERT_EQ(0, timerWheel.count);
+    ASSERT_EQ(TC_MAX_RETRY_REQUESTS, pendingRequests.freeRetryCount);
+
+    PASS();
+}
+
+TEST should_encode_publish_packet(void)
+{
+    unsigned char packet[512];
+    size_t packetLen = 0;
+
+    const char *topic = "a/b";
+    ASSERT_EQ_FMT(SUCCESS, tc_mqtt_serialize_publish(packet, sizeof(packet), topic, 3, QOS1, false, 0x1234, "hi", 2, &packetLen), "%d");
+
+    const unsigned char expected[] = {0x32, 9, 0, 3, 'a', '/', 'b', 0x12, 0x34, 'h', 'i'};
+    ASSERT_EQ(sizeof(expected), packetLen);
+    ASSERT_MEM_EQ(expected, packet, sizeof(expected));
+
+    ASSERT_EQ_FMT(MQTT_TX_BUFFER_TOO_SHORT_ERROR, tc_mqtt_serialize_publish(packet, 8, topic, 3, QOS0, false, 0, "hi", 2, &packetLen), "%d");
+    ASSERT_EQ(9, packetLen);
+
+    const size_t lengths[] = {0, 127, 128, 16383, 16384, 2097151, 2097152, TC_MQTT_MAX_REMAINING_LENGTH};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        size_t decoded = 0;
+        size_t size = 0;
+        const size_t encoded = tc_mqtt_encode_remaining_length(packet, lengths[i]);
+
+        ASSERT_EQ(tc_mqtt_remaining_length_size(lengths[i]), encoded);
+        ASSERT_EQ(SUCCESS, tc_mqtt_decode_remaining_length(packet, encoded, &decoded, &size));
+        ASSERT_EQ(lengths[i], decoded);
+        ASSERT_EQ(encoded, size);
+        ASSERT_EQ(MQTT_NOTHING_TO_READ, tc_mqtt_decode_remaining_length(packet, encoded - 1, &decoded, &size));
+    }
+
+    PASS();
+}
+
+static unsigned char capturedBytes[1024];
+static size_t capturedLen = 0;
+static int writes = 0;
+
+static IoT_Error_t capture_write(Network *network, unsigned char *data, size_t len, Timer *timer, size_t *sent)
+{
+    (void)network;
+    (void)timer;
+
+    memcpy(capturedBytes + capturedLen, data, len);
+    capturedLen += len;
+    writes++;
+    *sent = len;
+
+    return SUCCESS;
+}
+
+TEST should_batch_publishes(void)
+{
+    AWS_IoT_Client client;
+    memset(&client, 0, sizeof(client));
+    client.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    client.clientData.commandTimeoutMs = 1000;
+    client.networkStack.write = capture_write;
+
+    unsigned char buffer[64];
+    tc_batch batch;
+    ASSERT_EQ(SUCCESS, tc_batch_init(&batch, buffer, sizeof(buffer), 32, 1000));
+
+    capturedLen = 0;
+    writes = 0;
+
+    // Each packet is 2 + 2 + 9 + 2 = 15 bytes
+    const char *topic = "thincloud";
+    ASSERT_EQ(SUCCESS, tc_batch_publish(&batch, &client, topic, 9, "{}", 2));
+    ASSERT_EQ(SUCCESS, tc_batch_publish(&batch, &client, topic, 9, "{}", 2));
+    ASSERT_EQ(0, writes);
+
+    ASSERT_EQ(SUCCESS, tc_batch_poll(&batch, &client, batch.oldest + 999));
+    ASSERT_EQ(0, writes);
+
+    // The third packet crosses the 32 byte threshold
+    ASSERT_EQ(SUCCESS, tc_batch_publish(&batch, &client, topic, 9, "{}", 2));
+    ASSERT_EQ(1, writes);
+    ASSERT_EQ(45, capturedLen);
+    ASSERT_EQ(0x30, capturedBytes[30]);
+
+    ASSERT_EQ(SUCCESS, tc_batch_publish(&batch, &client, topic, 9, "{}", 2));
+    ASSERT_EQ(SUCCESS, tc_batch_poll(&batch, &client, batch.oldest + 1000));
+    ASSERT_EQ(2, writes);
+    ASSERT_EQ(60, capturedLen);
+    ASSERT_EQ(0, batch.count);
+
+    client.clientStatus.clientState = CLIENT_STATE_INITIALIZED;
+    ASSERT_EQ(SUCCESS, tc_batch_publish(&batch, &client, topic, 9, "{}", 2));
+    ASSERT_EQ(NETWORK_DISCONNECTED_ERROR, tc_batch_flush(&batch, &client));
+
+    PASS();
+}
+
+TEST should_retransmit_through_context(void)
+{
+    AWS_IoT_Client client;
+    memset(&client, 0, sizeof(client));
+    client.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    client.clientData.commandTimeoutMs = 1000;
+    client.networkStack.write = capture_write;
+
+    unsigned char buffer[512];
+    tc_batch batch;
+    ASSERT_EQ(SUCCESS, tc_batch_init(&batch, buffer, sizeof(buffer), 0, UINT32_MAX));
+
+    tc_context context;
+    ASSERT_EQ(SUCCESS, tc_context_init(&context));
+    tc_context_set_format(&context, TC_FORMAT_CBOR);
+    tc_context_set_batch(&context, &batch);
+
+    tc_correlation_init(&pendingRequests, &context.timers);
+    const tc_retry_policy policy = {1, 1000};
+
+    ASSERT_EQ(NULL_VALUE_ERROR, send_commissioning_request_async_ctx(&context, &client, NULL, "7890", "lock", "123456", NULL, 0, 100, &policy, NULL, NULL, QOS0));
+    ASSERT_EQ(SUCCESS, send_service_request_async_ctx(&context, &client, &pendingRequests, "7890", "123456", "getConfig", NULL, 100, &policy, count_service_response, NULL, QOS0));
+    ASSERT_EQ(1, batch.count);
+
+    capturedLen = 0;
+    ASSERT_EQ(SUCCESS, tc_batch_flush(&batch, &client));
+
+    // The payload follows the topic, in CBOR
+    unsigned char first[256];
+    const size_t firstLen = capturedLen;
+    memcpy(first, capturedBytes, firstLen);
+    ASSERT_EQ(strlen("thincloud/devices/123456/requests"), first[3]);
+    ASSERT_EQ(0xa0, first[4 + first[3]] & 0xe0);
+
+    // The retransmit goes through the batch again, byte for byte
+    tc_slice requestId = {"7890", 4};
+    const tc_pending_request *request = tc_correlation_find(&pendingRequests, requestId);
+    ASSERT(request != NULL);
+
+    tc_timer_wheel_advance(&context.timers, request->deadline);
+    ASSERT_EQ(1, batch.count);
+
+    capturedLen = 0;
+    ASSERT_EQ(SUCCESS, tc_batch_flush(&batch, &client));
+    ASSERT_EQ(firstLen, capturedLen);
+    ASSERT_MEM_EQ(first, capturedBytes, firstLen);
+
+    timedOutRequests = 0;
+    tc_timer_wheel_advance(&context.timers, context.timers.now + 1000);
+    ASSERT_EQ(1, timedOutRequests);
+    ASSERT_EQ(0, batch.count);
+
+    tc_context_free(&context);
+
+    PASS();
+}
+
+static tc_stats stats;
+static tc_stats_report statsReport;
+
+TEST should_count_messages_in_stats(void)
+{
+    tc_stats_init(&stats);
+
+    tc_dispatcher dispatcher;
+    ASSERT_EQ(SUCCESS, tc_dispatcher_init(&dispatcher));
+    tc_dispatcher_set_stats(&dispatcher, &stats);
+
+    const char *filter = "thincloud/devices/123456/requests/+/response";
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&dispatcher.trie, filter, strlen(filter), TC_ROUTE_SERVICE_RESPONSE));
+
+    const char *topic = "thincloud/devices/123456/requests/7890/response";
+    const char *response = "{\"id\":\"7890\",\"result\":{\"statusCode\":200}}";
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatch(&dispatcher, NULL, topic, strlen(topic), response, strlen(response)), "%d");
+    ASSERT_EQ_FMT(JSON_PARSE_ERROR, tc_dispatch(&dispatcher, NULL, topic, strlen(topic), "{\"id\":", 6), "%d");
+    ASSERT_EQ_FMT(INVALID_TOPIC_TYPE_ERROR, tc_dispatch(&dispatcher, NULL, "thincloud", 9, "{}", 2), "%d");
+
+    AWS_IoT_Client client;
+    memset(&client, 0, sizeof(client));
+    client.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    client.clientData.commandTimeoutMs = 1000;
+    client.networkStack.write = capture_write;
+    capturedLen = 0;
+
+    tc_context context;
+    tc_context_init(&context);
+    tc_context_set_stats(&context, &stats);
+
+    ASSERT_EQ_FMT(SUCCESS, send_command_response_ctx(&context, &client, "123456", "7890", 200, false, NULL, NULL, QOS0), "%d");
+    ASSERT_EQ_FMT(SUCCESS, send_service_request_ctx(&context, &client, "7891", "123456", "get", NULL, QOS0), "%d");
+    const size_t sentLen = capturedLen;
+
+    // A batch that flushes every message fails to once the link drops
+    unsigned char buffer[256];
+    tc_batch batch;
+    ASSERT_EQ(SUCCESS, tc_batch_init(&batch, buffer, sizeof(buffer), 1, 1000));
+    tc_context_set_batch(&context, &batch);
+
+    client.clientStatus.clientState = CLIENT_STATE_INITIALIZED;
+    ASSERT_EQ_FMT(NETWORK_DISCONNECTED_ERROR, send_command_response_ctx(&context, &client, "123456", "7892", 200, false, NULL, NULL, QOS0), "%d");
+
+    tc_stats_snapshot(&stats, &statsReport);
+
+    ASSERT_EQ(2, statsReport.messagesIn[TC_STATS_SERVICE_RESPONSE]);
+    ASSERT_EQ(1, statsReport.messagesIn[TC_STATS_OTHER]);
+    ASSERT_EQ(strlen(response) + 6 + 2, statsReport.bytesIn);
+    ASSERT_EQ(1, tc_stats_errors(&statsReport, JSON_PARSE_ERROR));
+    ASSERT_EQ(1, tc_stats_errors(&statsReport, INVALID_TOPIC_TYPE_ERROR));
+
+    ASSERT_EQ(1, statsReport.messagesOut[TC_STATS_COMMAND_RESPONSE]);
+    ASSERT_EQ(1, statsReport.messagesOut[TC_STATS_SERVICE_REQUEST]);
+    ASSERT_EQ(0, statsReport.messagesOut[TC_STATS_OTHER]);
+    ASSERT(statsReport.bytesOut > 0 && statsReport.bytesOut < sentLen);
+    ASSERT_EQ(1, tc_stats_errors(&statsReport, NETWORK_DISCONNECTED_ERROR));
+
+    // Messages with an unknown topic are not parsed, malformed ones are not handled
+    ASSERT_EQ(2, statsReport.latency[TC_STATS_PARSE].count);
+    ASSERT_EQ(1, statsReport.latency[TC_STATS_HANDLER].count);
+    ASSERT_EQ(3, statsReport.latency[TC_STATS_PUBLISH].count);
+
+    ASSERT_EQ(TC_STATS_COMMISSIONING_REQUEST, tc_stats_outbound_kind("thincloud/registration/lock_1/requests", 38));
+    ASSERT_EQ(TC_STATS_SERVICE_REQUEST, tc_stats_outbound_kind("thincloud/devices/1/requests", 28));
+
+    tc_context_free(&context);
+
+    PASS();
+}
+
+TEST should_bucket_latencies_log_linearly(void)
+{
+    for (uint64_t ns = 0; ns < 8; ns++)
+    {
+        ASSERT_EQ(ns, tc_stats_bucket(ns));
+    }
+
+    // Every bucket starts where the one before it ends and is within an eighth of its values
+    for (uint32_t bucket = 1; bucket < TC_STATS_BUCKETS; bucket++)
+    {
+        const uint64_t floor = tc_stats_bucket_floor(bucket);
+        ASSERT_EQ(bucket, tc_stats_bucket(floor));
+        ASSERT_EQ(bucket - 1, tc_stats_bucket(floor - 1));
+        ASSERT(bucket < TC_STATS_SUB_BUCKETS || floor - tc_stats_bucket_floor(bucket - 1) <= floor / TC_STATS_SUB_BUCKETS);
+    }
+    ASSERT_EQ(TC_STATS_BUCKETS - 1, tc_stats_bucket(UINT64_MAX));
+
+    tc_stats_init(&stats);
+    for (uint64_t ns = 1; ns <= 1000; ns++)
+    {
+        tc_stats_record(&stats, TC_STATS_HANDLER, ns * 1000);
+    }
+
+    tc_stats_snapshot(&stats, &statsReport);
+    ASSERT_EQ(1000, statsReport.latency[TC_STATS_HANDLER].count);
+    ASSERT_EQ(500500000, statsReport.latency[TC_STATS_HANDLER].sumNs);
+
+    const uint64_t p50 = tc_stats_percentile(&statsReport.latency[TC_STATS_HANDLER], 0.5);
+    const uint64_t p99 = tc_stats_percentile(&statsReport.latency[TC_STATS_HANDLER], 0.99);
+    ASSERT(p50 >= 500000 && p50 <= 500000 * 9 / 8);
+    ASSERT(p99 >= 990000 && p99 <= 990000 * 9 / 8);
+    ASSERT_EQ(0, tc_stats_percentile(&statsReport.latency[TC_STATS_PARSE], 0.5));
+
+    PASS();
+}
+
+static tc_trace_ring traceRing;
+static tc_trace_record traceRecords[TC_TRACE_RING_SIZE + 1];
+
+TEST should_keep_latest_trace_records(void)
+{
+    // Trace points are compiled out of the tests
+    uint32_t evaluated = 0;
+    TC_TRACE_BEGIN(TC_TRACE_TOPIC, evaluated++);
+    ASSERT_EQ(0, evaluated);
+
+    tc_trace_ring_init(&traceRing);
+    for (uint32_t i = 0; i < TC_TRACE_RING_SIZE + 10; i++)
+    {
+        tc_trace_ring_push(&traceRing, (tc_trace_stage)(i % TC_TRACE_STAGE_COUNT), i % 2 == 0 ? TC_TRACE_PHASE_BEGIN : TC_TRACE_PHASE_END, i);
+    }
+
+    // The ten oldest records were overwritten
+    uint64_t cursor = 0;
+    ASSERT_EQ(TC_TRACE_RING_SIZE, tc_trace_ring_read(&traceRing, &cursor, UINT64_MAX, traceRecords, TC_TRACE_RING_SIZE));
+    ASSERT_EQ(TC_TRACE_RING_SIZE + 10, cursor);
+    for (uint32_t i = 0; i < TC_TRACE_RING_SIZE; i++)
+    {
+        ASSERT_EQ(i + 10, traceRecords[i].arg);
+        ASSERT(i == 0 || traceRecords[i].timestampNs >= traceRecords[i - 1].timestampNs);
+    }
+    ASSERT_EQ(0, tc_trace_ring_read(&traceRing, &cursor, UINT64_MAX, traceRecords, TC_TRACE_RING_SIZE));
+
+    FILE *file = tmpfile();
+    ASSERT(file != NULL);
+    ASSERT_EQ_FMT(SUCCESS, tc_trace_write_header(fileno(file)), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_trace_write_ring(fileno(file), &traceRing, 3), "%d");
+    rewind(file);
+
+    tc_trace_header header;
+    ASSERT_EQ(1, fread(&header, sizeof(header), 1, file));
+    ASSERT_STR_EQ("TCTRACE", header.magic);
+    ASSERT_EQ(TC_TRACE_VERSION, header.version);
+    ASSERT_EQ(16, header.recordSize);
+
+    ASSERT_EQ(TC_TRACE_RING_SIZE, fread(traceRecords, sizeof(tc_trace_record), TC_TRACE_RING_SIZE + 1, file));
+    ASSERT_EQ(10, traceRecords[0].arg);
+    ASSERT_EQ(3, traceRecords[0].thread);
+    ASSERT_EQ(TC_TRACE_MARSHAL, traceRecords[TC_TRACE_RING_SIZE - 1].stage);
+    ASSERT_EQ('E', traceRecords[TC_TRACE_RING_SIZE - 1].phase);
+    fclose(file);
+
+    PASS();
+}
+
+TEST should_replay_offline_outbox(void)
+{
+    char path[] = "/tmp/tc_outbox_XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT(fd >= 0);
+    close(fd);
+
+    AWS_IoT_Client client;
+    memset(&client, 0, sizeof(client));
+    client.clientStatus.clientState = CLIENT_STATE_INITIALIZED;
+    client.clientData.commandTimeoutMs = 1000;
+    client.networkStack.write = capture_write;
+
+    // Records take 16 + 9 + 8 = 33 bytes, padded to 40
+    tc_outbox outbox;
+    ASSERT_EQ_FMT(SUCCESS, tc_outbox_open(&outbox, path, 100, false), "%d");
+
+    tc_context context;
+    tc_context_init(&context);
+    tc_context_set_outbox(&context, &outbox);
+
+    ASSERT_EQ_FMT(SUCCESS, tc_context_publish(&context, &client, "thincloud", 9, "message-1", 9), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_context_publish(&context, &client, "thincloud", 9, "message-2", 9), "%d");
+    ASSERT_EQ_FMT(LIMIT_EXCEEDED_ERROR, tc_context_publish(&context, &client, "thincloud", 9, "message-3", 9), "%d");
+    ASSERT_EQ(2, tc_outbox_count(&outbox));
+
+    // Contents survive reopening the file
+    tc_outbox_close(&outbox);
+    ASSERT_EQ_FMT(SUCCESS, tc_outbox_open(&outbox, path, 4096, false), "%d");
+    ASSERT_EQ(2, tc_outbox_count(&outbox));
+    ASSERT_EQ(104, outbox.state.capacity);
+
+    tc_outbox_record record;
+    ASSERT_EQ_FMT(SUCCESS, tc_outbox_peek(&outbox, &record, NULL), "%d");
+    ASSERT(TC_SLICE_EQUALS(record.payload, "message-1"));
+    ASSERT_EQ_FMT(SUCCESS, tc_outbox_pop(&outbox), "%d");
+
+    // The next record wraps to the start of the ring
+    ASSERT_EQ_FMT(SUCCESS, tc_outbox_append(&outbox, "thincloud", 9, "message-3", 9, QOS0), "%d");
+    ASSERT_EQ(2, tc_outbox_count(&outbox));
+
+    // Messages sent while older ones wait are queued behind them
+    client.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    ASSERT_EQ_FMT(LIMIT_EXCEEDED_ERROR, tc_context_publish(&context, &client, "thincloud", 9, "message-4", 9), "%d");
+
+    capturedLen = 0;
+    writes = 0;
+    ASSERT_EQ_FMT(SUCCESS, tc_outbox_drain(&outbox, &client), "%d");
+    ASSERT_EQ(0, tc_outbox_count(&outbox));
+    ASSERT_EQ(2, writes);
+
+    // Each packet is 2 + 2 + 9 + 9 = 22 bytes
+    ASSERT_EQ(44, capturedLen);
+    ASSERT_MEM_EQ("message-2", capturedBytes + 13, 9);
+    ASSERT_MEM_EQ("message-3", capturedBytes + 35, 9);
+
+    // With the outbox empty, messages go straight out
+    ASSERT_EQ_FMT(SUCCESS, tc_context_publish(&context, &client, "thincloud", 9, "message-4", 9), "%d");
+    ASSERT_EQ(3, writes);
+    ASSERT_EQ(0, tc_outbox_count(&outbox));
+
+    // A record that fails its CRC is reported as corrupt and the ring discarded
+    ASSERT_EQ_FMT(SUCCESS, tc_outbox_append(&outbox, "thincloud", 9, "message-5", 9, QOS0), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_outbox_peek(&outbox, &record, NULL), "%d");
+    ((char *)record.payload.data)[0] ^= 1;
+
+    bool corrupt = false;
+    ASSERT_EQ_FMT(FAILURE, tc_outbox_peek(&outbox, &record, &corrupt), "%d");
+    ASSERT(corrupt);
+    ASSERT_EQ_FMT(FAILURE, tc_context_drain(&context, &client), "%d");
+    ASSERT_EQ(0, tc_outbox_count(&outbox));
+    ASSERT_EQ(3, writes);
+
+    // So is a stale head too close to the end of the ring for a record header
+    ASSERT_EQ_FMT(SUCCESS, tc_outbox_append(&outbox, "thincloud", 9, "message-6", 9, QOS0), "%d");
+    const uint32_t staleLen = 40;
+    memcpy(outbox.ring + 96, &staleLen, 4);
+    outbox.state.head = 96;
+    ASSERT_EQ_FMT(FAILURE, tc_outbox_peek(&outbox, &record, &corrupt), "%d");
+    ASSERT(corrupt);
+    tc_outbox_clear(&outbox);
+
+    tc_context_free(&context);
+    tc_outbox_close(&outbox);
+    unlink(path);
+
+    PASS();
+}
+
+static unsigned char inboundBytes[64];
+static size_t inboundLen = 0;
+static size_t inboundPos = 0;
+
+static IoT_Error_t inbound_read(Network *network, unsigned char *data, size_t len, Timer *timer, size_t *read)
+{
+    (void)network;
+    (void)timer;
+
+    if (inboundPos == inboundLen)
+    {
+        return NETWORK_SSL_NOTHING_TO_READ;
+    }
+
+    memcpy(data, inboundBytes + inboundPos, len);
+    inboundPos += len;
+    *read = len;
+
+    return SUCCESS;
+}
+
+static IoT_Error_t acked[4];
+static int ackCount = 0;
+
+static void record_ack(AWS_IoT_Client *client, IoT_Error_t rc, uint16_t packetId, void *userData)
+{
+    (void)client;
+    (void)packetId;
+    (void)userData;
+
+    acked[ackCount++] = rc;
+}
+
+TEST should_ack_qos1_publishes_asynchronously(void)
+{
+    tc_inflight_client client;
+    memset(&client, 0, sizeof(client));
+    client.mqtt.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    client.mqtt.clientData.commandTimeoutMs = 1000;
+    client.mqtt.networkStack.write = capture_write;
+    client.mqtt.networkStack.read = inbound_read;
+
+    tc_timer_wheel wheel;
+    tc_timer_wheel_init(&wheel, tc_clock_ms());
+
+    unsigned char buffer[64];
+    tc_inflight inflight;
+    ASSERT_EQ_FMT(SUCCESS, tc_inflight_init(&inflight, buffer, sizeof(buffer), 2, &wheel, 100, 1), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_inflight_attach(&inflight, &client), "%d");
+    ASSERT_EQ_FMT(LIMIT_EXCEEDED_ERROR, tc_inflight_attach(&inflight, &client), "%d");
+
+    capturedLen = 0;
+    writes = 0;
+    ackCount = 0;
+
+    uint16_t first = 0;
+    uint16_t second = 0;
+    ASSERT_EQ_FMT(SUCCESS, tc_inflight_publish(&inflight, "thincloud", 9, "{}", 2, record_ack, NULL, &first), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_inflight_publish(&inflight, "thincloud", 9, "{}", 2, record_ack, NULL, &second), "%d");
+    ASSERT_EQ_FMT(LIMIT_EXCEEDED_ERROR, tc_inflight_publish(&inflight, "thincloud", 9, "{}", 2, record_ack, NULL, NULL), "%d");
+    ASSERT(first != second);
+    ASSERT_EQ(2, writes);
+
+    // Each packet is 2 + 2 + 9 + 2 + 2 = 17 bytes, with QoS1 set
+    ASSERT_EQ(34, capturedLen);
+    ASSERT_EQ(0x32, capturedBytes[0]);
+    ASSERT_EQ(first >> 8, capturedBytes[13]);
+    ASSERT_EQ(first & 0xFF, capturedBytes[14]);
+
+    // A PUBACK split across reads, between other packets, frees its slot
+    const unsigned char stream[] = {0xD0, 0x00, TC_MQTT_PUBACK, 0x02, (unsigned char)(first >> 8), (unsigned char)(first & 0xFF), 0x30, 0x03, 0x00, 0x01, 'a'};
+    memcpy(inboundBytes, stream, sizeof(stream));
+    inboundLen = sizeof(stream);
+    inboundPos = 0;
+
+    ASSERT_EQ_FMT(SUCCESS, aws_iot_mqtt_yield(&client.mqtt, 10), "%d");
+    ASSERT_EQ(1, ackCount);
+    ASSERT_EQ_FMT(SUCCESS, acked[0], "%d");
+    ASSERT_EQ(1, tc_inflight_count(&inflight));
+
+    // A late PUBACK is retransmitted once with DUP set, then the message fails
+    tc_timer_wheel_advance(&wheel, tc_clock_ms() + 100);
+    ASSERT_EQ(3, writes);
+    ASSERT_EQ(0x3A, capturedBytes[34]);
+
+    tc_timer_wheel_advance(&wheel, wheel.now + 100);
+    ASSERT_EQ(3, writes);
+    ASSERT_EQ(2, ackCount);
+    ASSERT_EQ_FMT(MQTT_REQUEST_TIMEOUT_ERROR, acked[1], "%d");
+    ASSERT_EQ(0, tc_inflight_count(&inflight));
+
+    // A CONNACK that resumes a session keeps outstanding messages, a clean one fails them
+    ASSERT_EQ_FMT(SUCCESS, tc_inflight_publish(&inflight, "thincloud", 9, "{}", 2, record_ack, NULL, NULL), "%d");
+    const unsigned char resumed[] = {TC_MQTT_CONNACK, 0x02, 0x01, 0x00};
+    tc_inflight_scan(&inflight, resumed, sizeof(resumed));
+    ASSERT_EQ(1, tc_inflight_count(&inflight));
+
+    const unsigned char clean[] = {TC_MQTT_CONNACK, 0x02, 0x00, 0x00};
+    tc_inflight_scan(&inflight, clean, sizeof(clean));
+    ASSERT_EQ(0, tc_inflight_count(&inflight));
+    ASSERT_EQ(3, ackCount);
+    ASSERT_EQ_FMT(NETWORK_DISCONNECTED_ERROR, acked[2], "%d");
+
+    tc_inflight_detach(&inflight);
+    ASSERT_EQ(inbound_read, client.mqtt.networkStack.read);
+    ASSERT_EQ(NULL, client.inflight);
+
+    PASS();
+}
+
+TEST should_send_client_qos1_through_window(void)
+{
+    static tc_client windowClient;
+    static tc_send sends[4];
+    ASSERT_EQ_FMT(SUCCESS, tc_client_init(&windowClient, sends, 4, "localhost", NULL, NULL, NULL, NULL, NULL), "%d");
+
+    windowClient.mqtt.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    windowClient.mqtt.clientData.commandTimeoutMs = 1000;
+    windowClient.mqtt.networkStack.write = capture_write;
+    windowClient.mqtt.networkStack.read = inbound_read;
+
+    unsigned char buffer[64];
+    tc_inflight inflight;
+    ASSERT_EQ_FMT(SUCCESS, tc_inflight_init(&inflight, buffer, sizeof(buffer), 2, &windowClient.context.timers, 100, 1), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_client_set_inflight(&windowClient, &inflight), "%d");
+    ASSERT_EQ(&windowClient.mqtt, inflight.client);
+
+    // A window attached elsewhere is refused
+    tc_inflight_client other;
+    memset(&other, 0, sizeof(other));
+    ASSERT_EQ_FMT(FAILURE, tc_context_set_inflight(&windowClient.context, &other.mqtt, &inflight), "%d");
+
+    capturedLen = 0;
+    writes = 0;
+
+    // Messages past the window stay queued until a PUBACK frees a slot
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT_EQ_FMT(SUCCESS, tc_client_publish(&windowClient, "thincloud", 9, "{}", 2, QOS1), "%d");
+    }
+    ASSERT_EQ(2, tc_client_flush(&windowClient));
+    ASSERT_EQ(2, writes);
+    ASSERT_EQ(2, tc_inflight_count(&inflight));
+    ASSERT_EQ(0x32, capturedBytes[0]);
+
+    const unsigned char puback[] = {TC_MQTT_PUBACK, 0x02, capturedBytes[13], capturedBytes[14]};
+    memcpy(inboundBytes, puback, sizeof(puback));
+    inboundLen = sizeof(puback);
+    inboundPos = 0;
+
+    ASSERT_EQ_FMT(SUCCESS, aws_iot_mqtt_yield(&windowClient.mqtt, 10), "%d");
+    ASSERT_EQ(1, tc_inflight_count(&inflight));
+    ASSERT_EQ(1, tc_client_flush(&windowClient));
+    ASSERT_EQ(3, writes);
+    ASSERT_EQ(2, tc_inflight_count(&inflight));
+
+    ASSERT_EQ_FMT(SUCCESS, tc_client_set_inflight(&windowClient, NULL), "%d");
+    ASSERT_EQ(inbound_read, windowClient.mqtt.networkStack.read);
+    ASSERT_EQ(NULL, windowClient.context.inflight);
+
+    tc_client_free(&windowClient);
+
+    PASS();
+}
+
+TEST should_keep_outbox_records_until_acked(void)
+{
+    char path[] = "/tmp/tc_outbox_XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT(fd >= 0);
+    close(fd);
+
+    tc_inflight_client client;
+    memset(&client, 0, sizeof(client));
+    client.mqtt.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    client.mqtt.clientData.commandTimeoutMs = 1000;
+    client.mqtt.networkStack.write = capture_write;
+    client.mqtt.networkStack.read = inbound_read;
+
+    tc_outbox outbox;
+    ASSERT_EQ_FMT(SUCCESS, tc_outbox_open(&outbox, path, 4096, false), "%d");
+
+    tc_context context;
+    tc_context_init(&context);
+    tc_context_set_outbox(&context, &outbox);
+
+    unsigned char buffer[64];
+    tc_inflight inflight;
+    ASSERT_EQ_FMT(SUCCESS, tc_inflight_init(&inflight, buffer, sizeof(buffer), 2, NULL, 100, 1), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_inflight_attach(&inflight, &client), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_context_set_inflight(&context, &client.mqtt, &inflight), "%d");
+
+    capturedLen = 0;
+    writes = 0;
+
+    // Each packet is 2 + 2 + 9 + 2 + 9 = 24 bytes, the packet ID at 13
+    ASSERT_EQ_FMT(SUCCESS, tc_context_publish_qos(&context, &client.mqtt, "thincloud", 9, "message-1", 9, QOS1), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_context_publish_qos(&context, &client.mqtt, "thincloud", 9, "message-2", 9, QOS1), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_context_publish_qos(&context, &client.mqtt, "thincloud", 9, "message-3", 9, QOS1), "%d");
+    ASSERT_EQ(2, writes);
+    ASSERT_EQ(3, tc_outbox_count(&outbox));
+    ASSERT(tc_context_draining(&context, &client.mqtt) == false);
+
+    // A PUBACK ahead of the head marks its record, which stays behind the head
+    const unsigned char second[] = {TC_MQTT_PUBACK, 0x02, capturedBytes[24 + 13], capturedBytes[24 + 14]};
+    memcpy(inboundBytes, second, sizeof(second));
+    inboundLen = sizeof(second);
+    inboundPos = 0;
+
+    ASSERT_EQ_FMT(SUCCESS, aws_iot_mqtt_yield(&client.mqtt, 10), "%d");
+    ASSERT_EQ(3, tc_outbox_count(&outbox));
+    ASSERT(tc_context_draining(&context, &client.mqtt));
+    ASSERT_EQ_FMT(SUCCESS, tc_context_drain(&context, &client.mqtt), "%d");
+    ASSERT_EQ(3, writes);
+    ASSERT_MEM_EQ("message-3", capturedBytes + 48 + 15, 9);
+
+    // A clean session fails what was outstanding without losing it
+    const unsigned char clean[] = {TC_MQTT_CONNACK, 0x02, 0x00, 0x00};
+    tc_inflight_scan(&inflight, clean, sizeof(clean));
+    ASSERT_EQ(0, tc_inflight_count(&inflight));
+    ASSERT_EQ(3, tc_outbox_count(&outbox));
+
+    capturedLen = 0;
+    ASSERT_EQ_FMT(SUCCESS, tc_context_drain(&context, &client.mqtt), "%d");
+    ASSERT_EQ(5, writes);
+    ASSERT_MEM_EQ("message-1", capturedBytes + 15, 9);
+    ASSERT_MEM_EQ("message-2", capturedBytes + 24 + 15, 9);
+
+    // Records are popped once every record ahead of them is acknowledged
+    const unsigned char both[] = {TC_MQTT_PUBACK, 0x02, capturedBytes[24 + 13], capturedBytes[24 + 14],
+                                  TC_MQTT_PUBACK, 0x02, capturedBytes[13], capturedBytes[14]};
+    memcpy(inboundBytes, both, sizeof(both));
+    inboundLen = sizeof(both);
+    inboundPos = 0;
+
+    ASSERT_EQ_FMT(SUCCESS, aws_iot_mqtt_yield(&client.mqtt, 10), "%d");
+    ASSERT_EQ(1, tc_outbox_count(&outbox));
+
+    capturedLen = 0;
+    ASSERT_EQ_FMT(SUCCESS, tc_context_drain(&context, &client.mqtt), "%d");
+    ASSERT_EQ(6, writes);
+    ASSERT_MEM_EQ("message-3", capturedBytes + 15, 9);
+
+    const unsigned char third[] = {TC_MQTT_PUBACK, 0x02, capturedBytes[13], capturedBytes[14]};
+    memcpy(inboundBytes, third, sizeof(third));
+    inboundLen = sizeof(third);
+    inboundPos = 0;
+
+    ASSERT_EQ_FMT(SUCCESS, aws_iot_mqtt_yield(&client.mqtt, 10), "%d");
+    ASSERT_EQ(0, tc_outbox_count(&outbox));
+    ASSERT(tc_context_draining(&context, &client.mqtt) == false);
+
+    tc_inflight_detach(&inflight);
+    tc_context_free(&context);
+    tc_outbox_close(&outbox);
+    unlink(path);
+
+    PASS();
+}
+
+#define PRODUCERS 4
+#define PRODUCER_SENDS 1000
+
+static uint32_t lastSequence[PRODUCERS];
+static uint32_t outOfOrder = 0;
+static uint32_t delivered = 0;
+
+static IoT_Error_t sequence_write(Network *network, unsigned char *data, size_t len, Timer *timer, size_t *sent)
+{
+    (void)network;
+    (void)timer;
+
+    // Payload is the producer followed by its sequence number
+    const unsigned char *payload = data + len - 5;
+    uint32_t sequence = 0;
+    memcpy(&sequence, payload + 1, sizeof(sequence));
+
+    if (sequence != lastSequence[payload[0]] + 1)
+    {
+        outOfOrder++;
+    }
+    lastSequence[payload[0]] = sequence;
+    delivered++;
+    *sent = len;
+
+    return SUCCESS;
+}
+
+static tc_client queueClient;
+
+static void *produce(void *arg)
+{
+    unsigned char payload[5] = {(unsigned char)(uintptr_t)arg};
+
+    for (uint32_t sequence = 1; sequence <= PRODUCER_SENDS; sequence++)
+    {
+        memcpy(payload + 1, &sequence, sizeof(sequence));
+        while (tc_client_publish(&queueClient, "thincloud", 9, (const char *)payload, sizeof(payload), QOS0) == LIMIT_EXCEEDED_ERROR)
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+TEST should_queue_sends_from_any_thread(void)
+{
+    static tc_send sends[16];
+    ASSERT_EQ_FMT(SUCCESS, tc_client_init(&queueClient, sends, 16, "localhost", NULL, NULL, NULL, NULL, NULL), "%d");
+    ASSERT_EQ_FMT(MAX_SIZE_ERROR, tc_queue_init(&queueClient.sends, &sends->cell, sizeof(tc_send), 12), "%d");
+
+    queueClient.mqtt.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    queueClient.mqtt.clientData.commandTimeoutMs = 1000;
+    queueClient.mqtt.networkStack.write = capture_write;
+
+    capturedLen = 0;
+    writes = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        ASSERT_EQ_FMT(SUCCESS, tc_client_publish(&queueClient, "thincloud", 9, "{}", 2, QOS0), "%d");
+    }
+    ASSERT_EQ_FMT(LIMIT_EXCEEDED_ERROR, tc_client_publish(&queueClient, "thincloud", 9, "{}", 2, QOS0), "%d");
+
+    // A failed send gives its slot back without publishing anything
+    ASSERT_EQ(16, tc_client_flush(&queueClient));
+    ASSERT_EQ_FMT(NULL_VALUE_ERROR, tc_client_send_command_response(NULL, "device", "command", 200, false, NULL, NULL, QOS0), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_client_send_command_response(&queueClient, "device", "command", 200, false, NULL, NULL, QOS0), "%d");
+    ASSERT_EQ_FMT(NULL_VALUE_ERROR, tc_client_send_service_request(&queueClient, "request", NULL, "GET", NULL, QOS0), "%d");
+    ASSERT_EQ_FMT(NULL_VALUE_ERROR, tc_client_subscribe_to_command_request(NULL, "device", NULL, NULL, QOS0), "%d");
+    ASSERT_EQ_FMT(NULL_VALUE_ERROR, tc_client_subscribe_to_service_response(NULL, "device", "request", NULL, NULL, QOS0), "%d");
+    ASSERT_EQ_FMT(NULL_VALUE_ERROR, tc_client_subscribe_to_commissioning_response(NULL, "request", "lock", "123456", NULL, NULL, QOS0), "%d");
+    ASSERT_EQ(1, tc_client_flush(&queueClient));
+    ASSERT_EQ(17, writes);
+    ASSERT_MEM_EQ("thincloud/devices/device/command/command/response", capturedBytes + 16 * 15 + 4, 49);
+
+    // Once a later slot is reserved, a failed one is committed empty and skipped
+    size_t failed = 0;
+    size_t later = 0;
+    ASSERT(tc_queue_reserve(&queueClient.sends, &failed));
+    ASSERT(tc_queue_reserve(&queueClient.sends, &later));
+    ASSERT_FALSE(tc_queue_cancel(&queueClient.sends, failed));
+    tc_client_discard(&queueClient, failed);
+    ASSERT(tc_queue_cancel(&queueClient.sends, later));
+    ASSERT_EQ(0, tc_client_flush(&queueClient));
+    ASSERT_EQ(17, writes);
+
+    // Messages from each producer are sent in the order they were queued
+    queueClient.mqtt.networkStack.write = sequence_write;
+    memset(lastSequence, 0, sizeof(lastSequence));
+    outOfOrder = 0;
+    delivered = 0;
+
+    pthread_t producers[PRODUCERS];
+    for (uintptr_t i = 0; i < PRODUCERS; i++)
+    {
+        pthread_create(&producers[i], NULL, produce, (void *)i);
+    }
+
+    while (delivered < PRODUCERS * PRODUCER_SENDS)
+    {
+        tc_client_flush(&queueClient);
+    }
+
+    for (int i = 0; i < PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+
+    ASSERT_EQ(0, outOfOrder);
+    ASSERT_EQ(PRODUCERS * PRODUCER_SENDS, delivered);
+
+    tc_client_free(&queueClient);
+
+    PASS();
+}
+
+static sem_t sendWritten;
+
+static IoT_Error_t signal_write(Network *network, unsigned char *data, size_t len, Timer *timer, size_t *sent)
+{
+    IoT_Error_t rc = capture_write(network, data, len, timer, sent);
+    sem_post(&sendWritten);
+
+    return rc;
+}
+
+static void *run_client(void *data)
+{
+    return (void *)(intptr_t)tc_run((tc_client *)data);
+}
+
+TEST should_run_until_next_deadline(void)
+{
+    tc_timer_wheel wheel;
+    tc_timer timer;
+    tc_timer_wheel_init(&wheel, 1000);
+    tc_timer_init(&timer, NULL, NULL);
+
+    ASSERT_EQ(UINT64_MAX, tc_timer_wheel_next(&wheel));
+    tc_timer_schedule(&wheel, &timer, 1005);
+    ASSERT_EQ(1005, tc_timer_wheel_next(&wheel));
+
+    // Later timers report when their slot cascades
+    tc_timer_schedule(&wheel, &timer, 1300);
+    ASSERT_EQ(1280, tc_timer_wheel_next(&wheel));
+
+    static tc_send sends[4];
+    ASSERT_EQ_FMT(SUCCESS, tc_client_init(&queueClient, sends, 4, "localhost", NULL, NULL, NULL, NULL, NULL), "%d");
+
+    queueClient.mqtt.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    queueClient.mqtt.clientData.commandTimeoutMs = 1000;
+    queueClient.mqtt.networkStack.tlsDataParams.server_fd.fd = -1;
+    queueClient.mqtt.networkStack.write = signal_write;
+
+    // Nothing is due, so tc_run sleeps until woken
+    ASSERT_EQ(UINT32_MAX, tc_client_next_timeout(&queueClient));
+
+    capturedLen = 0;
+    writes = 0;
+    sem_init(&sendWritten, 0, 0);
+
+    pthread_t runner;
+    pthread_create(&runner, NULL, run_client, &queueClient);
+
+    // A send from another thread wakes the loop
+    ASSERT_EQ_FMT(SUCCESS, tc_client_publish(&queueClient, "thincloud", 9, "{}", 2, QOS0), "%d");
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 5;
+    ASSERT_EQ(0, sem_timedwait(&sendWritten, &deadline));
+
+    tc_stop(&queueClient);
+
+    void *result = NULL;
+    pthread_join(runner, &result);
+    ASSERT_EQ_FMT(SUCCESS, (IoT_Error_t)(intptr_t)result, "%d");
+    ASSERT_EQ(1, writes);
+
+    sem_destroy(&sendWritten);
+    tc_client_free(&queueClient);
+
+    PASS();
+}
+
+static tc_gateway_device gatewayDevices[64];
+static char lastGatewayDevice[TC_ID_LENGTH];
+
+static void respond_gateway_command(AWS_IoT_Client *client, tc_gateway_device *device, const tc_command_request_view *request, void *userData)
+{
+    const tc_slice deviceId = tc_gateway_device_id(device);
+    memcpy(lastGatewayDevice, deviceId.data, deviceId.len);
+    lastGatewayDevice[deviceId.len] = '\0';
+
+    char commandId[TC_ID_LENGTH];
+    memcpy(commandId, request->requestId.data, request->requestId.len);
+    commandId[request->requestId.len] = '\0';
+
+    *(int *)userData += 1;
+    tc_gateway_send_command_response(NULL, client, device, commandId, 200, false, NULL, NULL, QOS0);
+}
+
+TEST should_route_gateway_commands_by_device(void)
+{
+    tc_gateway gateway;
+    ASSERT_EQ_FMT(MAX_SIZE_ERROR, tc_gateway_init(&gateway, gatewayDevices, 48), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_gateway_init(&gateway, gatewayDevices, 64), "%d");
+
+    int handled = 0;
+    char deviceId[TC_ID_LENGTH];
+
+    // Three quarters of the slots can be used
+    for (int i = 0; i < 48; i++)
+    {
+        snprintf(deviceId, sizeof(deviceId), "child-%d", i);
+        ASSERT_EQ_FMT(SUCCESS, tc_gateway_register(&gateway, deviceId, respond_gateway_command, &handled, NULL), "%d");
+    }
+    ASSERT_EQ_FMT(LIMIT_EXCEEDED_ERROR, tc_gateway_register(&gateway, "child-48", respond_gateway_command, &handled, NULL), "%d");
+    ASSERT_EQ(48, tc_gateway_count(&gateway));
+
+    for (int i = 0; i < 48; i += 2)
+    {
+        snprintf(deviceId, sizeof(deviceId), "child-%d", i);
+        tc_gateway_device *device = tc_gateway_find(&gateway, (tc_slice){deviceId, strlen(deviceId)});
+        ASSERT(device != NULL);
+        tc_gateway_unregister(&gateway, device);
+    }
+    ASSERT_EQ(24, tc_gateway_count(&gateway));
+    ASSERT_EQ_FMT(FAILURE, tc_gateway_register(&gateway, "child-47", respond_gateway_command, &handled, NULL), "%d");
+
+    // Removals keep the remaining probe sequences intact
+    for (int i = 0; i < 48; i++)
+    {
+        snprintf(deviceId, sizeof(deviceId), "child-%d", i);
+        ASSERT_EQ(i % 2 == 1, tc_gateway_find(&gateway, (tc_slice){deviceId, strlen(deviceId)}) != NULL);
+    }
+
+    tc_dispatcher dispatcher;
+    ASSERT_EQ(SUCCESS, tc_dispatcher_init(&dispatcher));
+    const char *filter = "thincloud/devices/+/command";
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&dispatcher.trie, filter, strlen(filter), TC_ROUTE_GATEWAY_COMMAND));
+    dispatcher.gateway = &gateway;
+
+    // The gateway's own commands keep their route next to the wildcard
+    filter = "thincloud/devices/123456/command";
+    ASSERT_EQ(SUCCESS, tc_topic_trie_insert(&dispatcher.trie, filter, strlen(filter), TC_ROUTE_COMMAND_REQUEST));
+    dispatcher.onCommandRequest = count_command_request;
+    dispatchedCommands = 0;
+
+    AWS_IoT_Client client;
+    memset(&client, 0, sizeof(client));
+    client.clientStatus.clientState = CLIENT_STATE_CONNECTED_IDLE;
+    client.clientData.commandTimeoutMs = 1000;
+    client.networkStack.write = capture_write;
+
+    capturedLen = 0;
+    writes = 0;
+
+    const char *topic = "thincloud/devices/child-17/command";
+    const char *request = "{\"id\":\"1234\",\"method\":\"startRoutine\",\"params\":[]}";
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatch(&dispatcher, &client, topic, strlen(topic), request, strlen(request)), "%d");
+    ASSERT_EQ(1, handled);
+    ASSERT_STR_EQ("child-17", lastGatewayDevice);
+    ASSERT_EQ(1, writes);
+    ASSERT_MEM_EQ("thincloud/devices/child-17/command/1234/response", capturedBytes + 4, 47);
+
+    topic = "thincloud/devices/child-16/command";
+    ASSERT_EQ_FMT(INVALID_TOPIC_TYPE_ERROR, tc_dispatch(&dispatcher, &client, topic, strlen(topic), request, strlen(request)), "%d");
+    ASSERT_EQ(1, handled);
+
+    topic = "thincloud/devices/123456/command";
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatch(&dispatcher, &client, topic, strlen(topic), request, strlen(request)), "%d");
+    ASSERT_EQ(1, dispatchedCommands);
+    ASSERT_EQ(1, handled);
+
+    PASS();
+}
+
+TEST should_write_nested_json(void)
+{
+    char buffer[128];
+    tc_json_writer writer;
+    tc_json_writer_init(&writer, buffer, sizeof(buffer));
+
+    tc_json_begin_object(&writer);
+    tc_json_key(&writer, "a");
+    tc_json_begin_array(&writer);
+    tc_json_int(&writer, -12);
+    tc_json_bool(&writer, true);
+    tc_json_null(&writer);
+    tc_json_string(&writer, "q\"\n");
+    tc_json_end_array(&writer);
+    tc_json_key(&writer, "b");
+    tc_json_begin_object(&writer);
+    tc_json_end_object(&writer);
+    tc_json_end_object(&writer);
+
+    ASSERT_EQ_FMT(SUCCESS, tc_json_writer_finish(&writer), "%d");
+    ASSERT_STR_EQ("{\"a\":[-12,true,null,\"q\\\"\\n\"],\"b\":{}}", buffer);
+
+    PASS();
+}
+
+TEST should_report_size_needed_on_overflow(void)
+{
+    char buffer[8];
+    tc_json_writer writer;
+    tc_json_writer_init(&writer, buffer, sizeof(buffer));
+
+    tc_json_begin_object(&writer);
+    tc_json_key(&writer, "method");
+    tc_json_string(&writer, "commission");
+    tc_json_end_object(&writer);
+
+    ASSERT_EQ_FMT(MAX_SIZE_ERROR, tc_json_writer_finish(&writer), "%d");
+    ASSERT_EQ(strlen("{\"method\":\"commission\"}"), writer.length);
+
+    PASS();
+}
+
+TEST should_write_shortest_round_trip_doubles(void)
+{
+    char buffer[128];
+    tc_json_writer writer;
+    tc_json_writer_init(&writer, buffer, sizeof(buffer));
+
+    tc_json_begin_array(&writer);
+    tc_json_double(&writer, 0.1);
+    tc_json_double(&writer, 1.0 / 3.0);
+    tc_json_double(&writer, -2.0);
+    tc_json_double(&writer, 1e300);
+    tc_json_end_array(&writer);
+
+    ASSERT_EQ_FMT(SUCCESS, tc_json_writer_finish(&writer), "%d");
+    ASSERT_STR_EQ("[0.1,0.3333333333333333,-2.0,1e+300]", buffer);
+
+    // Decimal commas from the locale never reach the output
+    if (setlocale(LC_NUMERIC, "de_DE.UTF-8") != NULL)
+    {
+        tc_json_writer_init(&writer, buffer, sizeof(buffer));
+        tc_json_double(&writer, 2.5);
+        setlocale(LC_NUMERIC, "C");
+
+        ASSERT_EQ_FMT(SUCCESS, tc_json_writer_finish(&writer), "%d");
+        ASSERT_STR_EQ("2.5", buffer);
+    }
+
+    tc_json_writer_init(&writer, NULL, 0);
+    ASSERT_EQ_FMT(SUCCESS, tc_json_writer_finish(&writer), "%d");
+
+    tc_json_writer_init(&writer, NULL, 0);
+    tc_json_double(&writer, 0.5);
+    ASSERT_EQ_FMT(MAX_SIZE_ERROR, tc_json_writer_finish(&writer), "%d");
+    ASSERT_EQ(3, writer.length);
+
+    PASS();
+}
+
+TEST should_report_bounded_message_length(void)
+{
+    char buffer[256];
+    size_t written = 0;
+
+    const char *expectedStr = "{\"id\":\"1234\",\"method\":\"GET\"}";
+
+    IoT_Error_t rc = service_request_n(buffer, sizeof(buffer), "1234", REQUEST_METHOD_GET, NULL, &written);
+
+    ASSERT_EQ(SUCCESS, rc);
+    ASSERT_STR_EQ(expectedStr, buffer);
+    ASSERT_EQ(strlen(expectedStr), written);
+
+    rc = service_request_n(buffer, 10, "1234", REQUEST_METHOD_GET, NULL, &written);
+
+    ASSERT_EQ(MAX_SIZE_ERROR, rc);
+    ASSERT_EQ(strlen(expectedStr), written);
+
+    rc = commissioning_request_n(NULL, 0, "1234", "lock", "5678", NULL, 0, &written);
+
+    ASSERT_EQ(MAX_SIZE_ERROR, rc);
+    ASSERT_EQ(strlen("{\"id\":\"1234\",\"method\":\"commission\",\"params\":[{\"data\":{\"deviceType\":\"lock\",\"physicalId\":\"5678\"}}]}"), written);
+
+    PASS();
+}
+
+TEST should_build_command_error_response(void)
+{
+    char buffer[256];
+
+    IoT_Error_t rc = command_response(buffer, "1234", 500, true, "failed", NULL);
+
+    const char *expectedStr = "{\"id\":\"1234\",\"error\":{\"statusCode\":500,\"message\":\"failed\"}}";
+
+    ASSERT_STR_EQ(expectedStr, buffer);
+    ASSERT_EQ(SUCCESS, rc);
+
+    PASS();
+}
+
+TEST should_skip_values_with_each_scan_kernel(void)
+{
+    const struct
+    {
+        const char *json;
+        IoT_Error_t rc;
+        size_t skipped;
+    } cases[] = {
+        {"{\"a\":[1,-2.5e3,true,false,null],\"b\":{}} ,", SUCCESS, 39},
+        {"[ \"}]\\\\\" , \"\\\"\" , [ ] , { \"k\" : \"v\" } ]x", SUCCESS, 39},
+        {"[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]", JSON_PARSE_ERROR, 0},
+        {"{\"a\":\"tab\there\"}", JSON_PARSE_ERROR, 0},
+        {"{\"a\":\"\\\"}", JSON_PARSE_ERROR, 0},
+        {"[1x]", JSON_PARSE_ERROR, 0},
+        {"[1 2]", JSON_PARSE_ERROR, 0},
+        {"[\"a\" \"b\"]", JSON_PARSE_ERROR, 0},
+        {"{\"a\" 1}", JSON_PARSE_ERROR, 0},
+        {"{\"a\":1,}", JSON_PARSE_ERROR, 0},
+        {"[1,]", JSON_PARSE_ERROR, 0},
+        {"[}", JSON_PARSE_ERROR, 0},
+        {"[tru]", JSON_PARSE_ERROR, 0},
+        {"[\"a\"", JSON_PARSE_ERROR, 0},
+    };
+
+    char json[256];
+
+    for (int isa = TC_SCAN_SCALAR; isa <= TC_SCAN_AVX2; isa++)
+    {
+        tc_scan_set_max_isa((tc_scan_isa)isa);
+
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        {
+            // Move each case across a block boundary
+            for (size_t padding = 0; padding <= TC_SCAN_BLOCK; padding++)
+            {
+                const size_t len = strlen(cases[i].json);
+                memset(json, ' ', padding);
+                memcpy(json + padding, cases[i].json, len);
+
+                tc_json_reader reader;
+                tc_json_reader_init(&reader, json, padding + len);
+
+                ASSERT_EQ_FMT(cases[i].rc, tc_json_skip_value(&reader, 0), "%d");
+                if (cases[i].rc == SUCCESS)
+                {
+                    ASSERT_EQ(padding + cases[i].skipped, (size_t)(reader.cursor - json));
+                }
+            }
+        }
+    }
+
+    tc_scan_set_max_isa(TC_SCAN_AVX2);
+
+    PASS();
+}
+
+TEST should_build_cbor_command_response(void)
+{
+    char buffer[256];
+    size_t written = 0;
+
+    IoT_Error_t rc = command_response_cbor_n(buffer, sizeof(buffer), "1", 200, false, NULL, NULL, &written);
+
+    // {"id":"1","result":{"statusCode":200}}
+    const unsigned char expected[] = {0xa2, 0x62, 'i', 'd', 0x61, '1', 0x66, 'r', 'e', 's', 'u', 'l', 't', 0xa1,
+                                      0x6a, 's', 't', 'a', 't', 'u', 's', 'C', 'o', 'd', 'e', 0x18, 0xc8};
+
+    ASSERT_EQ(SUCCESS, rc);
+    ASSERT_EQ(sizeof(expected), written);
+    ASSERT_MEM_EQ(expected, buffer, sizeof(expected));
+
+    rc = command_response_cbor_n(buffer, 8, "1", 200, false, NULL, NULL, &written);
+
+    ASSERT_EQ(MAX_SIZE_ERROR, rc);
+    ASSERT_EQ(sizeof(expected), written);
+
+    size_t jsonWritten = 0;
+    commissioning_request_n(buffer, sizeof(buffer), "1234", "lock", "5678", NULL, 0, &jsonWritten);
+    rc = commissioning_request_cbor_n(buffer, sizeof(buffer), "1234", "lock", "5678", NULL, 0, &written);
+
+    ASSERT_EQ(SUCCESS, rc);
+    ASSERT(written < jsonWritten);
+
+    PASS();
+}
+
+TEST should_read_cbor_messages(void)
+{
+    char payload[256];
+    tc_cbor_writer writer;
+    tc_cbor_writer_init(&writer, payload, sizeof(payload));
+
+    // {"id":"1234","method":"setLevel","params":[{"level":-40,"ramp":1.5,"on":true,"scene":null}]}
+    tc_cbor_begin_map(&writer, 3);
+    tc_cbor_string(&writer, "id");
+    tc_cbor_string(&writer, "1234");
+    tc_cbor_string(&writer, "method");
+    tc_cbor_string(&writer, "setLevel");
+    tc_cbor_string(&writer, "params");
+    tc_cbor_begin_array(&writer, 1);
+    tc_cbor_begin_map(&writer, 4);
+    tc_cbor_string(&writer, "level");
+    tc_cbor_int(&writer, -40);
+    tc_cbor_string(&writer, "ramp");
+    tc_cbor_double(&writer, 1.5);
+    tc_cbor_string(&writer, "on");
+    tc_cbor_bool(&writer, true);
+    tc_cbor_string(&writer, "scene");
+    tc_cbor_null(&writer);
+    ASSERT_EQ_FMT(SUCCESS, tc_cbor_writer_finish(&writer), "%d");
+
+    tc_context context;
+    tc_context_init(&context);
+    tc_context_set_format(&context, TC_FORMAT_CBOR);
+
+    char requestId[TC_ID_LENGTH];
+    char method[16];
+    json_object *params = NULL;
+
+    IoT_Error_t rc = command_request_ctx(&context, requestId, method, &params, payload, (unsigned int)writer.length);
+
+    ASSERT_EQ_FMT(SUCCESS, rc, "%d");
+    ASSERT_STR_EQ("1234", requestId);
+    ASSERT_STR_EQ("setLevel", method);
+    ASSERT_STR_EQ("[{\"level\":-40,\"ramp\":1.5,\"on\":true,\"scene\":null}]", json_object_to_json_string_ext(params, JSON_C_TO_STRING_PLAIN));
+    json_object_put(params);
+
+    // Truncated anywhere, the payload is rejected
+    tc_command_request_view view;
+    for (size_t len = 1; len < writer.length; len++)
+    {
+        ASSERT_EQ_FMT(JSON_PARSE_ERROR, command_request_cbor_view(&view, payload, len), "%d");
+    }
+
+    // An indefinite-length service response with a tagged status code
+    const unsigned char response[] = {0xbf, 0x62, 'i', 'd', 0x61, '7', 0x66, 'r', 'e', 's', 'u', 'l', 't', 0xa2,
+                                      0x6a, 's', 't', 'a', 't', 'u', 's', 'C', 'o', 'd', 'e', 0xc1, 0x19, 0x01, 0x94,
+                                      0x64, 'b', 'o', 'd', 'y', 0x9f, 0xf9, 0x3e, 0x00, 0xff, 0xff};
+
+    tc_dispatcher dispatcher;
+    tc_dispatcher_init(&dispatcher);
+    tc_dispatcher_set_format(&dispatcher, TC_FORMAT_CBOR);
+
+    tc_service_response_view serviceView;
+    rc = tc_unmarshal_service_response(dispatcher.format, &serviceView, (const char *)response, sizeof(response));
+
+    ASSERT_EQ_FMT(SUCCESS, rc, "%d");
+    ASSERT(TC_SLICE_EQUALS(serviceView.requestId, "7"));
+    ASSERT_EQ(404, serviceView.statusCode);
+
+    json_object *body = NULL;
+    ASSERT_EQ_FMT(SUCCESS, tc_context_parse_value(&context, serviceView.body, &body), "%d");
+    ASSERT_STR_EQ("[1.5]", json_object_to_json_string_ext(body, JSON_C_TO_STRING_PLAIN));
+    json_object_put(body);
+
+    tc_context_free(&context);
+
+    PASS();
+}
+
+static tc_broker rawBroker;
+
+static IoT_Error_t raw_send(Network *network, const unsigned char *packet, size_t len)
+{
+    Timer timer;
+    size_t written = 0;
+    countdown_ms(&timer, 1000);
+
+    return tc_socket_write(network, (unsigned char *)packet, len, &timer, &written);
+}
+
+static bool raw_expect(Network *network, const unsigned char *expected, size_t len)
+{
+    unsigned char received[64];
+    Timer timer;
+    size_t read = 0;
+    countdown_ms(&timer, 1000);
+
+    return tc_socket_read(network, received, len, &timer, &read) == SUCCESS && memcmp(received, expected, len) == 0;
+}
+
+static bool raw_connect(Network *network, const unsigned char *connect, size_t len)
+{
+    memset(network, 0, sizeof(*network));
+    tc_broker_network_init(network);
+    network->tlsConnectParams.pDestinationURL = tc_broker_address(&rawBroker);
+
+    return tc_socket_connect(network, NULL) == SUCCESS && raw_send(network, connect, len) == SUCCESS;
+}
+
+TEST should_speak_mqtt_to_loopback_broker(void)
+{
+    const unsigned char connect[] = {TC_MQTT_CONNECT, 15, 0, 4, 'M', 'Q', 'T', 'T', 4, 2, 0, 60, 0, 3, 'r', 'a', 'w'};
+    const unsigned char connack[] = {TC_MQTT_CONNACK, 2, 0, 0};
+
+    // The second filter overlaps the first and the third is invalid
+    const unsigned char subscribe[] = {TC_MQTT_SUBSCRIBE | 0x02, 24, 0, 1, 0, 5, 'a', '/', '+', '/', 'c', 1, 0, 3, 'a', '/', '#', 0, 0, 5, 'a', '/', '#', '/', 'c', 0};
+    const unsigned char suback[] = {TC_MQTT_SUBACK, 5, 0, 1, 1, 0, 0x80};
+
+    // Delivered once, at the higher QoS of the two matching subscriptions
+    const unsigned char publish[] = {TC_MQTT_PUBLISH | TC_MQTT_PUBLISH_QOS1, 11, 0, 5, 'a', '/', 'b', '/', 'c', 0, 7, 'h', 'i'};
+    const unsigned char puback[] = {TC_MQTT_PUBACK, 2, 0, 7};
+    const unsigned char forwarded[] = {TC_MQTT_PUBLISH | TC_MQTT_PUBLISH_QOS1, 11, 0, 5, 'a', '/', 'b', '/', 'c', 0, 1, 'h', 'i'};
+
+    const unsigned char publishQos0[] = {TC_MQTT_PUBLISH, 6, 0, 3, 'a', '/', 'x', 'y'};
+    const unsigned char pingreq[] = {TC_MQTT_PINGREQ, 0};
+    const unsigned char pingresp[] = {TC_MQTT_PINGRESP, 0};
+    const unsigned char unsubscribe[] = {TC_MQTT_UNSUBSCRIBE | 0x02, 7, 0, 2, 0, 3, 'a', '/', '#'};
+    const unsigned char unsuback[] = {TC_MQTT_UNSUBACK, 2, 0, 2};
+    const unsigned char fromBroker[] = {TC_MQTT_PUBLISH, 8, 0, 5, 'a', '/', 'b', '/', 'c', '!'};
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/tc_broker_%d.sock", (int)getpid());
+
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_init(&rawBroker), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_listen_unix(&rawBroker, path), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_start(&rawBroker), "%d");
+
+    Network raw;
+    ASSERT(raw_connect(&raw, connect, sizeof(connect)));
+    ASSERT(raw_expect(&raw, connack, sizeof(connack)));
+
+    ASSERT_EQ_FMT(SUCCESS, raw_send(&raw, subscribe, sizeof(subscribe)), "%d");
+    ASSERT(raw_expect(&raw, suback, sizeof(suback)));
+
+    ASSERT_EQ_FMT(SUCCESS, raw_send(&raw, publish, sizeof(publish)), "%d");
+    ASSERT(raw_expect(&raw, puback, sizeof(puback)));
+    ASSERT(raw_expect(&raw, forwarded, sizeof(forwarded)));
+
+    ASSERT_EQ_FMT(SUCCESS, raw_send(&raw, publishQos0, sizeof(publishQos0)), "%d");
+    ASSERT(raw_expect(&raw, publishQos0, sizeof(publishQos0)));
+
+    ASSERT_EQ_FMT(SUCCESS, raw_send(&raw, pingreq, sizeof(pingreq)), "%d");
+    ASSERT(raw_expect(&raw, pingresp, sizeof(pingresp)));
+
+    // Once unsubscribed nothing arrives ahead of the next PINGRESP
+    ASSERT_EQ_FMT(SUCCESS, raw_send(&raw, unsubscribe, sizeof(unsubscribe)), "%d");
+    ASSERT(raw_expect(&raw, unsuback, sizeof(unsuback)));
+    ASSERT_EQ_FMT(SUCCESS, raw_send(&raw, publishQos0, sizeof(publishQos0)), "%d");
+    ASSERT_EQ_FMT(SUCCESS, raw_send(&raw, pingreq, sizeof(pingreq)), "%d");
+    ASSERT(raw_expect(&raw, pingresp, sizeof(pingresp)));
+
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_publish(&rawBroker, "a/b/c", 5, "!", 1, QOS0), "%d");
+    ASSERT(raw_expect(&raw, fromBroker, sizeof(fromBroker)));
+
+    // MQTT 3.1 is refused and the connection closed
+    const unsigned char connectV3[] = {TC_MQTT_CONNECT, 17, 0, 6, 'M', 'Q', 'I', 's', 'd', 'p', 3, 2, 0, 60, 0, 3, 'o', 'l', 'd'};
+    const unsigned char refused[] = {TC_MQTT_CONNACK, 2, 0, 1};
+    Network old;
+    ASSERT(raw_connect(&old, connectV3, sizeof(connectV3)));
+    ASSERT(raw_expect(&old, refused, sizeof(refused)));
+    ASSERT_FALSE(raw_expect(&old, pingresp, 1));
+
+    tc_socket_disconnect(&old);
+    tc_socket_disconnect(&raw);
+    tc_broker_stop(&rawBroker);
+
+    ASSERT_EQ(-1, access(path, F_OK));
+
+    PASS();
+}
+
+static tc_broker loopbackBroker;
+static AWS_IoT_Client loopbackClient;
+static tc_dispatcher loopbackDispatcher;
+static char commissionedId[TC_ID_LENGTH];
+static char serviceBody[64];
+static char commandResponse[TC_MAX_PAYLOAD_LENGTH];
+static sem_t commandResponded;
+static uint16_t loopbackStatus = 0;
+static int loopbackMessages = 0;
+
+static void record_commissioning(AWS_IoT_Client *client, tc_slice registration, tc_slice requestId, const tc_commissioning_response_view *response, void *userData)
+{
+    (void)client;
+    (void)registration;
+    (void)requestId;
+    (void)userData;
+
+    snprintf(commissionedId, sizeof(commissionedId), "%.*s", (int)response->deviceId.len, response->deviceId.data);
+    loopbackStatus = response->statusCode;
+    loopbackMessages++;
+}
+
+static void respond_command(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, void *userData)
+{
+    char commandId[TC_ID_LENGTH];
+
+    (void)deviceId;
+    (void)userData;
+
+    snprintf(commandId, sizeof(commandId), "%.*s", (int)request->requestId.len, request->requestId.data);
+    send_command_response(client, commissionedId, commandId, 200, false, NULL, NULL);
+    loopbackMessages++;
+}
+
+static void record_service_response(AWS_IoT_Client *client, tc_slice deviceId, tc_slice requestId, const tc_service_response_view *response, void *userData)
+{
+    (void)client;
+    (void)deviceId;
+    (void)requestId;
+    (void)userData;
+
+    snprintf(serviceBody, sizeof(serviceBody), "%.*s", (int)response->body.len, response->body.data);
+    loopbackStatus = response->statusCode;
+    loopbackMessages++;
+}
+
+static void record_command_response(tc_broker *publisher, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen, void *userData)
+{
+    static const char filter[] = "thincloud/devices/+/command/+/response";
+
+    (void)publisher;
+    (void)userData;
+
+    if (tc_broker_filter_matches(filter, sizeof(filter) - 1, topic, topicLen))
+    {
+        snprintf(commandResponse, sizeof(commandResponse), "%.*s", (int)payloadLen, payload);
+        sem_post(&commandResponded);
+    }
+}
+
+static int yield_until(int messages)
+{
+    for (int i = 0; i < 200 && loopbackMessages < messages; i++)
+    {
+        aws_iot_mqtt_yield(&loopbackClient, 10);
+    }
+
+    return loopbackMessages;
+}
+
+TEST should_round_trip_through_loopback_broker(void)
+{
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_init(&loopbackBroker), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_listen_tcp(&loopbackBroker, 0), "%d");
+    tc_broker_set_service_response(&loopbackBroker, 202, "{\"locked\":true}");
+    tc_broker_set_publish_handler(&loopbackBroker, record_command_response, NULL);
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_start(&loopbackBroker), "%d");
+    sem_init(&commandResponded, 0, 0);
+
+    loopbackMessages = 0;
+    ASSERT_EQ_FMT(SUCCESS, tc_init(&loopbackClient, tc_broker_address(&loopbackBroker), "", "", "", NULL, NULL), "%d");
+    tc_broker_network_init(&loopbackClient.networkStack);
+    ASSERT_EQ_FMT(SUCCESS, tc_connect(&loopbackClient, "loopback", false), "%d");
+
+    tc_dispatcher_init(&loopbackDispatcher);
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatcher_subscribe_commissioning_responses(&loopbackDispatcher, &loopbackClient, record_commissioning, NULL, QOS1), "%d");
+    ASSERT_EQ_FMT(SUCCESS, send_commissioning_request(&loopbackClient, "3f2504e0-4f89-11d3-9a0c-0305e82c3301", "lock", "123456", NULL, 0), "%d");
+    ASSERT_EQ(1, yield_until(1));
+    ASSERT_EQ(200, loopbackStatus);
+    ASSERT_EQ(TC_UUID_TEXT_LENGTH, strlen(commissionedId));
+
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatcher_subscribe_command_requests(&loopbackDispatcher, &loopbackClient, commissionedId, respond_command, NULL, QOS1), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_send_command(&loopbackBroker, commissionedId, "6fa459ea-ee8a-3ca4-894e-db77e160355e", "lock", "{\"locked\":true}"), "%d");
+    ASSERT_EQ(2, yield_until(2));
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    ASSERT_EQ(0, sem_timedwait(&commandResponded, &deadline));
+    ASSERT_STR_EQ("{\"id\":\"6fa459ea-ee8a-3ca4-894e-db77e160355e\",\"result\":{\"statusCode\":200}}", commandResponse);
+
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatcher_subscribe_service_responses(&loopbackDispatcher, &loopbackClient, commissionedId, record_service_response, NULL, QOS1), "%d");
+    ASSERT_EQ_FMT(SUCCESS, send_service_request(&loopbackClient, "7f8e5b1a-3c5d-4e2f-9a7b-1c2d3e4f5a6b", commissionedId, REQUEST_METHOD_GET, NULL), "%d");
+    ASSERT_EQ(3, yield_until(3));
+    ASSERT_EQ(202, loopbackStatus);
+    ASSERT_STR_EQ("{\"locked\":true}", serviceBody);
+
+    aws_iot_mqtt_disconnect(&loopbackClient);
+    tc_broker_stop(&loopbackBroker);
+    sem_destroy(&commandResponded);
+
+    PASS();
+}
+
+TEST should_dispatch_gateway_commands_once(void)
+{
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_init(&loopbackBroker), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_listen_tcp(&loopbackBroker, 0), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_start(&loopbackBroker), "%d");
+
+    ASSERT_EQ_FMT(SUCCESS, tc_init(&loopbackClient, tc_broker_address(&loopbackBroker), "", "", "", NULL, NULL), "%d");
+    tc_broker_network_init(&loopbackClient.networkStack);
+    ASSERT_EQ_FMT(SUCCESS, tc_connect(&loopbackClient, "gateway", false), "%d");
+
+    int handled = 0;
+    tc_gateway gateway;
+    ASSERT_EQ_FMT(SUCCESS, tc_gateway_init(&gateway, gatewayDevices, 64), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_gateway_register(&gateway, "child-1", respond_gateway_command, &handled, NULL), "%d");
+
+    // The gateway's own filter is routed without a second subscription
+    tc_dispatcher_init(&loopbackDispatcher);
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatcher_subscribe_gateway_commands(&loopbackDispatcher, &loopbackClient, &gateway, QOS1), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatcher_subscribe_command_requests(&loopbackDispatcher, &loopbackClient, "123456", count_command_request, NULL, QOS1), "%d");
+
+    // Messages arrive in order, so the gateway's command is handled by the time the child's is
+    dispatchedCommands = 0;
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_send_command(&loopbackBroker, "123456", "6fa459ea-ee8a-3ca4-894e-db77e160355e", "startRoutine", "{}"), "%d");
+    ASSERT_EQ_FMT(SUCCESS, tc_broker_send_command(&loopbackBroker, "child-1", "7f8e5b1a-3c5d-4e2f-9a7b-1c2d3e4f5a6b", "startRoutine", "{}"), "%d");
+    for (int i = 0; i < 200 && handled == 0; i++)
+    {
+        aws_iot_mqtt_yield(&loopbackClient, 10);
+    }
+    ASSERT_EQ(1, handled);
+    ASSERT_EQ(1, dispatchedCommands);
+
+    // Subscribing to the wildcard after the gateway's own filter would dispatch its commands twice
+    tc_dispatcher dispatcher;
+    tc_dispatcher_init(&dispatcher);
+    ASSERT_EQ_FMT(SUCCESS, tc_dispatcher_subscribe_command_requests(&dispatcher, &loopbackClient, "123456", count_command_request, NULL, QOS1), "%d");
+    ASSERT_EQ_FMT(FAILURE, tc_dispatcher_subscribe_gateway_commands(&dispatcher, &loopbackClient, &gateway, QOS1), "%d");
+
+    aws_iot_mqtt_disconnect(&loopbackClient);
+    tc_broker_stop(&loopbackBroker);
+
+    PASS();
+}
+
+SUITE(tc_topics)
+{
+    RUN_TEST(should_build_commission_topic);
+    RUN_TEST(should_fail_commission_topic_on_null_inputs);
+    RUN_TEST(should_build_commission_response_topic);
+    RUN_TEST(should_build_command_request_topic);
+    RUN_TEST(should_build_command_response_topic);
+    RUN_TEST(should_build_service_request_topic);
+    RUN_TEST(should_build_service_response_topic);
+    RUN_TEST(should_build_bounded_topic);
+    RUN_TEST(should_build_topics_from_cache);
+    RUN_TEST(should_build_send_topics_from_context_cache);
+    RUN_TEST(should_match_topic_filters);
+    RUN_TEST(should_backtrack_from_failed_literal_branches);
+}
+
+SUITE(tc_unmarshal)
+{
+    RUN_TEST(should_build_commission_request);
+    RUN_TEST(should_build_command_response);
+    RUN_TEST(should_build_service_request);
+    RUN_TEST(should_build_command_error_response);
+    RUN_TEST(should_build_cbor_command_response);
+    RUN_TEST(should_report_bounded_message_length);
+}
+
+SUITE(tc_marshal)
+{
+    RUN_TEST(should_process_commissioning_response);
+    RUN_TEST(should_process_command_request);
+    RUN_TEST(should_process_service_response);
+    RUN_TEST(should_ignore_bytes_after_legacy_messages);
+    RUN_TEST(should_convert_legacy_status_codes);
+    RUN_TEST(should_view_command_request_in_place);
+    RUN_TEST(should_view_service_response_in_place);
+    RUN_TEST(should_fail_view_on_malformed_payload);
+    RUN_TEST(should_unescape_string_values);
+    RUN_TEST(should_read_cbor_messages);
+    RUN_TEST(should_reuse_pooled_tokeners);
+    RUN_TEST(should_round_trip_compressed_payloads);
+    RUN_TEST(should_decode_typed_messages);
+}
+
+SUITE(tc_json)
+{
+    RUN_TEST(should_write_nested_json);
+    RUN_TEST(should_report_size_needed_on_overflow);
+    RUN_TEST(should_write_shortest_round_trip_doubles);
+    RUN_TEST(should_skip_values_with_each_scan_kernel);
+}
+
+SUITE(tc_routing)
+{
+    RUN_TEST(should_dispatch_by_topic);
+    RUN_TEST(should_find_methods_through_perfect_hash);
+    RUN_TEST(should_dispatch_to_pending_request);
+    RUN_TEST(should_route_gateway_commands_by_device);
+}
+
+SUITE(tc_correlation)
+{
+    RUN_TEST(should_correlate_pending_requests);
+    RUN_TEST(should_generate_and_parse_uuids);
+    RUN_TEST(should_retransmit_until_timeout);
+    RUN_TEST(should_retransmit_through_context);
+}
+
+SUITE(tc_timers)
+{
+    RUN_TEST(should_fire_timers_on_time);
+}
+
+SUITE(tc_batching)
+{
+    RUN_TEST(should_encode_publish_packet);
+    RUN_TEST(should_batch_publishes);
+}
+
+SUITE(tc_offline)
+{
+    RUN_TEST(should_replay_offline_outbox);
+}
+
+SUITE(tc_qos1)
+{
+    RUN_TEST(should_ack_qos1_publishes_asynchronously);
+    RUN_TEST(should_send_client_qos1_through_window);
+    RUN_TEST(should_keep_outbox_records_until_acked);
+}
+
+SUITE(tc_clients)
+{
+    RUN_TEST(should_queue_sends_from_any_thread);
+    RUN_TEST(should_run_until_next_deadline);
+}
+
+SUITE(tc_statistics)
+{
+    RUN_TEST(should_count_messages_in_stats);
+    RUN_TEST(should_bucket_latencies_log_linearly);
+}
+
+SUITE(tc_tracing)
+{
+    RUN_TEST(should_keep_latest_trace_records);
+}
+
+SUITE(tc_loopback)
+{
+    RUN_TEST(should_match_broker_filters);
+    RUN_TEST(should_speak_mqtt_to_loopback_broker);
+    RUN_TEST(should_round_trip_through_loopback_broker);
+    RUN_TEST(should_dispatch_gateway_commands_once);
 }
 
 GREATEST_MAIN_DEFS();
@@ -258,6 +2759,17 @@ int main(int argc, char **argv)
     RUN_SUITE(tc_topics);
     RUN_SUITE(tc_unmarshal);
     RUN_SUITE(tc_marshal);
+    RUN_SUITE(tc_json);
+    RUN_SUITE(tc_routing);
+    RUN_SUITE(tc_correlation);
+    RUN_SUITE(tc_timers);
+    RUN_SUITE(tc_batching);
+    RUN_SUITE(tc_offline);
+    RUN_SUITE(tc_qos1);
+    RUN_SUITE(tc_clients);
+    RUN_SUITE(tc_statistics);
+    RUN_SUITE(tc_tracing);
+    RUN_SUITE(tc_loopback);
 
     GREATEST_MAIN_END();
 }
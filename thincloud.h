@@ -29,10 +29,17 @@
  * and marshal and unmarshal request and responses.
  */
 
+#include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #include <json-c/json.h>
 
@@ -40,6 +47,19 @@
 #include "aws_iot_error.h"
 #include "aws_iot_mqtt_client_interface.h"
 
+#include "thincloud_json.h"
+#include "thincloud_batch.h"
+#include "thincloud_cbor.h"
+#include "thincloud_inflight.h"
+#include "thincloud_lz.h"
+#include "thincloud_outbox.h"
+#include "thincloud_queue.h"
+#include "thincloud_stats.h"
+#include "thincloud_timer.h"
+#include "thincloud_topic.h"
+#include "thincloud_trace.h"
+#include "thincloud_uuid.h"
+
 /**
  * UUID standard length plus null character
  */
@@ -50,6 +70,14 @@
  */
 #define MAX_TOPIC_LENGTH 257
 
+/**
+ * Largest payload the send functions marshal, which is bounded by the
+ * MQTT client's transmit buffer
+ */
+#ifndef TC_MAX_PAYLOAD_LENGTH
+#define TC_MAX_PAYLOAD_LENGTH AWS_IOT_MQTT_TX_BUF_LEN
+#endif
+
 #define REQUEST_METHOD_GET "GET"
 #define REQUEST_METHOD_PUT "PUT"
 #define REQUEST_METHOD_POST "POST"
@@ -60,807 +88,6644 @@ char COMMAND_TOPIC_BUFFER[MAX_TOPIC_LENGTH];
 char SERVICE_RESPONSE_TOPIC_BUFFER[MAX_TOPIC_LENGTH];
 
 /**
- * @brief Build a commission request topic
- * 
- * Constructs a commission request topic of the format
- *       "thincloud/registration/{deviceType}_{physicalId}/requests"
+ * Number of idle json-c tokeners a context keeps for reuse
+ */
+#ifndef TC_TOKENER_POOL_SIZE
+#define TC_TOKENER_POOL_SIZE 2
+#endif
+
+/**
+ * @brief Payload format
  *
- * @param[out]  buffer      Pointer to a string buffer to write to.
- * @param[in]   deviceType  Devices's device type.
- * @param[in]   physicalId  Device's physical ID.
+ * CBOR messages have the same shape and keys as their JSON counterparts
+ * and are only understood by a cloud side configured for them.
+ */
+typedef enum
+{
+    TC_FORMAT_JSON = 0,
+    TC_FORMAT_CBOR
+} tc_format;
+
+/**
+ * @brief Payload compression settings
+ *
+ * Outbound payloads of at least threshold bytes are compressed when that
+ * makes them smaller; a threshold of zero disables compression. The
+ * buffer is optional. Outbound messages are marshalled into it first, so
+ * a message larger than TC_MAX_PAYLOAD_LENGTH can be sent once it is
+ * compressed, and compressed inbound payloads are decompressed into it.
+ */
+typedef struct
+{
+    size_t threshold;
+    const tc_lz_dictionary *dictionary;
+    char *buffer;
+    size_t bufferLen;
+} tc_compression;
+
+/**
+ * @brief Per-device topic cache
  * 
- * @return Zero on success, negative value otherwise 
+ * Holds the "thincloud/devices/{deviceId}/" prefix shared by every device
+ * topic, built once after commissioning, so per-request topics are built
+ * with length-checked copies instead of formatting.
  */
-IoT_Error_t commission_request_topic(char *buffer, const char *deviceType, const char *physicalId)
+typedef struct
 {
-    if (buffer == NULL)
+    char prefix[MAX_TOPIC_LENGTH];
+    uint16_t prefixLen;
+} tc_topic_cache;
+
+/**
+ * @brief Outbox records handed to an in-flight window
+ * 
+ * Records stay in the outbox until their PUBACK arrives. PUBACKs can
+ * come back out of order, so each one marks its record and records are
+ * popped once every record ahead of them is acknowledged too. A failed
+ * message rewinds the replay to the head, and the epoch tells completions
+ * of messages sent before the rewind apart.
+ */
+typedef struct
+{
+    uint64_t cursor;
+    uint64_t sequence;
+    uint64_t acked;
+    uint32_t sent;
+    uint32_t epoch;
+    struct
     {
-        return 0;
-    }
+        uint64_t sequence;
+        uint32_t epoch;
+    } slots[TC_INFLIGHT_MAX_WINDOW];
+} tc_outbox_replay;
+
+/**
+ * @brief ThinCloud client context
+ *
+ * Holds per-client state reused across messages. A context is not
+ * thread-safe and should be used from the thread that yields the client.
+ */
+typedef struct
+{
+    json_tokener *tokeners[TC_TOKENER_POOL_SIZE];
+    uint32_t idleTokeners;
+    int tokenerDepth;
+    void *userdata;
+    json_object_delete_fn *userDelete;
+    tc_timer_wheel timers;
+    tc_batch *batch;
+    tc_inflight *inflight;
+    tc_outbox *outbox;
+    tc_outbox_replay replay;
+    tc_format format;
+    tc_compression compression;
+    tc_uuid_generator ids;
+    tc_stats *stats;
+    tc_topic_cache topics;
+} tc_context;
 
-    if (deviceType == NULL || physicalId == NULL)
+/**
+ * @brief Initialize a ThinCloud context
+ * 
+ * @param[out]  context  Context to initialize.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_context_init(tc_context *context)
+{
+    if (context == NULL)
     {
         FUNC_EXIT_RC(NULL_VALUE_ERROR);
     }
 
-    sprintf(buffer, "thincloud/registration/%s_%s/requests", deviceType, physicalId);
+    memset(context, 0, sizeof(*context));
+    context->tokenerDepth = JSON_TOKENER_DEFAULT_DEPTH;
+    tc_timer_wheel_init(&context->timers, tc_clock_ms());
+    tc_uuid_generator_init(&context->ids);
 
     FUNC_EXIT_RC(SUCCESS);
 }
 
 /**
- * @brief Build a commission response topic
+ * @brief Generate a request ID
  * 
- * Constructs a commission response topic of the format
- *       "thincloud/registration/{deviceType}_{physicalId}/requests/{requestId}/response"
+ * Request IDs are random UUIDs from the context's generator, which is
+ * seeded once when the context is initialized.
  * 
- * @param[out]  buffer      Pointer to a string buffer to write to.
- * @param[in]   deviceType  Devices's device type.
- * @param[in]   physicalId  Device's physical ID.
- * @param[in]   requestId   Unique ID for the request.
+ * @param[in]   context    ThinCloud context.
+ * @param[out]  requestId  Buffer of at least TC_ID_LENGTH bytes. Null-terminated.
+ */
+void tc_context_request_id(tc_context *context, char *requestId)
+{
+    tc_uuid_generate_text(&context->ids, requestId);
+}
+
+/**
+ * @brief Attach userdata to parsed objects
  * 
- * @return Zero on success, negative value otherwise 
+ * Every json-c object a context hands back from an unmarshaller gets
+ * userdata attached with json_object_set_userdata, and userDelete is
+ * called when the object is freed. This lets applications track or
+ * recycle parsed parameters, e.g. to return them to their own pool.
+ * 
+ * @param[in]  context     ThinCloud context.
+ * @param[in]  userdata    Data attached to parsed objects.
+ * @param[in]  userDelete  Optional. Called with the object and userdata when the object is freed.
  */
-IoT_Error_t commission_response_topic(char *buffer, const char *deviceType, const char *physicalId, const char *requestId)
+void tc_context_set_userdata(tc_context *context, void *userdata, json_object_delete_fn *userDelete)
 {
-    if (buffer == NULL)
-    {
-        return 0;
-    }
+    context->userdata = userdata;
+    context->userDelete = userDelete;
+}
 
-    if (deviceType == NULL || physicalId == NULL || requestId == NULL)
-    {
-        FUNC_EXIT_RC(NULL_VALUE_ERROR);
-    }
+/**
+ * @brief Set the payload format of a context
+ * 
+ * Messages sent through the context are marshalled in this format, and
+ * the context's unmarshallers expect it. Defaults to TC_FORMAT_JSON.
+ * 
+ * @param[in]  context  ThinCloud context.
+ * @param[in]  format   Payload format.
+ */
+void tc_context_set_format(tc_context *context, tc_format format)
+{
+    context->format = format;
+}
 
-    sprintf(buffer, "thincloud/registration/%s_%s/requests/%s/response", deviceType, physicalId, requestId);
+/**
+ * @brief Compress a context's large outbound payloads
+ * 
+ * Receivers recognize compressed payloads by their envelope and need the
+ * same dictionary.
+ * 
+ * @param[in]  context     ThinCloud context.
+ * @param[in]  threshold   Smallest payload to compress. Zero disables compression.
+ * @param[in]  dictionary  Optional. Preset dictionary, e.g. &tc_lz_thincloud_dictionary.
+ * @param[in]  buffer      Optional. Buffer for uncompressed messages, sized for the largest one.
+ * @param[in]  bufferLen   Size of buffer.
+ */
+void tc_context_set_compression(tc_context *context, size_t threshold, const tc_lz_dictionary *dictionary, char *buffer, size_t bufferLen)
+{
+    context->compression.threshold = threshold;
+    context->compression.dictionary = dictionary;
+    context->compression.buffer = buffer;
+    context->compression.bufferLen = bufferLen;
+}
 
-    FUNC_EXIT_RC(SUCCESS);
+/**
+ * @brief Count a context's outbound messages
+ * 
+ * Messages published through the context are counted by kind, and the
+ * time each takes to publish is recorded, in stats.
+ * 
+ * @param[in]  context  ThinCloud context.
+ * @param[in]  stats    Optional. Initialized statistics, NULL to stop counting.
+ */
+void tc_context_set_stats(tc_context *context, tc_stats *stats)
+{
+    context->stats = stats;
 }
 
 /**
- * @brief Build a command request topic
+ * @brief Collect a context's QoS0 messages into a batch
  * 
- * Constructs a command request topic of the format
- *       "thincloud/devices/{deviceId}/command"
+ * QoS0 messages published through the context are buffered in batch and
+ * written together once it reaches its size threshold, once its oldest
+ * message has waited its interval (see tc_context_tick), or ahead of a
+ * QoS1 message. Flush the current batch with tc_batch_flush before
+ * replacing it.
  * 
- * @param[out]  buffer    Pointer to a string buffer to write to.
- * @param[in]   deviceId  Device's ID.
+ * @param[in]  context  ThinCloud context.
+ * @param[in]  batch    Optional. Initialized batch, NULL to publish each message at once.
+ */
+void tc_context_set_batch(tc_context *context, tc_batch *batch)
+{
+    context->batch = batch;
+}
+
+/**
+ * @brief Replay a context's outbox from its head again
  * 
- * @return Zero on success, negative value otherwise 
+ * Records handed to the in-flight window but not yet acknowledged are
+ * sent again by the next tc_context_drain, and completions of the
+ * messages already sent are ignored.
+ * 
+ * @param[in]  context  ThinCloud context.
  */
-IoT_Error_t command_request_topic(char *buffer, const char *deviceId)
+void tc_context_rewind(tc_context *context)
 {
-    if (buffer == NULL)
+    context->replay.epoch++;
+    context->replay.sent = 0;
+    context->replay.acked = 0;
+}
+
+/**
+ * @brief Keep a context's messages in an offline outbox
+ * 
+ * Messages published through the context while the client is
+ * disconnected, while the in-flight window is full, or while older
+ * messages are still waiting, are appended to outbox and replayed in
+ * order by tc_context_drain once the client is connected again. QoS1
+ * messages for the context's in-flight window always go through the
+ * outbox, and stay in it until their PUBACK arrives.
+ * 
+ * @param[in]  context  ThinCloud context.
+ * @param[in]  outbox   Optional. Opened outbox, NULL to drop messages sent while disconnected.
+ */
+void tc_context_set_outbox(tc_context *context, tc_outbox *outbox)
+{
+    context->outbox = outbox;
+    tc_context_rewind(context);
+}
+
+/**
+ * @brief Send a context's QoS1 messages through an in-flight window
+ * 
+ * QoS1 messages published through the context to the window's client are
+ * written without waiting for their PUBACK; messages to other clients
+ * still go through aws_iot_mqtt_publish. Attach the window to the client
+ * first, with tc_inflight_attach, or use tc_client_set_inflight.
+ * 
+ * @param[in]  context   ThinCloud context.
+ * @param[in]  client    AWS IoT MQTT Client instance the window is attached to.
+ * @param[in]  inflight  Optional. Attached window, NULL to publish QoS1 messages one at a time.
+ * 
+ * @return Zero on success, FAILURE if the window is attached to another
+ *         client, negative value otherwise
+ */
+IoT_Error_t tc_context_set_inflight(tc_context *context, AWS_IoT_Client *client, tc_inflight *inflight)
+{
+    if (context == NULL)
     {
-        return 0;
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
     }
 
-    if (deviceId == NULL)
+    if (inflight != NULL && inflight->client != client)
     {
-        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+        FUNC_EXIT_RC(FAILURE);
     }
 
-    sprintf(buffer, "thincloud/devices/%s/command", deviceId);
+    context->inflight = inflight;
 
     FUNC_EXIT_RC(SUCCESS);
 }
 
 /**
- * @brief Build a command response topic
+ * @brief Buffer to marshal an outbound message into
  * 
- * Constructs a command response topic of the format
- *       "thincloud/devices/{deviceId}/command/{commandId}/response"
+ * @param[in]   context     Optional. ThinCloud context.
+ * @param[in]   payload     Payload buffer.
+ * @param[in]   payloadLen  Size of the payload buffer.
+ * @param[out]  bufferLen   Size of the returned buffer.
  * 
- * @param[out]  buffer    Pointer to a string buffer to write to.
- * @param[in]   deviceId  Devices's ID.
- * @param[in]   commandId  Command request's ID.
+ * @return The context's compression buffer when compression is enabled
+ *         and has one, payload otherwise
+ */
+char *tc_context_message_buffer(tc_context *context, char *payload, size_t payloadLen, size_t *bufferLen)
+{
+    if (context != NULL && context->compression.threshold > 0 && context->compression.buffer != NULL)
+    {
+        *bufferLen = context->compression.bufferLen;
+        return context->compression.buffer;
+    }
+
+    *bufferLen = payloadLen;
+    return payload;
+}
+
+/**
+ * @brief Compress a marshalled message into its payload
  * 
- * @return Zero on success, negative value otherwise 
+ * Messages below the threshold, or that do not shrink, are copied as is.
+ * 
+ * @param[in]   context      Optional. ThinCloud context.
+ * @param[in]   message      Message from tc_context_message_buffer.
+ * @param[in]   messageLen   Length of the message.
+ * @param[out]  payload      Payload buffer. May be message.
+ * @param[in]   payloadSize  Size of the payload buffer.
+ * @param[out]  payloadLen   Length of the payload.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if the payload does not fit,
+ *         negative value otherwise
  */
-IoT_Error_t command_response_topic(char *buffer, const char *deviceId, const char *commandId)
+IoT_Error_t tc_context_compress(tc_context *context, const char *message, size_t messageLen, char *payload, size_t payloadSize, size_t *payloadLen)
 {
-    if (buffer == NULL)
+    if (context != NULL && context->compression.threshold > 0 && messageLen >= context->compression.threshold && message != payload)
     {
-        return 0;
+        // Only keep envelopes smaller than the message
+        const size_t limit = messageLen - 1 < payloadSize ? messageLen - 1 : payloadSize;
+        const IoT_Error_t rc = tc_lz_pack(context->compression.dictionary, message, messageLen, payload, limit, payloadLen);
+        if (rc != MAX_SIZE_ERROR)
+        {
+            FUNC_EXIT_RC(rc);
+        }
     }
 
-    if (deviceId == NULL || commandId == NULL)
+    if (messageLen > payloadSize)
     {
-        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+        FUNC_EXIT_RC(MAX_SIZE_ERROR);
     }
 
-    sprintf(buffer, "thincloud/devices/%s/command/%s/response", deviceId, commandId);
+    if (message != payload)
+    {
+        memcpy(payload, message, messageLen);
+    }
+    *payloadLen = messageLen;
 
     FUNC_EXIT_RC(SUCCESS);
 }
 
 /**
- * @brief Build a service request topic
- * 
- * Constructs a service request topic of the format
- *       "thincloud/devices/{deviceId}/requests"
+ * @brief Decompress an inbound payload if it is compressed
  * 
- * @param[out]  buffer    Pointer to a string buffer to write to.
- * @param[in]   deviceId  Devices's ID.
+ * @param[in]      dictionary  Optional. Preset dictionary.
+ * @param[in]      buffer      Buffer to decompress into.
+ * @param[in]      bufferLen   Size of buffer.
+ * @param[in,out]  payload     Payload, replaced by buffer when decompressed.
+ * @param[in,out]  payloadLen  Length of the payload.
  * 
- * @return Zero on success, negative value otherwise 
+ * @return Zero on success, NULL_VALUE_ERROR if a compressed payload
+ *         arrives without a buffer, negative value otherwise
  */
-IoT_Error_t service_request_topic(char *buffer, const char *deviceId)
+IoT_Error_t tc_inflate(const tc_lz_dictionary *dictionary, char *buffer, size_t bufferLen, const char **payload, size_t *payloadLen)
 {
-    if (buffer == NULL)
+    if (!tc_lz_is_packed(*payload, *payloadLen))
     {
-        return 0;
+        FUNC_EXIT_RC(SUCCESS);
     }
 
-    if (deviceId == NULL)
+    if (buffer == NULL)
     {
         FUNC_EXIT_RC(NULL_VALUE_ERROR);
     }
 
-    sprintf(buffer, "thincloud/devices/%s/requests", deviceId);
+    size_t inflatedLen = 0;
+    const IoT_Error_t rc = tc_lz_unpack(dictionary, *payload, *payloadLen, buffer, bufferLen, &inflatedLen);
+    if (rc == SUCCESS)
+    {
+        *payload = buffer;
+        *payloadLen = inflatedLen;
+    }
 
-    FUNC_EXIT_RC(SUCCESS);
+    FUNC_EXIT_RC(rc);
 }
 
 /**
- * @brief Build a service response topic
+ * @brief Payload format of an optional context
  * 
- * Constructs a service response topic of the format
- *       "thincloud/devices/{deviceId}/requests/%s/response"
+ * @param[in]  context  Optional. ThinCloud context.
  * 
- * @param[out] buffer     Pointer to a string buffer to write to.
- * @param[in]  deviceId   Devices's ID.
- * @param[in]  requestId  Request's ID.
+ * @return The context's format, TC_FORMAT_JSON without a context
+ */
+tc_format tc_context_format(const tc_context *context)
+{
+    return context != NULL ? context->format : TC_FORMAT_JSON;
+}
+
+/**
+ * @brief Free a ThinCloud context
  * 
- * @return Zero on success, negative value otherwise 
+ * Releases the pooled tokeners.
+ * 
+ * @param[in]  context  Context to free.
  */
-IoT_Error_t service_response_topic(char *buffer, const char *deviceId, const char *requestId)
+void tc_context_free(tc_context *context)
 {
-    if (buffer == NULL)
+    if (context == NULL)
     {
-        return 0;
+        return;
     }
 
-    if (deviceId == NULL || requestId == NULL)
+    for (uint32_t i = 0; i < context->idleTokeners; i++)
     {
-        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+        json_tokener_free(context->tokeners[i]);
+        context->tokeners[i] = NULL;
     }
 
-    sprintf(buffer, "thincloud/devices/%s/requests/%s/response", deviceId, requestId);
-
-    FUNC_EXIT_RC(SUCCESS);
+    context->idleTokeners = 0;
 }
 
 /**
- * @brief Build a commissioning request
+ * @brief Parse a JSON span with a pooled tokener
  * 
- * Construct a commissioning request.
+ * Reuses an idle tokener from the context, and only allocates one when
+ * the pool is empty, e.g. on first use or when a handler parses from
+ * inside another parse. Without a context the calling thread's tokener
+ * from tc_json_parse_slice is used.
  * 
- * @param[out] buffer           Pointer to a string buffer to write to 
- * @param[in]  requestId        Unique ID for the request
- * @param[in]  deviceType       Requesting device's type
- * @param[in]  physicalId       Device's physical ID
- * @param[in]  relatedDeviceIds List of devices to associate on commissioning
- * @param[in]  idsSize          Size of related device ids list 
+ * @param[in]   context  Optional. ThinCloud context.
+ * @param[in]   value    Raw JSON value.
+ * @param[out]  obj      Parsed object. The caller owns the result.
  * 
  * @return Zero on success, negative value otherwise 
  */
-IoT_Error_t commissioning_request(char *buffer, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize)
+IoT_Error_t tc_context_parse(tc_context *context, tc_slice value, json_object **obj)
 {
-    if (deviceType == NULL || physicalId == NULL)
+    if (context == NULL)
     {
-        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+        return tc_json_parse_slice(value, obj);
     }
 
-    json_object *obj = json_object_new_object();
-    if (requestId != NULL)
+    json_tokener *tok = context->idleTokeners > 0
+                            ? context->tokeners[--context->idleTokeners]
+                            : json_tokener_new_ex(context->tokenerDepth);
+    if (tok == NULL)
     {
-        json_object *value = json_object_new_string(requestId);
-        json_object_object_add(obj, "id", value);
+        FUNC_EXIT_RC(FAILURE);
     }
 
-    json_object *method = json_object_new_string("commission");
-    json_object_object_add(obj, "method", method);
+    *obj = json_tokener_parse_ex(tok, value.data, (int)value.len);
 
-    json_object *params = json_object_new_array();
-    json_object *data = json_object_new_object();
-    json_object *dataObj = json_object_new_object();
-
-    json_object *deviceTypeValue = json_object_new_string(deviceType);
-    json_object *physicalIdValue = json_object_new_string(physicalId);
-    json_object_object_add(data, "deviceType", deviceTypeValue);
-    json_object_object_add(data, "physicalId", physicalIdValue);
-
-    if (relatedDeviceIds != NULL && idsSize > 0)
+    if (context->idleTokeners < TC_TOKENER_POOL_SIZE)
     {
-        json_object *relatedDevices = json_object_new_array();
-        for (uint32_t i = 0; i < idsSize; i++)
-        {
-            const char *id = relatedDeviceIds[i];
-            if (id == NULL || strlen(id) <= 0)
-            {
-                continue;
-            }
-
-            json_object *deviceId = json_object_new_string(id);
-            json_object *deviceIdObj = json_object_new_object();
-            json_object_object_add(deviceIdObj, "deviceId", deviceId);
-            json_object_array_add(relatedDevices, deviceIdObj);
-        }
-
-        json_object_object_add(data, "relatedDevices", relatedDevices);
+        json_tokener_reset(tok);
+        context->tokeners[context->idleTokeners++] = tok;
+    }
+    else
+    {
+        json_tokener_free(tok);
     }
 
-    json_object_object_add(dataObj, "data", data);
-    json_object_array_add(params, dataObj);
-
-    json_object_object_add(obj, "params", params);
-
-    const char *str = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN);
-
-    strcpy(buffer, str);
+    if (*obj == NULL)
+    {
+        FUNC_EXIT_RC(JSON_PARSE_ERROR);
+    }
 
-    json_object_put(obj);
+    if (context->userdata != NULL || context->userDelete != NULL)
+    {
+        json_object_set_userdata(*obj, context->userdata, context->userDelete);
+    }
 
     FUNC_EXIT_RC(SUCCESS);
 }
 
 /**
- * @brief Unmarshall a commissioning response 
+ * @brief Parse a message value in a context's format
  * 
- * Unmarshall a commissioning response from a string stream.
+ * Parses request params and response bodies, as found by the views, with
+ * tc_context_parse for JSON or tc_cbor_parse_slice for CBOR.
  * 
- * @param[out]  deviceId    Assigned device ID.
- * @param[out]  statusCode  Commissioning status.
- * @param[out]  requestId   ID of the original request.
- * @param[in]   payload     Response payload.
- * @param[in]   payloadLen  Reponse payload's length.
+ * @param[in]   context  Optional. ThinCloud context.
+ * @param[in]   value    Raw value.
+ * @param[out]  obj      Parsed object. The caller owns the result.
  * 
- * @return Zero on success, a negative value otherwise 
+ * @return Zero on success, negative value otherwise 
  */
-IoT_Error_t commissioning_response(char *deviceId, uint16_t *statusCode, char *requestId, char *payload, uint16_t payloadLen)
+IoT_Error_t tc_context_parse_value(tc_context *context, tc_slice value, json_object **obj)
 {
-    if (payload == NULL || payloadLen == 0)
+    if (tc_context_format(context) != TC_FORMAT_CBOR)
     {
-        FUNC_EXIT_RC(SUCCESS);
+        return tc_context_parse(context, value, obj);
     }
 
-    json_tokener *tok = json_tokener_new();
-
-    json_object *obj = json_tokener_parse_ex(tok, payload, payloadLen);
-    if (obj == NULL)
+    const IoT_Error_t rc = tc_cbor_parse_slice(value, obj);
+    if (rc == SUCCESS && *obj != NULL && (context->userdata != NULL || context->userDelete != NULL))
     {
-        FUNC_EXIT_RC(JSON_PARSE_ERROR);
+        json_object_set_userdata(*obj, context->userdata, context->userDelete);
     }
 
-    if (requestId != NULL)
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Copy a message string in a context's format
+ * 
+ * JSON strings are unescaped, CBOR strings are copied as is.
+ * 
+ * @param[in]   context  Optional. ThinCloud context.
+ * @param[out]  buffer   Buffer large enough for the string and a null character.
+ * @param[in]   value    String contents, as found by the views.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_context_copy_string(tc_context *context, char *buffer, tc_slice value)
+{
+    if (tc_context_format(context) != TC_FORMAT_CBOR)
     {
-        const char *requestIdValue = json_object_get_string(json_object_object_get(obj, "id"));
-        if (requestIdValue != NULL)
-        {
-            strcpy(requestId, requestIdValue);
-        }
+        return tc_json_unescape(buffer, SIZE_MAX, value, NULL);
     }
 
-    json_object *result = json_object_object_get(obj, "result");
+    memcpy(buffer, value.data, value.len);
+    buffer[value.len] = '\0';
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Join string parts into a buffer
+ * 
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   parts      Strings to join.
+ * @param[in]   count      Number of parts.
+ * @param[out]  written    Optional. Length of the joined string, excluding the null
+ *                         character, even if it did not fit.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_join(char *buffer, size_t bufferLen, const char *const *parts, size_t count, size_t *written)
+{
+    size_t len = 0;
 
-    if (result != NULL)
+    for (size_t i = 0; i < count; i++)
     {
-        if (statusCode != NULL)
+        if (parts[i] == NULL)
         {
-            *statusCode = json_object_get_int(json_object_object_get(result, "statusCode"));
+            FUNC_EXIT_RC(NULL_VALUE_ERROR);
         }
 
-        if (deviceId != NULL)
+        const size_t partLen = strlen(parts[i]);
+        if (len + partLen < bufferLen)
         {
-            const char *deviceIdValue = json_object_get_string(json_object_object_get(result, "deviceId"));
-            if (deviceIdValue != NULL)
-            {
-                strcpy(deviceId, deviceIdValue);
-            }
+            memcpy(buffer + len, parts[i], partLen);
         }
+
+        len += partLen;
+    }
+
+    if (written != NULL)
+    {
+        *written = len;
     }
 
-    json_tokener_free(tok);
-    json_object_put(obj);
+    if (len >= bufferLen)
+    {
+        FUNC_EXIT_RC(MAX_SIZE_ERROR);
+    }
+
+    buffer[len] = '\0';
 
     FUNC_EXIT_RC(SUCCESS);
 }
 
 /**
- * @brief Marshal a command response
+ * @brief Join slices into a buffer
  * 
- * Marshal a command response into a JSON string.
+ * Like tc_join, for parts that are not null terminated.
  * 
- * @param[out]  buffer           Pointer to a string buffer to write to.
- * @param[in]   requestId        Command request's ID.
- * @param[in]   statusCode       Command's response status.
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   parts      Slices to join.
+ * @param[in]   count      Number of parts.
+ * @param[out]  written    Optional. Length of the joined string, excluding the null
+ *                         character, even if it did not fit.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_join_slices(char *buffer, size_t bufferLen, const tc_slice *parts, size_t count, size_t *written)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (parts[i].data == NULL && parts[i].len > 0)
+        {
+            FUNC_EXIT_RC(NULL_VALUE_ERROR);
+        }
+
+        if (len + parts[i].len < bufferLen)
+        {
+            memcpy(buffer + len, parts[i].data, parts[i].len);
+        }
+
+        len += parts[i].len;
+    }
+
+    if (written != NULL)
+    {
+        *written = len;
+    }
+
+    if (len >= bufferLen)
+    {
+        FUNC_EXIT_RC(MAX_SIZE_ERROR);
+    }
+
+    buffer[len] = '\0';
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Build a commission request topic into a bounded buffer
+ * 
+ * Constructs a commission request topic of the format
+ *       "thincloud/registration/{deviceType}_{physicalId}/requests"
+ * 
+ * @param[out]  buffer      Pointer to a string buffer to write to.
+ * @param[in]   bufferLen   Size of buffer, including room for the null character.
+ * @param[in]   deviceType  Devices's device type.
+ * @param[in]   physicalId  Device's physical ID.
+ * @param[out]  written     Optional. Length of the topic, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t commission_request_topic_n(char *buffer, size_t bufferLen, const char *deviceType, const char *physicalId, size_t *written)
+{
+    if (buffer == NULL || deviceType == NULL || physicalId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    const char *const parts[] = {"thincloud/registration/", deviceType, "_", physicalId, "/requests"};
+
+    return tc_join(buffer, bufferLen, parts, sizeof(parts) / sizeof(parts[0]), written);
+}
+
+/**
+ * @brief Build a commission response topic into a bounded buffer
+ * 
+ * Constructs a commission response topic of the format
+ *       "thincloud/registration/{deviceType}_{physicalId}/requests/{requestId}/response"
+ * 
+ * @param[out]  buffer      Pointer to a string buffer to write to.
+ * @param[in]   bufferLen   Size of buffer, including room for the null character.
+ * @param[in]   deviceType  Devices's device type.
+ * @param[in]   physicalId  Device's physical ID.
+ * @param[in]   requestId   Unique ID for the request.
+ * @param[out]  written     Optional. Length of the topic, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t commission_response_topic_n(char *buffer, size_t bufferLen, const char *deviceType, const char *physicalId, const char *requestId, size_t *written)
+{
+    if (buffer == NULL || deviceType == NULL || physicalId == NULL || requestId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    const char *const parts[] = {"thincloud/registration/", deviceType, "_", physicalId, "/requests/", requestId, "/response"};
+
+    return tc_join(buffer, bufferLen, parts, sizeof(parts) / sizeof(parts[0]), written);
+}
+
+/**
+ * @brief Build a command request topic into a bounded buffer
+ * 
+ * Constructs a command request topic of the format
+ *       "thincloud/devices/{deviceId}/command"
+ * 
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   deviceId   Devices's ID.
+ * @param[out]  written    Optional. Length of the topic, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t command_request_topic_n(char *buffer, size_t bufferLen, const char *deviceId, size_t *written)
+{
+    if (buffer == NULL || deviceId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    const char *const parts[] = {"thincloud/devices/", deviceId, "/command"};
+
+    return tc_join(buffer, bufferLen, parts, sizeof(parts) / sizeof(parts[0]), written);
+}
+
+/**
+ * @brief Build a command response topic into a bounded buffer
+ * 
+ * Constructs a command response topic of the format
+ *       "thincloud/devices/{deviceId}/command/{commandId}/response"
+ * 
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   deviceId   Devices's ID.
+ * @param[in]   commandId  Command request's ID.
+ * @param[out]  written    Optional. Length of the topic, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t command_response_topic_n(char *buffer, size_t bufferLen, const char *deviceId, const char *commandId, size_t *written)
+{
+    if (buffer == NULL || deviceId == NULL || commandId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    const char *const parts[] = {"thincloud/devices/", deviceId, "/command/", commandId, "/response"};
+
+    return tc_join(buffer, bufferLen, parts, sizeof(parts) / sizeof(parts[0]), written);
+}
+
+/**
+ * @brief Build a service request topic into a bounded buffer
+ * 
+ * Constructs a service request topic of the format
+ *       "thincloud/devices/{deviceId}/requests"
+ * 
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   deviceId   Devices's ID.
+ * @param[out]  written    Optional. Length of the topic, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t service_request_topic_n(char *buffer, size_t bufferLen, const char *deviceId, size_t *written)
+{
+    if (buffer == NULL || deviceId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    const char *const parts[] = {"thincloud/devices/", deviceId, "/requests"};
+
+    return tc_join(buffer, bufferLen, parts, sizeof(parts) / sizeof(parts[0]), written);
+}
+
+/**
+ * @brief Build a service response topic into a bounded buffer
+ * 
+ * Constructs a service response topic of the format
+ *       "thincloud/devices/{deviceId}/requests/{requestId}/response"
+ * 
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   deviceId   Devices's ID.
+ * @param[in]   requestId  Request's ID.
+ * @param[out]  written    Optional. Length of the topic, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t service_response_topic_n(char *buffer, size_t bufferLen, const char *deviceId, const char *requestId, size_t *written)
+{
+    if (buffer == NULL || deviceId == NULL || requestId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    const char *const parts[] = {"thincloud/devices/", deviceId, "/requests/", requestId, "/response"};
+
+    return tc_join(buffer, bufferLen, parts, sizeof(parts) / sizeof(parts[0]), written);
+}
+
+/**
+ * @brief Build a commission request topic
+ * 
+ * Constructs a commission request topic of the format
+ *       "thincloud/registration/{deviceType}_{physicalId}/requests"
+ *
+ * @param[out]  buffer      Pointer to a string buffer of MAX_TOPIC_LENGTH bytes to write to.
+ * @param[in]   deviceType  Devices's device type.
+ * @param[in]   physicalId  Device's physical ID.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t commission_request_topic(char *buffer, const char *deviceType, const char *physicalId)
+{
+    if (buffer == NULL)
+    {
+        return SUCCESS;
+    }
+
+    return commission_request_topic_n(buffer, MAX_TOPIC_LENGTH, deviceType, physicalId, NULL);
+}
+
+/**
+ * @brief Build a commission response topic
+ * 
+ * Constructs a commission response topic of the format
+ *       "thincloud/registration/{deviceType}_{physicalId}/requests/{requestId}/response"
+ * 
+ * @param[out]  buffer      Pointer to a string buffer of MAX_TOPIC_LENGTH bytes to write to.
+ * @param[in]   deviceType  Devices's device type.
+ * @param[in]   physicalId  Device's physical ID.
+ * @param[in]   requestId   Unique ID for the request.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t commission_response_topic(char *buffer, const char *deviceType, const char *physicalId, const char *requestId)
+{
+    if (buffer == NULL)
+    {
+        return SUCCESS;
+    }
+
+    return commission_response_topic_n(buffer, MAX_TOPIC_LENGTH, deviceType, physicalId, requestId, NULL);
+}
+
+/**
+ * @brief Build a command request topic
+ * 
+ * Constructs a command request topic of the format
+ *       "thincloud/devices/{deviceId}/command"
+ * 
+ * @param[out]  buffer    Pointer to a string buffer of MAX_TOPIC_LENGTH bytes to write to.
+ * @param[in]   deviceId  Device's ID.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t command_request_topic(char *buffer, const char *deviceId)
+{
+    if (buffer == NULL)
+    {
+        return SUCCESS;
+    }
+
+    return command_request_topic_n(buffer, MAX_TOPIC_LENGTH, deviceId, NULL);
+}
+
+/**
+ * @brief Build a command response topic
+ * 
+ * Constructs a command response topic of the format
+ *       "thincloud/devices/{deviceId}/command/{commandId}/response"
+ * 
+ * @param[out]  buffer    Pointer to a string buffer of MAX_TOPIC_LENGTH bytes to write to.
+ * @param[in]   deviceId  Devices's ID.
+ * @param[in]   commandId  Command request's ID.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t command_response_topic(char *buffer, const char *deviceId, const char *commandId)
+{
+    if (buffer == NULL)
+    {
+        return SUCCESS;
+    }
+
+    return command_response_topic_n(buffer, MAX_TOPIC_LENGTH, deviceId, commandId, NULL);
+}
+
+/**
+ * @brief Build a service request topic
+ * 
+ * Constructs a service request topic of the format
+ *       "thincloud/devices/{deviceId}/requests"
+ * 
+ * @param[out]  buffer    Pointer to a string buffer of MAX_TOPIC_LENGTH bytes to write to.
+ * @param[in]   deviceId  Devices's ID.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t service_request_topic(char *buffer, const char *deviceId)
+{
+    if (buffer == NULL)
+    {
+        return SUCCESS;
+    }
+
+    return service_request_topic_n(buffer, MAX_TOPIC_LENGTH, deviceId, NULL);
+}
+
+/**
+ * @brief Build a service response topic
+ * 
+ * Constructs a service response topic of the format
+ *       "thincloud/devices/{deviceId}/requests/%s/response"
+ * 
+ * @param[out] buffer     Pointer to a string buffer of MAX_TOPIC_LENGTH bytes to write to.
+ * @param[in]  deviceId   Devices's ID.
+ * @param[in]  requestId  Request's ID.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t service_response_topic(char *buffer, const char *deviceId, const char *requestId)
+{
+    if (buffer == NULL)
+    {
+        return SUCCESS;
+    }
+
+    return service_response_topic_n(buffer, MAX_TOPIC_LENGTH, deviceId, requestId, NULL);
+}
+
+/**
+ * @brief Initialize a topic cache
+ * 
+ * @param[out]  cache     Topic cache to initialize.
+ * @param[in]   deviceId  Device's ID.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_topic_cache_init(tc_topic_cache *cache, const char *deviceId)
+{
+    if (cache == NULL || deviceId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    const size_t deviceIdLen = strlen(deviceId);
+    const size_t prefixLen = sizeof("thincloud/devices/") - 1 + deviceIdLen + 1;
+    if (prefixLen >= sizeof(cache->prefix))
+    {
+        FUNC_EXIT_RC(MAX_SIZE_ERROR);
+    }
+
+    memcpy(cache->prefix, "thincloud/devices/", sizeof("thincloud/devices/") - 1);
+    memcpy(cache->prefix + sizeof("thincloud/devices/") - 1, deviceId, deviceIdLen);
+    cache->prefix[prefixLen - 1] = '/';
+    cache->prefix[prefixLen] = '\0';
+    cache->prefixLen = (uint16_t)prefixLen;
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Topic cache of a context's device
+ * 
+ * Contexts cache the topic prefix of the device they last sent for, and
+ * rebuild it when a different device sends.
+ * 
+ * @param[in]  context   Optional. ThinCloud context.
+ * @param[in]  deviceId  Device's ID.
+ * 
+ * @return The context's topic cache, NULL without a context or device ID
+ *         or if the device's prefix does not fit
+ */
+const tc_topic_cache *tc_context_topics(tc_context *context, const char *deviceId)
+{
+    if (context == NULL || deviceId == NULL)
+    {
+        return NULL;
+    }
+
+    const size_t deviceIdLen = strlen(deviceId);
+    tc_topic_cache *cache = &context->topics;
+
+    if (cache->prefixLen == sizeof("thincloud/devices/") + deviceIdLen &&
+        memcmp(cache->prefix + sizeof("thincloud/devices/") - 1, deviceId, deviceIdLen) == 0)
+    {
+        return cache;
+    }
+
+    if (tc_topic_cache_init(cache, deviceId) != SUCCESS)
+    {
+        cache->prefixLen = 0;
+        return NULL;
+    }
+
+    return cache;
+}
+
+/**
+ * @brief Build a topic from the cached prefix
+ * 
+ * Writes "{prefix}{name}" or, with an ID, "{prefix}{name}/{id}/response".
+ * 
+ * @param[in]   cache      Topic cache.
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   name       Topic name following the prefix.
+ * @param[in]   nameLen    Length of name.
+ * @param[in]   id         Optional. Request ID.
+ * @param[in]   idLen      Length of the request ID.
+ * @param[out]  topicLen   Optional. Length of the topic.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_topic_cache_build(const tc_topic_cache *cache, char *buffer, size_t bufferLen, const char *name, size_t nameLen, const char *id, size_t idLen, uint16_t *topicLen)
+{
+    if (cache == NULL || buffer == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    const size_t suffixLen = id != NULL ? 1 + idLen + sizeof("/response") - 1 : 0;
+    const size_t len = cache->prefixLen + nameLen + suffixLen;
+    if (len >= bufferLen || len >= MAX_TOPIC_LENGTH)
+    {
+        FUNC_EXIT_RC(MAX_SIZE_ERROR);
+    }
+
+    char *cursor = buffer;
+    memcpy(cursor, cache->prefix, cache->prefixLen);
+    cursor += cache->prefixLen;
+    memcpy(cursor, name, nameLen);
+    cursor += nameLen;
+
+    if (id != NULL)
+    {
+        *cursor++ = '/';
+        memcpy(cursor, id, idLen);
+        cursor += idLen;
+        memcpy(cursor, "/response", sizeof("/response") - 1);
+        cursor += sizeof("/response") - 1;
+    }
+
+    *cursor = '\0';
+
+    if (topicLen != NULL)
+    {
+        *topicLen = (uint16_t)len;
+    }
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Build a command request topic from a topic cache
+ * 
+ * Constructs a command request topic of the format
+ *       "thincloud/devices/{deviceId}/command"
+ * 
+ * @param[in]   cache      Topic cache.
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[out]  topicLen   Optional. Length of the topic.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_topic_cache_command_request(const tc_topic_cache *cache, char *buffer, size_t bufferLen, uint16_t *topicLen)
+{
+    return tc_topic_cache_build(cache, buffer, bufferLen, "command", sizeof("command") - 1, NULL, 0, topicLen);
+}
+
+/**
+ * @brief Build a command response topic from a topic cache
+ * 
+ * Constructs a command response topic of the format
+ *       "thincloud/devices/{deviceId}/command/{commandId}/response"
+ * 
+ * @param[in]   cache         Topic cache.
+ * @param[out]  buffer        Pointer to a string buffer to write to.
+ * @param[in]   bufferLen     Size of buffer, including room for the null character.
+ * @param[in]   commandId     Command request's ID.
+ * @param[in]   commandIdLen  Length of the command request's ID.
+ * @param[out]  topicLen      Optional. Length of the topic.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_topic_cache_command_response(const tc_topic_cache *cache, char *buffer, size_t bufferLen, const char *commandId, size_t commandIdLen, uint16_t *topicLen)
+{
+    if (commandId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    return tc_topic_cache_build(cache, buffer, bufferLen, "command", sizeof("command") - 1, commandId, commandIdLen, topicLen);
+}
+
+/**
+ * @brief Build a service request topic from a topic cache
+ * 
+ * Constructs a service request topic of the format
+ *       "thincloud/devices/{deviceId}/requests"
+ * 
+ * @param[in]   cache      Topic cache.
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[out]  topicLen   Optional. Length of the topic.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_topic_cache_service_request(const tc_topic_cache *cache, char *buffer, size_t bufferLen, uint16_t *topicLen)
+{
+    return tc_topic_cache_build(cache, buffer, bufferLen, "requests", sizeof("requests") - 1, NULL, 0, topicLen);
+}
+
+/**
+ * @brief Build a service response topic from a topic cache
+ * 
+ * Constructs a service response topic of the format
+ *       "thincloud/devices/{deviceId}/requests/{requestId}/response"
+ * 
+ * @param[in]   cache         Topic cache.
+ * @param[out]  buffer        Pointer to a string buffer to write to.
+ * @param[in]   bufferLen     Size of buffer, including room for the null character.
+ * @param[in]   requestId     Request's ID.
+ * @param[in]   requestIdLen  Length of the request's ID.
+ * @param[out]  topicLen      Optional. Length of the topic.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_topic_cache_service_response(const tc_topic_cache *cache, char *buffer, size_t bufferLen, const char *requestId, size_t requestIdLen, uint16_t *topicLen)
+{
+    if (requestId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    return tc_topic_cache_build(cache, buffer, bufferLen, "requests", sizeof("requests") - 1, requestId, requestIdLen, topicLen);
+}
+
+/**
+ * @brief Build a command response topic through a context
+ * 
+ * Built from the context's topic cache when there is a context, with
+ * command_response_topic_n otherwise.
+ * 
+ * @param[in]   context    Optional. ThinCloud context.
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   deviceId   Device's ID.
+ * @param[in]   commandId  Command request's ID.
+ * @param[out]  topicLen   Length of the topic.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_context_command_response_topic(tc_context *context, char *buffer, size_t bufferLen, const char *deviceId, const char *commandId, size_t *topicLen)
+{
+    const tc_topic_cache *topics = tc_context_topics(context, deviceId);
+    if (topics == NULL || commandId == NULL)
+    {
+        return command_response_topic_n(buffer, bufferLen, deviceId, commandId, topicLen);
+    }
+
+    uint16_t len = 0;
+    const IoT_Error_t rc = tc_topic_cache_command_response(topics, buffer, bufferLen, commandId, strlen(commandId), &len);
+    *topicLen = len;
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Build a service request topic through a context
+ * 
+ * Built from the context's topic cache when there is a context, with
+ * service_request_topic_n otherwise.
+ * 
+ * @param[in]   context    Optional. ThinCloud context.
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   deviceId   Device's ID.
+ * @param[out]  topicLen   Length of the topic.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_context_service_request_topic(tc_context *context, char *buffer, size_t bufferLen, const char *deviceId, size_t *topicLen)
+{
+    const tc_topic_cache *topics = tc_context_topics(context, deviceId);
+    if (topics == NULL)
+    {
+        return service_request_topic_n(buffer, bufferLen, deviceId, topicLen);
+    }
+
+    uint16_t len = 0;
+    const IoT_Error_t rc = tc_topic_cache_service_request(topics, buffer, bufferLen, &len);
+    *topicLen = len;
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Build a commissioning request into a bounded buffer from slices
+ * 
+ * See commissioning_request_n. A slice with NULL data is left out like a NULL string.
+ */
+IoT_Error_t commissioning_request_slice_n(char *buffer, size_t bufferLen, tc_slice requestId, tc_slice deviceType, tc_slice physicalId, char **relatedDeviceIds, uint32_t idsSize, size_t *written)
+{
+    if (deviceType.data == NULL || physicalId.data == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    tc_json_writer writer;
+    tc_json_writer_init(&writer, buffer, bufferLen);
+
+    tc_json_begin_object(&writer);
+    if (requestId.data != NULL)
+    {
+        tc_json_key(&writer, "id");
+        tc_json_string_len(&writer, requestId.data, requestId.len);
+    }
+
+    tc_json_key(&writer, "method");
+    tc_json_string(&writer, "commission");
+
+    tc_json_key(&writer, "params");
+    tc_json_begin_array(&writer);
+    tc_json_begin_object(&writer);
+    tc_json_key(&writer, "data");
+    tc_json_begin_object(&writer);
+
+    tc_json_key(&writer, "deviceType");
+    tc_json_string_len(&writer, deviceType.data, deviceType.len);
+    tc_json_key(&writer, "physicalId");
+    tc_json_string_len(&writer, physicalId.data, physicalId.len);
+
+    if (relatedDeviceIds != NULL && idsSize > 0)
+    {
+        tc_json_key(&writer, "relatedDevices");
+        tc_json_begin_array(&writer);
+        for (uint32_t i = 0; i < idsSize; i++)
+        {
+            const char *id = relatedDeviceIds[i];
+            if (id == NULL || id[0] == '\0')
+            {
+                continue;
+            }
+
+            tc_json_begin_object(&writer);
+            tc_json_key(&writer, "deviceId");
+            tc_json_string(&writer, id);
+            tc_json_end_object(&writer);
+        }
+        tc_json_end_array(&writer);
+    }
+
+    tc_json_end_object(&writer);
+    tc_json_end_object(&writer);
+    tc_json_end_array(&writer);
+    tc_json_end_object(&writer);
+
+    const IoT_Error_t rc = tc_json_writer_finish(&writer);
+    if (written != NULL)
+    {
+        *written = writer.length;
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Build a commissioning request into a bounded buffer
+ * 
+ * Construct a commissioning request.
+ * 
+ * @param[out] buffer           Pointer to a string buffer to write to 
+ * @param[in]  bufferLen        Size of buffer, including room for the null character.
+ * @param[in]  requestId        Unique ID for the request
+ * @param[in]  deviceType       Requesting device's type
+ * @param[in]  physicalId       Device's physical ID
+ * @param[in]  relatedDeviceIds List of devices to associate on commissioning
+ * @param[in]  idsSize          Size of related device ids list 
+ * @param[out] written          Optional. Length of the message, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         a negative value otherwise
+ */
+IoT_Error_t commissioning_request_n(char *buffer, size_t bufferLen, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize, size_t *written)
+{
+    return commissioning_request_slice_n(buffer, bufferLen, tc_slice_of(requestId), tc_slice_of(deviceType), tc_slice_of(physicalId), relatedDeviceIds, idsSize, written);
+}
+
+/**
+ * @brief Build a commissioning request
+ * 
+ * Construct a commissioning request.
+ * 
+ * @param[out] buffer           Pointer to a string buffer to write to 
+ * @param[in]  requestId        Unique ID for the request
+ * @param[in]  deviceType       Requesting device's type
+ * @param[in]  physicalId       Device's physical ID
+ * @param[in]  relatedDeviceIds List of devices to associate on commissioning
+ * @param[in]  idsSize          Size of related device ids list 
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t commissioning_request(char *buffer, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize)
+{
+    return commissioning_request_n(buffer, SIZE_MAX, requestId, deviceType, physicalId, relatedDeviceIds, idsSize, NULL);
+}
+
+/**
+ * @brief Marshal a commissioning request as CBOR from slices
+ * 
+ * See commissioning_request_cbor_n. A slice with NULL data is left out like a NULL string.
+ */
+IoT_Error_t commissioning_request_cbor_slice_n(char *buffer, size_t bufferLen, tc_slice requestId, tc_slice deviceType, tc_slice physicalId, char **relatedDeviceIds, uint32_t idsSize, size_t *written)
+{
+    if (deviceType.data == NULL || physicalId.data == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    // Maps and arrays are written with their lengths up front
+    uint32_t relatedCount = 0;
+    for (uint32_t i = 0; relatedDeviceIds != NULL && i < idsSize; i++)
+    {
+        if (relatedDeviceIds[i] != NULL && relatedDeviceIds[i][0] != '\0')
+        {
+            relatedCount++;
+        }
+    }
+
+    tc_cbor_writer writer;
+    tc_cbor_writer_init(&writer, buffer, bufferLen);
+
+    tc_cbor_begin_map(&writer, requestId.data != NULL ? 3 : 2);
+    if (requestId.data != NULL)
+    {
+        tc_cbor_string(&writer, "id");
+        tc_cbor_string_len(&writer, requestId.data, requestId.len);
+    }
+
+    tc_cbor_string(&writer, "method");
+    tc_cbor_string(&writer, "commission");
+
+    tc_cbor_string(&writer, "params");
+    tc_cbor_begin_array(&writer, 1);
+    tc_cbor_begin_map(&writer, 1);
+    tc_cbor_string(&writer, "data");
+    tc_cbor_begin_map(&writer, relatedCount > 0 ? 3 : 2);
+
+    tc_cbor_string(&writer, "deviceType");
+    tc_cbor_string_len(&writer, deviceType.data, deviceType.len);
+    tc_cbor_string(&writer, "physicalId");
+    tc_cbor_string_len(&writer, physicalId.data, physicalId.len);
+
+    if (relatedCount > 0)
+    {
+        tc_cbor_string(&writer, "relatedDevices");
+        tc_cbor_begin_array(&writer, relatedCount);
+        for (uint32_t i = 0; i < idsSize; i++)
+        {
+            const char *id = relatedDeviceIds[i];
+            if (id == NULL || id[0] == '\0')
+            {
+                continue;
+            }
+
+            tc_cbor_begin_map(&writer, 1);
+            tc_cbor_string(&writer, "deviceId");
+            tc_cbor_string(&writer, id);
+        }
+    }
+
+    const IoT_Error_t rc = tc_cbor_writer_finish(&writer);
+    if (written != NULL)
+    {
+        *written = writer.length;
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Marshal a commissioning request as CBOR
+ * 
+ * Construct a commissioning request with the shape of the JSON request.
+ * 
+ * @param[out] buffer           Buffer to write to.
+ * @param[in]  bufferLen        Size of buffer.
+ * @param[in]  requestId        Unique ID for the request
+ * @param[in]  deviceType       Requesting device's type
+ * @param[in]  physicalId       Device's physical ID
+ * @param[in]  relatedDeviceIds List of devices to associate on commissioning
+ * @param[in]  idsSize          Size of related device ids list 
+ * @param[out] written          Optional. Length of the message, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         a negative value otherwise
+ */
+IoT_Error_t commissioning_request_cbor_n(char *buffer, size_t bufferLen, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize, size_t *written)
+{
+    return commissioning_request_cbor_slice_n(buffer, bufferLen, tc_slice_of(requestId), tc_slice_of(deviceType), tc_slice_of(physicalId), relatedDeviceIds, idsSize, written);
+}
+
+/**
+ * @brief Marshal a commissioning request in a payload format
+ * 
+ * @param[in]  format  Payload format.
+ * 
+ * See commissioning_request_n for the other parameters. bufferLen needs
+ * no room for a null character with TC_FORMAT_CBOR.
+ */
+IoT_Error_t tc_marshal_commissioning_request(tc_format format, char *buffer, size_t bufferLen, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize, size_t *written)
+{
+    if (format == TC_FORMAT_CBOR)
+    {
+        return commissioning_request_cbor_n(buffer, bufferLen, requestId, deviceType, physicalId, relatedDeviceIds, idsSize, written);
+    }
+
+    return commissioning_request_n(buffer, bufferLen, requestId, deviceType, physicalId, relatedDeviceIds, idsSize, written);
+}
+
+/**
+ * @brief Marshal a commissioning request from slices in a payload format
+ * 
+ * See tc_marshal_commissioning_request and commissioning_request_slice_n.
+ */
+IoT_Error_t tc_marshal_commissioning_request_slice(tc_format format, char *buffer, size_t bufferLen, tc_slice requestId, tc_slice deviceType, tc_slice physicalId, char **relatedDeviceIds, uint32_t idsSize, size_t *written)
+{
+    if (format == TC_FORMAT_CBOR)
+    {
+        return commissioning_request_cbor_slice_n(buffer, bufferLen, requestId, deviceType, physicalId, relatedDeviceIds, idsSize, written);
+    }
+
+    return commissioning_request_slice_n(buffer, bufferLen, requestId, deviceType, physicalId, relatedDeviceIds, idsSize, written);
+}
+
+/**
+ * @brief Read a message ID value
+ *
+ * IDs are expected to be strings, numbers are accepted as is. Any other
+ * type leaves the ID empty.
+ *
+ * @param[in]   type   Type of the value.
+ * @param[in]   value  Value token.
+ * @param[out]  id     Message ID.
+ */
+void tc_read_id(tc_json_type type, tc_slice value, tc_slice *id)
+{
+    if (type == TC_JSON_STRING || type == TC_JSON_NUMBER)
+    {
+        *id = value;
+    }
+}
+
+/**
+ * @brief Read a response result object
+ *
+ * Reads the object in place, so a large body is skipped only once.
+ *
+ * @param[in]   reader         JSON reader positioned on the result object.
+ * @param[out]  statusCode     Result status code, converted like json_object_get_int.
+ * @param[out]  hasStatusCode  Optional. Whether the result has a status code.
+ * @param[out]  deviceId       Optional. Result device ID.
+ * @param[out]  body           Optional. Raw result body.
+ *
+ * @return Zero on success, a negative value otherwise
+ */
+IoT_Error_t tc_read_result(tc_json_reader *reader, uint16_t *statusCode, bool *hasStatusCode, tc_slice *deviceId, tc_slice *body)
+{
+    IoT_Error_t rc = tc_json_object_begin(reader);
+    while (rc == SUCCESS)
+    {
+        tc_slice key;
+        tc_slice value;
+        tc_json_type type;
+        bool hasMember;
+
+        rc = tc_json_object_next(reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        rc = tc_json_read_value(reader, &type, &value);
+        if (rc != SUCCESS)
+        {
+            break;
+        }
+
+        if (TC_SLICE_EQUALS(key, "statusCode"))
+        {
+            *statusCode = (uint16_t)tc_json_slice_coerce_int(type, value);
+            if (hasStatusCode != NULL)
+            {
+                *hasStatusCode = true;
+            }
+        }
+        else if (deviceId != NULL && TC_SLICE_EQUALS(key, "deviceId"))
+        {
+            tc_read_id(type, value, deviceId);
+        }
+        else if (body != NULL && TC_SLICE_EQUALS(key, "body") && type != TC_JSON_NULL)
+        {
+            *body = value;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Scan a response result object
+ *
+ * @param[in]   result         Raw result object.
+ * @param[out]  statusCode     Result status code, converted like json_object_get_int.
+ * @param[out]  hasStatusCode  Optional. Whether the result has a status code.
+ * @param[out]  deviceId       Optional. Result device ID.
+ * @param[out]  body           Optional. Raw result body.
+ *
+ * @return Zero on success, a negative value otherwise
+ */
+IoT_Error_t tc_scan_result(tc_slice result, uint16_t *statusCode, bool *hasStatusCode, tc_slice *deviceId, tc_slice *body)
+{
+    tc_json_reader reader;
+    tc_json_reader_init(&reader, result.data, result.len);
+
+    return tc_read_result(&reader, statusCode, hasStatusCode, deviceId, body);
+}
+
+/**
+ * @brief Scan a CBOR response result map
+ *
+ * @param[in]   result         Encoded result map.
+ * @param[out]  statusCode     Result status code.
+ * @param[out]  hasStatusCode  Optional. Whether the result has an integer status code.
+ * @param[out]  deviceId       Optional. Result device ID.
+ * @param[out]  body           Optional. Encoded result body.
+ *
+ * @return Zero on success, a negative value otherwise
+ */
+IoT_Error_t tc_cbor_scan_result(tc_slice result, uint16_t *statusCode, bool *hasStatusCode, tc_slice *deviceId, tc_slice *body)
+{
+    tc_cbor_reader reader;
+    tc_cbor_reader_init(&reader, result.data, result.len);
+
+    uint64_t remaining = 0;
+    IoT_Error_t rc = tc_cbor_map_begin(&reader, &remaining);
+    while (rc == SUCCESS)
+    {
+        tc_slice key;
+        tc_slice value;
+        tc_json_type type;
+        bool hasMember;
+
+        rc = tc_cbor_map_next(&reader, &remaining, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        rc = tc_cbor_read_value(&reader, &type, &value);
+        if (rc != SUCCESS)
+        {
+            break;
+        }
+
+        if (TC_SLICE_EQUALS(key, "statusCode"))
+        {
+            int64_t code = 0;
+            if (type == TC_JSON_NUMBER && tc_cbor_slice_to_int(value, &code) == SUCCESS)
+            {
+                *statusCode = (uint16_t)code;
+                if (hasStatusCode != NULL)
+                {
+                    *hasStatusCode = true;
+                }
+            }
+        }
+        else if (deviceId != NULL && TC_SLICE_EQUALS(key, "deviceId") && type == TC_JSON_STRING)
+        {
+            *deviceId = value;
+        }
+        else if (body != NULL && TC_SLICE_EQUALS(key, "body") && type != TC_JSON_NULL)
+        {
+            *body = value;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Zero-copy view of a commissioning response
+ *
+ * Slices point into the payload the view was read from.
+ */
+typedef struct
+{
+    tc_slice requestId;
+    uint16_t statusCode;
+    bool hasStatusCode;
+    tc_slice deviceId;
+} tc_commissioning_response_view;
+
+/**
+ * @brief Scan a commissioning response payload
+ *
+ * Scans a commissioning response in place, without allocating or copying.
+ * A strict scan fails on anything but whitespace after the message.
+ * 
+ * @param[out]  view        Commissioning response fields.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * @param[in]   strict      Whether to fail on trailing bytes.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t tc_read_commissioning_response(tc_commissioning_response_view *view, const char *payload, size_t payloadLen, bool strict)
+{
+    if (view == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    memset(view, 0, sizeof(*view));
+
+    if (payload == NULL || payloadLen == 0)
+    {
+        FUNC_EXIT_RC(SUCCESS);
+    }
+
+    tc_json_reader reader;
+    tc_json_reader_init(&reader, payload, payloadLen);
+    reader.strict = strict;
+
+    IoT_Error_t rc = tc_json_object_begin(&reader);
+    while (rc == SUCCESS)
+    {
+        tc_slice key;
+        tc_slice value;
+        tc_json_type type;
+        bool hasMember;
+
+        rc = tc_json_object_next(&reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        tc_json_skip_whitespace(&reader);
+        if (TC_SLICE_EQUALS(key, "result") && reader.cursor < reader.end && *reader.cursor == '{')
+        {
+            rc = tc_read_result(&reader, &view->statusCode, &view->hasStatusCode, &view->deviceId, NULL);
+            continue;
+        }
+
+        rc = tc_json_read_value(&reader, &type, &value);
+        if (rc != SUCCESS)
+        {
+            break;
+        }
+
+        if (TC_SLICE_EQUALS(key, "id"))
+        {
+            tc_read_id(type, value, &view->requestId);
+        }
+    }
+
+    if (rc == SUCCESS)
+    {
+        rc = tc_json_reader_finish(&reader);
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Scan a commissioning response
+ *
+ * Scans a commissioning response in place, without allocating or copying.
+ * 
+ * @param[out]  view        Commissioning response fields.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t commissioning_response_view(tc_commissioning_response_view *view, const char *payload, size_t payloadLen)
+{
+    return tc_read_commissioning_response(view, payload, payloadLen, true);
+}
+
+/**
+ * @brief Scan a CBOR commissioning response
+ *
+ * Scans a commissioning response in place, without allocating or copying.
+ * Only string IDs are read.
+ * 
+ * @param[out]  view        Commissioning response fields.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t commissioning_response_cbor_view(tc_commissioning_response_view *view, const char *payload, size_t payloadLen)
+{
+    if (view == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    memset(view, 0, sizeof(*view));
+
+    if (payload == NULL || payloadLen == 0)
+    {
+        FUNC_EXIT_RC(SUCCESS);
+    }
+
+    tc_cbor_reader reader;
+    tc_cbor_reader_init(&reader, payload, payloadLen);
+
+    uint64_t remaining = 0;
+    IoT_Error_t rc = tc_cbor_map_begin(&reader, &remaining);
+    while (rc == SUCCESS)
+    {
+        tc_slice key;
+        tc_slice value;
+        tc_json_type type;
+        bool hasMember;
+
+        rc = tc_cbor_map_next(&reader, &remaining, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        rc = tc_cbor_read_value(&reader, &type, &value);
+        if (rc != SUCCESS)
+        {
+            break;
+        }
+
+        if (TC_SLICE_EQUALS(key, "id") && type == TC_JSON_STRING)
+        {
+            view->requestId = value;
+        }
+        else if (TC_SLICE_EQUALS(key, "result") && type == TC_JSON_OBJECT)
+        {
+            rc = tc_cbor_scan_result(value, &view->statusCode, &view->hasStatusCode, &view->deviceId, NULL);
+        }
+    }
+
+    if (rc == SUCCESS)
+    {
+        rc = tc_cbor_reader_finish(&reader);
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Scan a commissioning response in a payload format
+ * 
+ * @param[in]  format  Payload format.
+ * 
+ * See commissioning_response_view for the other parameters.
+ */
+IoT_Error_t tc_unmarshal_commissioning_response(tc_format format, tc_commissioning_response_view *view, const char *payload, size_t payloadLen)
+{
+    TC_TRACE_BEGIN(TC_TRACE_UNMARSHAL, payloadLen);
+
+    const IoT_Error_t rc = format == TC_FORMAT_CBOR ? commissioning_response_cbor_view(view, payload, payloadLen) : commissioning_response_view(view, payload, payloadLen);
+
+    TC_TRACE_END(TC_TRACE_UNMARSHAL, rc);
+
+    return rc;
+}
+
+/**
+ * @brief Unmarshall a commissioning response 
+ * 
+ * Unmarshall a commissioning response from a string stream.
+ * 
+ * @param[out]  deviceId    Assigned device ID.
+ * @param[out]  statusCode  Commissioning status.
+ * @param[out]  requestId   ID of the original request.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t commissioning_response(char *deviceId, uint16_t *statusCode, char *requestId, char *payload, uint16_t payloadLen)
+{
+    if (payload == NULL || payloadLen == 0)
+    {
+        FUNC_EXIT_RC(SUCCESS);
+    }
+
+    // Like json-c, ignore whatever follows the message
+    TC_TRACE_BEGIN(TC_TRACE_UNMARSHAL, payloadLen);
+
+    tc_commissioning_response_view view;
+    IoT_Error_t rc = tc_read_commissioning_response(&view, payload, payloadLen, false);
+
+    TC_TRACE_END(TC_TRACE_UNMARSHAL, rc);
+
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    if (requestId != NULL && view.requestId.data != NULL)
+    {
+        rc = tc_json_unescape(requestId, SIZE_MAX, view.requestId, NULL);
+        if (rc != SUCCESS)
+        {
+            FUNC_EXIT_RC(rc);
+        }
+    }
+
+    // Leave the status code alone when the result has none
+    if (statusCode != NULL && view.hasStatusCode)
+    {
+        *statusCode = view.statusCode;
+    }
+
+    if (deviceId != NULL && view.deviceId.data != NULL)
+    {
+        rc = tc_json_unescape(deviceId, SIZE_MAX, view.deviceId, NULL);
+        if (rc != SUCCESS)
+        {
+            FUNC_EXIT_RC(rc);
+        }
+    }
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Marshal a command response into a bounded buffer from slices
+ * 
+ * See command_response_n. A slice with NULL data is left out like a NULL string.
+ */
+IoT_Error_t command_response_slice_n(char *buffer, size_t bufferLen, tc_slice requestId, uint16_t statusCode, bool isErrorResponse, tc_slice errorMessage, json_object *body, size_t *written)
+{
+    tc_json_writer writer;
+    tc_json_writer_init(&writer, buffer, bufferLen);
+
+    tc_json_begin_object(&writer);
+    if (requestId.data != NULL)
+    {
+        tc_json_key(&writer, "id");
+        tc_json_string_len(&writer, requestId.data, requestId.len);
+    }
+
+    if (isErrorResponse)
+    {
+        tc_json_key(&writer, "error");
+        tc_json_begin_object(&writer);
+        tc_json_key(&writer, "statusCode");
+        tc_json_int(&writer, statusCode);
+        if (errorMessage.data != NULL)
+        {
+            tc_json_key(&writer, "message");
+            tc_json_string_len(&writer, errorMessage.data, errorMessage.len);
+        }
+        tc_json_end_object(&writer);
+    }
+    else
+    {
+        tc_json_key(&writer, "result");
+        tc_json_begin_object(&writer);
+        tc_json_key(&writer, "statusCode");
+        tc_json_int(&writer, statusCode);
+        if (body != NULL)
+        {
+            tc_json_key(&writer, "body");
+            tc_json_object(&writer, body);
+        }
+        tc_json_end_object(&writer);
+    }
+
+    tc_json_end_object(&writer);
+
+    // The response takes ownership of body
+    json_object_put(body);
+
+    const IoT_Error_t rc = tc_json_writer_finish(&writer);
+    if (written != NULL)
+    {
+        *written = writer.length;
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Marshal a command response into a bounded buffer
+ * 
+ * Marshal a command response into a JSON string.
+ * 
+ * @param[out]  buffer           Pointer to a string buffer to write to.
+ * @param[in]   bufferLen        Size of buffer, including room for the null character.
+ * @param[in]   requestId        Command request's ID.
+ * @param[in]   statusCode       Command's response status.
+ * @param[in]   isErrorResponse  Signals if a command responds with an error.
+ * @param[in]   errorMessage     Response error message. Only used if isErrorResponse is set to true.
+ * @param[in]   body             Command response body. The response takes ownership of body.
+ * @param[out]  written          Optional. Length of the message, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         a negative value otherwise
+ */
+IoT_Error_t command_response_n(char *buffer, size_t bufferLen, const char *requestId, uint16_t statusCode, bool isErrorResponse, char *errorMessage, json_object *body, size_t *written)
+{
+    return command_response_slice_n(buffer, bufferLen, tc_slice_of(requestId), statusCode, isErrorResponse, tc_slice_of(errorMessage), body, written);
+}
+
+/**
+ * @brief Marshal a command response
+ * 
+ * Marshal a command response into a JSON string.
+ * 
+ * @param[out]  buffer           Pointer to a string buffer to write to.
+ * @param[in]   requestId        Command request's ID.
+ * @param[in]   statusCode       Command's response status.
+ * @param[in]   isErrorResponse  Signals if a command responds with an error.
+ * @param[in]   errorMessage     Response error message. Only used if isErrorResponse is set to true.
+ * @param[in]   body             Command response body. The response takes ownership of body.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t command_response(char *buffer, const char *requestId, uint16_t statusCode, bool isErrorResponse, char *errorMessage, json_object *body)
+{
+    return command_response_n(buffer, SIZE_MAX, requestId, statusCode, isErrorResponse, errorMessage, body, NULL);
+}
+
+/**
+ * @brief Marshal a command response as CBOR from slices
+ * 
+ * See command_response_cbor_n. A slice with NULL data is left out like a NULL string.
+ */
+IoT_Error_t command_response_cbor_slice_n(char *buffer, size_t bufferLen, tc_slice requestId, uint16_t statusCode, bool isErrorResponse, tc_slice errorMessage, json_object *body, size_t *written)
+{
+    tc_cbor_writer writer;
+    tc_cbor_writer_init(&writer, buffer, bufferLen);
+
+    tc_cbor_begin_map(&writer, requestId.data != NULL ? 2 : 1);
+    if (requestId.data != NULL)
+    {
+        tc_cbor_string(&writer, "id");
+        tc_cbor_string_len(&writer, requestId.data, requestId.len);
+    }
+
+    if (isErrorResponse)
+    {
+        tc_cbor_string(&writer, "error");
+        tc_cbor_begin_map(&writer, errorMessage.data != NULL ? 2 : 1);
+        tc_cbor_string(&writer, "statusCode");
+        tc_cbor_int(&writer, statusCode);
+        if (errorMessage.data != NULL)
+        {
+            tc_cbor_string(&writer, "message");
+            tc_cbor_string_len(&writer, errorMessage.data, errorMessage.len);
+        }
+    }
+    else
+    {
+        tc_cbor_string(&writer, "result");
+        tc_cbor_begin_map(&writer, body != NULL ? 2 : 1);
+        tc_cbor_string(&writer, "statusCode");
+        tc_cbor_int(&writer, statusCode);
+        if (body != NULL)
+        {
+            tc_cbor_string(&writer, "body");
+            tc_cbor_object(&writer, body);
+        }
+    }
+
+    // The response takes ownership of body
+    json_object_put(body);
+
+    const IoT_Error_t rc = tc_cbor_writer_finish(&writer);
+    if (written != NULL)
+    {
+        *written = writer.length;
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Marshal a command response as CBOR
+ * 
+ * Marshal a command response with the shape of the JSON response.
+ * 
+ * @param[out]  buffer           Buffer to write to.
+ * @param[in]   bufferLen        Size of buffer.
+ * @param[in]   requestId        Command request's ID.
+ * @param[in]   statusCode       Command's response status.
  * @param[in]   isErrorResponse  Signals if a command responds with an error.
  * @param[in]   errorMessage     Response error message. Only used if isErrorResponse is set to true.
- * @param[in]   body             Command response body.
+ * @param[in]   body             Command response body. The response takes ownership of body.
+ * @param[out]  written          Optional. Length of the message, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         a negative value otherwise
+ */
+IoT_Error_t command_response_cbor_n(char *buffer, size_t bufferLen, const char *requestId, uint16_t statusCode, bool isErrorResponse, char *errorMessage, json_object *body, size_t *written)
+{
+    return command_response_cbor_slice_n(buffer, bufferLen, tc_slice_of(requestId), statusCode, isErrorResponse, tc_slice_of(errorMessage), body, written);
+}
+
+/**
+ * @brief Marshal a command response in a payload format
+ * 
+ * @param[in]  format  Payload format.
+ * 
+ * See command_response_n for the other parameters. bufferLen needs no
+ * room for a null character with TC_FORMAT_CBOR.
+ */
+IoT_Error_t tc_marshal_command_response(tc_format format, char *buffer, size_t bufferLen, const char *requestId, uint16_t statusCode, bool isErrorResponse, char *errorMessage, json_object *body, size_t *written)
+{
+    if (format == TC_FORMAT_CBOR)
+    {
+        return command_response_cbor_n(buffer, bufferLen, requestId, statusCode, isErrorResponse, errorMessage, body, written);
+    }
+
+    return command_response_n(buffer, bufferLen, requestId, statusCode, isErrorResponse, errorMessage, body, written);
+}
+
+/**
+ * @brief Marshal a command response from slices in a payload format
+ * 
+ * See tc_marshal_command_response and command_response_slice_n.
+ */
+IoT_Error_t tc_marshal_command_response_slice(tc_format format, char *buffer, size_t bufferLen, tc_slice requestId, uint16_t statusCode, bool isErrorResponse, tc_slice errorMessage, json_object *body, size_t *written)
+{
+    if (format == TC_FORMAT_CBOR)
+    {
+        return command_response_cbor_slice_n(buffer, bufferLen, requestId, statusCode, isErrorResponse, errorMessage, body, written);
+    }
+
+    return command_response_slice_n(buffer, bufferLen, requestId, statusCode, isErrorResponse, errorMessage, body, written);
+}
+
+/**
+ * @brief Zero-copy view of a command request
+ *
+ * Slices point into the payload the view was read from. params holds the
+ * raw JSON of the request parameters, or their encoded item when read
+ * from CBOR.
+ */
+typedef struct
+{
+    tc_slice requestId;
+    tc_slice method;
+    tc_slice params;
+} tc_command_request_view;
+
+/**
+ * @brief Scan a command request payload
+ *
+ * Scans a command request in place, without allocating or copying.
+ * A strict scan fails on anything but whitespace after the message.
+ * 
+ * @param[out]  view        Command request fields.
+ * @param[in]   payload     Request payload.
+ * @param[in]   payloadLen  Request payload's length.
+ * @param[in]   strict      Whether to fail on trailing bytes.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t tc_read_command_request(tc_command_request_view *view, const char *payload, size_t payloadLen, bool strict)
+{
+    if (view == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    memset(view, 0, sizeof(*view));
+
+    if (payload == NULL || payloadLen == 0)
+    {
+        FUNC_EXIT_RC(SUCCESS);
+    }
+
+    tc_json_reader reader;
+    tc_json_reader_init(&reader, payload, payloadLen);
+    reader.strict = strict;
+
+    IoT_Error_t rc = tc_json_object_begin(&reader);
+    while (rc == SUCCESS)
+    {
+        tc_slice key;
+        tc_slice value;
+        tc_json_type type;
+        bool hasMember;
+
+        rc = tc_json_object_next(&reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        rc = tc_json_read_value(&reader, &type, &value);
+        if (rc != SUCCESS)
+        {
+            break;
+        }
+
+        if (TC_SLICE_EQUALS(key, "id"))
+        {
+            tc_read_id(type, value, &view->requestId);
+        }
+        else if (TC_SLICE_EQUALS(key, "method") && type == TC_JSON_STRING)
+        {
+            view->method = value;
+        }
+        else if (TC_SLICE_EQUALS(key, "params") && type != TC_JSON_NULL)
+        {
+            view->params = value;
+        }
+    }
+
+    if (rc == SUCCESS)
+    {
+        rc = tc_json_reader_finish(&reader);
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Scan a command request payload
+ *
+ * Scans a command request in place, without allocating or copying.
+ * 
+ * @param[out]  view        Command request fields.
+ * @param[in]   payload     Request payload.
+ * @param[in]   payloadLen  Request payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t command_request_view(tc_command_request_view *view, const char *payload, size_t payloadLen)
+{
+    return tc_read_command_request(view, payload, payloadLen, true);
+}
+
+/**
+ * @brief Scan a CBOR command request payload
+ *
+ * Scans a command request in place, without allocating or copying.
+ * Only string IDs are read.
+ * 
+ * @param[out]  view        Command request fields.
+ * @param[in]   payload     Request payload.
+ * @param[in]   payloadLen  Request payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t command_request_cbor_view(tc_command_request_view *view, const char *payload, size_t payloadLen)
+{
+    if (view == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    memset(view, 0, sizeof(*view));
+
+    if (payload == NULL || payloadLen == 0)
+    {
+        FUNC_EXIT_RC(SUCCESS);
+    }
+
+    tc_cbor_reader reader;
+    tc_cbor_reader_init(&reader, payload, payloadLen);
+
+    uint64_t remaining = 0;
+    IoT_Error_t rc = tc_cbor_map_begin(&reader, &remaining);
+    while (rc == SUCCESS)
+    {
+        tc_slice key;
+        tc_slice value;
+        tc_json_type type;
+        bool hasMember;
+
+        rc = tc_cbor_map_next(&reader, &remaining, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        rc = tc_cbor_read_value(&reader, &type, &value);
+        if (rc != SUCCESS)
+        {
+            break;
+        }
+
+        if (TC_SLICE_EQUALS(key, "id") && type == TC_JSON_STRING)
+        {
+            view->requestId = value;
+        }
+        else if (TC_SLICE_EQUALS(key, "method") && type == TC_JSON_STRING)
+        {
+            view->method = value;
+        }
+        else if (TC_SLICE_EQUALS(key, "params") && type != TC_JSON_NULL)
+        {
+            view->params = value;
+        }
+    }
+
+    if (rc == SUCCESS)
+    {
+        rc = tc_cbor_reader_finish(&reader);
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Scan a command request in a payload format
+ * 
+ * @param[in]  format  Payload format.
+ * 
+ * See command_request_view for the other parameters.
+ */
+IoT_Error_t tc_unmarshal_command_request(tc_format format, tc_command_request_view *view, const char *payload, size_t payloadLen)
+{
+    TC_TRACE_BEGIN(TC_TRACE_UNMARSHAL, payloadLen);
+
+    const IoT_Error_t rc = format == TC_FORMAT_CBOR ? command_request_cbor_view(view, payload, payloadLen) : command_request_view(view, payload, payloadLen);
+
+    TC_TRACE_END(TC_TRACE_UNMARSHAL, rc);
+
+    return rc;
+}
+
+/**
+ * @brief Find the data object of command params or a body
+ * 
+ * Command params carry their fields as [{"data":{...}}] and bodies as
+ * {"data":{...}}. Accepts either and returns the raw JSON of the data
+ * member, or an empty slice when there is none.
+ * 
+ * @param[in]   value  Raw JSON params or body, e.g. a view's params.
+ * @param[out]  data   Raw JSON of the data member.
+ * 
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_data_slice(tc_slice value, tc_slice *data)
+{
+    data->data = NULL;
+    data->len = 0;
+
+    if (value.data == NULL)
+    {
+        FUNC_EXIT_RC(SUCCESS);
+    }
+
+    tc_json_reader reader;
+    tc_json_reader_init(&reader, value.data, value.len);
+
+    IoT_Error_t rc = SUCCESS;
+    tc_json_skip_whitespace(&reader);
+    if (reader.cursor < reader.end && *reader.cursor == '[')
+    {
+        bool hasElement = false;
+        rc = tc_json_array_begin(&reader);
+        if (rc == SUCCESS)
+        {
+            rc = tc_json_array_next(&reader, &hasElement);
+        }
+
+        if (rc != SUCCESS || !hasElement)
+        {
+            FUNC_EXIT_RC(rc);
+        }
+    }
+
+    rc = tc_json_object_begin(&reader);
+
+    tc_slice key;
+    tc_json_type type;
+    tc_slice member;
+    bool hasMember = false;
+
+    while (rc == SUCCESS)
+    {
+        rc = tc_json_object_next(&reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        rc = tc_json_read_value(&reader, &type, &member);
+        if (rc == SUCCESS && TC_SLICE_EQUALS(key, "data"))
+        {
+            if (type != TC_JSON_NULL)
+            {
+                *data = member;
+            }
+            break;
+        }
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Unmarshall a command request payload using a context
+ * 
+ * Unmarshall a command request from a payload in the context's format,
+ * parsing JSON params with the context's pooled tokeners.
+ * Compressed payloads are decompressed into the context's compression
+ * buffer first.
+ * 
+ * @param[in]   context     Optional. ThinCloud context.
+ * @param[out]  requestId   ID of the original request.
+ * @param[out]  method      Command method.
+ * @param[out]  params      Command request parameters. The caller owns the result.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t command_request_ctx(tc_context *context, char *requestId, char *method, json_object **params, const char *payload, const unsigned int payloadLen)
+{
+    if (payload == NULL || payloadLen == 0)
+    {
+        FUNC_EXIT_RC(SUCCESS);
+    }
+
+    size_t messageLen = payloadLen;
+    IoT_Error_t rc = SUCCESS;
+    if (context != NULL)
+    {
+        rc = tc_inflate(context->compression.dictionary, context->compression.buffer, context->compression.bufferLen, &payload, &messageLen);
+    }
+    else if (tc_lz_is_packed(payload, messageLen))
+    {
+        rc = NULL_VALUE_ERROR;
+    }
+
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    // Like json-c, ignore whatever follows a JSON message
+    TC_TRACE_BEGIN(TC_TRACE_UNMARSHAL, messageLen);
+
+    tc_command_request_view view;
+    if (tc_context_format(context) == TC_FORMAT_CBOR)
+    {
+        rc = command_request_cbor_view(&view, payload, messageLen);
+    }
+    else
+    {
+        rc = tc_read_command_request(&view, payload, messageLen, false);
+    }
+
+    TC_TRACE_END(TC_TRACE_UNMARSHAL, rc);
+
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    if (requestId != NULL && view.requestId.data != NULL)
+    {
+        rc = tc_context_copy_string(context, requestId, view.requestId);
+        if (rc != SUCCESS)
+        {
+            FUNC_EXIT_RC(rc);
+        }
+    }
+
+    if (method != NULL && view.method.data != NULL)
+    {
+        rc = tc_context_copy_string(context, method, view.method);
+        if (rc != SUCCESS)
+        {
+            FUNC_EXIT_RC(rc);
+        }
+    }
+
+    if (params != NULL && view.params.data != NULL)
+    {
+        rc = tc_context_parse_value(context, view.params, params);
+        if (rc != SUCCESS)
+        {
+            FUNC_EXIT_RC(rc);
+        }
+    }
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Unmarshall a command request payload 
+ * 
+ * Unmarshall a command request from a string payload. 
+ * 
+ * @param[out]  requestId   ID of the original request.
+ * @param[out]  method      Command method.
+ * @param[out]  params      Command request parameters. The caller owns the result.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t command_request(char *requestId, char *method, json_object **params, const char *payload, const unsigned int payloadLen)
+{
+    return command_request_ctx(NULL, requestId, method, params, payload, payloadLen);
+}
+
+/**
+ * @brief Marshal a service request into a bounded buffer from slices
+ * 
+ * See service_request_n. A slice with NULL data is left out like a NULL string.
+ */
+IoT_Error_t service_request_slice_n(char *buffer, size_t bufferLen, tc_slice requestId, tc_slice method, json_object *params, size_t *written)
+{
+    if (method.data == NULL)
+    {
+        json_object_put(params);
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    tc_json_writer writer;
+    tc_json_writer_init(&writer, buffer, bufferLen);
+
+    tc_json_begin_object(&writer);
+    if (requestId.data != NULL)
+    {
+        tc_json_key(&writer, "id");
+        tc_json_string_len(&writer, requestId.data, requestId.len);
+    }
+
+    tc_json_key(&writer, "method");
+    tc_json_string_len(&writer, method.data, method.len);
+
+    if (params != NULL)
+    {
+        tc_json_key(&writer, "params");
+        tc_json_object(&writer, params);
+    }
+
+    tc_json_end_object(&writer);
+
+    // The request takes ownership of params
+    json_object_put(params);
+
+    const IoT_Error_t rc = tc_json_writer_finish(&writer);
+    if (written != NULL)
+    {
+        *written = writer.length;
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Marshal a service request into a bounded buffer
+ * 
+ * Marshal a service request to a JSON string.
+ * 
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   requestId  Unique ID for the request.
+ * @param[in]   method     Service method to request.
+ * @param[in]   params     Service request parameters. The request takes ownership of params.
+ * @param[out]  written    Optional. Length of the message, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         a negative value otherwise
+ */
+IoT_Error_t service_request_n(char *buffer, size_t bufferLen, const char *requestId, const char *method, json_object *params, size_t *written)
+{
+    return service_request_slice_n(buffer, bufferLen, tc_slice_of(requestId), tc_slice_of(method), params, written);
+}
+
+/**
+ * @brief Marshal a service request
+ * 
+ * Marshal a service request to a JSON string.
+ * 
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   requestId  Unique ID for the request.
+ * @param[in]   method     Service method to request.
+ * @param[in]   params     Service request parameters. The request takes ownership of params.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t service_request(char *buffer, const char *requestId, const char *method, json_object *params)
+{
+    return service_request_n(buffer, SIZE_MAX, requestId, method, params, NULL);
+}
+
+/**
+ * @brief Marshal a service request as CBOR from slices
+ * 
+ * See service_request_cbor_n. A slice with NULL data is left out like a NULL string.
+ */
+IoT_Error_t service_request_cbor_slice_n(char *buffer, size_t bufferLen, tc_slice requestId, tc_slice method, json_object *params, size_t *written)
+{
+    if (method.data == NULL)
+    {
+        json_object_put(params);
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    tc_cbor_writer writer;
+    tc_cbor_writer_init(&writer, buffer, bufferLen);
+
+    tc_cbor_begin_map(&writer, 1 + (requestId.data != NULL ? 1 : 0) + (params != NULL ? 1 : 0));
+    if (requestId.data != NULL)
+    {
+        tc_cbor_string(&writer, "id");
+        tc_cbor_string_len(&writer, requestId.data, requestId.len);
+    }
+
+    tc_cbor_string(&writer, "method");
+    tc_cbor_string_len(&writer, method.data, method.len);
+
+    if (params != NULL)
+    {
+        tc_cbor_string(&writer, "params");
+        tc_cbor_object(&writer, params);
+    }
+
+    // The request takes ownership of params
+    json_object_put(params);
+
+    const IoT_Error_t rc = tc_cbor_writer_finish(&writer);
+    if (written != NULL)
+    {
+        *written = writer.length;
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Marshal a service request as CBOR
+ * 
+ * Marshal a service request with the shape of the JSON request.
+ * 
+ * @param[out]  buffer     Buffer to write to.
+ * @param[in]   bufferLen  Size of buffer.
+ * @param[in]   requestId  Unique ID for the request.
+ * @param[in]   method     Service method to request.
+ * @param[in]   params     Service request parameters. The request takes ownership of params.
+ * @param[out]  written    Optional. Length of the message, or the length needed when buffer is too small.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         a negative value otherwise
+ */
+IoT_Error_t service_request_cbor_n(char *buffer, size_t bufferLen, const char *requestId, const char *method, json_object *params, size_t *written)
+{
+    return service_request_cbor_slice_n(buffer, bufferLen, tc_slice_of(requestId), tc_slice_of(method), params, written);
+}
+
+/**
+ * @brief Marshal a service request in a payload format
+ * 
+ * @param[in]  format  Payload format.
+ * 
+ * See service_request_n for the other parameters. bufferLen needs no
+ * room for a null character with TC_FORMAT_CBOR.
+ */
+IoT_Error_t tc_marshal_service_request(tc_format format, char *buffer, size_t bufferLen, const char *requestId, const char *method, json_object *params, size_t *written)
+{
+    if (format == TC_FORMAT_CBOR)
+    {
+        return service_request_cbor_n(buffer, bufferLen, requestId, method, params, written);
+    }
+
+    return service_request_n(buffer, bufferLen, requestId, method, params, written);
+}
+
+/**
+ * @brief Marshal a service request from slices in a payload format
+ * 
+ * See tc_marshal_service_request and service_request_slice_n.
+ */
+IoT_Error_t tc_marshal_service_request_slice(tc_format format, char *buffer, size_t bufferLen, tc_slice requestId, tc_slice method, json_object *params, size_t *written)
+{
+    if (format == TC_FORMAT_CBOR)
+    {
+        return service_request_cbor_slice_n(buffer, bufferLen, requestId, method, params, written);
+    }
+
+    return service_request_slice_n(buffer, bufferLen, requestId, method, params, written);
+}
+
+/**
+ * @brief Zero-copy view of a service response
+ *
+ * Slices point into the payload the view was read from. body holds the
+ * raw JSON of the response body, or its encoded item when read from CBOR.
+ */
+typedef struct
+{
+    tc_slice requestId;
+    uint16_t statusCode;
+    bool hasStatusCode;
+    tc_slice body;
+} tc_service_response_view;
+
+/**
+ * @brief Scan a service response payload
+ *
+ * Scans a service response in place, without allocating or copying.
+ * A strict scan fails on anything but whitespace after the message.
+ * 
+ * @param[out]  view        Service response fields.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * @param[in]   strict      Whether to fail on trailing bytes.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t tc_read_service_response(tc_service_response_view *view, const char *payload, size_t payloadLen, bool strict)
+{
+    if (view == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    memset(view, 0, sizeof(*view));
+
+    if (payload == NULL || payloadLen == 0)
+    {
+        FUNC_EXIT_RC(SUCCESS);
+    }
+
+    tc_json_reader reader;
+    tc_json_reader_init(&reader, payload, payloadLen);
+    reader.strict = strict;
+
+    IoT_Error_t rc = tc_json_object_begin(&reader);
+    while (rc == SUCCESS)
+    {
+        tc_slice key;
+        tc_slice value;
+        tc_json_type type;
+        bool hasMember;
+
+        rc = tc_json_object_next(&reader, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        tc_json_skip_whitespace(&reader);
+        if (TC_SLICE_EQUALS(key, "result") && reader.cursor < reader.end && *reader.cursor == '{')
+        {
+            rc = tc_read_result(&reader, &view->statusCode, &view->hasStatusCode, NULL, &view->body);
+            continue;
+        }
+
+        rc = tc_json_read_value(&reader, &type, &value);
+        if (rc != SUCCESS)
+        {
+            break;
+        }
+
+        if (TC_SLICE_EQUALS(key, "id"))
+        {
+            tc_read_id(type, value, &view->requestId);
+        }
+    }
+
+    if (rc == SUCCESS)
+    {
+        rc = tc_json_reader_finish(&reader);
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Scan a service response payload
+ *
+ * Scans a service response in place, without allocating or copying.
+ * 
+ * @param[out]  view        Service response fields.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t service_response_view(tc_service_response_view *view, const char *payload, size_t payloadLen)
+{
+    return tc_read_service_response(view, payload, payloadLen, true);
+}
+
+/**
+ * @brief Scan a CBOR service response payload
+ *
+ * Scans a service response in place, without allocating or copying.
+ * Only string IDs are read.
+ * 
+ * @param[out]  view        Service response fields.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t service_response_cbor_view(tc_service_response_view *view, const char *payload, size_t payloadLen)
+{
+    if (view == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    memset(view, 0, sizeof(*view));
+
+    if (payload == NULL || payloadLen == 0)
+    {
+        FUNC_EXIT_RC(SUCCESS);
+    }
+
+    tc_cbor_reader reader;
+    tc_cbor_reader_init(&reader, payload, payloadLen);
+
+    uint64_t remaining = 0;
+    IoT_Error_t rc = tc_cbor_map_begin(&reader, &remaining);
+    while (rc == SUCCESS)
+    {
+        tc_slice key;
+        tc_slice value;
+        tc_json_type type;
+        bool hasMember;
+
+        rc = tc_cbor_map_next(&reader, &remaining, &key, &hasMember);
+        if (rc != SUCCESS || !hasMember)
+        {
+            break;
+        }
+
+        rc = tc_cbor_read_value(&reader, &type, &value);
+        if (rc != SUCCESS)
+        {
+            break;
+        }
+
+        if (TC_SLICE_EQUALS(key, "id") && type == TC_JSON_STRING)
+        {
+            view->requestId = value;
+        }
+        else if (TC_SLICE_EQUALS(key, "result") && type == TC_JSON_OBJECT)
+        {
+            rc = tc_cbor_scan_result(value, &view->statusCode, &view->hasStatusCode, NULL, &view->body);
+        }
+    }
+
+    if (rc == SUCCESS)
+    {
+        rc = tc_cbor_reader_finish(&reader);
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Scan a service response in a payload format
+ * 
+ * @param[in]  format  Payload format.
+ * 
+ * See service_response_view for the other parameters.
+ */
+IoT_Error_t tc_unmarshal_service_response(tc_format format, tc_service_response_view *view, const char *payload, size_t payloadLen)
+{
+    TC_TRACE_BEGIN(TC_TRACE_UNMARSHAL, payloadLen);
+
+    const IoT_Error_t rc = format == TC_FORMAT_CBOR ? service_response_cbor_view(view, payload, payloadLen) : service_response_view(view, payload, payloadLen);
+
+    TC_TRACE_END(TC_TRACE_UNMARSHAL, rc);
+
+    return rc;
+}
+
+/**
+ * @brief Unmarshall a service response payload using a context
+ * 
+ * Unmarshall a service response from a payload in the context's format,
+ * parsing a JSON body with the context's pooled tokeners.
+ * Compressed payloads are decompressed into the context's compression
+ * buffer first.
+ * 
+ * @param[in]   context     Optional. ThinCloud context.
+ * @param[out]  requestId   Request ID of the original request.
+ * @param[out]  statusCode  Request's status.
+ * @param[out]  data        Response's data. The caller owns the result.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t service_response_ctx(tc_context *context, char *requestId, uint16_t *statusCode, json_object **data, const char *payload, const unsigned int payloadLen)
+{
+    if (payload == NULL || payloadLen == 0)
+    {
+        FUNC_EXIT_RC(SUCCESS);
+    }
+
+    size_t messageLen = payloadLen;
+    IoT_Error_t rc = SUCCESS;
+    if (context != NULL)
+    {
+        rc = tc_inflate(context->compression.dictionary, context->compression.buffer, context->compression.bufferLen, &payload, &messageLen);
+    }
+    else if (tc_lz_is_packed(payload, messageLen))
+    {
+        rc = NULL_VALUE_ERROR;
+    }
+
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    // Like json-c, ignore whatever follows a JSON message
+    TC_TRACE_BEGIN(TC_TRACE_UNMARSHAL, messageLen);
+
+    tc_service_response_view view;
+    if (tc_context_format(context) == TC_FORMAT_CBOR)
+    {
+        rc = service_response_cbor_view(&view, payload, messageLen);
+    }
+    else
+    {
+        rc = tc_read_service_response(&view, payload, messageLen, false);
+    }
+
+    TC_TRACE_END(TC_TRACE_UNMARSHAL, rc);
+
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    if (requestId != NULL && view.requestId.data != NULL)
+    {
+        rc = tc_context_copy_string(context, requestId, view.requestId);
+        if (rc != SUCCESS)
+        {
+            FUNC_EXIT_RC(rc);
+        }
+    }
+
+    // Leave the status code alone when the result has none
+    if (statusCode != NULL && view.hasStatusCode)
+    {
+        *statusCode = view.statusCode;
+    }
+
+    if (data != NULL && view.body.data != NULL)
+    {
+        rc = tc_context_parse_value(context, view.body, data);
+        if (rc != SUCCESS)
+        {
+            FUNC_EXIT_RC(rc);
+        }
+    }
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Unmarshall a service response payload 
+ * 
+ * Unmarshall a service response from a string payload. 
+ * 
+ * @param[out]  requestId   Request ID of the original request.
+ * @param[out]  statusCode  Request's status.
+ * @param[out]  data        Response's data. The caller owns the result.
+ * @param[in]   payload     Response payload.
+ * @param[in]   payloadLen  Reponse payload's length.
+ * 
+ * @return Zero on success, a negative value otherwise 
+ */
+IoT_Error_t service_response(char *requestId, uint16_t *statusCode, json_object **data, const char *payload, const unsigned int payloadLen)
+{
+    return service_response_ctx(NULL, requestId, statusCode, data, payload, payloadLen);
+}
+
+/**
+ * @brief Publish a message
+ * 
+ * Publish a payload to a topic with lengths already known.
+ * 
+ * @param[in]  client      AWS IoT MQTT Client instance.
+ * @param[in]  topic       Topic to publish to.
+ * @param[in]  topicLen    Length of the topic.
+ * @param[in]  payload     Message payload.
+ * @param[in]  payloadLen  Length of the payload.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_publish(AWS_IoT_Client *client, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen)
+{
+    IoT_Publish_Message_Params params;
+    params.qos = QOS0;
+    params.isRetained = false;
+    params.payload = (void *)payload;
+    params.payloadLen = payloadLen;
+
+    TC_TRACE_BEGIN(TC_TRACE_PUBLISH, payloadLen);
+
+    const IoT_Error_t rc = aws_iot_mqtt_publish(client, topic, topicLen, &params);
+
+    TC_TRACE_END(TC_TRACE_PUBLISH, rc);
+
+    return rc;
+}
+
+/**
+ * @brief Whether a message goes through a context's in-flight window
+ * 
+ * @param[in]  context  Optional. ThinCloud context.
+ * @param[in]  client   AWS IoT MQTT Client instance.
+ * @param[in]  qos      QoS of the message.
+ * 
+ * @return true for QoS1 messages when the context has a window attached to client
+ */
+bool tc_context_windowed(const tc_context *context, const AWS_IoT_Client *client, QoS qos)
+{
+    return qos == QOS1 && context != NULL && context->inflight != NULL && context->inflight->client == client;
+}
+
+/**
+ * @brief Send a message through a context's in-flight window
+ * 
+ * QoS1 messages go through the context's in-flight window when it has
+ * one attached to client; everything else is published with
+ * aws_iot_mqtt_publish. Neither the batch nor the outbox is used.
+ * 
+ * @param[in]  context     Optional. ThinCloud context.
+ * @param[in]  client      AWS IoT MQTT Client instance.
+ * @param[in]  topic       Topic to publish to.
+ * @param[in]  topicLen    Length of the topic.
+ * @param[in]  payload     Message payload.
+ * @param[in]  payloadLen  Length of the payload.
+ * @param[in]  qos         QoS to publish with.
+ * 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the in-flight window is
+ *         full, negative value otherwise 
+ */
+IoT_Error_t tc_context_send(tc_context *context, AWS_IoT_Client *client, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen, QoS qos)
+{
+    if (tc_context_windowed(context, client, qos))
+    {
+        return tc_inflight_publish(context->inflight, topic, topicLen, payload, payloadLen, NULL, NULL, NULL);
+    }
+
+    IoT_Publish_Message_Params params;
+    params.qos = qos;
+    params.isRetained = false;
+    params.payload = (void *)payload;
+    params.payloadLen = payloadLen;
+
+    return aws_iot_mqtt_publish(client, topic, topicLen, &params);
+}
+
+/**
+ * @brief Acknowledge a record handed out by tc_context_drain
+ * 
+ * Pops the record once every record ahead of it is acknowledged too.
+ * 
+ * @param[in]  context   ThinCloud context with an outbox.
+ * @param[in]  sequence  Sequence number of the record.
+ */
+void tc_context_ack(tc_context *context, uint64_t sequence)
+{
+    tc_outbox_replay *replay = &context->replay;
+
+    const uint64_t distance = sequence - replay->sequence;
+    if (distance >= replay->sent)
+    {
+        return;
+    }
+
+    replay->acked |= (uint64_t)1 << distance;
+    while ((replay->acked & 1) != 0 && tc_outbox_pop(context->outbox) == SUCCESS)
+    {
+        replay->acked >>= 1;
+        replay->sequence++;
+        replay->sent--;
+    }
+}
+
+/**
+ * @brief Completion callback for outbox records sent through the in-flight window
+ * 
+ * A failed record, whose session ended or which ran out of retransmits,
+ * rewinds the replay so it and everything after it are sent again.
+ * 
+ * @param[in]  client    AWS IoT MQTT Client instance.
+ * @param[in]  rc        Outcome of the message.
+ * @param[in]  packetId  Packet ID of the message.
+ * @param[in]  userData  ThinCloud context.
+ */
+void tc_context_acked(AWS_IoT_Client *client, IoT_Error_t rc, uint16_t packetId, void *userData)
+{
+    (void)client;
+
+    tc_context *context = (tc_context *)userData;
+    tc_outbox_replay *replay = &context->replay;
+
+    const uint32_t slot = packetId & (TC_INFLIGHT_MAX_WINDOW - 1);
+    if (context->outbox == NULL || replay->slots[slot].epoch != replay->epoch)
+    {
+        return;
+    }
+
+    if (rc == SUCCESS)
+    {
+        tc_context_ack(context, replay->slots[slot].sequence);
+    }
+    else
+    {
+        tc_context_rewind(context);
+    }
+}
+
+/**
+ * @brief Replay a context's outbox
+ * 
+ * Flushes the context's batch, whose messages are older than any in the
+ * outbox, then sends the outbox's records in order. Stops early, leaving
+ * the rest for the next call, if the in-flight window fills up. Records
+ * sent through the window stay in the outbox until their PUBACK arrives,
+ * so a clean session that discards them on reconnect only means they
+ * are sent again; other records are popped once they are published.
+ * 
+ * @param[in]  context  ThinCloud context with an outbox.
+ * @param[in]  client   Connected AWS IoT MQTT Client instance.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_context_drain(tc_context *context, AWS_IoT_Client *client)
+{
+    IoT_Error_t rc = SUCCESS;
+
+    if (context->batch != NULL)
+    {
+        rc = tc_batch_flush(context->batch, client);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+    }
+
+    tc_outbox_replay *replay = &context->replay;
+    if (replay->sent == 0)
+    {
+        replay->cursor = tc_outbox_head(context->outbox);
+    }
+
+    // Unacknowledged records are tracked in a 64-bit mask
+    while (replay->sent < tc_outbox_count(context->outbox) && replay->sent < 64)
+    {
+        tc_outbox_record record;
+        uint64_t next = 0;
+        if (tc_outbox_read(context->outbox, replay->cursor, &record, &next) != SUCCESS)
+        {
+            // A corrupt ring can only follow a power loss without sync
+            tc_outbox_clear(context->outbox);
+            tc_context_rewind(context);
+            return FAILURE;
+        }
+
+        const uint64_t sequence = replay->sequence + replay->sent;
+        if (tc_context_windowed(context, client, record.qos))
+        {
+            uint16_t packetId = 0;
+            rc = tc_inflight_publish(context->inflight, record.topic.data, (uint16_t)record.topic.len, record.payload.data, record.payload.len, tc_context_acked, context, &packetId);
+            if (rc == SUCCESS)
+            {
+                const uint32_t slot = packetId & (TC_INFLIGHT_MAX_WINDOW - 1);
+                replay->slots[slot].sequence = sequence;
+                replay->slots[slot].epoch = replay->epoch;
+            }
+        }
+        else
+        {
+            rc = tc_context_send(context, client, record.topic.data, (uint16_t)record.topic.len, record.payload.data, record.payload.len, record.qos);
+        }
+
+        if (rc == LIMIT_EXCEEDED_ERROR)
+        {
+            return SUCCESS;
+        }
+        else if (rc != SUCCESS)
+        {
+            return rc;
+        }
+
+        replay->cursor = next;
+        replay->sent++;
+
+        if (!tc_context_windowed(context, client, record.qos))
+        {
+            tc_context_ack(context, sequence);
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Whether a context's outbox has records to send now
+ * 
+ * @param[in]  context  ThinCloud context.
+ * @param[in]  client   AWS IoT MQTT Client instance.
+ * 
+ * @return true when the client is connected and the outbox has records
+ *         not yet sent, unless the in-flight window is full
+ */
+bool tc_context_draining(const tc_context *context, AWS_IoT_Client *client)
+{
+    if (context->outbox == NULL || tc_outbox_count(context->outbox) <= context->replay.sent || context->replay.sent >= 64)
+    {
+        return false;
+    }
+
+    // A full window frees up when a PUBACK is read
+    if (context->inflight != NULL && context->inflight->client == client && context->inflight->freeSlots == 0)
+    {
+        return false;
+    }
+
+    return aws_iot_mqtt_is_client_connected(client);
+}
+
+/**
+ * @brief Hand a message to a context's outbox, batch or in-flight window
+ * 
+ * See tc_context_publish_qos.
+ */
+IoT_Error_t tc_context_route(tc_context *context, AWS_IoT_Client *client, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen, QoS qos)
+{
+    tc_outbox *outbox = context != NULL ? context->outbox : NULL;
+
+    // Window messages stay in the outbox until their PUBACK arrives
+    if (outbox != NULL && tc_context_windowed(context, client, qos))
+    {
+        IoT_Error_t rc = tc_outbox_append(outbox, topic, topicLen, payload, payloadLen, qos);
+        if (rc == SUCCESS && aws_iot_mqtt_is_client_connected(client))
+        {
+            // A failed drain leaves the message for tc_context_tick
+            tc_context_drain(context, client);
+        }
+        return rc;
+    }
+
+    if (outbox != NULL && (tc_outbox_count(outbox) > 0 || !aws_iot_mqtt_is_client_connected(client)))
+    {
+        return tc_outbox_append(outbox, topic, topicLen, payload, payloadLen, qos);
+    }
+
+    IoT_Error_t rc = SUCCESS;
+    if (context != NULL && context->batch != NULL && qos == QOS0)
+    {
+        rc = tc_batch_publish(context->batch, client, topic, topicLen, payload, payloadLen);
+    }
+    else
+    {
+        // Batched messages go out ahead of a QoS1 message
+        if (context != NULL && context->batch != NULL)
+        {
+            rc = tc_batch_flush(context->batch, client);
+        }
+
+        if (rc == SUCCESS)
+        {
+            rc = tc_context_send(context, client, topic, topicLen, payload, payloadLen, qos);
+        }
+    }
+
+    // The link dropped during the publish, or the window is full
+    if (rc != SUCCESS && outbox != NULL && (rc == LIMIT_EXCEEDED_ERROR || !aws_iot_mqtt_is_client_connected(client)))
+    {
+        rc = tc_outbox_append(outbox, topic, topicLen, payload, payloadLen, qos);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Publish a message through a context
+ * 
+ * QoS0 messages are queued on the context's batch when it has one, and
+ * QoS1 messages are sent through its in-flight window; otherwise the
+ * message is published immediately. When the context has an outbox,
+ * messages sent while the client is disconnected, while the in-flight
+ * window is full, or while older messages are still waiting in the
+ * outbox, are appended to it instead, and QoS1 messages for the window
+ * are replayed from it so they stay there until their PUBACK arrives. Messages are counted in the
+ * context's statistics, if it has any.
+ * 
+ * @param[in]  context     Optional. ThinCloud context.
+ * @param[in]  client      AWS IoT MQTT Client instance.
+ * @param[in]  topic       Topic to publish to.
+ * @param[in]  topicLen    Length of the topic.
+ * @param[in]  payload     Message payload.
+ * @param[in]  payloadLen  Length of the payload.
+ * @param[in]  qos         QoS to publish with.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_context_publish_qos(tc_context *context, AWS_IoT_Client *client, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen, QoS qos)
+{
+    tc_stats *stats = context != NULL ? context->stats : NULL;
+    const uint64_t start = tc_stats_start(stats);
+    TC_TRACE_BEGIN(TC_TRACE_PUBLISH, payloadLen);
+
+    const IoT_Error_t rc = tc_context_route(context, client, topic, topicLen, payload, payloadLen, qos);
+
+    TC_TRACE_END(TC_TRACE_PUBLISH, rc);
+
+    if (stats != NULL)
+    {
+        tc_stats_lap(stats, TC_STATS_PUBLISH, start);
+        tc_stats_sent(stats, tc_stats_outbound_kind(topic, topicLen), payloadLen, rc);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Publish a QoS0 message through a context
+ * 
+ * See tc_context_publish_qos.
+ * 
+ * @param[in]  context     Optional. ThinCloud context.
+ * @param[in]  client      AWS IoT MQTT Client instance.
+ * @param[in]  topic       Topic to publish to.
+ * @param[in]  topicLen    Length of the topic.
+ * @param[in]  payload     Message payload.
+ * @param[in]  payloadLen  Length of the payload.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_context_publish(tc_context *context, AWS_IoT_Client *client, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen)
+{
+    return tc_context_publish_qos(context, client, topic, topicLen, payload, payloadLen, QOS0);
+}
+
+
+/**
+ * @brief Send a command response through a context
+ * 
+ * Publish a command response to MQTT.
+ * 
+ * @param[in]  context          Optional. ThinCloud context to publish through, in its format.
+ * @param[in]  client           AWS IoT MQTT Client instance.
+ * @param[in]  deviceId         Device's ID.
+ * @param[in]  commandId        ID of the requested command.
+ * @param[in]  statusCode       Command's status code.
+ * @param[in]  isErrorResponse  Signals if a command responds with an error.
+ * @param[in]  errorMessage     Response error message. Only used if isErrorResponse is set to true.
+ * @param[in]  body             Command response body. The response takes ownership of body.
+ * @param[in]  qos              QoS to publish with.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if the response does not fit in
+ *         TC_MAX_PAYLOAD_LENGTH, negative value otherwise
+ */
+IoT_Error_t send_command_response_ctx(tc_context *context, AWS_IoT_Client *client, const char *deviceId, const char *commandId, uint16_t statusCode, bool isErrorResponse, char *errorMessage, json_object *body, QoS qos)
+{
+    char topic[MAX_TOPIC_LENGTH];
+    size_t topicLen = 0;
+
+    TC_TRACE_BEGIN(TC_TRACE_TOPIC, 0);
+    IoT_Error_t rc = tc_context_command_response_topic(context, topic, sizeof(topic), deviceId, commandId, &topicLen);
+    TC_TRACE_END(TC_TRACE_TOPIC, rc);
+
+    if (rc != SUCCESS)
+    {
+        json_object_put(body);
+        FUNC_EXIT_RC(rc);
+    }
+
+    char payload[TC_MAX_PAYLOAD_LENGTH];
+    size_t payloadLen = 0;
+    size_t messageSize = 0;
+    char *message = tc_context_message_buffer(context, payload, sizeof(payload), &messageSize);
+
+    TC_TRACE_BEGIN(TC_TRACE_MARSHAL, 0);
+    rc = tc_marshal_command_response(tc_context_format(context), message, messageSize, commandId, statusCode, isErrorResponse, errorMessage, body, &payloadLen);
+
+    if (rc == SUCCESS)
+    {
+        rc = tc_context_compress(context, message, payloadLen, payload, sizeof(payload), &payloadLen);
+    }
+    TC_TRACE_END(TC_TRACE_MARSHAL, rc);
+
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    return tc_context_publish_qos(context, client, topic, (uint16_t)topicLen, payload, payloadLen, qos);
+}
+
+/**
+ * @brief Send a command response.
+ * 
+ * Publish a command response to MQTT.
+ * 
+ * @param[in]  client           AWS IoT MQTT Client instance.
+ * @param[in]  deviceId         Device's ID.
+ * @param[in]  commandId        ID of the requested command.
+ * @param[in]  statusCode       Command's status code.
+ * @param[in]  isErrorResponse  Signals if a command responds with an error.
+ * @param[in]  errorMessage     Response error message. Only used if isErrorResponse is set to true.
+ * @param[in]  body             Command response body. The response takes ownership of body.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if the response does not fit in
+ *         TC_MAX_PAYLOAD_LENGTH, negative value otherwise
+ */
+IoT_Error_t send_command_response(AWS_IoT_Client *client, const char *deviceId, const char *commandId, uint16_t statusCode, bool isErrorResponse, char *errorMessage, json_object *body)
+{
+    return send_command_response_ctx(NULL, client, deviceId, commandId, statusCode, isErrorResponse, errorMessage, body, QOS0);
+}
+
+/**
+ * @brief Build a commissioning request's topic and payload through a context
+ * 
+ * @param[in]   context          Optional. ThinCloud context, marshals in its format.
+ * @param[out]  topic            Buffer of MAX_TOPIC_LENGTH bytes.
+ * @param[out]  topicLen         Length of the topic.
+ * @param[out]  payload          Buffer of TC_MAX_PAYLOAD_LENGTH bytes.
+ * @param[out]  payloadLen       Length of the payload.
+ * @param[in]   requestId        Unique ID for the request.
+ * @param[in]   deviceType       Devices's device type.
+ * @param[in]   physicalId       Device's physical ID.
+ * @param[in]   relatedDeviceIds List of devices to associate on commissioning
+ * @param[in]   idsSize          Size of related device ids list 
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if the request does not fit in
+ *         TC_MAX_PAYLOAD_LENGTH, negative value otherwise
+ */
+IoT_Error_t tc_context_build_commissioning_request(tc_context *context, char *topic, uint16_t *topicLen, char *payload, size_t *payloadLen, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize)
+{
+    size_t len = 0;
+
+    TC_TRACE_BEGIN(TC_TRACE_TOPIC, 0);
+    IoT_Error_t rc = commission_request_topic_n(topic, MAX_TOPIC_LENGTH, deviceType, physicalId, &len);
+    TC_TRACE_END(TC_TRACE_TOPIC, rc);
+
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    *topicLen = (uint16_t)len;
+
+    TC_TRACE_BEGIN(TC_TRACE_MARSHAL, 0);
+    rc = tc_marshal_commissioning_request(tc_context_format(context), payload, TC_MAX_PAYLOAD_LENGTH, requestId, deviceType, physicalId, relatedDeviceIds, idsSize, payloadLen);
+    TC_TRACE_END(TC_TRACE_MARSHAL, rc);
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Send commissioning request through a context
+ * 
+ * Publish a commissioning request to MQTT.
+ * 
+ * @param[in]  context          Optional. ThinCloud context to publish through, in its format.
+ * @param[in]  client           AWS IoT MQTT Client instance.
+ * @param[in]  requestId        Unique ID for the request.
+ * @param[in]  deviceType       Devices's device type.
+ * @param[in]  physicalId       Device's physical ID.
+ * @param[in]  relatedDeviceIds List of devices to associate on commissioning
+ * @param[in]  idsSize          Size of related device ids list 
+ * @param[in]  qos              QoS to publish with.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if the request does not fit in
+ *         TC_MAX_PAYLOAD_LENGTH, negative value otherwise
+ */
+IoT_Error_t send_commissioning_request_ctx(tc_context *context, AWS_IoT_Client *client, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize, QoS qos)
+{
+    char topic[MAX_TOPIC_LENGTH];
+    uint16_t topicLen = 0;
+    char payload[TC_MAX_PAYLOAD_LENGTH];
+    size_t payloadLen = 0;
+
+    const IoT_Error_t rc = tc_context_build_commissioning_request(context, topic, &topicLen, payload, &payloadLen, requestId, deviceType, physicalId, relatedDeviceIds, idsSize);
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    return tc_context_publish_qos(context, client, topic, topicLen, payload, payloadLen, qos);
+}
+
+/**
+ * @brief Send commissioning request
+ * 
+ * Publish a commissioning request to MQTT.
+ * 
+ * @param[in]  client           AWS IoT MQTT Client instance.
+ * @param[in]  requestId        Unique ID for the request.
+ * @param[in]  deviceType       Devices's device type.
+ * @param[in]  physicalId       Device's physical ID.
+ * @param[in]  relatedDeviceIds List of devices to associate on commissioning
+ * @param[in]  idsSize          Size of related device ids list 
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if the request does not fit in
+ *         TC_MAX_PAYLOAD_LENGTH, negative value otherwise
+ */
+IoT_Error_t send_commissioning_request(AWS_IoT_Client *client, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize)
+{
+    return send_commissioning_request_ctx(NULL, client, requestId, deviceType, physicalId, relatedDeviceIds, idsSize, QOS0);
+}
+
+/**
+ * @brief Build a service request's topic and payload through a context
+ * 
+ * The payload is compressed when the context compresses payloads.
+ * 
+ * @param[in]   context     Optional. ThinCloud context, marshals in its format.
+ * @param[out]  topic       Buffer of MAX_TOPIC_LENGTH bytes.
+ * @param[out]  topicLen    Length of the topic.
+ * @param[out]  payload     Buffer of TC_MAX_PAYLOAD_LENGTH bytes.
+ * @param[out]  payloadLen  Length of the payload.
+ * @param[in]   requestId   Unique ID for the request.
+ * @param[in]   deviceId    Devices's ID.
+ * @param[in]   method      Service method to request.
+ * @param[in]   reqParams   Service request parameters. The request takes ownership of params.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if the request does not fit in
+ *         TC_MAX_PAYLOAD_LENGTH, negative value otherwise
+ */
+IoT_Error_t tc_context_build_service_request(tc_context *context, char *topic, uint16_t *topicLen, char *payload, size_t *payloadLen, const char *requestId, const char *deviceId, const char *method, json_object *reqParams)
+{
+    size_t len = 0;
+
+    TC_TRACE_BEGIN(TC_TRACE_TOPIC, 0);
+    IoT_Error_t rc = tc_context_service_request_topic(context, topic, MAX_TOPIC_LENGTH, deviceId, &len);
+    TC_TRACE_END(TC_TRACE_TOPIC, rc);
+
+    if (rc != SUCCESS)
+    {
+        json_object_put(reqParams);
+        FUNC_EXIT_RC(rc);
+    }
+
+    *topicLen = (uint16_t)len;
+
+    size_t messageSize = 0;
+    char *message = tc_context_message_buffer(context, payload, TC_MAX_PAYLOAD_LENGTH, &messageSize);
+
+    TC_TRACE_BEGIN(TC_TRACE_MARSHAL, 0);
+    rc = tc_marshal_service_request(tc_context_format(context), message, messageSize, requestId, method, reqParams, payloadLen);
+
+    if (rc == SUCCESS)
+    {
+        rc = tc_context_compress(context, message, *payloadLen, payload, TC_MAX_PAYLOAD_LENGTH, payloadLen);
+    }
+    TC_TRACE_END(TC_TRACE_MARSHAL, rc);
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Send service request through a context
+ * 
+ * Publish a service request to MQTT.
+ * 
+ * @param[in]  context    Optional. ThinCloud context to publish through, in its format.
+ * @param[in]  client     AWS IoT MQTT Client instance.
+ * @param[in]  requestId  Unique ID for the request.
+ * @param[in]  deviceId   Devices's ID.
+ * @param[in]  method     Service method to request.
+ * @param[in]  params     Service request parameters. The request takes ownership of params.
+ * @param[in]  qos        QoS to publish with.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if the request does not fit in
+ *         TC_MAX_PAYLOAD_LENGTH, negative value otherwise
+ */
+IoT_Error_t send_service_request_ctx(tc_context *context, AWS_IoT_Client *client, const char *requestId, const char *deviceId, const char *method, json_object *reqParams, QoS qos)
+{
+    char topic[MAX_TOPIC_LENGTH];
+    uint16_t topicLen = 0;
+    char payload[TC_MAX_PAYLOAD_LENGTH];
+    size_t payloadLen = 0;
+
+    const IoT_Error_t rc = tc_context_build_service_request(context, topic, &topicLen, payload, &payloadLen, requestId, deviceId, method, reqParams);
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    return tc_context_publish_qos(context, client, topic, topicLen, payload, payloadLen, qos);
+}
+
+/**
+ * @brief Send service request
+ * 
+ * Publish a service request to MQTT.
+ * 
+ * @param[in]  client     AWS IoT MQTT Client instance.
+ * @param[in]  requestId  Unique ID for the request.
+ * @param[in]  deviceId   Devices's ID.
+ * @param[in]  method     Service method to request.
+ * @param[in]  params     Service request parameters. The request takes ownership of params.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if the request does not fit in
+ *         TC_MAX_PAYLOAD_LENGTH, negative value otherwise
+ */
+IoT_Error_t send_service_request(AWS_IoT_Client *client, const char *requestId, const char *deviceId, const char *method, json_object *reqParams)
+{
+    return send_service_request_ctx(NULL, client, requestId, deviceId, method, reqParams, QOS0);
+}
+
+/**
+ * @brief Subscribe to commissioning respones with a QoS
+ * 
+ * @param[in]  client          AWS IoT MQTT Client instance.
+ * @param[in]  requestId       Unique ID of a request.
+ * @param[in]  deviceType      Devices's device type.
+ * @param[in]  physicalId      Device's physical ID.
+ * @param[in]  handler         Subscription response handler.
+ * @param[in]  subscriberData  Data blob to be passed to the subscription handler on invoke.
+ * @param[in]  qos             Maximum QoS of messages delivered to the handler.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t subscribe_to_commissioning_response_qos(AWS_IoT_Client *client, const char *requestId, const char *deviceType, const char *physicalId, pApplicationHandler_t handler, void *subscribeData, QoS qos)
+{
+    size_t topicLen = 0;
+    IoT_Error_t rc = commission_response_topic_n(COMMISSIONING_RESPONSE_TOPIC_BUFFER, sizeof(COMMISSIONING_RESPONSE_TOPIC_BUFFER), deviceType, physicalId, requestId, &topicLen);
+
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    return aws_iot_mqtt_subscribe(client, COMMISSIONING_RESPONSE_TOPIC_BUFFER, (uint16_t)topicLen, qos, handler, subscribeData);
+}
+
+/**
+ * @brief Subscribe to commissioning respones
+ * 
+ * @param[in]  client          AWS IoT MQTT Client instance.
+ * @param[in]  requestId       Unique ID of a request.
+ * @param[in]  deviceType      Devices's device type.
+ * @param[in]  physicalId      Device's physical ID.
+ * @param[in]  handler         Subscription response handler.
+ * @param[in]  subscriberData  Data blob to be passed to the subscription handler on invoke.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t subscribe_to_commissioning_response(AWS_IoT_Client *client, const char *requestId, const char *deviceType, const char *physicalId, pApplicationHandler_t handler, void *subscribeData)
+{
+    return subscribe_to_commissioning_response_qos(client, requestId, deviceType, physicalId, handler, subscribeData, QOS0);
+}
+
+/**
+ * @brief Subscribe to command requests with a QoS
+ * 
+ * @param[in]  client          AWS IoT MQTT Client instance.
+ * @param[in]  deviceId        Device's ID.
+ * @param[in]  handler         Subscription response handler.
+ * @param[in]  subscriberData  Data blob to be passed to the subscription handler on invoke.
+ * @param[in]  qos             Maximum QoS of messages delivered to the handler.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t subscribe_to_command_request_qos(AWS_IoT_Client *client, const char *deviceId, pApplicationHandler_t handler, void *subscribeData, QoS qos)
+{
+    size_t topicLen = 0;
+    IoT_Error_t rc = command_request_topic_n(COMMAND_TOPIC_BUFFER, sizeof(COMMAND_TOPIC_BUFFER), deviceId, &topicLen);
+
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    return aws_iot_mqtt_subscribe(client, COMMAND_TOPIC_BUFFER, (uint16_t)topicLen, qos, handler, subscribeData);
+}
+
+/**
+ * @brief Subscribe to command requests
+ * 
+ * @param[in]  client          AWS IoT MQTT Client instance.
+ * @param[in]  deviceId        Device's ID.
+ * @param[in]  handler         Subscription response handler.
+ * @param[in]  subscriberData  Data blob to be passed to the subscription handler on invoke.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t subscribe_to_command_request(AWS_IoT_Client *client, const char *deviceId, pApplicationHandler_t handler, void *subscribeData)
+{
+    return subscribe_to_command_request_qos(client, deviceId, handler, subscribeData, QOS0);
+}
+
+/**
+ * @brief Subscribe to service responses with a QoS
+ * 
+ * @param[in]  client          AWS IoT MQTT Client instance.
+ * @param[in]  deviceId        Device's ID.
+ * @param[in]  requestId       Unique ID of a request.
+ * @param[in]  handler         Subscription response handler.
+ * @param[in]  subscriberData  Data blob to be passed to the subscription handler on invoke.
+ * @param[in]  qos             Maximum QoS of messages delivered to the handler.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t subscribe_to_service_response_qos(AWS_IoT_Client *client, const char *deviceId, const char *requestId, pApplicationHandler_t handler, void *subscribeData, QoS qos)
+{
+    size_t topicLen = 0;
+    IoT_Error_t rc = service_response_topic_n(SERVICE_RESPONSE_TOPIC_BUFFER, sizeof(SERVICE_RESPONSE_TOPIC_BUFFER), deviceId, requestId, &topicLen);
+
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    return aws_iot_mqtt_subscribe(client, SERVICE_RESPONSE_TOPIC_BUFFER, (uint16_t)topicLen, qos, handler, subscribeData);
+}
+
+/**
+ * @brief Subscribe to service responses
+ * 
+ * @param[in]  client          AWS IoT MQTT Client instance.
+ * @param[in]  deviceId        Device's ID.
+ * @param[in]  requestId       Unique ID of a request.
+ * @param[in]  handler         Subscription response handler.
+ * @param[in]  subscriberData  Data blob to be passed to the subscription handler on invoke.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t subscribe_to_service_response(AWS_IoT_Client *client, const char *deviceId, const char *requestId, pApplicationHandler_t handler, void *subscribeData)
+{
+    return subscribe_to_service_response_qos(client, deviceId, requestId, handler, subscribeData, QOS0);
+}
+
+/**
+ * Routes of the inbound ThinCloud topics
+ */
+typedef enum
+{
+    TC_ROUTE_COMMAND_REQUEST = 0,
+    TC_ROUTE_SERVICE_RESPONSE,
+    TC_ROUTE_COMMISSIONING_RESPONSE,
+    TC_ROUTE_GATEWAY_COMMAND,
+    TC_ROUTE_COUNT
+} tc_route;
+
+/**
+ * @brief Command request callback
+ *
+ * The view and slices point into the message and are only valid for the
+ * duration of the call.
+ *
+ * @param[in]  client    AWS IoT MQTT Client instance.
+ * @param[in]  deviceId  Device ID from the topic.
+ * @param[in]  request   Command request.
+ * @param[in]  userData  Data blob passed on subscribe.
+ */
+typedef void (*tc_command_request_handler)(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, void *userData);
+
+/**
+ * @brief Service response callback
+ *
+ * @param[in]  client     AWS IoT MQTT Client instance.
+ * @param[in]  deviceId   Device ID from the topic.
+ * @param[in]  requestId  Request ID from the topic.
+ * @param[in]  response   Service response.
+ * @param[in]  userData   Data blob passed on subscribe.
+ */
+typedef void (*tc_service_response_handler)(AWS_IoT_Client *client, tc_slice deviceId, tc_slice requestId, const tc_service_response_view *response, void *userData);
+
+/**
+ * @brief Commissioning response callback
+ *
+ * @param[in]  client        AWS IoT MQTT Client instance.
+ * @param[in]  registration  "{deviceType}_{physicalId}" from the topic.
+ * @param[in]  requestId     Request ID from the topic.
+ * @param[in]  response      Commissioning response.
+ * @param[in]  userData      Data blob passed on subscribe.
+ */
+typedef void (*tc_commissioning_response_handler)(AWS_IoT_Client *client, tc_slice registration, tc_slice requestId, const tc_commissioning_response_view *response, void *userData);
+
+/**
+ * Maximum number of requests awaiting a response. Must be a power of two.
+ */
+#ifndef TC_MAX_PENDING_REQUESTS
+#define TC_MAX_PENDING_REQUESTS 256
+#endif
+
+#if (TC_MAX_PENDING_REQUESTS & (TC_MAX_PENDING_REQUESTS - 1)) != 0 || TC_MAX_PENDING_REQUESTS > 32768
+#error "TC_MAX_PENDING_REQUESTS must be a power of two no larger than 32768"
+#endif
+
+/**
+ * Size of the correlation table's hash index. Twice the capacity keeps
+ * probe sequences short at full load.
+ */
+#define TC_PENDING_INDEX_SIZE (2 * TC_MAX_PENDING_REQUESTS)
+
+/**
+ * Number of pending requests that can keep a copy of their message for
+ * retransmission
+ */
+#ifndef TC_MAX_RETRY_REQUESTS
+#define TC_MAX_RETRY_REQUESTS 8
+#endif
+
+/**
+ * @brief Service request completion callback
+ *
+ * Invoked once per request, either with the response or with
+ * MQTT_REQUEST_TIMEOUT_ERROR and a NULL response when the deadline passes.
+ *
+ * @param[in]  client    AWS IoT MQTT Client instance.
+ * @param[in]  rc        SUCCESS or MQTT_REQUEST_TIMEOUT_ERROR.
+ * @param[in]  response  Service response, valid for the duration of the call.
+ * @param[in]  userData  Data blob passed with the request.
+ */
+typedef void (*tc_service_response_callback)(AWS_IoT_Client *client, IoT_Error_t rc, const tc_service_response_view *response, void *userData);
+
+/**
+ * @brief Commissioning request completion callback
+ *
+ * @param[in]  client    AWS IoT MQTT Client instance.
+ * @param[in]  rc        SUCCESS or MQTT_REQUEST_TIMEOUT_ERROR.
+ * @param[in]  response  Commissioning response, valid for the duration of the call.
+ * @param[in]  userData  Data blob passed with the request.
+ */
+typedef void (*tc_commissioning_response_callback)(AWS_IoT_Client *client, IoT_Error_t rc, const tc_commissioning_response_view *response, void *userData);
+
+/**
+ * @brief Retransmission policy
+ *
+ * A request is sent again each time it goes unanswered for its current
+ * timeout. The timeout starts at the request's timeout, doubles after
+ * every attempt up to maxTimeoutMs and is jittered by up to half.
+ */
+typedef struct
+{
+    uint8_t maxRetries;
+    uint32_t maxTimeoutMs;
+} tc_retry_policy;
+
+/**
+ * @brief Copy of a request kept for retransmission
+ */
+typedef struct
+{
+    char topic[MAX_TOPIC_LENGTH];
+    uint16_t topicLen;
+    char payload[TC_MAX_PAYLOAD_LENGTH];
+    size_t payloadLen;
+    QoS qos;
+} tc_retry_buffer;
+
+/**
+ * Longest request ID a correlation table can track, the length of a UUID
+ */
+#define TC_MAX_REQUEST_ID_LENGTH (TC_ID_LENGTH - 1)
+
+/**
+ * @brief Request ID as a correlation table keeps it
+ *
+ * A UUID is kept in binary in head. Any other ID keeps its first 16
+ * bytes in head and the rest in tail, both padded with zeros.
+ */
+typedef struct
+{
+    tc_uuid head;
+    char tail[TC_MAX_REQUEST_ID_LENGTH - sizeof(tc_uuid)];
+    uint8_t len;
+    bool uuid;
+} tc_request_key;
+
+/**
+ * @brief Request awaiting a response
+ */
+typedef struct
+{
+    tc_request_key requestId;
+    uint8_t route;
+    union
+    {
+        tc_service_response_callback service;
+        tc_commissioning_response_callback commissioning;
+    } callback;
+    void *userData;
+    uint64_t deadline;
+    tc_timer timer;
+    AWS_IoT_Client *client;
+    tc_context *context;
+    tc_retry_buffer *retry;
+    uint8_t retriesLeft;
+    uint32_t timeoutMs;
+    uint32_t maxTimeoutMs;
+} tc_pending_request;
+
+/**
+ * @brief Request/response correlation table
+ *
+ * Fixed-capacity table of pending requests keyed by request ID. Requests
+ * live in stable slots; a linear probing index maps request IDs to slots,
+ * so lookups are O(1) and removals shift the index back instead of
+ * leaving tombstones.
+ *
+ * When timers is set, every request gets a timer on that wheel that
+ * times it out or retransmits it. Otherwise call tc_correlation_expire
+ * periodically.
+ */
+typedef struct
+{
+    tc_pending_request requests[TC_MAX_PENDING_REQUESTS];
+    uint16_t index[TC_PENDING_INDEX_SIZE];
+    uint16_t freeSlots[TC_MAX_PENDING_REQUESTS];
+    uint32_t freeCount;
+    tc_retry_buffer retryBuffers[TC_MAX_RETRY_REQUESTS];
+    tc_retry_buffer *freeRetryBuffers[TC_MAX_RETRY_REQUESTS];
+    uint32_t freeRetryCount;
+    tc_timer_wheel *timers;
+    uint32_t jitter;
+} tc_correlation_table;
+
+/**
+ * @brief FNV-1a hash of a byte string
+ */
+uint32_t tc_hash(const char *data, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Key of a request ID in a correlation table
+ * 
+ * @param[in]   requestId  Request ID.
+ * @param[in]   len        Length of the request ID.
+ * @param[out]  key        Key of the request ID.
+ * 
+ * @return false if the ID is empty or longer than TC_MAX_REQUEST_ID_LENGTH
+ */
+bool tc_correlation_key(const char *requestId, size_t len, tc_request_key *key)
+{
+    if (len == 0 || len > TC_MAX_REQUEST_ID_LENGTH)
+    {
+        return false;
+    }
+
+    memset(key, 0, sizeof(*key));
+    key->len = (uint8_t)len;
+
+    if (len == TC_UUID_TEXT_LENGTH && tc_uuid_parse(requestId, len, &key->head))
+    {
+        key->uuid = true;
+        return true;
+    }
+
+    // Any other ID is kept as text
+    const size_t headLen = len < sizeof(tc_uuid) ? len : sizeof(tc_uuid);
+    memcpy(&key->head, requestId, headLen);
+    memcpy(key->tail, requestId + headLen, len - headLen);
+
+    return true;
+}
+
+/**
+ * @brief Compare two correlation keys
+ */
+bool tc_correlation_key_equals(const tc_request_key *a, const tc_request_key *b)
+{
+    return tc_uuid_equals(&a->head, &b->head) && a->len == b->len && a->uuid == b->uuid && memcmp(a->tail, b->tail, sizeof(a->tail)) == 0;
+}
+
+/**
+ * @brief Hash of a correlation key
+ */
+uint32_t tc_correlation_hash(const tc_request_key *key)
+{
+    uint64_t hash = (key->head.hi * 0x9e3779b97f4a7c15ULL) ^ key->head.lo;
+
+    // IDs sharing their first 16 bytes still hash apart
+    if (!key->uuid && key->len > sizeof(tc_uuid))
+    {
+        hash ^= tc_hash(key->tail, key->len - sizeof(tc_uuid));
+    }
+
+    hash *= 0xbf58476d1ce4e5b9ULL;
+
+    return (uint32_t)(hash >> 32);
+}
+
+/**
+ * @brief Text of a pending request's ID
+ * 
+ * UUIDs are written in lowercase whatever the case they were tracked in.
+ * 
+ * @param[in]   request  Pending request.
+ * @param[out]  text     Buffer of at least TC_ID_LENGTH bytes. Null-terminated.
+ */
+void tc_correlation_id(const tc_pending_request *request, char *text)
+{
+    const tc_request_key *key = &request->requestId;
+
+    if (key->uuid)
+    {
+        tc_uuid_format(&key->head, text);
+        return;
+    }
+
+    const size_t headLen = key->len < sizeof(tc_uuid) ? key->len : sizeof(tc_uuid);
+    memcpy(text, &key->head, headLen);
+    memcpy(text + headLen, key->tail, key->len - headLen);
+    text[key->len] = '\0';
+}
+
+/**
+ * @brief Initialize an empty correlation table
+ * 
+ * @param[out]  table   Table to initialize.
+ * @param[in]   timers  Optional. Timer wheel that times out and retransmits requests,
+ *                      usually the one in the client's tc_context.
+ */
+void tc_correlation_init(tc_correlation_table *table, tc_timer_wheel *timers)
+{
+    memset(table->index, 0, sizeof(table->index));
+
+    for (uint32_t i = 0; i < TC_MAX_PENDING_REQUESTS; i++)
+    {
+        table->freeSlots[i] = (uint16_t)(TC_MAX_PENDING_REQUESTS - 1 - i);
+    }
+    table->freeCount = TC_MAX_PENDING_REQUESTS;
+
+    for (uint32_t i = 0; i < TC_MAX_RETRY_REQUESTS; i++)
+    {
+        table->freeRetryBuffers[i] = &table->retryBuffers[i];
+    }
+    table->freeRetryCount = TC_MAX_RETRY_REQUESTS;
+
+    table->timers = timers;
+    table->jitter = (uint32_t)tc_clock_ms() | 1;
+}
+
+/**
+ * @brief Number of requests in a correlation table
+ */
+uint32_t tc_correlation_count(const tc_correlation_table *table)
+{
+    return TC_MAX_PENDING_REQUESTS - table->freeCount;
+}
+
+/**
+ * @brief Find the index position of a request ID
+ * 
+ * @return Position holding the request, or the empty position ending its
+ *         probe sequence
+ */
+uint32_t tc_correlation_probe(const tc_correlation_table *table, const tc_request_key *key)
+{
+    uint32_t position = tc_correlation_hash(key) & (TC_PENDING_INDEX_SIZE - 1);
+
+    while (table->index[position] != 0)
+    {
+        const tc_pending_request *request = &table->requests[table->index[position] - 1];
+        if (tc_correlation_key_equals(&request->requestId, key))
+        {
+            break;
+        }
+
+        position = (position + 1) & (TC_PENDING_INDEX_SIZE - 1);
+    }
+
+    return position;
+}
+
+/**
+ * @brief Find a pending request
+ * 
+ * UUIDs match in either case.
+ * 
+ * @param[in]  table      Correlation table.
+ * @param[in]  requestId  Request ID.
+ * 
+ * @return The pending request, or NULL if none matches
+ */
+tc_pending_request *tc_correlation_find(tc_correlation_table *table, tc_slice requestId)
+{
+    tc_request_key key;
+    if (!tc_correlation_key(requestId.data, requestId.len, &key))
+    {
+        return NULL;
+    }
+
+    const uint32_t position = tc_correlation_probe(table, &key);
+    if (table->index[position] == 0)
+    {
+        return NULL;
+    }
+
+    return &table->requests[table->index[position] - 1];
+}
+
+/**
+ * @brief Stop tracking a request
+ * 
+ * Cancels the request's timer and releases its retransmission copy.
+ * 
+ * @param[in]  table    Correlation table.
+ * @param[in]  request  Request returned by tc_correlation_insert or tc_correlation_find.
+ */
+void tc_correlation_remove(tc_correlation_table *table, tc_pending_request *request)
+{
+    const uint16_t slot = (uint16_t)(request - table->requests);
+    uint32_t position = tc_correlation_probe(table, &request->requestId);
+
+    // Shift later members of the probe sequence back into the gap
+    uint32_t next = (position + 1) & (TC_PENDING_INDEX_SIZE - 1);
+    while (table->index[next] != 0)
+    {
+        const uint32_t home = tc_correlation_hash(&table->requests[table->index[next] - 1].requestId) & (TC_PENDING_INDEX_SIZE - 1);
+        const uint32_t distance = (next - home) & (TC_PENDING_INDEX_SIZE - 1);
+        const uint32_t gap = (next - position) & (TC_PENDING_INDEX_SIZE - 1);
+
+        if (distance >= gap)
+        {
+            table->index[position] = table->index[next];
+            position = next;
+        }
+
+        next = (next + 1) & (TC_PENDING_INDEX_SIZE - 1);
+    }
+
+    table->index[position] = 0;
+    table->freeSlots[table->freeCount++] = slot;
+
+    if (table->timers != NULL)
+    {
+        tc_timer_cancel(table->timers, &request->timer);
+    }
+
+    if (request->retry != NULL)
+    {
+        table->freeRetryBuffers[table->freeRetryCount++] = request->retry;
+        request->retry = NULL;
+    }
+}
+
+/**
+ * @brief Complete a pending request
+ * 
+ * Removes the request and invokes its callback.
+ * 
+ * @param[in]  table     Correlation table.
+ * @param[in]  request   Pending request.
+ * @param[in]  client    AWS IoT MQTT Client instance passed to the callback.
+ * @param[in]  rc        Completion status.
+ * @param[in]  response  View matching the request's route, NULL unless rc is SUCCESS.
+ */
+void tc_correlation_complete(tc_correlation_table *table, tc_pending_request *request, AWS_IoT_Client *client, IoT_Error_t rc, const void *response)
+{
+    const tc_pending_request completed = *request;
+
+    // Free the slot first so the callback can send a follow-up request
+    tc_correlation_remove(table, request);
+
+    if (completed.route == TC_ROUTE_COMMISSIONING_RESPONSE)
+    {
+        completed.callback.commissioning(client, rc, (const tc_commissioning_response_view *)response, completed.userData);
+    }
+    else
+    {
+        completed.callback.service(client, rc, (const tc_service_response_view *)response, completed.userData);
+    }
+}
+
+/**
+ * @brief Time out or retransmit a request whose timer expired
+ */
+void tc_correlation_timeout(tc_timer *timer, void *data)
+{
+    tc_correlation_table *table = (tc_correlation_table *)data;
+    tc_pending_request *request = TC_TIMER_CONTAINER(timer, tc_pending_request, timer);
+
+    if (request->retry == NULL || request->retriesLeft == 0)
+    {
+        tc_correlation_complete(table, request, request->client, MQTT_REQUEST_TIMEOUT_ERROR, NULL);
+        return;
+    }
+
+    request->retriesLeft--;
+
+    uint64_t timeoutMs = (uint64_t)request->timeoutMs * 2;
+    if (timeoutMs > request->maxTimeoutMs)
+    {
+        timeoutMs = request->maxTimeoutMs;
+    }
+    request->timeoutMs = (uint32_t)timeoutMs;
+
+    // xorshift32, jitter the next timeout down by up to half
+    table->jitter ^= table->jitter << 13;
+    table->jitter ^= table->jitter >> 17;
+    table->jitter ^= table->jitter << 5;
+    const uint32_t jitter = request->timeoutMs / 2 == 0 ? 0 : table->jitter % (request->timeoutMs / 2);
+
+    request->deadline = table->timers->now + request->timeoutMs - jitter;
+    tc_timer_schedule(table->timers, timer, request->deadline);
+
+    // Resent the way it was first sent
+    const tc_retry_buffer *retry = request->retry;
+    const IoT_Error_t rc = tc_context_publish_qos(request->context, request->client, retry->topic, retry->topicLen, retry->payload, retry->payloadLen, retry->qos);
+    if (rc != SUCCESS)
+    {
+        char requestId[TC_ID_LENGTH];
+        tc_correlation_id(request, requestId);
+        IOT_WARN("Retransmit of %s failed: %d", requestId, rc);
+    }
+}
+
+/**
+ * @brief Track a pending request
+ * 
+ * @param[in]   table         Correlation table.
+ * @param[in]   requestId     Request ID.
+ * @param[in]   requestIdLen  Length of the request ID.
+ * @param[in]   route         Route the response arrives on.
+ * @param[in]   deadline      tc_clock_ms() time after which the request times out.
+ * @param[out]  request       Tracked request. The caller sets its callback.
+ * 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the table is full,
+ *         FAILURE if the request ID is already pending, MAX_SIZE_ERROR if
+ *         the request ID is empty or longer than TC_MAX_REQUEST_ID_LENGTH,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_correlation_track(tc_correlation_table *table, const char *requestId, size_t requestIdLen, tc_route route, uint64_t deadline, tc_pending_request **request)
+{
+    if (table == NULL || requestId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    tc_request_key key;
+    if (!tc_correlation_key(requestId, requestIdLen, &key))
+    {
+        FUNC_EXIT_RC(MAX_SIZE_ERROR);
+    }
+
+    if (table->freeCount == 0)
+    {
+        FUNC_EXIT_RC(LIMIT_EXCEEDED_ERROR);
+    }
+
+    const uint32_t position = tc_correlation_probe(table, &key);
+    if (table->index[position] != 0)
+    {
+        FUNC_EXIT_RC(FAILURE);
+    }
+
+    const uint16_t slot = table->freeSlots[--table->freeCount];
+    tc_pending_request *pending = &table->requests[slot];
+    memset(pending, 0, sizeof(*pending));
+
+    pending->requestId = key;
+    pending->route = (uint8_t)route;
+    pending->deadline = deadline;
+
+    table->index[position] = (uint16_t)(slot + 1);
+
+    if (table->timers != NULL)
+    {
+        tc_timer_init(&pending->timer, tc_correlation_timeout, table);
+        tc_timer_schedule(table->timers, &pending->timer, deadline);
+    }
+
+    *request = pending;
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Track a pending service request
+ * 
+ * @param[in]   table         Correlation table.
+ * @param[in]   requestId     Request ID.
+ * @param[in]   requestIdLen  Length of the request ID.
+ * @param[in]   callback      Completion callback.
+ * @param[in]   userData      Data blob to be passed to the callback on invoke.
+ * @param[in]   deadline      tc_clock_ms() time after which the request times out.
+ * @param[out]  request       Optional. Tracked request.
+ * 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the table is full,
+ *         FAILURE if the request ID is already pending, negative value otherwise
+ */
+IoT_Error_t tc_correlation_insert(tc_correlation_table *table, const char *requestId, size_t requestIdLen, tc_service_response_callback callback, void *userData, uint64_t deadline, tc_pending_request **request)
+{
+    if (callback == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    tc_pending_request *pending = NULL;
+    const IoT_Error_t rc = tc_correlation_track(table, requestId, requestIdLen, TC_ROUTE_SERVICE_RESPONSE, deadline, &pending);
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    pending->callback.service = callback;
+    pending->userData = userData;
+
+    if (request != NULL)
+    {
+        *request = pending;
+    }
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Keep a copy of a request for retransmission
+ * 
+ * @param[in]   table      Correlation table. Must have a timer wheel.
+ * @param[in]   request    Pending request.
+ * @param[in]   client     AWS IoT MQTT Client instance used to retransmit.
+ * @param[in]   timeoutMs  Timeout of the first attempt.
+ * @param[in]   policy     Retransmission policy.
+ * @param[out]  retry      Buffer to marshal the request's topic and payload into.
+ * 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if no retry buffer is free,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_correlation_retry(tc_correlation_table *table, tc_pending_request *request, AWS_IoT_Client *client, uint32_t timeoutMs, const tc_retry_policy *policy, tc_retry_buffer **retry)
+{
+    if (table->timers == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    if (table->freeRetryCount == 0)
+    {
+        FUNC_EXIT_RC(LIMIT_EXCEEDED_ERROR);
+    }
+
+    request->retry = table->freeRetryBuffers[--table->freeRetryCount];
+    request->retry->qos = QOS0;
+    request->client = client;
+    request->retriesLeft = policy->maxRetries;
+    request->timeoutMs = timeoutMs;
+    request->maxTimeoutMs = policy->maxTimeoutMs > timeoutMs ? policy->maxTimeoutMs : timeoutMs;
+
+    *retry = request->retry;
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Time out expired requests
+ * 
+ * Only needed for tables without a timer wheel.
+ * 
+ * @param[in]  table   Correlation table.
+ * @param[in]  client  AWS IoT MQTT Client instance passed to the callbacks.
+ * @param[in]  now     Current tc_clock_ms() time.
+ * 
+ * @return Number of requests that timed out
+ */
+uint32_t tc_correlation_expire(tc_correlation_table *table, AWS_IoT_Client *client, uint64_t now)
+{
+    uint32_t expired = 0;
+
+    for (uint32_t i = 0; i < TC_PENDING_INDEX_SIZE; i++)
+    {
+        // A removal can shift a later entry into this position
+        while (table->index[i] != 0 && table->requests[table->index[i] - 1].deadline <= now)
+        {
+            tc_correlation_complete(table, &table->requests[table->index[i] - 1], client, MQTT_REQUEST_TIMEOUT_ERROR, NULL);
+            expired++;
+        }
+    }
+
+    return expired;
+}
+
+/**
+ * Maximum number of methods in a command method table
+ */
+#ifndef TC_MAX_COMMAND_METHODS
+#define TC_MAX_COMMAND_METHODS 256
+#endif
+
+#if TC_MAX_COMMAND_METHODS > 65535
+#error "TC_MAX_COMMAND_METHODS must be no larger than 65535"
+#endif
+
+/**
+ * @brief Command method and its handler
+ */
+typedef struct
+{
+    const char *name;
+    tc_command_request_handler handler;
+    void *userData;
+} tc_command_method;
+
+/**
+ * @brief Command method table
+ *
+ * Maps command methods to handlers through a minimal perfect hash built
+ * once from the method names. A lookup hashes the method straight from
+ * the payload, picks its bucket's displacement and lands on the only
+ * method that can match, so it costs one hash and one compare however
+ * many methods there are.
+ */
+typedef struct
+{
+    const tc_command_method *methods;
+    uint32_t count;
+    uint32_t bucketCount;
+    uint32_t salt;
+    uint8_t nameLens[TC_MAX_COMMAND_METHODS];
+    uint16_t displacements[TC_MAX_COMMAND_METHODS];
+    uint16_t slots[TC_MAX_COMMAND_METHODS];
+    tc_command_request_handler onUnknown;
+    void *unknownData;
+} tc_method_table;
+
+/**
+ * @brief Salted 64-bit FNV-1a hash of a byte string
+ * 
+ * Finished with a 64-bit mix, since FNV-1a barely reaches the high bits
+ * for names as short as most methods.
+ */
+uint64_t tc_method_hash(const char *data, size_t len, uint32_t salt)
+{
+    uint64_t hash = 14695981039346656037ull ^ salt;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)data[i];
+        hash *= 1099511628211ull;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/**
+ * @brief Map a 32-bit value onto [0, range) without dividing
+ */
+uint32_t tc_method_reduce(uint32_t value, uint32_t range)
+{
+    return (uint32_t)(((uint64_t)value * range) >> 32);
+}
+
+/**
+ * @brief Slot of a method hash under a displacement
+ */
+uint32_t tc_method_slot(const tc_method_table *table, uint64_t hash, uint32_t displacement)
+{
+    const uint32_t h1 = (uint32_t)hash;
+    const uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+
+    return tc_method_reduce(h1 + displacement * h2, table->count);
+}
+
+/**
+ * @brief Try to place every method with the table's current salt
+ * 
+ * Buckets are placed largest first, each with the first displacement
+ * that moves all of its methods to free slots.
+ */
+bool tc_method_table_place(tc_method_table *table)
+{
+    uint64_t hashes[TC_MAX_COMMAND_METHODS];
+    uint16_t buckets[TC_MAX_COMMAND_METHODS];
+    uint16_t bucketSizes[TC_MAX_COMMAND_METHODS];
+    bool taken[TC_MAX_COMMAND_METHODS];
+    uint16_t maxSize = 0;
+
+    memset(bucketSizes, 0, sizeof(bucketSizes));
+    memset(taken, 0, sizeof(taken));
+
+    for (uint32_t i = 0; i < table->count; i++)
+    {
+        hashes[i] = tc_method_hash(table->methods[i].name, table->nameLens[i], table->salt);
+        buckets[i] = (uint16_t)tc_method_reduce((uint32_t)(hashes[i] >> 32), table->bucketCount);
+        bucketSizes[buckets[i]]++;
+        maxSize = bucketSizes[buckets[i]] > maxSize ? bucketSizes[buckets[i]] : maxSize;
+    }
+
+    for (uint16_t size = maxSize; size > 0; size--)
+    {
+        for (uint32_t bucket = 0; bucket < table->bucketCount; bucket++)
+        {
+            if (bucketSizes[bucket] != size)
+            {
+                continue;
+            }
+
+            uint32_t displacement = 0;
+            for (; displacement <= UINT16_MAX; displacement++)
+            {
+                uint32_t placed = 0;
+                uint32_t slots[TC_MAX_COMMAND_METHODS];
+
+                for (uint32_t i = 0; i < table->count && placed < size; i++)
+                {
+                    if (buckets[i] != bucket)
+                    {
+                        continue;
+                    }
+
+                    const uint32_t slot = tc_method_slot(table, hashes[i], displacement);
+                    bool clear = !taken[slot];
+                    for (uint32_t j = 0; j < placed && clear; j++)
+                    {
+                        clear = slots[j] != slot;
+                    }
+                    if (!clear)
+                    {
+                        break;
+                    }
+
+                    slots[placed++] = slot;
+                }
+
+                if (placed == size)
+                {
+                    break;
+                }
+            }
+
+            if (displacement > UINT16_MAX)
+            {
+                return false;
+            }
+
+            table->displacements[bucket] = (uint16_t)displacement;
+            for (uint32_t i = 0; i < table->count; i++)
+            {
+                if (buckets[i] == bucket)
+                {
+                    const uint32_t slot = tc_method_slot(table, hashes[i], displacement);
+                    taken[slot] = true;
+                    table->slots[slot] = (uint16_t)i;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Build a command method table
+ * 
+ * @param[out]  table    Table to build.
+ * @param[in]   methods  Methods and their handlers. Must outlive the table.
+ * @param[in]   count    Number of methods.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if there are more than
+ *         TC_MAX_COMMAND_METHODS methods or a name is too long, FAILURE if
+ *         a method name repeats, negative value otherwise
+ */
+IoT_Error_t tc_method_table_init(tc_method_table *table, const tc_command_method *methods, size_t count)
+{
+    if (table == NULL || (methods == NULL && count > 0))
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    if (count > TC_MAX_COMMAND_METHODS)
+    {
+        FUNC_EXIT_RC(MAX_SIZE_ERROR);
+    }
+
+    memset(table, 0, sizeof(*table));
+    table->methods = methods;
+    table->count = (uint32_t)count;
+    table->bucketCount = count > 1 ? (uint32_t)(count + 1) / 2 : 1;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (methods[i].name == NULL || methods[i].handler == NULL)
+        {
+            FUNC_EXIT_RC(NULL_VALUE_ERROR);
+        }
+
+        const size_t nameLen = strlen(methods[i].name);
+        if (nameLen > UINT8_MAX)
+        {
+            FUNC_EXIT_RC(MAX_SIZE_ERROR);
+        }
+        table->nameLens[i] = (uint8_t)nameLen;
+
+        for (uint32_t j = 0; j < i; j++)
+        {
+            if (table->nameLens[j] == nameLen && memcmp(methods[j].name, methods[i].name, nameLen) == 0)
+            {
+                FUNC_EXIT_RC(FAILURE);
+            }
+        }
+    }
+
+    // A salt that leaves a bucket unplaceable is rare; try the next one
+    for (table->salt = 0; table->salt < 64; table->salt++)
+    {
+        if (tc_method_table_place(table))
+        {
+            FUNC_EXIT_RC(SUCCESS);
+        }
+    }
+
+    FUNC_EXIT_RC(FAILURE);
+}
+
+/**
+ * @brief Find a command method
+ * 
+ * @param[in]  table   Command method table.
+ * @param[in]  method  Method name, e.g. the method slice of a tc_command_request_view.
+ * 
+ * @return The method, or NULL if the table has no such method
+ */
+const tc_command_method *tc_method_table_find(const tc_method_table *table, tc_slice method)
+{
+    if (table->count == 0)
+    {
+        return NULL;
+    }
+
+    const uint64_t hash = tc_method_hash(method.data, method.len, table->salt);
+    const uint32_t bucket = tc_method_reduce((uint32_t)(hash >> 32), table->bucketCount);
+    const uint32_t index = table->slots[tc_method_slot(table, hash, table->displacements[bucket])];
+
+    if (table->nameLens[index] != method.len || memcmp(table->methods[index].name, method.data, method.len) != 0)
+    {
+        return NULL;
+    }
+
+    return &table->methods[index];
+}
+
+/**
+ * @brief Set the handler for methods missing from a table
+ * 
+ * @param[in]  table     Command method table.
+ * @param[in]  handler   Optional. Handler invoked for unknown methods.
+ * @param[in]  userData  Data blob to be passed to the handler on invoke.
+ */
+void tc_method_table_set_unknown(tc_method_table *table, tc_command_request_handler handler, void *userData)
+{
+    table->onUnknown = handler;
+    table->unknownData = userData;
+}
+
+/**
+ * @brief Command request handler that dispatches on the method
+ * 
+ * Pass as the handler of tc_dispatcher_subscribe_command_requests with
+ * the method table as its data blob.
+ */
+void tc_method_table_handler(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, void *userData)
+{
+    const tc_method_table *table = (const tc_method_table *)userData;
+    const tc_command_method *method = tc_method_table_find(table, request->method);
+
+    if (method != NULL)
+    {
+        method->handler(client, deviceId, request, method->userData);
+    }
+    else if (table->onUnknown != NULL)
+    {
+        table->onUnknown(client, deviceId, request, table->unknownData);
+    }
+    else
+    {
+        IOT_WARN("Dropped command with unknown method %.*s", (int)request->method.len, request->method.data);
+    }
+}
+
+typedef struct tc_gateway_device tc_gateway_device;
+
+/**
+ * @brief Gateway command request callback
+ *
+ * @param[in]  client    AWS IoT MQTT Client instance.
+ * @param[in]  device    Registered device the command is addressed to.
+ * @param[in]  request   Command request, valid for the duration of the call.
+ * @param[in]  userData  Data blob passed on register.
+ */
+typedef void (*tc_gateway_command_handler)(AWS_IoT_Client *client, tc_gateway_device *device, const tc_command_request_view *request, void *userData);
+
+/**
+ * @brief Child device of a gateway
+ *
+ * Each entry also holds one position of the gateway's hash index, so the
+ * table needs no storage besides the entries themselves.
+ */
+struct tc_gateway_device
+{
+    tc_topic_cache topics;
+    uint8_t deviceIdLen;
+    uint32_t hash;
+    tc_gateway_command_handler handler;
+    void *userData;
+    uint32_t bucket;
+    uint32_t nextFree;
+};
+
+/**
+ * @brief Gateway device table
+ *
+ * Fixed-capacity table of child devices keyed by device ID, for gateways
+ * that proxy many devices over one connection. Devices live in stable
+ * slots of a caller-owned array; a linear probing index maps device IDs
+ * to slots, so lookups are O(1) and removals shift the index back instead
+ * of leaving tombstones. The table holds up to three quarters of its
+ * capacity to keep probe sequences short.
+ *
+ * Command requests for every device arrive on a single subscription, see
+ * tc_dispatcher_subscribe_gateway_commands.
+ */
+typedef struct
+{
+    tc_gateway_device *devices;
+    uint32_t mask;
+    uint32_t count;
+    uint32_t maxCount;
+    uint32_t freeHead;
+} tc_gateway;
+
+/**
+ * @brief Initialize an empty gateway device table
+ * 
+ * @param[out]  gateway   Table to initialize.
+ * @param[in]   devices   Device slots.
+ * @param[in]   capacity  Number of slots. Must be a power of two.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_gateway_init(tc_gateway *gateway, tc_gateway_device *devices, size_t capacity)
+{
+    if (gateway == NULL || devices == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0 || capacity > ((size_t)1 << 30))
+    {
+        FUNC_EXIT_RC(MAX_SIZE_ERROR);
+    }
+
+    gateway->devices = devices;
+    gateway->mask = (uint32_t)capacity - 1;
+    gateway->count = 0;
+    gateway->maxCount = (uint32_t)(capacity - capacity / 4);
+    gateway->freeHead = 1;
+
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        devices[i].bucket = 0;
+        devices[i].nextFree = i + 2 <= capacity ? i + 2 : 0;
+    }
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Number of devices in a gateway device table
+ */
+uint32_t tc_gateway_count(const tc_gateway *gateway)
+{
+    return gateway->count;
+}
+
+/**
+ * @brief ID of a gateway device
+ * 
+ * Points into the device's cached topic prefix.
+ */
+tc_slice tc_gateway_device_id(const tc_gateway_device *device)
+{
+    const tc_slice deviceId = {device->topics.prefix + sizeof("thincloud/devices/") - 1, device->deviceIdLen};
+
+    return deviceId;
+}
+
+/**
+ * @brief Find the index position of a device ID
+ * 
+ * @return Position holding the device, or the empty position ending its
+ *         probe sequence
+ */
+uint32_t tc_gateway_probe(const tc_gateway *gateway, const char *deviceId, size_t deviceIdLen, uint32_t hash)
+{
+    uint32_t position = hash & gateway->mask;
+
+    while (gateway->devices[position].bucket != 0)
+    {
+        const tc_gateway_device *device = &gateway->devices[gateway->devices[position].bucket - 1];
+        if (device->hash == hash && device->deviceIdLen == deviceIdLen && memcmp(tc_gateway_device_id(device).data, deviceId, deviceIdLen) == 0)
+        {
+            break;
+        }
+
+        position = (position + 1) & gateway->mask;
+    }
+
+    return position;
+}
+
+/**
+ * @brief Find a gateway device
+ * 
+ * @param[in]  gateway   Gateway device table.
+ * @param[in]  deviceId  Device ID, e.g. from a topic.
+ * 
+ * @return The device, or NULL if none is registered with the ID
+ */
+tc_gateway_device *tc_gateway_find(tc_gateway *gateway, tc_slice deviceId)
+{
+    if (deviceId.len == 0 || deviceId.len >= TC_ID_LENGTH)
+    {
+        return NULL;
+    }
+
+    const uint32_t position = tc_gateway_probe(gateway, deviceId.data, deviceId.len, tc_hash(deviceId.data, deviceId.len));
+    if (gateway->devices[position].bucket == 0)
+    {
+        return NULL;
+    }
+
+    return &gateway->devices[gateway->devices[position].bucket - 1];
+}
+
+/**
+ * @brief Register a gateway device
+ * 
+ * Builds the device's topic prefix once, so its command responses are
+ * published without formatting.
+ * 
+ * @param[in]   gateway   Gateway device table.
+ * @param[in]   deviceId  Device's ID.
+ * @param[in]   handler   Command request callback.
+ * @param[in]   userData  Data blob to be passed to the callback on invoke.
+ * @param[out]  device    Optional. Registered device.
+ * 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the table is full,
+ *         FAILURE if the device ID is already registered, negative value otherwise
+ */
+IoT_Error_t tc_gateway_register(tc_gateway *gateway, const char *deviceId, tc_gateway_command_handler handler, void *userData, tc_gateway_device **device)
+{
+    if (gateway == NULL || deviceId == NULL || handler == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    const size_t deviceIdLen = strlen(deviceId);
+    if (deviceIdLen == 0 || deviceIdLen >= TC_ID_LENGTH)
+    {
+        FUNC_EXIT_RC(MAX_SIZE_ERROR);
+    }
+
+    if (gateway->count == gateway->maxCount)
+    {
+        FUNC_EXIT_RC(LIMIT_EXCEEDED_ERROR);
+    }
+
+    const uint32_t hash = tc_hash(deviceId, deviceIdLen);
+    const uint32_t position = tc_gateway_probe(gateway, deviceId, deviceIdLen, hash);
+    if (gateway->devices[position].bucket != 0)
+    {
+        FUNC_EXIT_RC(FAILURE);
+    }
+
+    const uint32_t slot = gateway->freeHead - 1;
+    tc_gateway_device *registered = &gateway->devices[slot];
+
+    IoT_Error_t rc = tc_topic_cache_init(&registered->topics, deviceId);
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    gateway->freeHead = registered->nextFree;
+    registered->nextFree = 0;
+    registered->deviceIdLen = (uint8_t)deviceIdLen;
+    registered->hash = hash;
+    registered->handler = handler;
+    registered->userData = userData;
+
+    gateway->devices[position].bucket = slot + 1;
+    gateway->count++;
+
+    if (device != NULL)
+    {
+        *device = registered;
+    }
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Unregister a gateway device
+ * 
+ * @param[in]  gateway  Gateway device table.
+ * @param[in]  device   Device returned by tc_gateway_register or tc_gateway_find.
+ */
+void tc_gateway_unregister(tc_gateway *gateway, tc_gateway_device *device)
+{
+    const uint32_t slot = (uint32_t)(device - gateway->devices);
+    uint32_t position = tc_gateway_probe(gateway, tc_gateway_device_id(device).data, device->deviceIdLen, device->hash);
+
+    // Shift later members of the probe sequence back into the gap
+    uint32_t next = (position + 1) & gateway->mask;
+    while (gateway->devices[next].bucket != 0)
+    {
+        const uint32_t home = gateway->devices[gateway->devices[next].bucket - 1].hash & gateway->mask;
+        const uint32_t distance = (next - home) & gateway->mask;
+        const uint32_t gap = (next - position) & gateway->mask;
+
+        if (distance >= gap)
+        {
+            gateway->devices[position].bucket = gateway->devices[next].bucket;
+            position = next;
+        }
+
+        next = (next + 1) & gateway->mask;
+    }
+
+    gateway->devices[position].bucket = 0;
+
+    device->handler = NULL;
+    device->nextFree = gateway->freeHead;
+    gateway->freeHead = slot + 1;
+    gateway->count--;
+}
+
+/**
+ * @brief Inbound message dispatcher
+ *
+ * Subscribes once per topic wildcard and routes every inbound message
+ * through a topic trie to a typed callback. Request IDs are read from the
+ * topic, so the receive path does not grow with the number of outstanding
+ * requests. Responses to requests tracked in the pending table complete
+ * those requests; the rest go to the response callbacks.
+ * The dispatcher must outlive its subscriptions.
+ */
+typedef struct
+{
+    tc_topic_trie trie;
+    char filters[TC_ROUTE_COUNT][MAX_TOPIC_LENGTH];
+    tc_command_request_handler onCommandRequest;
+    void *commandRequestData;
+    tc_service_response_handler onServiceResponse;
+    void *serviceResponseData;
+    tc_commissioning_response_handler onCommissioningResponse;
+    void *commissioningResponseData;
+    tc_correlation_table *pending;
+    tc_gateway *gateway;
+    tc_format format;
+    const tc_lz_dictionary *dictionary;
+    char *inflateBuffer;
+    size_t inflateBufferLen;
+    tc_stats *stats;
+} tc_dispatcher;
+
+/**
+ * @brief Initialize a dispatcher
+ * 
+ * @param[out]  dispatcher  Dispatcher to initialize.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_dispatcher_init(tc_dispatcher *dispatcher)
+{
+    if (dispatcher == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    memset(dispatcher, 0, sizeof(*dispatcher));
+    tc_topic_trie_init(&dispatcher->trie);
+
+    FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Set the payload format of a dispatcher
+ * 
+ * Inbound payloads are scanned in this format. Defaults to TC_FORMAT_JSON.
+ * 
+ * @param[in]  dispatcher  Dispatcher instance.
+ * @param[in]  format      Payload format.
+ */
+void tc_dispatcher_set_format(tc_dispatcher *dispatcher, tc_format format)
+{
+    dispatcher->format = format;
+}
+
+/**
+ * @brief Accept compressed payloads on a dispatcher
+ * 
+ * Compressed payloads are decompressed into buffer before they are
+ * scanned, so views handed to callbacks point into it. Without a buffer,
+ * compressed payloads are rejected.
+ * 
+ * @param[in]  dispatcher  Dispatcher instance.
+ * @param[in]  dictionary  Optional. Preset dictionary the sender compresses with.
+ * @param[in]  buffer      Buffer sized for the largest decompressed payload.
+ * @param[in]  bufferLen   Size of buffer.
+ */
+void tc_dispatcher_set_compression(tc_dispatcher *dispatcher, const tc_lz_dictionary *dictionary, char *buffer, size_t bufferLen)
+{
+    dispatcher->dictionary = dictionary;
+    dispatcher->inflateBuffer = buffer;
+    dispatcher->inflateBufferLen = bufferLen;
+}
+
+/**
+ * @brief Count a dispatcher's inbound messages
+ * 
+ * Messages dispatched are counted by route, and the time spent parsing
+ * each and in its callback is recorded, in stats.
+ * 
+ * @param[in]  dispatcher  Dispatcher instance.
+ * @param[in]  stats       Optional. Initialized statistics, NULL to stop counting.
+ */
+void tc_dispatcher_set_stats(tc_dispatcher *dispatcher, tc_stats *stats)
+{
+    dispatcher->stats = stats;
+}
+
+/**
+ * @brief Statistics kind of the messages on a route
+ */
+tc_stats_kind tc_route_stats_kind(tc_route route)
+{
+    switch (route)
+    {
+    case TC_ROUTE_COMMAND_REQUEST:
+    case TC_ROUTE_GATEWAY_COMMAND:
+        return TC_STATS_COMMAND_REQUEST;
+    case TC_ROUTE_SERVICE_RESPONSE:
+        return TC_STATS_SERVICE_RESPONSE;
+    case TC_ROUTE_COMMISSIONING_RESPONSE:
+        return TC_STATS_COMMISSIONING_RESPONSE;
+    default:
+        return TC_STATS_OTHER;
+    }
+}
+
+/**
+ * @brief Dispatch an inbound message
+ * 
+ * Matches the topic, scans the payload in place and invokes the callback
+ * registered for the route.
+ * Compressed payloads are decompressed first, see
+ * tc_dispatcher_set_compression.
+ * 
+ * @param[in]  dispatcher  Dispatcher instance.
+ * @param[in]  client      AWS IoT MQTT Client instance passed to the callback.
+ * @param[in]  topic       Topic the message arrived on.
+ * @param[in]  topicLen    Length of the topic.
+ * @param[in]  payload     Message payload.
+ * @param[in]  payloadLen  Length of the payload.
+ * 
+ * @return Zero on success, INVALID_TOPIC_TYPE_ERROR if no route or gateway
+ *         device matched, negative value otherwise
+ */
+IoT_Error_t tc_dispatch(tc_dispatcher *dispatcher, AWS_IoT_Client *client, const char *topic, size_t topicLen, const char *payload, size_t payloadLen)
+{
+    if (dispatcher == NULL || topic == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    tc_stats *stats = dispatcher->stats;
+    const size_t receivedLen = payloadLen;
+
+    tc_topic_match match;
+    // ThinCloud topics carry the device and request IDs in the third and fifth segments
+    if (!tc_topic_trie_match(&dispatcher->trie, topic, topicLen, &match) || match.segmentCount < 3)
+    {
+        tc_stats_received(stats, TC_STATS_OTHER, receivedLen, INVALID_TOPIC_TYPE_ERROR);
+        FUNC_EXIT_RC(INVALID_TOPIC_TYPE_ERROR);
+    }
+
+    uint64_t lap = tc_stats_start(stats);
+
+    IoT_Error_t rc = tc_inflate(dispatcher->dictionary, dispatcher->inflateBuffer, dispatcher->inflateBufferLen, &payload, &payloadLen);
+    if (rc != SUCCESS)
+    {
+        tc_stats_received(stats, tc_route_stats_kind((tc_route)match.route), receivedLen, rc);
+        FUNC_EXIT_RC(rc);
+    }
+
+    switch (match.route)
+    {
+    case TC_ROUTE_COMMAND_REQUEST:
+    case TC_ROUTE_GATEWAY_COMMAND:
+    {
+        tc_command_request_view view;
+        rc = tc_unmarshal_command_request(dispatcher->format, &view, payload, payloadLen);
+        lap = tc_stats_lap(stats, TC_STATS_PARSE, lap);
+        if (rc != SUCCESS)
+        {
+            break;
+        }
+
+        TC_TRACE_BEGIN(TC_TRACE_HANDLER, payloadLen);
+        if (match.route == TC_ROUTE_GATEWAY_COMMAND)
+        {
+            tc_gateway_device *device = dispatcher->gateway != NULL ? tc_gateway_find(dispatcher->gateway, match.segments[2]) : NULL;
+            if (device != NULL)
+            {
+                device->handler(client, device, &view, device->userData);
+            }
+            else
+            {
+                rc = INVALID_TOPIC_TYPE_ERROR;
+            }
+        }
+        else if (dispatcher->onCommandRequest != NULL)
+        {
+            dispatcher->onCommandRequest(client, match.segments[2], &view, dispatcher->commandRequestData);
+        }
+        TC_TRACE_END(TC_TRACE_HANDLER, rc);
+        tc_stats_lap(stats, TC_STATS_HANDLER, lap);
+        break;
+    }
+    case TC_ROUTE_SERVICE_RESPONSE:
+    {
+        tc_service_response_view view;
+        rc = tc_unmarshal_service_response(dispatcher->format, &view, payload, payloadLen);
+        lap = tc_stats_lap(stats, TC_STATS_PARSE, lap);
+        if (rc != SUCCESS || match.segmentCount < 5)
+        {
+            break;
+        }
+
+        TC_TRACE_BEGIN(TC_TRACE_HANDLER, payloadLen);
+        tc_pending_request *request = dispatcher->pending != NULL ? tc_correlation_find(dispatcher->pending, match.segments[4]) : NULL;
+        if (request != NULL && request->route == TC_ROUTE_SERVICE_RESPONSE)
+        {
+            tc_correlation_complete(dispatcher->pending, request, client, SUCCESS, &view);
+        }
+        else if (dispatcher->onServiceResponse != NULL)
+        {
+            dispatcher->onServiceResponse(client, match.segments[2], match.segments[4], &view, dispatcher->serviceResponseData);
+        }
+        TC_TRACE_END(TC_TRACE_HANDLER, rc);
+        tc_stats_lap(stats, TC_STATS_HANDLER, lap);
+        break;
+    }
+    case TC_ROUTE_COMMISSIONING_RESPONSE:
+    {
+        tc_commissioning_response_view view;
+        rc = tc_unmarshal_commissioning_response(dispatcher->format, &view, payload, payloadLen);
+        lap = tc_stats_lap(stats, TC_STATS_PARSE, lap);
+        if (rc != SUCCESS || match.segmentCount < 5)
+        {
+            break;
+        }
+
+        TC_TRACE_BEGIN(TC_TRACE_HANDLER, payloadLen);
+        tc_pending_request *request = dispatcher->pending != NULL ? tc_correlation_find(dispatcher->pending, match.segments[4]) : NULL;
+        if (request != NULL && request->route == TC_ROUTE_COMMISSIONING_RESPONSE)
+        {
+            tc_correlation_complete(dispatcher->pending, request, client, SUCCESS, &view);
+        }
+        else if (dispatcher->onCommissioningResponse != NULL)
+        {
+            dispatcher->onCommissioningResponse(client, match.segments[2], match.segments[4], &view, dispatcher->commissioningResponseData);
+        }
+        TC_TRACE_END(TC_TRACE_HANDLER, rc);
+        tc_stats_lap(stats, TC_STATS_HANDLER, lap);
+        break;
+    }
+    default:
+        rc = INVALID_TOPIC_TYPE_ERROR;
+        break;
+    }
+
+    tc_stats_received(stats, tc_route_stats_kind((tc_route)match.route), receivedLen, rc);
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief MQTT subscription handler for a dispatcher
+ * 
+ * Registered by the tc_dispatcher_subscribe_* functions with the
+ * dispatcher as its data blob.
+ */
+void tc_dispatcher_handler(AWS_IoT_Client *client, char *topic, uint16_t topicLen, IoT_Publish_Message_Params *params, void *data)
+{
+    TC_TRACE_BEGIN(TC_TRACE_CALLBACK, params->payloadLen);
+
+    const IoT_Error_t rc = tc_dispatch((tc_dispatcher *)data, client, topic, topicLen, (const char *)params->payload, params->payloadLen);
+
+    TC_TRACE_END(TC_TRACE_CALLBACK, rc);
+
+    if (rc != SUCCESS)
+    {
+        IOT_WARN("Dropped message on %.*s: %d", topicLen, topic, rc);
+    }
+}
+
+/**
+ * @brief Route a topic filter and subscribe to it
+ * 
+ * Without a client the filter is only routed, for messages that arrive
+ * through a wider subscription.
+ * 
+ * @param[in]  dispatcher  Dispatcher instance.
+ * @param[in]  client      Optional. AWS IoT MQTT Client instance.
+ * @param[in]  route       Route of the filter.
+ * @param[in]  parts       Parts of the topic filter.
+ * @param[in]  count       Number of parts.
+ * @param[in]  qos         Maximum QoS of messages delivered on the route.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_dispatcher_subscribe(tc_dispatcher *dispatcher, AWS_IoT_Client *client, tc_route route, const char *const *parts, size_t count, QoS qos)
+{
+    char *filter = dispatcher->filters[route];
+    size_t filterLen = 0;
+
+    IoT_Error_t rc = tc_join(filter, MAX_TOPIC_LENGTH, parts, count, &filterLen);
+    if (rc == SUCCESS && client != NULL)
+    {
+        rc = aws_iot_mqtt_subscribe(client, filter, (uint16_t)filterLen, qos, tc_dispatcher_handler, dispatcher);
+    }
+
+    if (rc != SUCCESS)
+    {
+        filter[0] = '\0';
+        FUNC_EXIT_RC(rc);
+    }
+
+    // Only filters the broker granted are routed
+    rc = tc_topic_trie_insert(&dispatcher->trie, filter, filterLen, route);
+    if (rc != SUCCESS)
+    {
+        if (client != NULL)
+        {
+            aws_iot_mqtt_unsubscribe(client, filter, (uint16_t)filterLen);
+        }
+        filter[0] = '\0';
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Dispatch command requests
+ * 
+ * Subscribes to "thincloud/devices/{deviceId}/command". When the
+ * dispatcher already dispatches gateway commands, the broker delivers the
+ * device's commands through "thincloud/devices/+/command", and the AWS
+ * SDK would call the handler once for each matching subscription, so the
+ * filter is only routed instead.
+ * 
+ * @param[in]  dispatcher  Dispatcher instance.
+ * @param[in]  client      AWS IoT MQTT Client instance.
+ * @param[in]  deviceId    Device's ID.
+ * @param[in]  handler     Command request callback.
+ * @param[in]  userData    Data blob to be passed to the callback on invoke.
+ * @param[in]  qos         Maximum QoS of messages delivered to the handler.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_dispatcher_subscribe_command_requests(tc_dispatcher *dispatcher, AWS_IoT_Client *client, const char *deviceId, tc_command_request_handler handler, void *userData, QoS qos)
+{
+    if (dispatcher == NULL || deviceId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    dispatcher->onCommandRequest = handler;
+    dispatcher->commandRequestData = userData;
+
+    const char *const parts[] = {"thincloud/devices/", deviceId, "/command"};
+
+    return tc_dispatcher_subscribe(dispatcher, dispatcher->gateway == NULL ? client : NULL, TC_ROUTE_COMMAND_REQUEST, parts, sizeof(parts) / sizeof(parts[0]), qos);
+}
+
+/**
+ * @brief Dispatch service responses
+ * 
+ * Subscribes once to "thincloud/devices/{deviceId}/requests/+/response"
+ * for all of the device's service requests.
+ * 
+ * @param[in]  dispatcher  Dispatcher instance.
+ * @param[in]  client      AWS IoT MQTT Client instance.
+ * @param[in]  deviceId    Device's ID.
+ * @param[in]  handler     Service response callback.
+ * @param[in]  userData    Data blob to be passed to the callback on invoke.
+ * @param[in]  qos         Maximum QoS of messages delivered to the handler.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_dispatcher_subscribe_service_responses(tc_dispatcher *dispatcher, AWS_IoT_Client *client, const char *deviceId, tc_service_response_handler handler, void *userData, QoS qos)
+{
+    if (dispatcher == NULL || deviceId == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    dispatcher->onServiceResponse = handler;
+    dispatcher->serviceResponseData = userData;
+
+    const char *const parts[] = {"thincloud/devices/", deviceId, "/requests/+/response"};
+
+    return tc_dispatcher_subscribe(dispatcher, client, TC_ROUTE_SERVICE_RESPONSE, parts, sizeof(parts) / sizeof(parts[0]), qos);
+}
+
+/**
+ * @brief Dispatch commissioning responses
+ * 
+ * Subscribes once to "thincloud/registration/+/requests/+/response".
+ * 
+ * @param[in]  dispatcher  Dispatcher instance.
+ * @param[in]  client      AWS IoT MQTT Client instance.
+ * @param[in]  handler     Commissioning response callback.
+ * @param[in]  userData    Data blob to be passed to the callback on invoke.
+ * @param[in]  qos         Maximum QoS of messages delivered to the handler.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_dispatcher_subscribe_commissioning_responses(tc_dispatcher *dispatcher, AWS_IoT_Client *client, tc_commissioning_response_handler handler, void *userData, QoS qos)
+{
+    if (dispatcher == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    dispatcher->onCommissioningResponse = handler;
+    dispatcher->commissioningResponseData = userData;
+
+    const char *const parts[] = {"thincloud/registration/+/requests/+/response"};
+
+    return tc_dispatcher_subscribe(dispatcher, client, TC_ROUTE_COMMISSIONING_RESPONSE, parts, sizeof(parts) / sizeof(parts[0]), qos);
+}
+
+/**
+ * @brief Dispatch command requests for every device of a gateway
+ * 
+ * Subscribes once to "thincloud/devices/+/command" and routes each
+ * command to the handler of the device registered in the gateway table.
+ * Commands for unregistered devices are dropped. Devices can be
+ * registered and unregistered at any time without subscribing again.
+ * 
+ * The gateway's own commands arrive through the same subscription. Call
+ * tc_dispatcher_subscribe_command_requests afterwards to route them to
+ * its command request callback; it then adds no subscription of its own,
+ * so each command is dispatched once.
+ * 
+ * @param[in]  dispatcher  Dispatcher instance.
+ * @param[in]  client      AWS IoT MQTT Client instance.
+ * @param[in]  gateway     Gateway device table. Must outlive the subscription.
+ * @param[in]  qos         Maximum QoS of messages delivered to the handlers.
+ * 
+ * @return Zero on success, FAILURE if the dispatcher already subscribed to
+ *         the gateway's own commands, negative value otherwise
+ */
+IoT_Error_t tc_dispatcher_subscribe_gateway_commands(tc_dispatcher *dispatcher, AWS_IoT_Client *client, tc_gateway *gateway, QoS qos)
+{
+    if (dispatcher == NULL || gateway == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    // Both subscriptions would match the gateway's own commands
+    if (dispatcher->gateway == NULL && dispatcher->filters[TC_ROUTE_COMMAND_REQUEST][0] != '\0')
+    {
+        FUNC_EXIT_RC(FAILURE);
+    }
+
+    tc_gateway *previous = dispatcher->gateway;
+    dispatcher->gateway = gateway;
+
+    const char *const parts[] = {"thincloud/devices/+/command"};
+
+    const IoT_Error_t rc = tc_dispatcher_subscribe(dispatcher, client, TC_ROUTE_GATEWAY_COMMAND, parts, sizeof(parts) / sizeof(parts[0]), qos);
+    if (rc != SUCCESS)
+    {
+        dispatcher->gateway = previous;
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Send a command response for a gateway device
+ * 
+ * Builds the response topic from the device's cached prefix.
+ * 
+ * @param[in]  context          Optional. ThinCloud context to publish through, in its format.
+ * @param[in]  client           AWS IoT MQTT Client instance.
+ * @param[in]  device           Registered gateway device.
+ * @param[in]  commandId        ID of the requested command.
+ * @param[in]  statusCode       Command's status code.
+ * @param[in]  isErrorResponse  Signals if a command responds with an error.
+ * @param[in]  errorMessage     Response error message. Only used if isErrorResponse is set to true.
+ * @param[in]  body             Command response body. The response takes ownership of body.
+ * @param[in]  qos              QoS to publish with.
+ * 
+ * @return Zero on success, MAX_SIZE_ERROR if the response does not fit in
+ *         TC_MAX_PAYLOAD_LENGTH, negative value otherwise
+ */
+IoT_Error_t tc_gateway_send_command_response(tc_context *context, AWS_IoT_Client *client, const tc_gateway_device *device, const char *commandId, uint16_t statusCode, bool isErrorResponse, char *errorMessage, json_object *body, QoS qos)
+{
+    if (device == NULL || commandId == NULL)
+    {
+        json_object_put(body);
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    char topic[MAX_TOPIC_LENGTH];
+    uint16_t topicLen = 0;
+
+    TC_TRACE_BEGIN(TC_TRACE_TOPIC, 0);
+    IoT_Error_t rc = tc_topic_cache_command_response(&device->topics, topic, sizeof(topic), commandId, strlen(commandId), &topicLen);
+    TC_TRACE_END(TC_TRACE_TOPIC, rc);
+
+    if (rc != SUCCESS)
+    {
+        json_object_put(body);
+        FUNC_EXIT_RC(rc);
+    }
+
+    char payload[TC_MAX_PAYLOAD_LENGTH];
+    size_t payloadLen = 0;
+    size_t messageSize = 0;
+    char *message = tc_context_message_buffer(context, payload, sizeof(payload), &messageSize);
+
+    TC_TRACE_BEGIN(TC_TRACE_MARSHAL, 0);
+    rc = tc_marshal_command_response(tc_context_format(context), message, messageSize, commandId, statusCode, isErrorResponse, errorMessage, body, &payloadLen);
+    if (rc == SUCCESS)
+    {
+        rc = tc_context_compress(context, message, payloadLen, payload, sizeof(payload), &payloadLen);
+    }
+    TC_TRACE_END(TC_TRACE_MARSHAL, rc);
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    return tc_context_publish_qos(context, client, topic, topicLen, payload, payloadLen, qos);
+}
+
+/**
+ * @brief Send a tracked service request through a context
+ * 
+ * Publish a service request and track it in a correlation table until
+ * its response arrives on the dispatcher's service response subscription
+ * or it times out. Retransmits go through the context exactly as the
+ * first attempt did, with the same payload and QoS.
+ * 
+ * @param[in]  context    Optional. ThinCloud context to publish through, in its format.
+ * @param[in]  client     AWS IoT MQTT Client instance.
+ * @param[in]  pending    Correlation table of the client's dispatcher.
+ * @param[in]  requestId  Unique ID for the request. At most TC_MAX_REQUEST_ID_LENGTH bytes.
+ * @param[in]  deviceId   Devices's ID.
+ * @param[in]  method     Service method to request.
+ * @param[in]  params     Service request parameters. The request takes ownership of params.
+ * @param[in]  timeoutMs  Time to wait for a response.
+ * @param[in]  retry      Optional. Retransmission policy. Requires a table with a timer wheel.
+ * @param[in]  callback   Completion callback.
+ * @param[in]  userData   Data blob to be passed to the callback on invoke.
+ * @param[in]  qos        QoS to publish with.
+ * 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if too many requests are
+ *         pending, negative value otherwise
+ */
+IoT_Error_t send_service_request_async_ctx(tc_context *context, AWS_IoT_Client *client, tc_correlation_table *pending, const char *requestId, const char *deviceId, const char *method, json_object *reqParams, uint32_t timeoutMs, const tc_retry_policy *retry, tc_service_response_callback callback, void *userData, QoS qos)
+{
+    if (pending == NULL || requestId == NULL || callback == NULL)
+    {
+        json_object_put(reqParams);
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    tc_pending_request *request = NULL;
+    IoT_Error_t rc = tc_correlation_track(pending, requestId, strlen(requestId), TC_ROUTE_SERVICE_RESPONSE, tc_clock_ms() + timeoutMs, &request);
+    if (rc != SUCCESS)
+    {
+        json_object_put(reqParams);
+        FUNC_EXIT_RC(rc);
+    }
+
+    request->callback.service = callback;
+    request->userData = userData;
+    request->client = client;
+    request->context = context;
+
+    if (retry == NULL)
+    {
+        rc = send_service_request_ctx(context, client, requestId, deviceId, method, reqParams, qos);
+    }
+    else
+    {
+        tc_retry_buffer *buffer = NULL;
+
+        rc = tc_correlation_retry(pending, request, client, timeoutMs, retry, &buffer);
+        if (rc == SUCCESS)
+        {
+            buffer->qos = qos;
+            rc = tc_context_build_service_request(context, buffer->topic, &buffer->topicLen, buffer->payload, &buffer->payloadLen, requestId, deviceId, method, reqParams);
+        }
+        else
+        {
+            json_object_put(reqParams);
+        }
+
+        if (rc == SUCCESS)
+        {
+            rc = tc_context_publish_qos(context, client, buffer->topic, buffer->topicLen, buffer->payload, buffer->payloadLen, qos);
+        }
+    }
+
+    if (rc != SUCCESS)
+    {
+        tc_correlation_remove(pending, request);
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Send a tracked service request
+ * 
+ * Publish a service request and track it in a correlation table until
+ * its response arrives on the dispatcher's service response subscription
+ * or it times out.
+ * 
+ * @param[in]  client     AWS IoT MQTT Client instance.
+ * @param[in]  pending    Correlation table of the client's dispatcher.
+ * @param[in]  requestId  Unique ID for the request. At most TC_MAX_REQUEST_ID_LENGTH bytes.
+ * @param[in]  deviceId   Devices's ID.
+ * @param[in]  method     Service method to request.
+ * @param[in]  params     Service request parameters. The request takes ownership of params.
+ * @param[in]  timeoutMs  Time to wait for a response.
+ * @param[in]  retry      Optional. Retransmission policy. Requires a table with a timer wheel.
+ * @param[in]  callback   Completion callback.
+ * @param[in]  userData   Data blob to be passed to the callback on invoke.
+ * 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if too many requests are
+ *         pending, negative value otherwise
+ */
+IoT_Error_t send_service_request_async(AWS_IoT_Client *client, tc_correlation_table *pending, const char *requestId, const char *deviceId, const char *method, json_object *reqParams, uint32_t timeoutMs, const tc_retry_policy *retry, tc_service_response_callback callback, void *userData)
+{
+    return send_service_request_async_ctx(NULL, client, pending, requestId, deviceId, method, reqParams, timeoutMs, retry, callback, userData, QOS0);
+}
+
+/**
+ * @brief Send a tracked commissioning request through a context
+ * 
+ * Publish a commissioning request and track it in a correlation table
+ * until its response arrives on the dispatcher's commissioning response
+ * subscription or it times out. Retransmits go through the context
+ * exactly as the first attempt did, with the same payload and QoS.
+ * 
+ * @param[in]  context          Optional. ThinCloud context to publish through, in its format.
+ * @param[in]  client           AWS IoT MQTT Client instance.
+ * @param[in]  pending          Correlation table of the client's dispatcher.
+ * @param[in]  requestId        Unique ID for the request. At most TC_MAX_REQUEST_ID_LENGTH bytes.
+ * @param[in]  deviceType       Devices's device type.
+ * @param[in]  physicalId       Device's physical ID.
+ * @param[in]  relatedDeviceIds List of devices to associate on commissioning
+ * @param[in]  idsSize          Size of related device ids list 
+ * @param[in]  timeoutMs        Time to wait for a response.
+ * @param[in]  retry            Optional. Retransmission policy. Requires a table with a timer wheel.
+ * @param[in]  callback         Completion callback.
+ * @param[in]  userData         Data blob to be passed to the callback on invoke.
+ * @param[in]  qos              QoS to publish with.
+ * 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if too many requests are
+ *         pending, negative value otherwise
+ */
+IoT_Error_t send_commissioning_request_async_ctx(tc_context *context, AWS_IoT_Client *client, tc_correlation_table *pending, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize, uint32_t timeoutMs, const tc_retry_policy *retry, tc_commissioning_response_callback callback, void *userData, QoS qos)
+{
+    if (pending == NULL || requestId == NULL || callback == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    tc_pending_request *request = NULL;
+    IoT_Error_t rc = tc_correlation_track(pending, requestId, strlen(requestId), TC_ROUTE_COMMISSIONING_RESPONSE, tc_clock_ms() + timeoutMs, &request);
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    request->callback.commissioning = callback;
+    request->userData = userData;
+    request->client = client;
+    request->context = context;
+
+    if (retry == NULL)
+    {
+        rc = send_commissioning_request_ctx(context, client, requestId, deviceType, physicalId, relatedDeviceIds, idsSize, qos);
+    }
+    else
+    {
+        tc_retry_buffer *buffer = NULL;
+
+        rc = tc_correlation_retry(pending, request, client, timeoutMs, retry, &buffer);
+        if (rc == SUCCESS)
+        {
+            buffer->qos = qos;
+            rc = tc_context_build_commissioning_request(context, buffer->topic, &buffer->topicLen, buffer->payload, &buffer->payloadLen, requestId, deviceType, physicalId, relatedDeviceIds, idsSize);
+        }
+
+        if (rc == SUCCESS)
+        {
+            rc = tc_context_publish_qos(context, client, buffer->topic, buffer->topicLen, buffer->payload, buffer->payloadLen, qos);
+        }
+    }
+
+    if (rc != SUCCESS)
+    {
+        tc_correlation_remove(pending, request);
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Send a tracked commissioning request
+ * 
+ * Publish a commissioning request and track it in a correlation table
+ * until its response arrives on the dispatcher's commissioning response
+ * subscription or it times out.
+ * 
+ * @param[in]  client           AWS IoT MQTT Client instance.
+ * @param[in]  pending          Correlation table of the client's dispatcher.
+ * @param[in]  requestId        Unique ID for the request. At most TC_MAX_REQUEST_ID_LENGTH bytes.
+ * @param[in]  deviceType       Devices's device type.
+ * @param[in]  physicalId       Device's physical ID.
+ * @param[in]  relatedDeviceIds List of devices to associate on commissioning
+ * @param[in]  idsSize          Size of related device ids list 
+ * @param[in]  timeoutMs        Time to wait for a response.
+ * @param[in]  retry            Optional. Retransmission policy. Requires a table with a timer wheel.
+ * @param[in]  callback         Completion callback.
+ * @param[in]  userData         Data blob to be passed to the callback on invoke.
+ * 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if too many requests are
+ *         pending, negative value otherwise
+ */
+IoT_Error_t send_commissioning_request_async(AWS_IoT_Client *client, tc_correlation_table *pending, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize, uint32_t timeoutMs, const tc_retry_policy *retry, tc_commissioning_response_callback callback, void *userData)
+{
+    return send_commissioning_request_async_ctx(NULL, client, pending, requestId, deviceType, physicalId, relatedDeviceIds, idsSize, timeoutMs, retry, callback, userData, QOS0);
+}
+
+/**
+ * @brief Run a context's due work
+ * 
+ * Advances the context's timer wheel, timing out and retransmitting
+ * pending requests and unacknowledged QoS1 messages, flushes the
+ * context's batch once its time threshold passes, and replays the
+ * context's outbox once the client is connected again.
+ * 
+ * @param[in]  context  ThinCloud context.
+ * @param[in]  client   AWS IoT MQTT Client instance.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_context_tick(tc_context *context, AWS_IoT_Client *client)
+{
+    IoT_Error_t rc = SUCCESS;
+
+    const uint64_t now = tc_clock_ms();
+    tc_timer_wheel_advance(&context->timers, now);
+
+    const bool connected = aws_iot_mqtt_is_client_connected(client);
+
+    if (context->batch != NULL && connected)
+    {
+        rc = tc_batch_poll(context->batch, client, now);
+    }
+
+    if (tc_context_draining(context, client))
+    {
+        const IoT_Error_t drainRc = tc_context_drain(context, client);
+        if (rc == SUCCESS)
+        {
+            rc = drainRc;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Time until a context has due work
+ * 
+ * Covers the context's timers and batch, and the client's keepalive ping
+ * and reconnect delay.
+ * 
+ * @param[in]  context  ThinCloud context.
+ * @param[in]  client   AWS IoT MQTT Client instance.
+ * 
+ * @return Milliseconds until tc_yield next has work, UINT32_MAX if nothing is scheduled
+ */
+uint32_t tc_context_next_timeout(tc_context *context, AWS_IoT_Client *client)
+{
+    const uint64_t now = tc_clock_ms();
+    uint64_t next = tc_timer_wheel_next(&context->timers);
+
+    if (context->batch != NULL && context->batch->count > 0)
+    {
+        const uint64_t flush = context->batch->oldest + context->batch->flushIntervalMs;
+        next = flush < next ? flush : next;
+    }
+
+    uint32_t timeoutMs = UINT32_MAX;
+    if (next <= now)
+    {
+        timeoutMs = 0;
+    }
+    else if (next - now < UINT32_MAX)
+    {
+        timeoutMs = (uint32_t)(next - now);
+    }
+
+    if (aws_iot_mqtt_is_client_connected(client))
+    {
+        if (client->clientData.keepAliveInterval > 0)
+        {
+            const uint32_t ping = left_ms(&client->pingTimer);
+            timeoutMs = ping < timeoutMs ? ping : timeoutMs;
+        }
+    }
+    else if (client->clientStatus.isAutoReconnectEnabled)
+    {
+        const uint32_t reconnect = left_ms(&client->reconnectDelayTimer);
+        timeoutMs = reconnect < timeoutMs ? reconnect : timeoutMs;
+    }
+    else
+    {
+        // tc_yield reports the disconnect
+        timeoutMs = 0;
+    }
+
+    if (tc_context_draining(context, client))
+    {
+        timeoutMs = 0;
+    }
+
+    return timeoutMs;
+}
+
+/**
+ * @brief Yield to the MQTT client and run due timers
+ * 
+ * Drop-in replacement for aws_iot_mqtt_yield that also runs the
+ * context's due work with tc_context_tick. PUBACKs for the context's
+ * in-flight window are handled inside aws_iot_mqtt_yield.
+ * 
+ * @param[in]  context    ThinCloud context.
+ * @param[in]  client     AWS IoT MQTT Client instance.
+ * @param[in]  timeoutMs  Time to wait for inbound messages.
+ * 
+ * @return Result of aws_iot_mqtt_yield
+ */
+IoT_Error_t tc_yield(tc_context *context, AWS_IoT_Client *client, uint32_t timeoutMs)
+{
+    IoT_Error_t rc = aws_iot_mqtt_yield(client, timeoutMs);
+
+    const IoT_Error_t tickRc = tc_context_tick(context, client);
+    if ((rc == SUCCESS || rc == NETWORK_RECONNECTED) && tickRc != SUCCESS)
+    {
+        rc = tickRc;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Initialize an AWS IoT Client 
+ * 
+ * Initialize an AWS IoT Client instance with ThinCloud specific parameters and defaults.
+ * 
+ * @param[in]  client          AWS IoT MQTT Client instance.
+ * @param[in]  hostAddr        ThinCloud host address. 
+ * @param[in]  rootCAPath      Path to a root CA.
+ * @param[in]  clientCRTPath   Path to a client CRT.
+ * @param[in]  clientKeyPath   Path to a client private key.
+ * @param[in]  handler         Disconnect handler.
+ * @param[in]  disconnectData  Data blob to be passed to the disconnect handler on invoke.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_init(AWS_IoT_Client *client, char *hostAddr, char *rootCAPath, char *clientCRTPath, char *clientKeyPath, iot_disconnect_handler handler, void *disconnectData)
+{
+    IoT_Client_Init_Params params = iotClientInitParamsDefault;
+
+    params.enableAutoReconnect = false; // We enable this on connect
+    params.pHostURL = hostAddr;
+    params.port = 443; // Default MQTT port
+    params.pRootCALocation = rootCAPath;
+    params.pDeviceCertLocation = clientCRTPath;
+    params.pDevicePrivateKeyLocation = clientKeyPath;
+    params.mqttCommandTimeout_ms = 20000;
+    params.tlsHandshakeTimeout_ms = 5000;
+    params.isSSLHostnameVerify = true;
+    params.disconnectHandler = handler;
+    params.disconnectHandlerData = disconnectData;
+
+    return aws_iot_mqtt_init(client, &params);
+}
+
+/**
+ * @brief Start MQTT connection to ThinCloud host
  * 
- * @return Zero on success, a negative value otherwise 
+ * Initialize an MQTT conenction to a thincloud host.
+ * 
+ * @param[in]  client         AWS IoT MQTT Client instance.
+ * @param[in]  clientId       An unique ID for the client instance.
+ * @param[in]  autoReconnect  Signals if the MQTT client should attempt to auto-reconnect
+ *                            after connection failures.
+ * 
+ * @return Zero on success, negative value otherwise 
  */
-IoT_Error_t command_response(char *buffer, const char *requestId, uint16_t statusCode, bool isErrorResponse, char *errorMessage, json_object *body)
+IoT_Error_t tc_connect(AWS_IoT_Client *client, char *clientId, bool autoReconnect)
 {
-    json_object *obj = json_object_new_object();
-    if (requestId != NULL)
+    IoT_Client_Connect_Params params = iotClientConnectParamsDefault;
+
+    params.keepAliveIntervalInSec = 600;
+    params.isCleanSession = true;
+    params.MQTTVersion = MQTT_3_1_1;
+    params.pClientID = clientId;
+    params.clientIDLen = (uint16_t)strlen(clientId);
+    params.isWillMsgPresent = false;
+
+    IoT_Error_t rc = aws_iot_mqtt_connect(client, &params);
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    if (autoReconnect)
     {
-        json_object *value = json_object_new_string(requestId);
-        json_object_object_add(obj, "id", value);
+        rc = aws_iot_mqtt_autoreconnect_set_status(client, true);
+        if (rc != SUCCESS)
+        {
+            FUNC_EXIT_RC(rc);
+        }
     }
 
-    json_object *statusCodeValue = json_object_new_int(statusCode);
+    FUNC_EXIT_RC(SUCCESS);
+}
 
-    if (isErrorResponse)
+/**
+ * @brief Start MQTT connection through a context
+ * 
+ * Connects like tc_connect, then replays the context's outbox in order.
+ * 
+ * @param[in]  context        ThinCloud context.
+ * @param[in]  client         AWS IoT MQTT Client instance.
+ * @param[in]  clientId       An unique ID for the client instance.
+ * @param[in]  autoReconnect  Signals if the MQTT client should attempt to auto-reconnect
+ *                            after connection failures.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_connect_ctx(tc_context *context, AWS_IoT_Client *client, char *clientId, bool autoReconnect)
+{
+    IoT_Error_t rc = tc_connect(client, clientId, autoReconnect);
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    if (context != NULL && context->outbox != NULL)
+    {
+        rc = tc_context_drain(context, client);
+    }
+
+    FUNC_EXIT_RC(rc);
+}
+
+
+/**
+ * @brief Message waiting in a tc_client's send queue
+ */
+typedef struct
+{
+    tc_queue_cell cell;
+    QoS qos;
+    uint16_t topicLen;
+    size_t payloadLen;
+    char topic[MAX_TOPIC_LENGTH];
+    char payload[TC_MAX_PAYLOAD_LENGTH];
+} tc_send;
+
+/**
+ * @brief ThinCloud client
+ * 
+ * Owns an MQTT client, its context and its subscription topics, with no
+ * state shared between instances. Any thread may queue messages with the
+ * tc_client_send_* functions without blocking; only the thread that calls
+ * tc_client_yield or tc_run touches the connection. Everything else is for
+ * that thread only.
+ * 
+ * The MQTT client doubles as a tc_inflight_client, so a QoS1 in-flight
+ * window can be attached with tc_client_set_inflight.
+ */
+typedef struct
+{
+    union
+    {
+        AWS_IoT_Client mqtt;
+        tc_inflight_client link;
+    };
+    tc_context context;
+    tc_queue sends;
+    int wakeFd[2];
+    atomic_bool wakePending;
+    atomic_bool running;
+    char commissioningResponseTopic[MAX_TOPIC_LENGTH];
+    char commandTopic[MAX_TOPIC_LENGTH];
+    char serviceResponseTopic[MAX_TOPIC_LENGTH];
+} tc_client;
+
+/**
+ * @brief Initialize a ThinCloud client
+ * 
+ * @param[out]  client          Client to initialize.
+ * @param[in]   sends           Send queue slots.
+ * @param[in]   capacity        Number of slots. Must be a power of two.
+ * @param[in]   hostAddr        ThinCloud host address. 
+ * @param[in]   rootCAPath      Path to a root CA.
+ * @param[in]   clientCRTPath   Path to a client CRT.
+ * @param[in]   clientKeyPath   Path to a client private key.
+ * @param[in]   handler         Disconnect handler.
+ * @param[in]   disconnectData  Data blob to be passed to the disconnect handler on invoke.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_client_init(tc_client *client, tc_send *sends, size_t capacity, char *hostAddr, char *rootCAPath, char *clientCRTPath, char *clientKeyPath, iot_disconnect_handler handler, void *disconnectData)
+{
+    if (client == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    memset((void *)client, 0, sizeof(*client));
+    client->wakeFd[0] = -1;
+    client->wakeFd[1] = -1;
+    atomic_init(&client->wakePending, false);
+    atomic_init(&client->running, false);
+
+    IoT_Error_t rc = tc_context_init(&client->context);
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    rc = tc_queue_init(&client->sends, &sends->cell, sizeof(tc_send), capacity);
+    if (rc != SUCCESS)
+    {
+        FUNC_EXIT_RC(rc);
+    }
+
+    // Producers wake tc_run through an eventfd, or a pipe where there is none
+#ifdef __linux__
+    client->wakeFd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    client->wakeFd[1] = client->wakeFd[0];
+    if (client->wakeFd[0] < 0)
+    {
+        FUNC_EXIT_RC(FAILURE);
+    }
+#else
+    if (pipe(client->wakeFd) != 0)
+    {
+        client->wakeFd[0] = -1;
+        client->wakeFd[1] = -1;
+        FUNC_EXIT_RC(FAILURE);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(client->wakeFd[i], F_SETFL, fcntl(client->wakeFd[i], F_GETFL) | O_NONBLOCK);
+        fcntl(client->wakeFd[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    return tc_init(&client->mqtt, hostAddr, rootCAPath, clientCRTPath, clientKeyPath, handler, disconnectData);
+}
+
+/**
+ * @brief Set the payload format of a ThinCloud client
+ * 
+ * Messages queued with the tc_client_send_* functions are marshalled in
+ * this format. Set it before other threads start sending, and set the
+ * same format on the client's dispatcher. Defaults to TC_FORMAT_JSON.
+ * 
+ * @param[in]  client  ThinCloud client.
+ * @param[in]  format  Payload format.
+ */
+void tc_client_set_format(tc_client *client, tc_format format)
+{
+    tc_context_set_format(&client->context, format);
+}
+
+/**
+ * @brief Compress a ThinCloud client's large outbound payloads
+ * 
+ * Command responses and service requests queued with the tc_client_send_*
+ * functions are compressed in their send slot when they reach threshold
+ * and compression makes them smaller. Set it before other threads start
+ * sending. Payloads are compressed after marshalling, so they must still
+ * fit in TC_MAX_PAYLOAD_LENGTH uncompressed.
+ * 
+ * @param[in]  client      ThinCloud client.
+ * @param[in]  threshold   Smallest payload to compress. Zero disables compression.
+ * @param[in]  dictionary  Optional. Preset dictionary, e.g. &tc_lz_thincloud_dictionary.
+ */
+void tc_client_set_compression(tc_client *client, size_t threshold, const tc_lz_dictionary *dictionary)
+{
+    tc_context_set_compression(&client->context, threshold, dictionary, NULL, 0);
+}
+
+/**
+ * @brief Collect a ThinCloud client's QoS0 messages into a batch
+ * 
+ * Queued QoS0 messages are written together instead of one write each.
+ * See tc_context_set_batch. Set it before the client starts running.
+ * 
+ * @param[in]  client  ThinCloud client.
+ * @param[in]  batch   Optional. Initialized batch, NULL to publish each message at once.
+ */
+void tc_client_set_batch(tc_client *client, tc_batch *batch)
+{
+    tc_context_set_batch(&client->context, batch);
+}
+
+/**
+ * @brief Keep a ThinCloud client's messages in an offline outbox
+ * 
+ * Messages queued while the client is disconnected are appended to the
+ * outbox instead of waiting in the send queue, and replayed once the
+ * client reconnects. See tc_context_set_outbox. Set it before the client
+ * starts running.
+ * 
+ * @param[in]  client  ThinCloud client.
+ * @param[in]  outbox  Optional. Opened outbox, NULL to keep messages queued while disconnected.
+ */
+void tc_client_set_outbox(tc_client *client, tc_outbox *outbox)
+{
+    tc_context_set_outbox(&client->context, outbox);
+}
+
+/**
+ * @brief Send a ThinCloud client's QoS1 messages through an in-flight window
+ * 
+ * Attaches the window to the client, so queued QoS1 messages are written
+ * without waiting for their PUBACK. Once the window is full, messages
+ * stay queued, or go to the outbox, until PUBACKs free its slots. Give
+ * the window the client's context timers to retransmit late messages.
+ * Set it after tc_client_init and before the client starts running.
+ * 
+ * @param[in]  client    ThinCloud client.
+ * @param[in]  inflight  Optional. Initialized window, NULL to detach the current one.
+ * 
+ * @return Zero on success, FAILURE if the window is attached to another
+ *         client, LIMIT_EXCEEDED_ERROR if the client carries another
+ *         window, negative value otherwise
+ */
+IoT_Error_t tc_client_set_inflight(tc_client *client, tc_inflight *inflight)
+{
+    if (client == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    if (inflight == NULL)
     {
-        json_object *error = json_object_new_object();
-        json_object_object_add(error, "statusCode", statusCodeValue);
-        if (errorMessage != NULL)
+        if (client->link.inflight != NULL)
         {
-            json_object *errorMessageValue = json_object_new_string(errorMessage);
-            json_object_object_add(error, "message", errorMessageValue);
+            tc_inflight_detach(client->link.inflight);
         }
 
-        json_object_object_add(obj, "error", error);
+        return tc_context_set_inflight(&client->context, &client->mqtt, NULL);
     }
-    else
+
+    if (inflight->client == NULL)
     {
-        json_object *result = json_object_new_object();
-        json_object_object_add(result, "statusCode", statusCodeValue);
+        const IoT_Error_t rc = tc_inflight_attach(inflight, &client->link);
+        if (rc != SUCCESS)
+        {
+            FUNC_EXIT_RC(rc);
+        }
+    }
 
-        if (body != NULL)
+    return tc_context_set_inflight(&client->context, &client->mqtt, inflight);
+}
+
+/**
+ * @brief Free a ThinCloud client's context and wakeup descriptors
+ */
+void tc_client_free(tc_client *client)
+{
+    if (client->link.inflight != NULL)
+    {
+        tc_inflight_detach(client->link.inflight);
+    }
+
+    tc_context_free(&client->context);
+
+    if (client->wakeFd[0] >= 0)
+    {
+        close(client->wakeFd[0]);
+    }
+    if (client->wakeFd[1] >= 0 && client->wakeFd[1] != client->wakeFd[0])
+    {
+        close(client->wakeFd[1]);
+    }
+
+    client->wakeFd[0] = -1;
+    client->wakeFd[1] = -1;
+}
+
+/**
+ * @brief Connect a ThinCloud client
+ * 
+ * @param[in]  client         ThinCloud client.
+ * @param[in]  clientId       An unique ID for the client instance.
+ * @param[in]  autoReconnect  Signals if the MQTT client should attempt to auto-reconnect
+ *                            after connection failures.
+ * 
+ * @return Zero on success, negative value otherwise 
+ */
+IoT_Error_t tc_client_connect(tc_client *client, char *clientId, bool autoReconnect)
+{
+    return tc_connect_ctx(&client->context, &client->mqtt, clientId, autoReconnect);
+}
+
+/**
+ * @brief Wake a client's tc_run loop
+ * 
+ * Safe to call from any thread. Only the first wakeup after tc_run last
+ * woke up is written to the wakeup descriptor.
+ * 
+ * @param[in]  client  ThinCloud client.
+ */
+void tc_client_wake(tc_client *client)
+{
+    if (atomic_exchange_explicit(&client->wakePending, true, memory_order_acq_rel))
+    {
+        return;
+    }
+
+    // A full pipe already holds a wakeup
+    const uint64_t one = 1;
+    const ssize_t written = write(client->wakeFd[1], &one, sizeof(one));
+    (void)written;
+}
+
+/**
+ * @brief Compress a marshalled payload in its send slot
+ */
+void tc_client_compress(tc_client *client, tc_send *send)
+{
+    const tc_compression *compression = &client->context.compression;
+    if (compression->threshold == 0 || send->payloadLen < compression->threshold)
+    {
+        return;
+    }
+
+    char packed[TC_MAX_PAYLOAD_LENGTH];
+    size_t packedLen = 0;
+
+    // Only keep envelopes smaller than the payload
+    if (tc_lz_pack(compression->dictionary, send->payload, send->payloadLen, packed, send->payloadLen - 1, &packedLen) == SUCCESS)
+    {
+        memcpy(send->payload, packed, packedLen);
+        send->payloadLen = packedLen;
+    }
+}
+
+/**
+ * @brief Hand a filled send slot to the thread running the client
+ */
+void tc_client_commit(tc_client *client, size_t position)
+{
+    tc_queue_commit(&client->sends, position);
+    tc_client_wake(client);
+}
+
+/**
+ * @brief Give back a send slot whose message could not be built
+ *
+ * The reservation is undone if no later send has reserved a slot since;
+ * otherwise the slot is committed empty and skipped by the thread running
+ * the client.
+ */
+void tc_client_discard(tc_client *client, size_t position)
+{
+    if (!tc_queue_cancel(&client->sends, position))
+    {
+        TC_QUEUE_SLOT(&client->sends, position, tc_send)->topicLen = 0;
+        tc_queue_commit(&client->sends, position);
+    }
+}
+
+/**
+ * @brief Send every queued message
+ * 
+ * Stops early, keeping the rest queued, while the client is disconnected
+ * without an outbox or its in-flight window is full. Called by
+ * tc_client_yield.
+ * 
+ * @param[in]  client  ThinCloud client.
+ * 
+ * @return Number of messages taken off the queue
+ */
+uint32_t tc_client_flush(tc_client *client)
+{
+    uint32_t sent = 0;
+    size_t position = 0;
+
+    while (tc_queue_peek(&client->sends, &position))
+    {
+        tc_send *send = TC_QUEUE_SLOT(&client->sends, position, tc_send);
+
+        // Slots of failed sends that could not be cancelled are committed empty
+        if (send->topicLen > 0)
         {
-            json_object_object_add(result, "body", body);
+            if (client->context.outbox == NULL && !aws_iot_mqtt_is_client_connected(&client->mqtt))
+            {
+                break;
+            }
+
+            const IoT_Error_t rc = tc_context_publish_qos(&client->context, &client->mqtt, send->topic, send->topicLen, send->payload, send->payloadLen, send->qos);
+            if (rc == LIMIT_EXCEEDED_ERROR)
+            {
+                break;
+            }
+            else if (rc != SUCCESS)
+            {
+                IOT_WARN("Dropped message on %.*s: %d", send->topicLen, send->topic, rc);
+            }
+
+            sent++;
         }
 
-        json_object_object_add(obj, "result", result);
+        tc_queue_release(&client->sends, position);
+    }
+
+    return sent;
+}
+
+/**
+ * @brief Yield to a ThinCloud client
+ * 
+ * Sends the queued messages and yields with tc_yield.
+ * 
+ * @param[in]  client     ThinCloud client.
+ * @param[in]  timeoutMs  Time to wait for inbound messages.
+ * 
+ * @return Result of tc_yield
+ */
+IoT_Error_t tc_client_yield(tc_client *client, uint32_t timeoutMs)
+{
+    tc_client_flush(client);
+
+    const IoT_Error_t rc = tc_yield(&client->context, &client->mqtt, timeoutMs);
+
+    // Send what message handlers queued during the yield
+    tc_client_flush(client);
+
+    return rc;
+}
+
+/**
+ * @brief Time until a ThinCloud client has work
+ * 
+ * Zero while the MQTT client still holds received data the socket no
+ * longer shows, otherwise the time until the context's next deadline.
+ */
+uint32_t tc_client_next_timeout(tc_client *client)
+{
+    if (aws_iot_mqtt_is_client_connected(&client->mqtt) && mbedtls_ssl_get_bytes_avail(&client->mqtt.networkStack.tlsDataParams.ssl) > 0)
+    {
+        return 0;
     }
 
-    const char *str = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN);
-
-    strcpy(buffer, str);
-
-    json_object_put(obj);
-
-    FUNC_EXIT_RC(SUCCESS);
+    return tc_context_next_timeout(&client->context, &client->mqtt);
 }
 
 /**
- * @brief Unmarshall a command request payload 
+ * @brief Run a ThinCloud client until stopped
  * 
- * Unmarshall a command request from a string payload. 
+ * Event-driven replacement for calling tc_client_yield in a loop. Sleeps
+ * in poll on the connection's socket and the client's wakeup descriptor
+ * until a message arrives, another thread queues a send or the next
+ * timer, batch, keepalive or reconnect deadline passes, instead of waking
+ * at a fixed interval.
  * 
- * @param[out]  requestId   ID of the original request.
- * @param[out]  method      Command method.
- * @param[out]  params      Command request parameters.
- * @param[in]   payload     Response payload.
- * @param[in]   payloadLen  Reponse payload's length.
+ * Message handlers run on the calling thread. Returns once tc_stop is
+ * called, or when tc_yield fails with anything but a reconnect in progress.
  * 
- * @return Zero on success, a negative value otherwise 
+ * @param[in]  client  ThinCloud client.
+ * 
+ * @return Zero once stopped, result of tc_yield otherwise
  */
-IoT_Error_t command_request(char *requestId, char *method, json_object **params, const char *payload, const unsigned int payloadLen)
+IoT_Error_t tc_run(tc_client *client)
 {
-    if (payload == NULL || payloadLen == 0)
-    {
-        FUNC_EXIT_RC(SUCCESS);
-    }
+    IoT_Error_t rc = SUCCESS;
 
-    json_tokener *tok = json_tokener_new();
+    atomic_store_explicit(&client->running, true, memory_order_release);
 
-    json_object *obj = json_tokener_parse_ex(tok, payload, payloadLen);
-    if (obj == NULL)
+    while (atomic_load_explicit(&client->running, memory_order_acquire))
     {
-        FUNC_EXIT_RC(JSON_PARSE_ERROR);
-    }
+        // Producers that commit after this point write a new wakeup
+        atomic_store_explicit(&client->wakePending, false, memory_order_release);
+        tc_client_flush(client);
 
-    if (requestId != NULL)
-    {
-        const char *requestIdValue = json_object_get_string(json_object_object_get(obj, "id"));
-        if (requestIdValue != NULL)
+        const uint32_t timeoutMs = tc_client_next_timeout(client);
+
+        struct pollfd fds[2];
+        nfds_t count = 0;
+
+        fds[count].fd = client->wakeFd[0];
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        count++;
+
+        const int socket = client->mqtt.networkStack.tlsDataParams.server_fd.fd;
+        if (socket >= 0 && aws_iot_mqtt_is_client_connected(&client->mqtt))
         {
-            strcpy(requestId, requestIdValue);
+            fds[count].fd = socket;
+            fds[count].events = POLLIN;
+            fds[count].revents = 0;
+            count++;
         }
-    }
 
-    if (method != NULL)
-    {
-        const char *methodValue = json_object_get_string(json_object_object_get(obj, "method"));
-        if (methodValue != NULL)
+        const int ready = poll(fds, count, timeoutMs > INT32_MAX ? -1 : (int)timeoutMs);
+        if (ready < 0)
         {
-            strcpy(method, methodValue);
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t wakeups = 0;
+            while (read(client->wakeFd[0], &wakeups, sizeof(wakeups)) > 0)
+            {
+            }
         }
-    }
 
-    json_object *pParams = json_object_object_get(obj, "params");
+        // Only a wakeup means there is nothing for the MQTT client yet
+        if (ready > 0 && !(count > 1 && fds[1].revents != 0))
+        {
+            continue;
+        }
 
-    if (pParams != NULL && params != NULL)
-    {
-        const int rc = json_object_deep_copy(pParams, params, NULL);
-        if (rc < 0)
+        // The SDK only reads until its timer expires, so yield for a tick
+        rc = tc_yield(&client->context, &client->mqtt, 1);
+        if (rc != SUCCESS && rc != NETWORK_ATTEMPTING_RECONNECT && rc != NETWORK_RECONNECTED)
         {
-            FUNC_EXIT_RC(JSON_PARSE_ERROR);
+            break;
         }
+        rc = SUCCESS;
     }
 
-    json_tokener_free(tok);
-    json_object_put(obj);
+    atomic_store_explicit(&client->running, false, memory_order_release);
 
-    FUNC_EXIT_RC(SUCCESS);
+    // Send what message handlers queued during the last yield
+    tc_client_flush(client);
+
+    return rc;
 }
 
 /**
- * @brief Marshal a service request
- * 
- * Marshal a service request to a JSON string.
+ * @brief Stop a client's tc_run loop
  * 
- * @param[out]  buffer     Pointer to a string buffer to write to.
- * @param[in]   requestId  Unique ID for the request.
- * @param[in]   method     Service method to request.
- * @param[in]   params     Service request parameters.
+ * Safe to call from any thread, including message handlers.
  * 
- * @return Zero on success, a negative value otherwise 
+ * @param[in]  client  ThinCloud client.
  */
-IoT_Error_t service_request(char *buffer, const char *requestId, const char *method, json_object *params)
+void tc_stop(tc_client *client)
 {
-    json_object *obj = json_object_new_object();
-    if (requestId != NULL)
-    {
-        json_object *value = json_object_new_string(requestId);
-        json_object_object_add(obj, "id", value);
-    }
-
-    json_object *methodValue = json_object_new_string(method);
-    json_object_object_add(obj, "method", methodValue);
-
-    if (params != NULL)
-    {
-        json_object_object_add(obj, "params", params);
-    }
-
-    const char *str = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN);
-
-    strcpy(buffer, str);
-
-    json_object_put(obj);
-
-    FUNC_EXIT_RC(SUCCESS);
+    atomic_store_explicit(&client->running, false, memory_order_release);
+    atomic_store_explicit(&client->wakePending, false, memory_order_release);
+    tc_client_wake(client);
 }
 
 /**
- * @brief Unmarshall a service response payload 
+ * @brief Queue a message
  * 
- * Unmarshall a service response from a string payload. 
+ * Safe to call from any thread.
  * 
- * @param[out]  requestId   Request ID of the original request.
- * @param[out]  statusCode  Request's status.
- * @param[out]  data        Response's data.
- * @param[in]   payload     Response payload.
- * @param[in]   payloadLen  Reponse payload's length.
+ * @param[in]  client      ThinCloud client.
+ * @param[in]  topic       Topic to publish to.
+ * @param[in]  topicLen    Length of the topic.
+ * @param[in]  payload     Message payload.
+ * @param[in]  payloadLen  Length of the payload.
+ * @param[in]  qos         QoS to publish with.
  * 
- * @return Zero on success, a negative value otherwise 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the queue is full,
+ *         MAX_SIZE_ERROR if the message does not fit a slot, negative value otherwise
  */
-IoT_Error_t service_response(char *requestId, uint16_t *statusCode, json_object **data, const char *payload, const unsigned int payloadLen)
+IoT_Error_t tc_client_publish(tc_client *client, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen, QoS qos)
 {
-    if (payload == NULL || payloadLen == 0)
+    if (client == NULL || topic == NULL || topicLen == 0 || (payload == NULL && payloadLen > 0))
     {
-        FUNC_EXIT_RC(SUCCESS);
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
     }
 
-    json_tokener *tok = json_tokener_new();
-
-    json_object *obj = json_tokener_parse_ex(tok, payload, payloadLen);
-    if (obj == NULL)
+    if (topicLen > MAX_TOPIC_LENGTH || payloadLen > TC_MAX_PAYLOAD_LENGTH)
     {
-        FUNC_EXIT_RC(JSON_PARSE_ERROR);
+        FUNC_EXIT_RC(MAX_SIZE_ERROR);
     }
 
-    if (requestId != NULL)
+    size_t position = 0;
+    if (!tc_queue_reserve(&client->sends, &position))
     {
-        const char *requestIdValue = json_object_get_string(json_object_object_get(obj, "id"));
-        if (requestIdValue != NULL)
-        {
-
-            strcpy(requestId, requestIdValue);
-        }
+        FUNC_EXIT_RC(LIMIT_EXCEEDED_ERROR);
     }
 
-    json_object *result = json_object_object_get(obj, "result");
-
-    if (result != NULL)
-    {
-        if (statusCode != NULL)
-        {
-            *statusCode = json_object_get_int(json_object_object_get(result, "statusCode"));
-        }
-
-        json_object *body = json_object_object_get(result, "body");
-        if (body != NULL && data != NULL)
-        {
-            const int rc = json_object_deep_copy(body, data, NULL);
-            if (rc < 0)
-            {
-                FUNC_EXIT_RC(JSON_PARSE_ERROR);
-            }
-        }
-    }
+    tc_send *send = TC_QUEUE_SLOT(&client->sends, position, tc_send);
+    memcpy(send->topic, topic, topicLen);
+    memcpy(send->payload, payload, payloadLen);
+    send->topicLen = topicLen;
+    send->payloadLen = payloadLen;
+    send->qos = qos;
 
-    json_tokener_free(tok);
-    json_object_put(obj);
+    tc_client_commit(client, position);
 
     FUNC_EXIT_RC(SUCCESS);
 }
 
 /**
- * @brief Send a command response.
+ * @brief Queue a command response
  * 
- * Publish a command response to MQTT.
+ * Safe to call from any thread. The response is marshalled straight into
+ * its queue slot.
  * 
- * @param[in]  client           AWS IoT MQTT Client instance.
+ * @param[in]  client           ThinCloud client.
  * @param[in]  deviceId         Device's ID.
  * @param[in]  commandId        ID of the requested command.
  * @param[in]  statusCode       Command's status code.
  * @param[in]  isErrorResponse  Signals if a command responds with an error.
  * @param[in]  errorMessage     Response error message. Only used if isErrorResponse is set to true.
- * @param[in]  body             Command response body.
+ * @param[in]  body             Command response body. The response takes ownership of body.
+ * @param[in]  qos              QoS to publish with.
  * 
- * @return Zero on success, negative value otherwise 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the queue is full,
+ *         MAX_SIZE_ERROR if the response does not fit in TC_MAX_PAYLOAD_LENGTH,
+ *         negative value otherwise
  */
-IoT_Error_t send_command_response(AWS_IoT_Client *client, const char *deviceId, const char *commandId, uint16_t statusCode, bool isErrorResponse, char *errorMessage, json_object *body)
+IoT_Error_t tc_client_send_command_response(tc_client *client, const char *deviceId, const char *commandId, uint16_t statusCode, bool isErrorResponse, char *errorMessage, json_object *body, QoS qos)
 {
-    char topic[MAX_TOPIC_LENGTH];
+    if (client == NULL)
+    {
+        json_object_put(body);
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
 
-    IoT_Error_t rc = command_response_topic(topic, deviceId, commandId);
-    if (rc != SUCCESS)
+    size_t position = 0;
+    if (!tc_queue_reserve(&client->sends, &position))
     {
-        FUNC_EXIT_RC(rc);
+        json_object_put(body);
+        FUNC_EXIT_RC(LIMIT_EXCEEDED_ERROR);
     }
 
-    char payload[MAX_JSON_TOKEN_EXPECTED];
+    tc_send *send = TC_QUEUE_SLOT(&client->sends, position, tc_send);
+    size_t topicLen = 0;
+
+    send->qos = qos;
 
-    rc = command_response(payload, commandId, statusCode, isErrorResponse, errorMessage, body);
+    TC_TRACE_BEGIN(TC_TRACE_TOPIC, 0);
+    IoT_Error_t rc = command_response_topic_n(send->topic, sizeof(send->topic), deviceId, commandId, &topicLen);
+    TC_TRACE_END(TC_TRACE_TOPIC, rc);
 
     if (rc != SUCCESS)
     {
+        json_object_put(body);
+    }
+    else
+    {
+        TC_TRACE_BEGIN(TC_TRACE_MARSHAL, 0);
+        rc = tc_marshal_command_response(client->context.format, send->payload, sizeof(send->payload), commandId, statusCode, isErrorResponse, errorMessage, body, &send->payloadLen);
+        TC_TRACE_END(TC_TRACE_MARSHAL, rc);
+    }
+
+    if (rc != SUCCESS)
+    {
+        tc_client_discard(client, position);
         FUNC_EXIT_RC(rc);
     }
 
-    IoT_Publish_Message_Params params;
-    params.qos = QOS0;
-    params.isRetained = false;
-    params.payload = (void *)payload;
-    params.payloadLen = strlen(payload);
+    tc_client_compress(client, send);
+    send->topicLen = (uint16_t)topicLen;
+    tc_client_commit(client, position);
 
-    return aws_iot_mqtt_publish(client, topic, strlen(topic), &params);
+    FUNC_EXIT_RC(rc);
 }
 
 /**
- * @brief Send commissioning request
+ * @brief Queue a commissioning request
  * 
- * Publish a commissioning request to MQTT.
+ * Safe to call from any thread. The request is marshalled straight into
+ * its queue slot.
  * 
- * @param[in]  client           AWS IoT MQTT Client instance.
+ * @param[in]  client           ThinCloud client.
  * @param[in]  requestId        Unique ID for the request.
  * @param[in]  deviceType       Devices's device type.
  * @param[in]  physicalId       Device's physical ID.
  * @param[in]  relatedDeviceIds List of devices to associate on commissioning
  * @param[in]  idsSize          Size of related device ids list 
+ * @param[in]  qos              QoS to publish with.
  * 
- * @return Zero on success, negative value otherwise 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the queue is full,
+ *         MAX_SIZE_ERROR if the request does not fit in TC_MAX_PAYLOAD_LENGTH,
+ *         negative value otherwise
  */
-IoT_Error_t send_commissioning_request(AWS_IoT_Client *client, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize)
+IoT_Error_t tc_client_send_commissioning_request(tc_client *client, const char *requestId, const char *deviceType, const char *physicalId, char **relatedDeviceIds, uint32_t idsSize, QoS qos)
 {
-    char topic[MAX_TOPIC_LENGTH];
+    if (client == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
 
-    IoT_Error_t rc = commission_request_topic(topic, deviceType, physicalId);
-    if (rc != SUCCESS)
+    size_t position = 0;
+    if (!tc_queue_reserve(&client->sends, &position))
     {
-        FUNC_EXIT_RC(rc);
+        FUNC_EXIT_RC(LIMIT_EXCEEDED_ERROR);
     }
 
-    char payload[MAX_JSON_TOKEN_EXPECTED];
+    tc_send *send = TC_QUEUE_SLOT(&client->sends, position, tc_send);
+    size_t topicLen = 0;
+
+    send->qos = qos;
+
+    TC_TRACE_BEGIN(TC_TRACE_TOPIC, 0);
+    IoT_Error_t rc = commission_request_topic_n(send->topic, sizeof(send->topic), deviceType, physicalId, &topicLen);
+    TC_TRACE_END(TC_TRACE_TOPIC, rc);
 
-    rc = commissioning_request(payload, requestId, deviceType, physicalId, relatedDeviceIds, idsSize);
+    if (rc == SUCCESS)
+    {
+        TC_TRACE_BEGIN(TC_TRACE_MARSHAL, 0);
+        rc = tc_marshal_commissioning_request(client->context.format, send->payload, sizeof(send->payload), requestId, deviceType, physicalId, relatedDeviceIds, idsSize, &send->payloadLen);
+        TC_TRACE_END(TC_TRACE_MARSHAL, rc);
+    }
 
     if (rc != SUCCESS)
     {
+        tc_client_discard(client, position);
         FUNC_EXIT_RC(rc);
     }
 
-    IoT_Publish_Message_Params params;
-    params.qos = QOS0;
-    params.isRetained = false;
-    params.payload = (void *)payload;
-    params.payloadLen = strlen(payload);
+    send->topicLen = (uint16_t)topicLen;
+    tc_client_commit(client, position);
 
-    return aws_iot_mqtt_publish(client, topic, strlen(topic), &params);
+    FUNC_EXIT_RC(rc);
 }
 
 /**
- * @brief Send service request
+ * @brief Generate a request ID on any thread
  * 
- * Publish a service request to MQTT.
+ * Like tc_context_request_id, but draws from the calling thread's own
+ * generator rather than the client's context, so threads that queue
+ * requests with tc_client_send_service_request can generate their IDs
+ * without locking.
  * 
- * @param[in]  client     AWS IoT MQTT Client instance.
+ * @param[in]   client     ThinCloud client the request is for.
+ * @param[out]  requestId  Buffer of at least TC_ID_LENGTH bytes. Null-terminated.
+ */
+void tc_client_request_id(tc_client *client, char *requestId)
+{
+    (void)client;
+
+    tc_uuid_generate_text(tc_uuid_thread_generator(), requestId);
+}
+
+/**
+ * @brief Queue a service request
+ * 
+ * Safe to call from any thread. The request is marshalled straight into
+ * its queue slot.
+ * 
+ * @param[in]  client     ThinCloud client.
  * @param[in]  requestId  Unique ID for the request.
  * @param[in]  deviceId   Devices's ID.
  * @param[in]  method     Service method to request.
- * @param[in]  params     Service request parameters.
+ * @param[in]  params     Service request parameters. The request takes ownership of params.
+ * @param[in]  qos        QoS to publish with.
  * 
- * @return Zero on success, negative value otherwise 
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the queue is full,
+ *         MAX_SIZE_ERROR if the request does not fit in TC_MAX_PAYLOAD_LENGTH,
+ *         negative value otherwise
  */
-IoT_Error_t send_service_request(AWS_IoT_Client *client, const char *requestId, const char *deviceId, const char *method, json_object *reqParams)
+IoT_Error_t tc_client_send_service_request(tc_client *client, const char *requestId, const char *deviceId, const char *method, json_object *reqParams, QoS qos)
 {
-    char topic[MAX_TOPIC_LENGTH];
-
-    IoT_Error_t rc = service_request_topic(topic, deviceId);
+    if (client == NULL)
+    {
+        json_object_put(reqParams);
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
 
-    if (rc != SUCCESS)
+    size_t position = 0;
+    if (!tc_queue_reserve(&client->sends, &position))
     {
-        FUNC_EXIT_RC(rc);
+        json_object_put(reqParams);
+        FUNC_EXIT_RC(LIMIT_EXCEEDED_ERROR);
     }
 
-    char payload[MAX_JSON_TOKEN_EXPECTED];
+    tc_send *send = TC_QUEUE_SLOT(&client->sends, position, tc_send);
+    size_t topicLen = 0;
 
-    rc = service_request(payload, requestId, method, reqParams);
+    send->qos = qos;
+
+    TC_TRACE_BEGIN(TC_TRACE_TOPIC, 0);
+    IoT_Error_t rc = service_request_topic_n(send->topic, sizeof(send->topic), deviceId, &topicLen);
+    TC_TRACE_END(TC_TRACE_TOPIC, rc);
 
     if (rc != SUCCESS)
     {
-        FUNC_EXIT_RC(rc);
+        json_object_put(reqParams);
+    }
+    else
+    {
+        TC_TRACE_BEGIN(TC_TRACE_MARSHAL, 0);
+        rc = tc_marshal_service_request(client->context.format, send->payload, sizeof(send->payload), requestId, method, reqParams, &send->payloadLen);
+        TC_TRACE_END(TC_TRACE_MARSHAL, rc);
     }
-
-    IoT_Publish_Message_Params params;
-    params.qos = QOS0;
-    params.isRetained = false;
-    params.payload = (void *)payload;
-    params.payloadLen = strlen(payload);
-
-    return aws_iot_mqtt_publish(client, topic, strlen(topic), &params);
-}
-
-/**
- * @brief Subscribe to commissioning respones
- * 
- * @param[in]  client          AWS IoT MQTT Client instance.
- * @param[in]  requestId       Unique ID of a request.
- * @param[in]  deviceType      Devices's device type.
- * @param[in]  physicalId      Device's physical ID.
- * @param[in]  handler         Subscription response handler.
- * @param[in]  subscriberData  Data blob to be passed to the subscription handler on invoke.
- * 
- * @return Zero on success, negative value otherwise 
- */
-IoT_Error_t subscribe_to_commissioning_response(AWS_IoT_Client *client, const char *requestId, const char *deviceType, const char *physicalId, pApplicationHandler_t handler, void *subscribeData)
-{
-    IoT_Error_t rc = commission_response_topic(COMMISSIONING_RESPONSE_TOPIC_BUFFER, deviceType, physicalId, requestId);
 
     if (rc != SUCCESS)
     {
+        tc_client_discard(client, position);
         FUNC_EXIT_RC(rc);
     }
 
-    return aws_iot_mqtt_subscribe(client, COMMISSIONING_RESPONSE_TOPIC_BUFFER, strlen(COMMISSIONING_RESPONSE_TOPIC_BUFFER), QOS0, handler, subscribeData);
+    tc_client_compress(client, send);
+    send->topicLen = (uint16_t)topicLen;
+    tc_client_commit(client, position);
+
+    FUNC_EXIT_RC(rc);
 }
 
 /**
- * @brief Subscribe to command requests
+ * @brief Subscribe a ThinCloud client to command requests
  * 
- * @param[in]  client          AWS IoT MQTT Client instance.
+ * @param[in]  client          ThinCloud client.
  * @param[in]  deviceId        Device's ID.
  * @param[in]  handler         Subscription response handler.
  * @param[in]  subscriberData  Data blob to be passed to the subscription handler on invoke.
+ * @param[in]  qos             Maximum QoS of messages delivered to the handler.
  * 
  * @return Zero on success, negative value otherwise 
  */
-IoT_Error_t subscribe_to_command_request(AWS_IoT_Client *client, const char *deviceId, pApplicationHandler_t handler, void *subscribeData)
+IoT_Error_t tc_client_subscribe_to_command_request(tc_client *client, const char *deviceId, pApplicationHandler_t handler, void *subscribeData, QoS qos)
 {
-    IoT_Error_t rc = command_request_topic(COMMAND_TOPIC_BUFFER, deviceId);
+    if (client == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    size_t topicLen = 0;
+    IoT_Error_t rc = command_request_topic_n(client->commandTopic, sizeof(client->commandTopic), deviceId, &topicLen);
 
     if (rc != SUCCESS)
     {
         FUNC_EXIT_RC(rc);
     }
 
-    return aws_iot_mqtt_subscribe(client, COMMAND_TOPIC_BUFFER, strlen(COMMAND_TOPIC_BUFFER), QOS0, handler, subscribeData);
+    return aws_iot_mqtt_subscribe(&client->mqtt, client->commandTopic, (uint16_t)topicLen, qos, handler, subscribeData);
 }
 
 /**
- * @brief Subscribe to service responses
+ * @brief Subscribe a ThinCloud client to service responses
  * 
- * @param[in]  client          AWS IoT MQTT Client instance.
+ * @param[in]  client          ThinCloud client.
  * @param[in]  deviceId        Device's ID.
  * @param[in]  requestId       Unique ID of a request.
  * @param[in]  handler         Subscription response handler.
  * @param[in]  subscriberData  Data blob to be passed to the subscription handler on invoke.
+ * @param[in]  qos             Maximum QoS of messages delivered to the handler.
  * 
  * @return Zero on success, negative value otherwise 
  */
-IoT_Error_t subscribe_to_service_response(AWS_IoT_Client *client, const char *deviceId, const char *requestId, pApplicationHandler_t handler, void *subscribeData)
+IoT_Error_t tc_client_subscribe_to_service_response(tc_client *client, const char *deviceId, const char *requestId, pApplicationHandler_t handler, void *subscribeData, QoS qos)
 {
-    IoT_Error_t rc = service_response_topic(SERVICE_RESPONSE_TOPIC_BUFFER, deviceId, requestId);
+    if (client == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
+
+    size_t topicLen = 0;
+    IoT_Error_t rc = service_response_topic_n(client->serviceResponseTopic, sizeof(client->serviceResponseTopic), deviceId, requestId, &topicLen);
 
     if (rc != SUCCESS)
     {
         FUNC_EXIT_RC(rc);
     }
 
-    return aws_iot_mqtt_subscribe(client, SERVICE_RESPONSE_TOPIC_BUFFER, strlen(SERVICE_RESPONSE_TOPIC_BUFFER), QOS0, handler, subscribeData);
-}
-
-/**
- * @brief Initialize an AWS IoT Client 
- * 
- * Initialize an AWS IoT Client instance with ThinCloud specific parameters and defaults.
- * 
- * @param[in]  client          AWS IoT MQTT Client instance.
- * @param[in]  hostAddr        ThinCloud host address. 
- * @param[in]  rootCAPath      Path to a root CA.
- * @param[in]  clientCRTPath   Path to a client CRT.
- * @param[in]  clientKeyPath   Path to a client private key.
- * @param[in]  handler         Disconnect handler.
- * @param[in]  disconnectData  Data blob to be passed to the disconnect handler on invoke.
- * 
- * @return Zero on success, negative value otherwise 
- */
-IoT_Error_t tc_init(AWS_IoT_Client *client, char *hostAddr, char *rootCAPath, char *clientCRTPath, char *clientKeyPath, iot_disconnect_handler handler, void *disconnectData)
-{
-    IoT_Client_Init_Params params = iotClientInitParamsDefault;
-
-    params.enableAutoReconnect = false; // We enable this on connect
-    params.pHostURL = hostAddr;
-    params.port = 443; // Default MQTT port
-    params.pRootCALocation = rootCAPath;
-    params.pDeviceCertLocation = clientCRTPath;
-    params.pDevicePrivateKeyLocation = clientKeyPath;
-    params.mqttCommandTimeout_ms = 20000;
-    params.tlsHandshakeTimeout_ms = 5000;
-    params.isSSLHostnameVerify = true;
-    params.disconnectHandler = handler;
-    params.disconnectHandlerData = disconnectData;
-
-    return aws_iot_mqtt_init(client, &params);
+    return aws_iot_mqtt_subscribe(&client->mqtt, client->serviceResponseTopic, (uint16_t)topicLen, qos, handler, subscribeData);
 }
 
 /**
- * @brief Start MQTT connection to ThinCloud host
- * 
- * Initialize an MQTT conenction to a thincloud host.
+ * @brief Subscribe a ThinCloud client to commissioning responses
  * 
- * @param[in]  client         AWS IoT MQTT Client instance.
- * @param[in]  clientId       An unique ID for the client instance.
- * @param[in]  autoReconnect  Signals if the MQTT client should attempt to auto-reconnect
- *                            after connection failures.
+ * @param[in]  client          ThinCloud client.
+ * @param[in]  requestId       Unique ID of a request.
+ * @param[in]  deviceType      Devices's device type.
+ * @param[in]  physicalId      Device's physical ID.
+ * @param[in]  handler         Subscription response handler.
+ * @param[in]  subscriberData  Data blob to be passed to the subscription handler on invoke.
+ * @param[in]  qos             Maximum QoS of messages delivered to the handler.
  * 
  * @return Zero on success, negative value otherwise 
  */
-IoT_Error_t tc_connect(AWS_IoT_Client *client, char *clientId, bool autoReconnect)
+IoT_Error_t tc_client_subscribe_to_commissioning_response(tc_client *client, const char *requestId, const char *deviceType, const char *physicalId, pApplicationHandler_t handler, void *subscribeData, QoS qos)
 {
-    IoT_Client_Connect_Params params = iotClientConnectParamsDefault;
+    if (client == NULL)
+    {
+        FUNC_EXIT_RC(NULL_VALUE_ERROR);
+    }
 
-    params.keepAliveIntervalInSec = 600;
-    params.isCleanSession = true;
-    params.MQTTVersion = MQTT_3_1_1;
-    params.pClientID = clientId;
-    params.clientIDLen = (uint16_t)strlen(clientId);
-    params.isWillMsgPresent = false;
+    size_t topicLen = 0;
+    IoT_Error_t rc = commission_response_topic_n(client->commissioningResponseTopic, sizeof(client->commissioningResponseTopic), deviceType, physicalId, requestId, &topicLen);
 
-    IoT_Error_t rc = aws_iot_mqtt_connect(client, &params);
     if (rc != SUCCESS)
     {
         FUNC_EXIT_RC(rc);
     }
 
-    if (autoReconnect)
-    {
-        rc = aws_iot_mqtt_autoreconnect_set_status(client, true);
-        if (rc != SUCCESS)
-        {
-            FUNC_EXIT_RC(rc);
-        }
-    }
-
-    FUNC_EXIT_RC(SUCCESS);
+    return aws_iot_mqtt_subscribe(&client->mqtt, client->commissioningResponseTopic, (uint16_t)topicLen, qos, handler, subscribeData);
 }
 
 #endif /* THINCLOUD_EMBEDDED_C_SDK_ */
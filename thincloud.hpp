@@ -0,0 +1,684 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_HPP_
+#define THINCLOUD_EMBEDDED_C_SDK_HPP_
+
+/*
+ * Thincloud C Embedded SDK - C++17 wrapper
+ *
+ * Header-only C++17 layer over thincloud.h. Received payloads are read
+ * through std::string_view accessors, json-c ownership is explicit, and
+ * messages are built into buffers the message object owns and reuses, so
+ * the wrapper allocates nothing the C API does not. String views are
+ * handed to the C API as slices, never copied to terminate them.
+ *
+ * Like thincloud.h, this header defines the SDK's functions and is
+ * included from one translation unit.
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+#include <utility>
+
+#include "thincloud.h"
+
+namespace thincloud
+{
+
+using error = IoT_Error_t;
+
+/**
+ * @brief View of a slice
+ */
+constexpr std::string_view view(tc_slice slice) noexcept
+{
+    return {slice.data, slice.len};
+}
+
+/**
+ * @brief Topic lengths
+ *
+ * Lengths of the topics the SDK builds, without the null character, so
+ * buffer sizes can be checked at compile time, e.g.
+ *       static_assert(topic::command_response_length(topic::id_length, topic::id_length) < MAX_TOPIC_LENGTH);
+ */
+namespace topic
+{
+
+/**
+ * Length of a UUID
+ */
+constexpr std::size_t id_length = TC_ID_LENGTH - 1;
+
+constexpr std::size_t literal_length(std::string_view literal) noexcept
+{
+    return literal.size();
+}
+
+constexpr std::size_t command_request_length(std::size_t deviceIdLen) noexcept
+{
+    return literal_length("thincloud/devices/") + deviceIdLen + literal_length("/command");
+}
+
+constexpr std::size_t command_response_length(std::size_t deviceIdLen, std::size_t commandIdLen) noexcept
+{
+    return literal_length("thincloud/devices/") + deviceIdLen + literal_length("/command/") + commandIdLen + literal_length("/response");
+}
+
+constexpr std::size_t service_request_length(std::size_t deviceIdLen) noexcept
+{
+    return literal_length("thincloud/devices/") + deviceIdLen + literal_length("/requests");
+}
+
+constexpr std::size_t service_response_length(std::size_t deviceIdLen, std::size_t requestIdLen) noexcept
+{
+    return literal_length("thincloud/devices/") + deviceIdLen + literal_length("/requests/") + requestIdLen + literal_length("/response");
+}
+
+constexpr std::size_t commissioning_request_length(std::size_t deviceTypeLen, std::size_t physicalIdLen) noexcept
+{
+    return literal_length("thincloud/registration/") + deviceTypeLen + 1 + physicalIdLen + literal_length("/requests");
+}
+
+constexpr std::size_t commissioning_response_length(std::size_t deviceTypeLen, std::size_t physicalIdLen, std::size_t requestIdLen) noexcept
+{
+    return commissioning_request_length(deviceTypeLen, physicalIdLen) + 1 + requestIdLen + literal_length("/response");
+}
+
+static_assert(command_response_length(id_length, id_length) < MAX_TOPIC_LENGTH, "UUID command response topics must fit MAX_TOPIC_LENGTH");
+static_assert(service_response_length(id_length, id_length) < MAX_TOPIC_LENGTH, "UUID service response topics must fit MAX_TOPIC_LENGTH");
+
+} // namespace topic
+
+namespace detail
+{
+
+/**
+ * @brief Slice of a string view
+ *
+ * A default-constructed view gives a slice with NULL data, which the C
+ * API leaves out like a NULL string.
+ */
+constexpr tc_slice slice(std::string_view value) noexcept
+{
+    return {value.data(), value.size()};
+}
+
+} // namespace detail
+
+/**
+ * @brief Owned json-c object
+ *
+ * Releases its reference on destruction. Functions that take ownership of
+ * an object take a json by value, so handing it over is always explicit.
+ */
+class json
+{
+public:
+    json() noexcept = default;
+
+    explicit json(json_object *object) noexcept : object_(object)
+    {
+    }
+
+    json(const json &) = delete;
+    json &operator=(const json &) = delete;
+
+    json(json &&other) noexcept : object_(other.release())
+    {
+    }
+
+    json &operator=(json &&other) noexcept
+    {
+        if (this != &other)
+        {
+            json_object_put(object_);
+            object_ = other.release();
+        }
+        return *this;
+    }
+
+    ~json()
+    {
+        json_object_put(object_);
+    }
+
+    /**
+     * @brief New empty JSON object
+     */
+    static json object()
+    {
+        return json(json_object_new_object());
+    }
+
+    json_object *get() const noexcept
+    {
+        return object_;
+    }
+
+    /**
+     * @brief Give up ownership of the object
+     */
+    json_object *release() noexcept
+    {
+        return std::exchange(object_, nullptr);
+    }
+
+private:
+    json_object *object_ = nullptr;
+};
+
+/**
+ * @brief Received command request
+ *
+ * Accessors point into the payload it was parsed from.
+ */
+class command_request
+{
+public:
+    /**
+     * @brief Scan a command request payload in place
+     *
+     * @param[in]  payload  Received payload.
+     * @param[in]  format   Format the payload was sent in.
+     */
+    error parse(std::string_view payload, tc_format format = TC_FORMAT_JSON) noexcept
+    {
+        return tc_unmarshal_command_request(format, &view_, payload.data(), payload.size());
+    }
+
+    std::string_view id() const noexcept
+    {
+        return view(view_.requestId);
+    }
+
+    std::string_view method() const noexcept
+    {
+        return view(view_.method);
+    }
+
+    /**
+     * @brief Raw request parameters
+     *
+     * JSON text, or the encoded item for a TC_FORMAT_CBOR payload.
+     */
+    std::string_view params() const noexcept
+    {
+        return view(view_.params);
+    }
+
+    const tc_command_request_view &c_view() const noexcept
+    {
+        return view_;
+    }
+
+private:
+    tc_command_request_view view_{};
+};
+
+/**
+ * @brief Received service response
+ *
+ * Accessors point into the payload it was parsed from.
+ */
+class service_response
+{
+public:
+    /**
+     * @brief Scan a service response payload in place
+     *
+     * @param[in]  payload  Received payload.
+     * @param[in]  format   Format the payload was sent in.
+     */
+    error parse(std::string_view payload, tc_format format = TC_FORMAT_JSON) noexcept
+    {
+        return tc_unmarshal_service_response(format, &view_, payload.data(), payload.size());
+    }
+
+    std::string_view id() const noexcept
+    {
+        return view(view_.requestId);
+    }
+
+    uint16_t status_code() const noexcept
+    {
+        return view_.statusCode;
+    }
+
+    /**
+     * @brief Raw response body
+     *
+     * JSON text, or the encoded item for a TC_FORMAT_CBOR payload.
+     */
+    std::string_view body() const noexcept
+    {
+        return view(view_.body);
+    }
+
+    const tc_service_response_view &c_view() const noexcept
+    {
+        return view_;
+    }
+
+private:
+    tc_service_response_view view_{};
+};
+
+/**
+ * @brief Received commissioning response
+ *
+ * Accessors point into the payload it was parsed from.
+ */
+class commissioning_response
+{
+public:
+    /**
+     * @brief Scan a commissioning response payload in place
+     *
+     * @param[in]  payload  Received payload.
+     * @param[in]  format   Format the payload was sent in.
+     */
+    error parse(std::string_view payload, tc_format format = TC_FORMAT_JSON) noexcept
+    {
+        return tc_unmarshal_commissioning_response(format, &view_, payload.data(), payload.size());
+    }
+
+    std::string_view id() const noexcept
+    {
+        return view(view_.requestId);
+    }
+
+    uint16_t status_code() const noexcept
+    {
+        return view_.statusCode;
+    }
+
+    std::string_view device_id() const noexcept
+    {
+        return view(view_.deviceId);
+    }
+
+    const tc_commissioning_response_view &c_view() const noexcept
+    {
+        return view_;
+    }
+
+private:
+    tc_commissioning_response_view view_{};
+};
+
+/**
+ * @brief Outbound message
+ *
+ * Holds a topic and payload in buffers sized for the largest message the
+ * SDK sends. Each build overwrites the previous message, so one message
+ * object can be reused for every send. Payloads are marshalled in the
+ * message's format, JSON unless given, e.g. message(client.format()).
+ * Messages are move-only; moving copies only the bytes in use.
+ */
+class message
+{
+public:
+    message() noexcept = default;
+
+    explicit message(tc_format format) noexcept : format_(format)
+    {
+    }
+
+    message(const message &) = delete;
+    message &operator=(const message &) = delete;
+
+    message(message &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    message &operator=(message &&other) noexcept
+    {
+        if (this != &other)
+        {
+            std::memcpy(topic_.data(), other.topic_.data(), other.topicLen_ + 1);
+            std::memcpy(payload_.data(), other.payload_.data(), other.payloadLen_);
+            topicLen_ = other.topicLen_;
+            payloadLen_ = other.payloadLen_;
+            format_ = other.format_;
+            other.clear();
+        }
+        return *this;
+    }
+
+    /**
+     * @brief Build a command response
+     *
+     * @param[in]  deviceId    Device's ID.
+     * @param[in]  commandId   ID of the requested command.
+     * @param[in]  statusCode  Command's status code.
+     * @param[in]  body        Optional. Command response body.
+     *
+     * @return Zero on success, MAX_SIZE_ERROR if the response does not fit,
+     *         negative value otherwise
+     */
+    error command_response(std::string_view deviceId, std::string_view commandId, uint16_t statusCode, json body = json())
+    {
+        return build_command_response(deviceId, commandId, statusCode, false, std::string_view(), std::move(body));
+    }
+
+    /**
+     * @brief Build a command error response
+     *
+     * @param[in]  deviceId      Device's ID.
+     * @param[in]  commandId     ID of the requested command.
+     * @param[in]  statusCode    Command's status code.
+     * @param[in]  errorMessage  Response error message.
+     *
+     * @return Zero on success, MAX_SIZE_ERROR if the response does not fit,
+     *         negative value otherwise
+     */
+    error command_error(std::string_view deviceId, std::string_view commandId, uint16_t statusCode, std::string_view errorMessage)
+    {
+        return build_command_response(deviceId, commandId, statusCode, true, errorMessage, json());
+    }
+
+    /**
+     * @brief Build a service request
+     *
+     * @param[in]  deviceId   Devices's ID.
+     * @param[in]  requestId  Unique ID for the request.
+     * @param[in]  method     Service method to request.
+     * @param[in]  params     Optional. Service request parameters.
+     *
+     * @return Zero on success, MAX_SIZE_ERROR if the request does not fit,
+     *         negative value otherwise
+     */
+    error service_request(std::string_view deviceId, std::string_view requestId, std::string_view method, json params = json())
+    {
+        clear();
+
+        const tc_slice parts[] = {detail::slice("thincloud/devices/"), detail::slice(deviceId), detail::slice("/requests")};
+        std::size_t topicLen = 0;
+        error rc = tc_join_slices(topic_.data(), topic_.size(), parts, std::size(parts), &topicLen);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+
+        rc = tc_marshal_service_request_slice(format_, payload_.data(), payload_.size(), detail::slice(requestId), detail::slice(method), params.release(), &payloadLen_);
+
+        return finish(rc, topicLen);
+    }
+
+    /**
+     * @brief Build a commissioning request
+     *
+     * @param[in]  requestId   Unique ID for the request.
+     * @param[in]  deviceType  Devices's device type.
+     * @param[in]  physicalId  Device's physical ID.
+     *
+     * @return Zero on success, MAX_SIZE_ERROR if the request does not fit,
+     *         negative value otherwise
+     */
+    error commissioning_request(std::string_view requestId, std::string_view deviceType, std::string_view physicalId)
+    {
+        clear();
+
+        const tc_slice parts[] = {detail::slice("thincloud/registration/"), detail::slice(deviceType), detail::slice("_"), detail::slice(physicalId), detail::slice("/requests")};
+        std::size_t topicLen = 0;
+        error rc = tc_join_slices(topic_.data(), topic_.size(), parts, std::size(parts), &topicLen);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+
+        rc = tc_marshal_commissioning_request_slice(format_, payload_.data(), payload_.size(), detail::slice(requestId), detail::slice(deviceType), detail::slice(physicalId), nullptr, 0, &payloadLen_);
+
+        return finish(rc, topicLen);
+    }
+
+    std::string_view topic() const noexcept
+    {
+        return {topic_.data(), topicLen_};
+    }
+
+    std::string_view payload() const noexcept
+    {
+        return {payload_.data(), payloadLen_};
+    }
+
+    tc_format format() const noexcept
+    {
+        return format_;
+    }
+
+    bool empty() const noexcept
+    {
+        return topicLen_ == 0;
+    }
+
+    void clear() noexcept
+    {
+        topic_[0] = '\0';
+        topicLen_ = 0;
+        payloadLen_ = 0;
+    }
+
+private:
+    error build_command_response(std::string_view deviceId, std::string_view commandId, uint16_t statusCode, bool isErrorResponse, std::string_view errorMessage, json body)
+    {
+        clear();
+
+        const tc_slice parts[] = {detail::slice("thincloud/devices/"), detail::slice(deviceId), detail::slice("/command/"), detail::slice(commandId), detail::slice("/response")};
+        std::size_t topicLen = 0;
+        error rc = tc_join_slices(topic_.data(), topic_.size(), parts, std::size(parts), &topicLen);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+
+        rc = tc_marshal_command_response_slice(format_, payload_.data(), payload_.size(), detail::slice(commandId), statusCode, isErrorResponse, detail::slice(errorMessage), body.release(), &payloadLen_);
+
+        return finish(rc, topicLen);
+    }
+
+    error finish(error rc, std::size_t topicLen) noexcept
+    {
+        if (rc != SUCCESS)
+        {
+            clear();
+            return rc;
+        }
+
+        topicLen_ = static_cast<uint16_t>(topicLen);
+
+        return SUCCESS;
+    }
+
+    std::array<char, MAX_TOPIC_LENGTH> topic_{};
+    uint16_t topicLen_ = 0;
+    std::array<char, TC_MAX_PAYLOAD_LENGTH> payload_;
+    std::size_t payloadLen_ = 0;
+    tc_format format_ = TC_FORMAT_JSON;
+};
+
+/**
+ * @brief ThinCloud client
+ *
+ * Owns a tc_client and its send queue of Capacity slots, and frees them
+ * on destruction. Neither copyable nor movable, since the MQTT client
+ * keeps pointers into it. Construction never fails; check status().
+ */
+template <std::size_t Capacity = 16>
+class client
+{
+public:
+    client(const char *hostAddr, const char *rootCAPath, const char *clientCRTPath, const char *clientKeyPath, iot_disconnect_handler handler = nullptr, void *disconnectData = nullptr)
+    {
+        status_ = tc_client_init(&client_, sends_.data(), Capacity, const_cast<char *>(hostAddr), const_cast<char *>(rootCAPath), const_cast<char *>(clientCRTPath), const_cast<char *>(clientKeyPath), handler, disconnectData);
+    }
+
+    client(const client &) = delete;
+    client &operator=(const client &) = delete;
+
+    ~client()
+    {
+        if (aws_iot_mqtt_is_client_connected(&client_.mqtt))
+        {
+            aws_iot_mqtt_disconnect(&client_.mqtt);
+        }
+
+        tc_client_free(&client_);
+    }
+
+    /**
+     * @brief Result of initializing the client
+     */
+    error status() const noexcept
+    {
+        return status_;
+    }
+
+    /**
+     * @brief Payload format of the client's context, for its messages
+     */
+    tc_format format() const noexcept
+    {
+        return client_.context.format;
+    }
+
+    error connect(const char *clientId, bool autoReconnect = true)
+    {
+        return tc_client_connect(&client_, const_cast<char *>(clientId), autoReconnect);
+    }
+
+    error yield(uint32_t timeoutMs)
+    {
+        return tc_client_yield(&client_, timeoutMs);
+    }
+
+    /**
+     * @brief Run the client until stop is called, see tc_run
+     */
+    error run()
+    {
+        return tc_run(&client_);
+    }
+
+    /**
+     * @brief Stop run. Safe to call from any thread.
+     */
+    void stop() noexcept
+    {
+        tc_stop(&client_);
+    }
+
+    /**
+     * @brief Queue a message. Safe to call from any thread.
+     */
+    error publish(const message &outbound, QoS qos = QOS0) noexcept
+    {
+        if (outbound.empty())
+        {
+            return NULL_VALUE_ERROR;
+        }
+
+        return tc_client_publish(&client_, outbound.topic().data(), static_cast<uint16_t>(outbound.topic().size()), outbound.payload().data(), outbound.payload().size(), qos);
+    }
+
+    /**
+     * @brief Subscribe to command requests
+     *
+     * @param[in]  deviceId  Device's ID.
+     * @param[in]  handler   Callable taking a const command_request&. Must outlive the subscription.
+     * @param[in]  qos       Maximum QoS of messages delivered to the handler.
+     *
+     * @return Zero on success, negative value otherwise
+     */
+    template <typename Handler>
+    error subscribe_to_command_request(std::string_view deviceId, Handler &handler, QoS qos = QOS0)
+    {
+        const tc_slice parts[] = {detail::slice("thincloud/devices/"), detail::slice(deviceId), detail::slice("/command")};
+        std::size_t topicLen = 0;
+        const error rc = tc_join_slices(client_.commandTopic, sizeof(client_.commandTopic), parts, std::size(parts), &topicLen);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+
+        return aws_iot_mqtt_subscribe(&client_.mqtt, client_.commandTopic, static_cast<uint16_t>(topicLen), qos, on_message<command_request, Handler>, &handler);
+    }
+
+    /**
+     * @brief Subscribe to service responses for a request
+     *
+     * @param[in]  deviceId   Device's ID.
+     * @param[in]  requestId  Request's ID.
+     * @param[in]  handler    Callable taking a const service_response&. Must outlive the subscription.
+     * @param[in]  qos        Maximum QoS of messages delivered to the handler.
+     *
+     * @return Zero on success, negative value otherwise
+     */
+    template <typename Handler>
+    error subscribe_to_service_response(std::string_view deviceId, std::string_view requestId, Handler &handler, QoS qos = QOS0)
+    {
+        const tc_slice parts[] = {detail::slice("thincloud/devices/"), detail::slice(deviceId), detail::slice("/requests/"), detail::slice(requestId), detail::slice("/response")};
+        std::size_t topicLen = 0;
+        const error rc = tc_join_slices(client_.serviceResponseTopic, sizeof(client_.serviceResponseTopic), parts, std::size(parts), &topicLen);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+
+        return aws_iot_mqtt_subscribe(&client_.mqtt, client_.serviceResponseTopic, static_cast<uint16_t>(topicLen), qos, on_message<service_response, Handler>, &handler);
+    }
+
+    /**
+     * @brief Underlying tc_client, for the parts of the C API not wrapped here
+     */
+    tc_client &native() noexcept
+    {
+        return client_;
+    }
+
+private:
+    template <typename Received, typename Handler>
+    static void on_message(AWS_IoT_Client *mqtt, char *topicName, uint16_t topicNameLen, IoT_Publish_Message_Params *params, void *data)
+    {
+        // The MQTT client is the first member of its tc_client
+        const tc_format format = reinterpret_cast<const tc_client *>(mqtt)->context.format;
+
+        Received received;
+        const error rc = received.parse(std::string_view(static_cast<const char *>(params->payload), params->payloadLen), format);
+        if (rc != SUCCESS)
+        {
+            IOT_WARN("Dropped message on %.*s: %d", topicNameLen, topicName, rc);
+            return;
+        }
+
+        (*static_cast<Handler *>(data))(static_cast<const Received &>(received));
+    }
+
+    std::array<tc_send, Capacity> sends_;
+    tc_client client_;
+    error status_ = SUCCESS;
+};
+
+} // namespace thincloud
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_HPP_ */
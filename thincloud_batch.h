@@ -0,0 +1,190 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_BATCH_
+#define THINCLOUD_EMBEDDED_C_SDK_BATCH_
+
+/*
+ * Thincloud C Embedded SDK - Outbound batching
+ *
+ * Collects QoS0 PUBLISH packets in a buffer and writes them to the
+ * client's network stack in one pass, so a burst of messages costs one
+ * TLS write instead of one per message.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_mqtt_client_interface.h"
+
+#include "thincloud_mqtt.h"
+#include "thincloud_timer.h"
+
+/**
+ * @brief Outbound publish batch
+ */
+typedef struct
+{
+    unsigned char *buffer;
+    size_t capacity;
+    size_t length;
+    uint32_t count;
+    size_t flushBytes;
+    uint32_t flushIntervalMs;
+    uint64_t oldest;
+} tc_batch;
+
+/**
+ * @brief Initialize a publish batch
+ *
+ * @param[out]  batch            Batch to initialize.
+ * @param[in]   buffer           Buffer packets are collected in.
+ * @param[in]   capacity         Size of buffer.
+ * @param[in]   flushBytes       Flush once this many bytes are buffered. Zero flushes only when full.
+ * @param[in]   flushIntervalMs  Flush once the oldest buffered message has waited this long.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_batch_init(tc_batch *batch, unsigned char *buffer, size_t capacity, size_t flushBytes, uint32_t flushIntervalMs)
+{
+    if (batch == NULL || buffer == NULL || capacity == 0)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    memset(batch, 0, sizeof(*batch));
+
+    batch->buffer = buffer;
+    batch->capacity = capacity;
+    batch->flushBytes = flushBytes == 0 || flushBytes > capacity ? capacity : flushBytes;
+    batch->flushIntervalMs = flushIntervalMs;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Write all buffered messages
+ *
+ * The batch is emptied even if the write fails; like any QoS0 publish,
+ * the messages are then lost.
+ *
+ * @param[in]  batch   Publish batch.
+ * @param[in]  client  AWS IoT MQTT Client instance.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_batch_flush(tc_batch *batch, AWS_IoT_Client *client)
+{
+    if (batch->length == 0)
+    {
+        return SUCCESS;
+    }
+
+    const IoT_Error_t rc = tc_mqtt_write(client, batch->buffer, batch->length);
+
+    batch->length = 0;
+    batch->count = 0;
+
+    return rc;
+}
+
+/**
+ * @brief Queue a QoS0 publish
+ *
+ * Flushes first if the message does not fit, and after if the batch
+ * reaches its byte threshold. Messages too large for the batch are
+ * published directly.
+ *
+ * @param[in]  batch       Publish batch.
+ * @param[in]  client      AWS IoT MQTT Client instance.
+ * @param[in]  topic       Topic to publish to.
+ * @param[in]  topicLen    Length of the topic.
+ * @param[in]  payload     Message payload.
+ * @param[in]  payloadLen  Length of the payload.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_batch_publish(tc_batch *batch, AWS_IoT_Client *client, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen)
+{
+    IoT_Error_t rc = SUCCESS;
+
+    const size_t size = tc_mqtt_publish_size(topicLen, QOS0, payloadLen);
+    if (batch->length + size > batch->capacity)
+    {
+        rc = tc_batch_flush(batch, client);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+    }
+
+    if (size > batch->capacity)
+    {
+        IoT_Publish_Message_Params params;
+        params.qos = QOS0;
+        params.isRetained = false;
+        params.payload = (void *)payload;
+        params.payloadLen = payloadLen;
+
+        return aws_iot_mqtt_publish(client, topic, topicLen, &params);
+    }
+
+    rc = tc_mqtt_serialize_publish(batch->buffer + batch->length, batch->capacity - batch->length, topic, topicLen, QOS0, false, 0, payload, payloadLen, NULL);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    if (batch->count == 0)
+    {
+        batch->oldest = tc_clock_ms();
+    }
+
+    batch->length += size;
+    batch->count++;
+
+    if (batch->length >= batch->flushBytes)
+    {
+        rc = tc_batch_flush(batch, client);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Flush a batch if its oldest message has waited long enough
+ *
+ * Called once per yield cycle by tc_yield.
+ *
+ * @param[in]  batch   Publish batch.
+ * @param[in]  client  AWS IoT MQTT Client instance.
+ * @param[in]  now     Current tc_clock_ms() time.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_batch_poll(tc_batch *batch, AWS_IoT_Client *client, uint64_t now)
+{
+    if (batch->count == 0 || now - batch->oldest < batch->flushIntervalMs)
+    {
+        return SUCCESS;
+    }
+
+    return tc_batch_flush(batch, client);
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_BATCH_ */
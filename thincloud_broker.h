@@ -0,0 +1,1486 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_BROKER_
+#define THINCLOUD_EMBEDDED_C_SDK_BROKER_
+
+/*
+ * Thincloud C Embedded SDK - Loopback broker
+ *
+ * A minimal MQTT 3.1.1 broker running on a thread of the process that
+ * uses it, so tc_init, tc_connect and every send and receive after them
+ * can be tested and measured end to end without AWS IoT. It listens on
+ * the loopback interface or a Unix socket and handles CONNECT,
+ * SUBSCRIBE and UNSUBSCRIBE with + and # wildcards, PUBLISH at QOS0 and
+ * QOS1, PINGREQ and DISCONNECT. Sessions, retained messages, wills and
+ * QOS2 are not supported.
+ *
+ * The broker also plays the ThinCloud side of a conversation: it answers
+ * JSON commissioning and service requests and sends command requests.
+ *
+ * The broker speaks plain MQTT, so clients replace their TLS network
+ * stack with tc_broker_network_init after tc_init.
+ *
+ * Not included by thincloud.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "thincloud.h"
+
+/**
+ * Most clients connected to a broker at once
+ */
+#define TC_BROKER_MAX_CONNECTIONS 8
+
+/**
+ * Most topic filters a connection can subscribe to
+ */
+#define TC_BROKER_MAX_SUBSCRIPTIONS 16
+
+/**
+ * Size of each connection's receive and send buffers. Larger packets
+ * close the connection.
+ */
+#define TC_BROKER_BUFFER_SIZE 32768
+
+/**
+ * Longest address tc_broker_address returns, with the null character
+ */
+#define TC_BROKER_ADDRESS_LENGTH (sizeof(((struct sockaddr_un *)0)->sun_path) + 6)
+
+/*
+ * Plain socket network stack
+ */
+
+/**
+ * @brief Connect to the broker named by a client's host address
+ *
+ * Addresses are "host:port" or "unix:path". A host without a port uses
+ * the port tc_init set.
+ */
+IoT_Error_t tc_socket_connect(Network *network, TLSConnectParams *params)
+{
+    if (network == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    if (params != NULL)
+    {
+        network->tlsConnectParams = *params;
+    }
+
+    const char *url = network->tlsConnectParams.pDestinationURL;
+    if (url == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    int fd = -1;
+
+    if (strncmp(url, "unix:", 5) == 0)
+    {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if (strlen(url + 5) >= sizeof(address.sun_path))
+        {
+            return NETWORK_ERR_NET_UNKNOWN_HOST;
+        }
+        strcpy(address.sun_path, url + 5);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            return NETWORK_ERR_NET_SOCKET_FAILED;
+        }
+
+        if (connect(fd, (const struct sockaddr *)&address, sizeof(address)) != 0)
+        {
+            close(fd);
+            return NETWORK_ERR_NET_CONNECT_FAILED;
+        }
+    }
+    else
+    {
+        char host[128];
+        char port[8];
+
+        const char *colon = strrchr(url, ':');
+        const size_t hostLen = colon == NULL ? strlen(url) : (size_t)(colon - url);
+        if (hostLen >= sizeof(host))
+        {
+            return NETWORK_ERR_NET_UNKNOWN_HOST;
+        }
+        memcpy(host, url, hostLen);
+        host[hostLen] = '\0';
+
+        if (colon != NULL)
+        {
+            snprintf(port, sizeof(port), "%s", colon + 1);
+        }
+        else
+        {
+            snprintf(port, sizeof(port), "%u", (unsigned int)network->tlsConnectParams.DestinationPort);
+        }
+
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        struct addrinfo *addresses = NULL;
+        if (getaddrinfo(host, port, &hints, &addresses) != 0)
+        {
+            return NETWORK_ERR_NET_UNKNOWN_HOST;
+        }
+
+        for (const struct addrinfo *address = addresses; address != NULL && fd < 0; address = address->ai_next)
+        {
+            fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+            if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+
+        if (fd < 0)
+        {
+            return NETWORK_ERR_NET_CONNECT_FAILED;
+        }
+
+        // Small packets go out as they are written, as they would through TLS records
+        const int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    network->tlsDataParams.server_fd.fd = fd;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Read exactly len bytes before the timer expires
+ *
+ * @return Zero once len bytes are read, NETWORK_SSL_NOTHING_TO_READ if
+ *         none arrived, NETWORK_SSL_READ_TIMEOUT_ERROR if only some did,
+ *         NETWORK_SSL_READ_ERROR if the connection failed or closed
+ */
+IoT_Error_t tc_socket_read(Network *network, unsigned char *data, size_t len, Timer *timer, size_t *read)
+{
+    const int fd = network->tlsDataParams.server_fd.fd;
+    size_t total = 0;
+
+    // Like the TLS stack, try at least once even if the timer has expired
+    do
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        const int ready = poll(&pfd, 1, (int)left_ms(timer));
+        if (ready < 0 && errno != EINTR)
+        {
+            return NETWORK_SSL_READ_ERROR;
+        }
+
+        if (ready > 0)
+        {
+            const ssize_t received = recv(fd, data + total, len - total, 0);
+            if (received == 0 || (received < 0 && errno != EINTR && errno != EAGAIN))
+            {
+                return NETWORK_SSL_READ_ERROR;
+            }
+
+            total += received > 0 ? (size_t)received : 0;
+        }
+    } while (total < len && !has_timer_expired(timer));
+
+    *read = total;
+
+    if (total == len)
+    {
+        return SUCCESS;
+    }
+
+    return total == 0 ? NETWORK_SSL_NOTHING_TO_READ : NETWORK_SSL_READ_TIMEOUT_ERROR;
+}
+
+/**
+ * @brief Write len bytes before the timer expires
+ */
+IoT_Error_t tc_socket_write(Network *network, unsigned char *data, size_t len, Timer *timer, size_t *written)
+{
+    const int fd = network->tlsDataParams.server_fd.fd;
+    size_t total = 0;
+
+    while (total < len)
+    {
+        const ssize_t sent = send(fd, data + total, len - total, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent > 0)
+        {
+            total += (size_t)sent;
+            continue;
+        }
+
+        if (sent < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            *written = total;
+            return NETWORK_SSL_WRITE_ERROR;
+        }
+
+        if (has_timer_expired(timer))
+        {
+            *written = total;
+            return NETWORK_SSL_WRITE_TIMEOUT_ERROR;
+        }
+
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        poll(&pfd, 1, (int)left_ms(timer));
+    }
+
+    *written = total;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Close the connection
+ */
+IoT_Error_t tc_socket_disconnect(Network *network)
+{
+    if (network->tlsDataParams.server_fd.fd >= 0)
+    {
+        close(network->tlsDataParams.server_fd.fd);
+        network->tlsDataParams.server_fd.fd = -1;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Report whether the connection is open
+ */
+IoT_Error_t tc_socket_is_connected(Network *network)
+{
+    return network->tlsDataParams.server_fd.fd >= 0 ? NETWORK_PHYSICAL_LAYER_CONNECTED : NETWORK_PHYSICAL_LAYER_DISCONNECTED;
+}
+
+/**
+ * @brief Release the network stack; sockets hold nothing past disconnect
+ */
+IoT_Error_t tc_socket_destroy(Network *network)
+{
+    (void)network;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Replace a client's TLS network stack with plain sockets
+ *
+ * Call after tc_init, which sets up the TLS stack, and before
+ * tc_connect. The client's host address names the broker, as returned
+ * by tc_broker_address. The certificate paths given to tc_init are not
+ * read, but the MQTT client still requires them to be non-null.
+ *
+ * @param[in]  network  Network stack of an initialized client.
+ */
+void tc_broker_network_init(Network *network)
+{
+    network->connect = tc_socket_connect;
+    network->read = tc_socket_read;
+    network->write = tc_socket_write;
+    network->disconnect = tc_socket_disconnect;
+    network->isConnected = tc_socket_is_connected;
+    network->destroy = tc_socket_destroy;
+    network->tlsDataParams.server_fd.fd = -1;
+}
+
+/*
+ * Broker
+ */
+
+/**
+ * @brief Topic filter a connection subscribed to
+ */
+typedef struct
+{
+    char filter[MAX_TOPIC_LENGTH];
+    uint16_t filterLen;
+    QoS qos;
+} tc_broker_subscription;
+
+/**
+ * @brief Client connection
+ *
+ * Sends are buffered and written as the socket accepts them, so a
+ * client that is busy writing never blocks the broker. A client that
+ * falls a whole buffer behind is disconnected.
+ */
+typedef struct
+{
+    int fd;
+    bool connected;
+    uint16_t nextPacketId;
+    uint32_t subscriptionCount;
+    tc_broker_subscription subscriptions[TC_BROKER_MAX_SUBSCRIPTIONS];
+    size_t inLen;
+    size_t outLen;
+    unsigned char in[TC_BROKER_BUFFER_SIZE];
+    unsigned char out[TC_BROKER_BUFFER_SIZE];
+} tc_broker_connection;
+
+typedef struct tc_broker tc_broker;
+
+/**
+ * @brief Function called for each message a client publishes
+ *
+ * Called on the broker's thread with the broker locked, after the
+ * message is delivered, so it must not block or call tc_broker_publish.
+ */
+typedef void (*tc_broker_publish_handler)(tc_broker *broker, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen, void *userData);
+
+/**
+ * @brief Loopback broker
+ *
+ * About 550 KB; give it static storage.
+ */
+struct tc_broker
+{
+    int listenFd;
+    int wakeFds[2];
+    bool unixSocket;
+    bool running;
+    bool stopping;
+    char address[TC_BROKER_ADDRESS_LENGTH];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    tc_broker_connection connections[TC_BROKER_MAX_CONNECTIONS];
+    tc_uuid_generator deviceIds;
+    uint16_t serviceStatus;
+    const char *serviceBody;
+    tc_broker_publish_handler onPublish;
+    void *publishData;
+};
+
+/**
+ * @brief Check a topic against a topic filter
+ *
+ * + matches one topic level and # the rest of the topic, including its
+ * parent. Topics starting with $ only match filters that name the $
+ * level.
+ *
+ * @return true if the filter matches the topic
+ */
+bool tc_broker_filter_matches(const char *filter, size_t filterLen, const char *topic, size_t topicLen)
+{
+    if (topicLen > 0 && topic[0] == '$' && filterLen > 0 && (filter[0] == '+' || filter[0] == '#'))
+    {
+        return false;
+    }
+
+    size_t f = 0;
+    size_t t = 0;
+
+    while (f < filterLen)
+    {
+        if (filter[f] == '#')
+        {
+            return true;
+        }
+
+        if (filter[f] == '+')
+        {
+            while (t < topicLen && topic[t] != '/')
+            {
+                t++;
+            }
+            f++;
+        }
+        else
+        {
+            for (; f < filterLen && filter[f] != '/'; f++, t++)
+            {
+                if (t >= topicLen || topic[t] != filter[f])
+                {
+                    return false;
+                }
+            }
+        }
+
+        if (f == filterLen)
+        {
+            break;
+        }
+
+        // Both are at a level separator, or the topic ended and only /# is left
+        if (t == topicLen)
+        {
+            return filterLen - f == 2 && filter[f + 1] == '#';
+        }
+
+        if (topic[t] != '/')
+        {
+            return false;
+        }
+
+        f++;
+        t++;
+    }
+
+    return t == topicLen;
+}
+
+/**
+ * @brief Check that wildcards fill whole levels and # comes last
+ */
+bool tc_broker_filter_valid(const char *filter, size_t filterLen)
+{
+    if (filterLen == 0)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < filterLen; i++)
+    {
+        if (filter[i] != '+' && filter[i] != '#')
+        {
+            continue;
+        }
+
+        const bool levelStart = i == 0 || filter[i - 1] == '/';
+        const bool levelEnd = i + 1 == filterLen || filter[i + 1] == '/';
+        if (!levelStart || !levelEnd || (filter[i] == '#' && i + 1 != filterLen))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Initialize a broker
+ *
+ * Service requests are answered with status 200 and no body until
+ * tc_broker_set_service_response says otherwise.
+ *
+ * @param[out]  broker  Broker to initialize.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_broker_init(tc_broker *broker)
+{
+    if (broker == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    memset(broker, 0, sizeof(*broker));
+    broker->listenFd = -1;
+    broker->wakeFds[0] = -1;
+    broker->wakeFds[1] = -1;
+    broker->serviceStatus = 200;
+
+    for (uint32_t i = 0; i < TC_BROKER_MAX_CONNECTIONS; i++)
+    {
+        broker->connections[i].fd = -1;
+    }
+
+    // Commissioned devices get the same IDs on every run
+    tc_uuid_generator_seed(&broker->deviceIds, 0x7463);
+
+    if (pthread_mutex_init(&broker->lock, NULL) != 0)
+    {
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Set how the broker answers service requests
+ *
+ * @param[in]  broker      Broker instance.
+ * @param[in]  statusCode  Status code of each response.
+ * @param[in]  body        Optional. Raw JSON body of each response. Must outlive the broker.
+ */
+void tc_broker_set_service_response(tc_broker *broker, uint16_t statusCode, const char *body)
+{
+    pthread_mutex_lock(&broker->lock);
+    broker->serviceStatus = statusCode;
+    broker->serviceBody = body;
+    pthread_mutex_unlock(&broker->lock);
+}
+
+/**
+ * @brief Observe the messages clients publish
+ *
+ * Command responses and anything else not addressed to a subscriber can
+ * only be seen here.
+ *
+ * @param[in]  broker    Broker instance.
+ * @param[in]  handler   Function to call, NULL for none.
+ * @param[in]  userData  Passed to handler.
+ */
+void tc_broker_set_publish_handler(tc_broker *broker, tc_broker_publish_handler handler, void *userData)
+{
+    pthread_mutex_lock(&broker->lock);
+    broker->onPublish = handler;
+    broker->publishData = userData;
+    pthread_mutex_unlock(&broker->lock);
+}
+
+/**
+ * @brief Listen for TCP connections on the loopback interface
+ *
+ * @param[in]  broker  Initialized broker.
+ * @param[in]  port    Port to listen on, 0 for any free port.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_broker_listen_tcp(tc_broker *broker, uint16_t port)
+{
+    if (broker->listenFd >= 0)
+    {
+        return TCP_SETUP_ERROR;
+    }
+
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return NETWORK_ERR_NET_SOCKET_FAILED;
+    }
+
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in address;
+    socklen_t addressLen = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (const struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(fd, TC_BROKER_MAX_CONNECTIONS) != 0 ||
+        getsockname(fd, (struct sockaddr *)&address, &addressLen) != 0)
+    {
+        close(fd);
+        return TCP_SETUP_ERROR;
+    }
+
+    broker->listenFd = fd;
+    broker->unixSocket = false;
+    snprintf(broker->address, sizeof(broker->address), "127.0.0.1:%u", (unsigned int)ntohs(address.sin_port));
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Listen for connections on a Unix socket
+ *
+ * Any file already at path is replaced, and the socket is removed when
+ * the broker stops.
+ *
+ * @param[in]  broker  Initialized broker.
+ * @param[in]  path    Path of the socket.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_broker_listen_unix(tc_broker *broker, const char *path)
+{
+    struct sockaddr_un address;
+
+    if (broker->listenFd >= 0)
+    {
+        return TCP_SETUP_ERROR;
+    }
+
+    if (path == NULL || strlen(path) >= sizeof(address.sun_path))
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return NETWORK_ERR_NET_SOCKET_FAILED;
+    }
+
+    unlink(path);
+
+    if (bind(fd, (const struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(fd, TC_BROKER_MAX_CONNECTIONS) != 0)
+    {
+        close(fd);
+        return TCP_SETUP_ERROR;
+    }
+
+    broker->listenFd = fd;
+    broker->unixSocket = true;
+    snprintf(broker->address, sizeof(broker->address), "unix:%s", path);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Address clients pass to tc_init to reach a listening broker
+ */
+char *tc_broker_address(tc_broker *broker)
+{
+    return broker->address;
+}
+
+/**
+ * @brief Wake the broker's thread so it sees new state
+ */
+void tc_broker_wake(tc_broker *broker)
+{
+    const char byte = 0;
+
+    if (broker->wakeFds[1] >= 0 && write(broker->wakeFds[1], &byte, 1) < 0)
+    {
+        // EAGAIN; the pipe is full, so the broker will wake anyway
+    }
+}
+
+/**
+ * @brief Close a connection and free its slot
+ */
+void tc_broker_close(tc_broker_connection *connection)
+{
+    close(connection->fd);
+    connection->fd = -1;
+    connection->connected = false;
+    connection->subscriptionCount = 0;
+    connection->inLen = 0;
+    connection->outLen = 0;
+}
+
+/**
+ * @brief Write as much buffered output as the socket takes
+ */
+void tc_broker_flush(tc_broker_connection *connection)
+{
+    size_t offset = 0;
+
+    while (offset < connection->outLen)
+    {
+        const ssize_t sent = send(connection->fd, connection->out + offset, connection->outLen - offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent > 0)
+        {
+            offset += (size_t)sent;
+        }
+        else if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        else
+        {
+            tc_broker_close(connection);
+            return;
+        }
+    }
+
+    memmove(connection->out, connection->out + offset, connection->outLen - offset);
+    connection->outLen -= offset;
+}
+
+/**
+ * @brief Make room for len bytes of output
+ *
+ * @return Where to write them, NULL if the client is too far behind
+ */
+unsigned char *tc_broker_reserve(tc_broker_connection *connection, size_t len)
+{
+    if (sizeof(connection->out) - connection->outLen < len)
+    {
+        tc_broker_flush(connection);
+    }
+
+    if (connection->fd < 0 || sizeof(connection->out) - connection->outLen < len)
+    {
+        return NULL;
+    }
+
+    return connection->out + connection->outLen;
+}
+
+/**
+ * @brief Queue a packet to a client and try to send it
+ */
+void tc_broker_send(tc_broker_connection *connection, const unsigned char *packet, size_t len)
+{
+    unsigned char *out = tc_broker_reserve(connection, len);
+    if (out == NULL)
+    {
+        if (connection->fd >= 0)
+        {
+            tc_broker_close(connection);
+        }
+        return;
+    }
+
+    memcpy(out, packet, len);
+    connection->outLen += len;
+
+    tc_broker_flush(connection);
+}
+
+/**
+ * @brief Send a message to every connection subscribed to its topic
+ *
+ * Each connection gets one copy, at the highest QoS of its matching
+ * subscriptions but no higher than the message's. Caller holds the lock.
+ */
+void tc_broker_deliver(tc_broker *broker, const char *topic, uint16_t topicLen, const void *payload, size_t payloadLen, QoS qos)
+{
+    const size_t size = tc_mqtt_publish_size(topicLen, qos, payloadLen);
+
+    for (uint32_t i = 0; i < TC_BROKER_MAX_CONNECTIONS; i++)
+    {
+        tc_broker_connection *connection = &broker->connections[i];
+        bool matched = false;
+        QoS granted = QOS0;
+
+        if (!connection->connected)
+        {
+            continue;
+        }
+
+        for (uint32_t s = 0; s < connection->subscriptionCount; s++)
+        {
+            const tc_broker_subscription *subscription = &connection->subscriptions[s];
+            if (tc_broker_filter_matches(subscription->filter, subscription->filterLen, topic, topicLen))
+            {
+                matched = true;
+                granted = subscription->qos > granted ? subscription->qos : granted;
+            }
+        }
+
+        if (!matched)
+        {
+            continue;
+        }
+
+        const QoS deliveredQos = qos < granted ? qos : granted;
+        uint16_t packetId = 0;
+        if (deliveredQos != QOS0)
+        {
+            connection->nextPacketId = connection->nextPacketId == UINT16_MAX ? 1 : (uint16_t)(connection->nextPacketId + 1);
+            packetId = connection->nextPacketId;
+        }
+
+        unsigned char *out = tc_broker_reserve(connection, size);
+        size_t written = 0;
+        if (out == NULL || tc_mqtt_serialize_publish(out, size, topic, topicLen, deliveredQos, false, packetId, payload, payloadLen, &written) != SUCCESS)
+        {
+            if (connection->fd >= 0)
+            {
+                tc_broker_close(connection);
+            }
+            continue;
+        }
+
+        connection->outLen += written;
+        tc_broker_flush(connection);
+    }
+}
+
+/**
+ * @brief Publish a message to the broker's subscribers
+ *
+ * Safe to call from any thread while the broker runs.
+ *
+ * @param[in]  broker      Running broker.
+ * @param[in]  topic       Topic to publish to.
+ * @param[in]  topicLen    Length of the topic.
+ * @param[in]  payload     Message payload.
+ * @param[in]  payloadLen  Length of the payload.
+ * @param[in]  qos         QOS0 or QOS1.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_broker_publish(tc_broker *broker, const char *topic, uint16_t topicLen, const void *payload, size_t payloadLen, QoS qos)
+{
+    if (broker == NULL || topic == NULL || topicLen == 0 || (payload == NULL && payloadLen > 0))
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    pthread_mutex_lock(&broker->lock);
+    tc_broker_deliver(broker, topic, topicLen, payload, payloadLen, qos);
+    pthread_mutex_unlock(&broker->lock);
+
+    // Output the socket did not take is sent once the broker polls it
+    tc_broker_wake(broker);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Send a command request to a device
+ *
+ * @param[in]  broker     Running broker.
+ * @param[in]  deviceId   Device to command.
+ * @param[in]  requestId  Command's request ID.
+ * @param[in]  method     Command method.
+ * @param[in]  data       Optional. Raw JSON data of the command's parameters.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_broker_send_command(tc_broker *broker, const char *deviceId, const char *requestId, const char *method, const char *data)
+{
+    char topic[MAX_TOPIC_LENGTH];
+    char payload[TC_MAX_PAYLOAD_LENGTH];
+    size_t topicLen = 0;
+
+    if (broker == NULL || requestId == NULL || method == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    IoT_Error_t rc = command_request_topic_n(topic, sizeof(topic), deviceId, &topicLen);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    tc_json_writer writer;
+    tc_json_writer_init(&writer, payload, sizeof(payload));
+    tc_json_begin_object(&writer);
+    tc_json_key(&writer, "id");
+    tc_json_string(&writer, requestId);
+    tc_json_key(&writer, "method");
+    tc_json_string(&writer, method);
+    if (data != NULL)
+    {
+        tc_json_key(&writer, "params");
+        tc_json_begin_array(&writer);
+        tc_json_begin_object(&writer);
+        tc_json_key(&writer, "data");
+        tc_json_raw(&writer, data, strlen(data));
+        tc_json_end_object(&writer);
+        tc_json_end_array(&writer);
+    }
+    tc_json_end_object(&writer);
+
+    rc = tc_json_writer_finish(&writer);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    return tc_broker_publish(broker, topic, (uint16_t)topicLen, payload, writer.length, QOS1);
+}
+
+/**
+ * @brief Answer a commissioning or service request as ThinCloud would
+ *
+ * Requests are read as JSON; anything else on a request topic, or a
+ * request without an ID, goes unanswered. Caller holds the lock.
+ */
+void tc_broker_respond(tc_broker *broker, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen)
+{
+    static const char commissioningFilter[] = "thincloud/registration/+/requests";
+    static const char serviceFilter[] = "thincloud/devices/+/requests";
+
+    const bool commissioning = tc_broker_filter_matches(commissioningFilter, sizeof(commissioningFilter) - 1, topic, topicLen);
+    const bool service = tc_broker_filter_matches(serviceFilter, sizeof(serviceFilter) - 1, topic, topicLen);
+    if (!commissioning && !service)
+    {
+        return;
+    }
+
+    // Commissioning and service requests share the command request's shape
+    tc_command_request_view request;
+    char requestId[TC_ID_LENGTH * 2];
+    if (command_request_view(&request, payload, payloadLen) != SUCCESS || request.requestId.len == 0 ||
+        tc_json_unescape(requestId, sizeof(requestId), request.requestId, NULL) != SUCCESS)
+    {
+        return;
+    }
+
+    char responseTopic[MAX_TOPIC_LENGTH];
+    const int responseTopicLen = snprintf(responseTopic, sizeof(responseTopic), "%.*s/%s/response", (int)topicLen, topic, requestId);
+    if (responseTopicLen < 0 || (size_t)responseTopicLen >= sizeof(responseTopic))
+    {
+        return;
+    }
+
+    char response[TC_MAX_PAYLOAD_LENGTH];
+    tc_json_writer writer;
+    tc_json_writer_init(&writer, response, sizeof(response));
+    tc_json_begin_object(&writer);
+    tc_json_key(&writer, "id");
+    tc_json_string(&writer, requestId);
+    tc_json_key(&writer, "result");
+    tc_json_begin_object(&writer);
+
+    if (commissioning)
+    {
+        char deviceId[TC_UUID_TEXT_LENGTH + 1];
+        tc_uuid_generate_text(&broker->deviceIds, deviceId);
+
+        tc_json_key(&writer, "statusCode");
+        tc_json_int(&writer, 200);
+        tc_json_key(&writer, "deviceId");
+        tc_json_string(&writer, deviceId);
+    }
+    else
+    {
+        tc_json_key(&writer, "statusCode");
+        tc_json_int(&writer, broker->serviceStatus);
+        if (broker->serviceBody != NULL)
+        {
+            tc_json_key(&writer, "body");
+            tc_json_raw(&writer, broker->serviceBody, strlen(broker->serviceBody));
+        }
+    }
+
+    tc_json_end_object(&writer);
+    tc_json_end_object(&writer);
+
+    if (tc_json_writer_finish(&writer) == SUCCESS)
+    {
+        tc_broker_deliver(broker, responseTopic, (uint16_t)responseTopicLen, response, writer.length, QOS1);
+    }
+}
+
+/**
+ * @brief Read a length-prefixed string from a packet
+ *
+ * @return false if the packet ends first
+ */
+bool tc_broker_read_string(const unsigned char *body, size_t len, size_t *offset, const char **value, uint16_t *valueLen)
+{
+    if (len - *offset < 2)
+    {
+        return false;
+    }
+
+    const uint16_t stringLen = (uint16_t)(body[*offset] << 8 | body[*offset + 1]);
+    if (len - *offset - 2 < stringLen)
+    {
+        return false;
+    }
+
+    *value = (const char *)body + *offset + 2;
+    *valueLen = stringLen;
+    *offset += 2 + (size_t)stringLen;
+
+    return true;
+}
+
+/**
+ * @brief Handle CONNECT
+ */
+bool tc_broker_handle_connect(tc_broker_connection *connection, const unsigned char *body, size_t len)
+{
+    size_t offset = 0;
+    const char *protocol;
+    uint16_t protocolLen;
+
+    if (connection->connected || !tc_broker_read_string(body, len, &offset, &protocol, &protocolLen) || len - offset < 4)
+    {
+        return false;
+    }
+
+    // Protocol name, level, flags and keep alive; the will and credentials are ignored
+    const bool accepted = protocolLen == 4 && memcmp(protocol, "MQTT", 4) == 0 && body[offset] == 4;
+    const unsigned char connack[] = {TC_MQTT_CONNACK, 2, 0, (unsigned char)(accepted ? 0 : 1)};
+    tc_broker_send(connection, connack, sizeof(connack));
+
+    connection->connected = accepted;
+
+    return accepted;
+}
+
+/**
+ * @brief Handle SUBSCRIBE
+ *
+ * Grants QOS1 to requests for QOS2. A subscription to a filter the
+ * connection already has replaces it.
+ */
+bool tc_broker_handle_subscribe(tc_broker_connection *connection, unsigned char flags, const unsigned char *body, size_t len)
+{
+    unsigned char suback[4 + TC_BROKER_MAX_SUBSCRIPTIONS * 2];
+    size_t count = 0;
+    size_t offset = 2;
+
+    if (flags != 0x02 || len < 2)
+    {
+        return false;
+    }
+
+    while (offset < len)
+    {
+        const char *filter;
+        uint16_t filterLen;
+        if (!tc_broker_read_string(body, len, &offset, &filter, &filterLen) || offset >= len || count == sizeof(suback) - 4)
+        {
+            return false;
+        }
+
+        const unsigned char requested = body[offset++];
+        unsigned char granted = 0x80;
+
+        if (requested <= 2 && filterLen < MAX_TOPIC_LENGTH && tc_broker_filter_valid(filter, filterLen))
+        {
+            uint32_t s = 0;
+            while (s < connection->subscriptionCount &&
+                   (connection->subscriptions[s].filterLen != filterLen || memcmp(connection->subscriptions[s].filter, filter, filterLen) != 0))
+            {
+                s++;
+            }
+
+            if (s < TC_BROKER_MAX_SUBSCRIPTIONS)
+            {
+                tc_broker_subscription *subscription = &connection->subscriptions[s];
+                memcpy(subscription->filter, filter, filterLen);
+                subscription->filter[filterLen] = '\0';
+                subscription->filterLen = filterLen;
+                subscription->qos = requested == 0 ? QOS0 : QOS1;
+                connection->subscriptionCount += s == connection->subscriptionCount ? 1 : 0;
+                granted = (unsigned char)subscription->qos;
+            }
+        }
+
+        suback[4 + count++] = granted;
+    }
+
+    if (count == 0)
+    {
+        return false;
+    }
+
+    // Too few filters fit for the remaining length to take more than a byte
+    const size_t remaining = 2 + count;
+    suback[0] = TC_MQTT_SUBACK;
+    suback[1] = (unsigned char)remaining;
+    suback[2] = body[0];
+    suback[3] = body[1];
+    tc_broker_send(connection, suback, 2 + remaining);
+
+    return true;
+}
+
+/**
+ * @brief Handle UNSUBSCRIBE
+ */
+bool tc_broker_handle_unsubscribe(tc_broker_connection *connection, unsigned char flags, const unsigned char *body, size_t len)
+{
+    size_t offset = 2;
+
+    if (flags != 0x02 || len < 2)
+    {
+        return false;
+    }
+
+    while (offset < len)
+    {
+        const char *filter;
+        uint16_t filterLen;
+        if (!tc_broker_read_string(body, len, &offset, &filter, &filterLen))
+        {
+            return false;
+        }
+
+        for (uint32_t s = 0; s < connection->subscriptionCount; s++)
+        {
+            tc_broker_subscription *subscription = &connection->subscriptions[s];
+            if (subscription->filterLen == filterLen && memcmp(subscription->filter, filter, filterLen) == 0)
+            {
+                *subscription = connection->subscriptions[--connection->subscriptionCount];
+                break;
+            }
+        }
+    }
+
+    const unsigned char unsuback[] = {TC_MQTT_UNSUBACK, 2, body[0], body[1]};
+    tc_broker_send(connection, unsuback, sizeof(unsuback));
+
+    return true;
+}
+
+/**
+ * @brief Handle PUBLISH
+ *
+ * Acknowledges a QOS1 message before delivering it, so the publisher
+ * sees its PUBACK ahead of any response to the message.
+ */
+bool tc_broker_handle_publish(tc_broker *broker, tc_broker_connection *connection, unsigned char flags, const unsigned char *body, size_t len)
+{
+    const QoS qos = (flags & TC_MQTT_PUBLISH_QOS1) ? QOS1 : QOS0;
+    size_t offset = 0;
+    const char *topic;
+    uint16_t topicLen;
+
+    if ((flags & 0x04) != 0 || !tc_broker_read_string(body, len, &offset, &topic, &topicLen) || topicLen == 0 ||
+        memchr(topic, '+', topicLen) != NULL || memchr(topic, '#', topicLen) != NULL)
+    {
+        return false;
+    }
+
+    if (qos == QOS1)
+    {
+        if (len - offset < 2)
+        {
+            return false;
+        }
+
+        const unsigned char puback[] = {TC_MQTT_PUBACK, 2, body[offset], body[offset + 1]};
+        tc_broker_send(connection, puback, sizeof(puback));
+        offset += 2;
+    }
+
+    const char *payload = (const char *)body + offset;
+    const size_t payloadLen = len - offset;
+
+    tc_broker_deliver(broker, topic, topicLen, payload, payloadLen, qos);
+    tc_broker_respond(broker, topic, topicLen, payload, payloadLen);
+
+    if (broker->onPublish != NULL)
+    {
+        broker->onPublish(broker, topic, topicLen, payload, payloadLen, broker->publishData);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Handle one packet from a client
+ *
+ * @return false if the connection must be closed
+ */
+bool tc_broker_handle(tc_broker *broker, tc_broker_connection *connection, unsigned char header, const unsigned char *body, size_t len)
+{
+    const unsigned char type = header & 0xF0;
+    const unsigned char flags = header & 0x0F;
+
+    if (!connection->connected && type != TC_MQTT_CONNECT)
+    {
+        return false;
+    }
+
+    switch (type)
+    {
+    case TC_MQTT_CONNECT:
+        return tc_broker_handle_connect(connection, body, len);
+    case TC_MQTT_PUBLISH:
+        return tc_broker_handle_publish(broker, connection, flags, body, len);
+    case TC_MQTT_PUBACK:
+        // Deliveries are not retried, so there is nothing to release
+        return true;
+    case TC_MQTT_SUBSCRIBE:
+        return tc_broker_handle_subscribe(connection, flags, body, len);
+    case TC_MQTT_UNSUBSCRIBE:
+        return tc_broker_handle_unsubscribe(connection, flags, body, len);
+    case TC_MQTT_PINGREQ:
+    {
+        const unsigned char pingresp[] = {TC_MQTT_PINGRESP, 0};
+        tc_broker_send(connection, pingresp, sizeof(pingresp));
+        return true;
+    }
+    default:
+        // DISCONNECT, and QOS2 or server-to-client packets this broker does not support
+        return false;
+    }
+}
+
+/**
+ * @brief Read from a client and handle each complete packet
+ */
+void tc_broker_receive(tc_broker *broker, tc_broker_connection *connection)
+{
+    const ssize_t received = recv(connection->fd, connection->in + connection->inLen, sizeof(connection->in) - connection->inLen, MSG_DONTWAIT);
+    if (received < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return;
+    }
+
+    if (received <= 0)
+    {
+        tc_broker_close(connection);
+        return;
+    }
+
+    connection->inLen += (size_t)received;
+
+    size_t offset = 0;
+    while (connection->inLen - offset >= 2)
+    {
+        size_t remaining = 0;
+        size_t size = 0;
+        const IoT_Error_t rc = tc_mqtt_decode_remaining_length(connection->in + offset + 1, connection->inLen - offset - 1, &remaining, &size);
+        if (rc == MQTT_NOTHING_TO_READ || (rc == SUCCESS && connection->inLen - offset < 1 + size + remaining))
+        {
+            break;
+        }
+
+        if (rc != SUCCESS || !tc_broker_handle(broker, connection, connection->in[offset], connection->in + offset + 1 + size, remaining))
+        {
+            tc_broker_close(connection);
+            return;
+        }
+
+        // A handler can close the connection when its output overflows
+        if (connection->fd < 0)
+        {
+            return;
+        }
+
+        offset += 1 + size + remaining;
+    }
+
+    memmove(connection->in, connection->in + offset, connection->inLen - offset);
+    connection->inLen -= offset;
+
+    // A packet larger than the buffer can never complete
+    if (connection->inLen == sizeof(connection->in))
+    {
+        tc_broker_close(connection);
+    }
+}
+
+/**
+ * @brief Accept a client, refusing it when every slot is taken
+ */
+void tc_broker_accept(tc_broker *broker)
+{
+    const int fd = accept(broker->listenFd, NULL, NULL);
+    if (fd < 0)
+    {
+        return;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    for (uint32_t i = 0; i < TC_BROKER_MAX_CONNECTIONS; i++)
+    {
+        tc_broker_connection *connection = &broker->connections[i];
+        if (connection->fd < 0)
+        {
+            if (!broker->unixSocket)
+            {
+                const int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+
+            connection->fd = fd;
+            connection->connected = false;
+            connection->nextPacketId = 0;
+            connection->subscriptionCount = 0;
+            connection->inLen = 0;
+            connection->outLen = 0;
+            return;
+        }
+    }
+
+    close(fd);
+}
+
+/**
+ * @brief Broker thread: poll the listener and connections until stopped
+ */
+void *tc_broker_run(void *data)
+{
+    tc_broker *broker = (tc_broker *)data;
+    struct pollfd fds[TC_BROKER_MAX_CONNECTIONS + 2];
+
+    for (;;)
+    {
+        pthread_mutex_lock(&broker->lock);
+
+        if (broker->stopping)
+        {
+            pthread_mutex_unlock(&broker->lock);
+            break;
+        }
+
+        fds[0].fd = broker->wakeFds[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = broker->listenFd;
+        fds[1].events = POLLIN;
+
+        // Free slots have a negative fd, which poll skips
+        for (uint32_t i = 0; i < TC_BROKER_MAX_CONNECTIONS; i++)
+        {
+            const tc_broker_connection *connection = &broker->connections[i];
+            fds[2 + i].fd = connection->fd;
+            fds[2 + i].events = (short)(POLLIN | (connection->outLen > 0 ? POLLOUT : 0));
+        }
+
+        pthread_mutex_unlock(&broker->lock);
+
+        if (poll(fds, TC_BROKER_MAX_CONNECTIONS + 2, -1) < 0)
+        {
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            char wakeups[64];
+            while (read(broker->wakeFds[0], wakeups, sizeof(wakeups)) > 0)
+            {
+            }
+        }
+
+        pthread_mutex_lock(&broker->lock);
+
+        if (fds[1].revents & POLLIN)
+        {
+            tc_broker_accept(broker);
+        }
+
+        for (uint32_t i = 0; i < TC_BROKER_MAX_CONNECTIONS; i++)
+        {
+            tc_broker_connection *connection = &broker->connections[i];
+
+            // Skip slots accepted or closed since the poll
+            if (fds[2 + i].fd < 0 || fds[2 + i].fd != connection->fd)
+            {
+                continue;
+            }
+
+            if (fds[2 + i].revents & POLLOUT)
+            {
+                tc_broker_flush(connection);
+            }
+
+            if (connection->fd >= 0 && (fds[2 + i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                tc_broker_receive(broker, connection);
+            }
+        }
+
+        pthread_mutex_unlock(&broker->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Start the broker's thread
+ *
+ * @param[in]  broker  Broker with a listener.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_broker_start(tc_broker *broker)
+{
+    if (broker == NULL || broker->listenFd < 0 || broker->running)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    if (pipe(broker->wakeFds) != 0)
+    {
+        return FAILURE;
+    }
+
+    // Wakeups never block; a full pipe already has one pending
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        fcntl(broker->wakeFds[i], F_SETFD, FD_CLOEXEC);
+        fcntl(broker->wakeFds[i], F_SETFL, O_NONBLOCK);
+    }
+
+    broker->stopping = false;
+
+    if (pthread_create(&broker->thread, NULL, tc_broker_run, broker) != 0)
+    {
+        close(broker->wakeFds[0]);
+        close(broker->wakeFds[1]);
+        broker->wakeFds[0] = -1;
+        broker->wakeFds[1] = -1;
+        return FAILURE;
+    }
+
+    broker->running = true;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Stop the broker and close every connection and the listener
+ *
+ * Connected clients see the connection close. The broker can be
+ * initialized again afterwards.
+ *
+ * @param[in]  broker  Broker instance.
+ */
+void tc_broker_stop(tc_broker *broker)
+{
+    if (broker->running)
+    {
+        pthread_mutex_lock(&broker->lock);
+        broker->stopping = true;
+        pthread_mutex_unlock(&broker->lock);
+
+        tc_broker_wake(broker);
+        pthread_join(broker->thread, NULL);
+        broker->running = false;
+
+        close(broker->wakeFds[0]);
+        close(broker->wakeFds[1]);
+        broker->wakeFds[0] = -1;
+        broker->wakeFds[1] = -1;
+    }
+
+    for (uint32_t i = 0; i < TC_BROKER_MAX_CONNECTIONS; i++)
+    {
+        if (broker->connections[i].fd >= 0)
+        {
+            tc_broker_close(&broker->connections[i]);
+        }
+    }
+
+    if (broker->listenFd >= 0)
+    {
+        close(broker->listenFd);
+        broker->listenFd = -1;
+
+        if (broker->unixSocket)
+        {
+            unlink(broker->address + 5);
+        }
+    }
+
+    pthread_mutex_destroy(&broker->lock);
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_BROKER_ */
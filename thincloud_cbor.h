@@ -0,0 +1,1033 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_CBOR_
+#define THINCLOUD_EMBEDDED_C_SDK_CBOR_
+
+/*
+ * Thincloud C Embedded SDK - CBOR
+ *
+ * Bounded, allocation-free CBOR (RFC 8949) writer and zero-copy reader
+ * for the binary message format. Messages keep the shape and keys of
+ * their JSON counterparts, so either side can convert one into the
+ * other without knowing the message type. Malformed input is reported
+ * as JSON_PARSE_ERROR, like malformed JSON.
+ */
+
+#include <float.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-c/json.h>
+
+#include "aws_iot_error.h"
+
+#include "thincloud_json.h"
+
+/**
+ * Maximum nesting depth of arrays, maps and tags the reader and the
+ * json-c conversions accept
+ */
+#ifndef TC_CBOR_MAX_DEPTH
+#define TC_CBOR_MAX_DEPTH 32
+#endif
+
+#define TC_CBOR_UNSIGNED 0
+#define TC_CBOR_NEGATIVE 1
+#define TC_CBOR_BYTES 2
+#define TC_CBOR_TEXT 3
+#define TC_CBOR_ARRAY 4
+#define TC_CBOR_MAP 5
+#define TC_CBOR_TAG 6
+#define TC_CBOR_SIMPLE 7
+
+#define TC_CBOR_FALSE 0xf4
+#define TC_CBOR_TRUE 0xf5
+#define TC_CBOR_NULL 0xf6
+#define TC_CBOR_FLOAT32 0xfa
+#define TC_CBOR_FLOAT64 0xfb
+#define TC_CBOR_BREAK 0xff
+
+/**
+ * Item count of an indefinite-length array or map
+ */
+#define TC_CBOR_INDEFINITE UINT64_MAX
+
+/**
+ * @brief Streaming CBOR writer
+ *
+ * Writes definite-length items directly into a caller supplied buffer.
+ * Errors are sticky, and the writer keeps counting bytes after running
+ * out of space so the required size is known, like tc_json_writer.
+ */
+typedef struct
+{
+    char *buffer;
+    size_t capacity;
+    size_t length;
+    IoT_Error_t rc;
+} tc_cbor_writer;
+
+/**
+ * @brief Initialize a CBOR writer
+ *
+ * @param[out]  writer    Writer to initialize.
+ * @param[in]   buffer    Output buffer. May be NULL when capacity is zero to only measure.
+ * @param[in]   capacity  Size of the output buffer.
+ */
+void tc_cbor_writer_init(tc_cbor_writer *writer, char *buffer, size_t capacity)
+{
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+    writer->length = 0;
+    writer->rc = (buffer == NULL && capacity != 0) ? NULL_VALUE_ERROR : SUCCESS;
+}
+
+/**
+ * @brief Append raw bytes to the writer's buffer
+ *
+ * @param[in]  writer  CBOR writer.
+ * @param[in]  data    Bytes to append.
+ * @param[in]  len     Number of bytes to append.
+ */
+void tc_cbor_put(tc_cbor_writer *writer, const void *data, size_t len)
+{
+    if (writer->rc == SUCCESS)
+    {
+        if (len <= writer->capacity - writer->length)
+        {
+            memcpy(writer->buffer + writer->length, data, len);
+        }
+        else
+        {
+            writer->rc = MAX_SIZE_ERROR;
+        }
+    }
+
+    writer->length += len;
+}
+
+/**
+ * @brief Write an initial byte followed by a big-endian argument
+ *
+ * @param[in]  writer    CBOR writer.
+ * @param[in]  initial   Initial byte.
+ * @param[in]  argument  Argument value.
+ * @param[in]  size      Size of the argument in bytes, at most 8.
+ */
+void tc_cbor_put_head(tc_cbor_writer *writer, uint8_t initial, uint64_t argument, size_t size)
+{
+    uint8_t head[9];
+
+    head[0] = initial;
+    for (size_t i = 0; i < size; i++)
+    {
+        head[1 + i] = (uint8_t)(argument >> (8 * (size - 1 - i)));
+    }
+
+    tc_cbor_put(writer, head, size + 1);
+}
+
+/**
+ * @brief Write an item head in its shortest form
+ *
+ * @param[in]  writer    CBOR writer.
+ * @param[in]  major     Major type.
+ * @param[in]  argument  Value, length or item count.
+ */
+void tc_cbor_head(tc_cbor_writer *writer, uint8_t major, uint64_t argument)
+{
+    const uint8_t type = (uint8_t)(major << 5);
+
+    if (argument < 24)
+    {
+        tc_cbor_put_head(writer, (uint8_t)(type | argument), 0, 0);
+    }
+    else if (argument <= UINT8_MAX)
+    {
+        tc_cbor_put_head(writer, type | 24, argument, 1);
+    }
+    else if (argument <= UINT16_MAX)
+    {
+        tc_cbor_put_head(writer, type | 25, argument, 2);
+    }
+    else if (argument <= UINT32_MAX)
+    {
+        tc_cbor_put_head(writer, type | 26, argument, 4);
+    }
+    else
+    {
+        tc_cbor_put_head(writer, type | 27, argument, 8);
+    }
+}
+
+/**
+ * @brief Start a map
+ *
+ * Follow with count key and value pairs.
+ *
+ * @param[in]  writer  CBOR writer.
+ * @param[in]  count   Number of members.
+ */
+void tc_cbor_begin_map(tc_cbor_writer *writer, size_t count)
+{
+    tc_cbor_head(writer, TC_CBOR_MAP, count);
+}
+
+/**
+ * @brief Start an array
+ *
+ * Follow with count values.
+ *
+ * @param[in]  writer  CBOR writer.
+ * @param[in]  count   Number of elements.
+ */
+void tc_cbor_begin_array(tc_cbor_writer *writer, size_t count)
+{
+    tc_cbor_head(writer, TC_CBOR_ARRAY, count);
+}
+
+/**
+ * @brief Write a text string of known length
+ *
+ * @param[in]  writer  CBOR writer.
+ * @param[in]  value   UTF-8 string.
+ * @param[in]  len     Length of the string.
+ */
+void tc_cbor_string_len(tc_cbor_writer *writer, const char *value, size_t len)
+{
+    tc_cbor_head(writer, TC_CBOR_TEXT, len);
+    tc_cbor_put(writer, value, len);
+}
+
+/**
+ * @brief Write a null terminated text string
+ *
+ * @param[in]  writer  CBOR writer.
+ * @param[in]  value   UTF-8 string.
+ */
+void tc_cbor_string(tc_cbor_writer *writer, const char *value)
+{
+    tc_cbor_string_len(writer, value, strlen(value));
+}
+
+/**
+ * @brief Write an integer
+ *
+ * @param[in]  writer  CBOR writer.
+ * @param[in]  value   Integer to write.
+ */
+void tc_cbor_int(tc_cbor_writer *writer, int64_t value)
+{
+    if (value < 0)
+    {
+        tc_cbor_head(writer, TC_CBOR_NEGATIVE, (uint64_t)(-1 - value));
+    }
+    else
+    {
+        tc_cbor_head(writer, TC_CBOR_UNSIGNED, (uint64_t)value);
+    }
+}
+
+/**
+ * @brief Write a floating point number
+ *
+ * Uses single precision when it holds the value exactly.
+ *
+ * @param[in]  writer  CBOR writer.
+ * @param[in]  value   Number to write.
+ */
+void tc_cbor_double(tc_cbor_writer *writer, double value)
+{
+    if (value >= -FLT_MAX && value <= FLT_MAX && (double)(float)value == value)
+    {
+        const float single = (float)value;
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        tc_cbor_put_head(writer, TC_CBOR_FLOAT32, bits, 4);
+    }
+    else
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        tc_cbor_put_head(writer, TC_CBOR_FLOAT64, bits, 8);
+    }
+}
+
+/**
+ * @brief Write a boolean
+ *
+ * @param[in]  writer  CBOR writer.
+ * @param[in]  value   Boolean to write.
+ */
+void tc_cbor_bool(tc_cbor_writer *writer, bool value)
+{
+    tc_cbor_put_head(writer, value ? TC_CBOR_TRUE : TC_CBOR_FALSE, 0, 0);
+}
+
+/**
+ * @brief Write null
+ *
+ * @param[in]  writer  CBOR writer.
+ */
+void tc_cbor_null(tc_cbor_writer *writer)
+{
+    tc_cbor_put_head(writer, TC_CBOR_NULL, 0, 0);
+}
+
+/**
+ * @brief Write a json-c object tree at a nesting depth
+ */
+void tc_cbor_object_at(tc_cbor_writer *writer, json_object *obj, uint32_t depth)
+{
+    if (depth >= TC_CBOR_MAX_DEPTH)
+    {
+        if (writer->rc == SUCCESS)
+        {
+            writer->rc = LIMIT_EXCEEDED_ERROR;
+        }
+        return;
+    }
+
+    switch (json_object_get_type(obj))
+    {
+    case json_type_boolean:
+        tc_cbor_bool(writer, json_object_get_boolean(obj));
+        break;
+    case json_type_double:
+        tc_cbor_double(writer, json_object_get_double(obj));
+        break;
+    case json_type_int:
+        tc_cbor_int(writer, json_object_get_int64(obj));
+        break;
+    case json_type_string:
+        tc_cbor_string_len(writer, json_object_get_string(obj), (size_t)json_object_get_string_len(obj));
+        break;
+    case json_type_object:
+    {
+        tc_cbor_begin_map(writer, (size_t)json_object_object_length(obj));
+
+        struct json_object_iterator it = json_object_iter_begin(obj);
+        const struct json_object_iterator end = json_object_iter_end(obj);
+        while (!json_object_iter_equal(&it, &end))
+        {
+            tc_cbor_string(writer, json_object_iter_peek_name(&it));
+            tc_cbor_object_at(writer, json_object_iter_peek_value(&it), depth + 1);
+            json_object_iter_next(&it);
+        }
+        break;
+    }
+    case json_type_array:
+    {
+        const size_t len = json_object_array_length(obj);
+        tc_cbor_begin_array(writer, len);
+        for (size_t i = 0; i < len; i++)
+        {
+            tc_cbor_object_at(writer, json_object_array_get_idx(obj, i), depth + 1);
+        }
+        break;
+    }
+    default:
+        tc_cbor_null(writer);
+        break;
+    }
+}
+
+/**
+ * @brief Write a json-c object tree
+ *
+ * Objects become maps with text keys, and numbers keep the json-c type
+ * they were created with.
+ *
+ * @param[in]  writer  CBOR writer.
+ * @param[in]  obj     Object to write. NULL is written as null.
+ */
+void tc_cbor_object(tc_cbor_writer *writer, json_object *obj)
+{
+    tc_cbor_object_at(writer, obj, 0);
+}
+
+/**
+ * @brief Finish writing
+ *
+ * @param[in]  writer  CBOR writer.
+ *
+ * @return Zero on success, MAX_SIZE_ERROR if the buffer was too small,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_cbor_writer_finish(tc_cbor_writer *writer)
+{
+    return writer->rc;
+}
+
+/**
+ * @brief Zero-copy CBOR reader
+ *
+ * Reads a CBOR item in place. Strings are returned as slices of their
+ * contents, other values as slices of their encoded item. Tags are
+ * skipped, and indefinite-length arrays and maps are accepted;
+ * indefinite-length strings are not.
+ */
+typedef struct
+{
+    const uint8_t *cursor;
+    const uint8_t *end;
+} tc_cbor_reader;
+
+/**
+ * @brief Initialize a CBOR reader
+ *
+ * @param[out]  reader  Reader to initialize.
+ * @param[in]   data    CBOR data to read.
+ * @param[in]   len     Length of the data.
+ */
+void tc_cbor_reader_init(tc_cbor_reader *reader, const char *data, size_t len)
+{
+    reader->cursor = (const uint8_t *)data;
+    reader->end = reader->cursor + len;
+}
+
+/**
+ * @brief Read an item head
+ *
+ * @param[in]   reader    CBOR reader.
+ * @param[out]  major     Major type.
+ * @param[out]  info      Additional information bits.
+ * @param[out]  argument  Value, length or item count. TC_CBOR_INDEFINITE for
+ *                        indefinite-length items and break.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_cbor_read_head(tc_cbor_reader *reader, uint8_t *major, uint8_t *info, uint64_t *argument)
+{
+    if (reader->cursor >= reader->end)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    const uint8_t initial = *reader->cursor++;
+    *major = initial >> 5;
+    *info = initial & 0x1f;
+
+    if (*info < 24)
+    {
+        *argument = *info;
+        return SUCCESS;
+    }
+
+    if (*info == 31)
+    {
+        // Indefinite lengths only apply to strings, arrays and maps, and break
+        *argument = TC_CBOR_INDEFINITE;
+        return (*major >= TC_CBOR_BYTES && *major <= TC_CBOR_MAP) || *major == TC_CBOR_SIMPLE ? SUCCESS : JSON_PARSE_ERROR;
+    }
+
+    if (*info > 27)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    const size_t size = (size_t)1 << (*info - 24);
+    if ((size_t)(reader->end - reader->cursor) < size)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    *argument = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        *argument = (*argument << 8) | *reader->cursor++;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Check that a string or container of the given length can fit
+ *
+ * Every element takes at least a byte, so larger counts are malformed
+ * and rejecting them early keeps counts from overflowing.
+ */
+bool tc_cbor_fits(const tc_cbor_reader *reader, uint64_t len)
+{
+    return len <= (uint64_t)(reader->end - reader->cursor);
+}
+
+/**
+ * @brief Check for and consume a break
+ *
+ * @param[in]   reader   CBOR reader inside an indefinite-length item.
+ * @param[out]  isBreak  Set if the next byte was a break.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR at the end of the data
+ */
+IoT_Error_t tc_cbor_read_break(tc_cbor_reader *reader, bool *isBreak)
+{
+    if (reader->cursor >= reader->end)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    *isBreak = *reader->cursor == TC_CBOR_BREAK;
+    if (*isBreak)
+    {
+        reader->cursor++;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Skip over a complete CBOR item
+ *
+ * The item is validated while it is skipped.
+ *
+ * @param[in]  reader  CBOR reader.
+ * @param[in]  depth   Current nesting depth.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_cbor_skip_value(tc_cbor_reader *reader, uint32_t depth)
+{
+    uint8_t major;
+    uint8_t info;
+    uint64_t argument;
+
+    IoT_Error_t rc = tc_cbor_read_head(reader, &major, &info, &argument);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    switch (major)
+    {
+    case TC_CBOR_BYTES:
+    case TC_CBOR_TEXT:
+        if (argument == TC_CBOR_INDEFINITE || !tc_cbor_fits(reader, argument))
+        {
+            return JSON_PARSE_ERROR;
+        }
+        reader->cursor += argument;
+        return SUCCESS;
+    case TC_CBOR_ARRAY:
+    case TC_CBOR_MAP:
+    {
+        if (depth + 1 >= TC_CBOR_MAX_DEPTH)
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        const uint32_t itemsPerEntry = major == TC_CBOR_MAP ? 2 : 1;
+
+        if (argument == TC_CBOR_INDEFINITE)
+        {
+            for (;;)
+            {
+                bool isBreak;
+                rc = tc_cbor_read_break(reader, &isBreak);
+                if (rc != SUCCESS || isBreak)
+                {
+                    return rc;
+                }
+
+                for (uint32_t i = 0; i < itemsPerEntry && rc == SUCCESS; i++)
+                {
+                    rc = tc_cbor_skip_value(reader, depth + 1);
+                }
+                if (rc != SUCCESS)
+                {
+                    return rc;
+                }
+            }
+        }
+
+        if (!tc_cbor_fits(reader, argument))
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        for (uint64_t i = 0; i < argument * itemsPerEntry; i++)
+        {
+            rc = tc_cbor_skip_value(reader, depth + 1);
+            if (rc != SUCCESS)
+            {
+                return rc;
+            }
+        }
+        return SUCCESS;
+    }
+    case TC_CBOR_TAG:
+        if (depth + 1 >= TC_CBOR_MAX_DEPTH)
+        {
+            return JSON_PARSE_ERROR;
+        }
+        return tc_cbor_skip_value(reader, depth + 1);
+    case TC_CBOR_SIMPLE:
+        // A break outside of an indefinite-length item
+        return info == 31 ? JSON_PARSE_ERROR : SUCCESS;
+    default:
+        return SUCCESS;
+    }
+}
+
+/**
+ * @brief Read the next value
+ *
+ * Reports the JSON type the item maps to. Text and byte strings are
+ * returned as their contents; every other item as its encoded span, so
+ * containers can be read later with a new reader and numbers converted
+ * with tc_cbor_slice_to_int.
+ *
+ * @param[in]   reader  CBOR reader.
+ * @param[out]  type    JSON type of the value.
+ * @param[out]  value   String contents or item span.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_cbor_read_value(tc_cbor_reader *reader, tc_json_type *type, tc_slice *value)
+{
+    uint8_t major;
+    uint8_t info;
+    uint64_t argument;
+    const uint8_t *start;
+    IoT_Error_t rc;
+    uint32_t tags = 0;
+
+    do
+    {
+        start = reader->cursor;
+        rc = tc_cbor_read_head(reader, &major, &info, &argument);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+    } while (major == TC_CBOR_TAG && ++tags < TC_CBOR_MAX_DEPTH);
+
+    switch (major)
+    {
+    case TC_CBOR_UNSIGNED:
+    case TC_CBOR_NEGATIVE:
+        *type = TC_JSON_NUMBER;
+        break;
+    case TC_CBOR_BYTES:
+    case TC_CBOR_TEXT:
+        if (argument == TC_CBOR_INDEFINITE || !tc_cbor_fits(reader, argument))
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        *type = TC_JSON_STRING;
+        value->data = (const char *)reader->cursor;
+        value->len = (size_t)argument;
+        reader->cursor += argument;
+        return SUCCESS;
+    case TC_CBOR_ARRAY:
+    case TC_CBOR_MAP:
+        *type = major == TC_CBOR_MAP ? TC_JSON_OBJECT : TC_JSON_ARRAY;
+        reader->cursor = start;
+        rc = tc_cbor_skip_value(reader, tags);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+        break;
+    case TC_CBOR_SIMPLE:
+        if (info == 31)
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        if (*start == TC_CBOR_FALSE)
+        {
+            *type = TC_JSON_FALSE;
+        }
+        else if (*start == TC_CBOR_TRUE)
+        {
+            *type = TC_JSON_TRUE;
+        }
+        else if (info >= 25 && info <= 27)
+        {
+            *type = TC_JSON_NUMBER;
+        }
+        else
+        {
+            // null, undefined and unassigned simple values
+            *type = TC_JSON_NULL;
+        }
+        break;
+    default:
+        // Too many nested tags
+        return JSON_PARSE_ERROR;
+    }
+
+    value->data = (const char *)start;
+    value->len = (size_t)(reader->cursor - start);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Enter a map
+ *
+ * @param[in]   reader     CBOR reader positioned on a map.
+ * @param[out]  remaining  Number of members, TC_CBOR_INDEFINITE for an
+ *                         indefinite-length map. Pass to tc_cbor_map_next.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_cbor_map_begin(tc_cbor_reader *reader, uint64_t *remaining)
+{
+    uint8_t major;
+    uint8_t info;
+    IoT_Error_t rc;
+    uint32_t tags = 0;
+
+    do
+    {
+        rc = tc_cbor_read_head(reader, &major, &info, remaining);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+    } while (major == TC_CBOR_TAG && ++tags < TC_CBOR_MAX_DEPTH);
+
+    if (major != TC_CBOR_MAP || (*remaining != TC_CBOR_INDEFINITE && !tc_cbor_fits(reader, *remaining)))
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Advance to the next map member
+ *
+ * On success with hasMember set, the reader is positioned on the member's
+ * value, which must be consumed with tc_cbor_read_value before calling
+ * again. When hasMember is false the map has been left.
+ *
+ * @param[in]      reader     CBOR reader inside a map.
+ * @param[in,out]  remaining  Members left, as set by tc_cbor_map_begin.
+ * @param[out]     key        Member name.
+ * @param[out]     hasMember  Set if a member was read.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise, including for
+ *         keys that are not strings
+ */
+IoT_Error_t tc_cbor_map_next(tc_cbor_reader *reader, uint64_t *remaining, tc_slice *key, bool *hasMember)
+{
+    *hasMember = false;
+
+    if (*remaining == TC_CBOR_INDEFINITE)
+    {
+        bool isBreak;
+        const IoT_Error_t rc = tc_cbor_read_break(reader, &isBreak);
+        if (rc != SUCCESS || isBreak)
+        {
+            return rc;
+        }
+    }
+    else if (*remaining == 0)
+    {
+        return SUCCESS;
+    }
+    else
+    {
+        (*remaining)--;
+    }
+
+    tc_json_type type;
+    const IoT_Error_t rc = tc_cbor_read_value(reader, &type, key);
+    if (rc != SUCCESS || type != TC_JSON_STRING)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    *hasMember = true;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Check that nothing is left
+ *
+ * @param[in]  reader  CBOR reader.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_cbor_reader_finish(tc_cbor_reader *reader)
+{
+    return reader->cursor == reader->end ? SUCCESS : JSON_PARSE_ERROR;
+}
+
+/**
+ * @brief Convert an integer item
+ *
+ * @param[in]   value   Encoded item, as returned by tc_cbor_read_value.
+ * @param[out]  number  Integer value.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR if the item is not an integer
+ *         or does not fit
+ */
+IoT_Error_t tc_cbor_slice_to_int(tc_slice value, int64_t *number)
+{
+    tc_cbor_reader reader;
+    tc_cbor_reader_init(&reader, value.data, value.len);
+
+    uint8_t major;
+    uint8_t info;
+    uint64_t argument;
+
+    const IoT_Error_t rc = tc_cbor_read_head(&reader, &major, &info, &argument);
+    if (rc != SUCCESS || (major != TC_CBOR_UNSIGNED && major != TC_CBOR_NEGATIVE) || argument > INT64_MAX)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    *number = major == TC_CBOR_UNSIGNED ? (int64_t)argument : -1 - (int64_t)argument;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Widen a half precision float to single precision bits
+ */
+uint32_t tc_cbor_half_to_single(uint16_t half)
+{
+    const uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    if (exponent == 0x1f)
+    {
+        return sign | 0x7f800000 | (mantissa << 13);
+    }
+
+    if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            return sign;
+        }
+
+        // Normalize a subnormal
+        exponent = 127 - 15 + 1;
+        while ((mantissa & 0x400) == 0)
+        {
+            mantissa <<= 1;
+            exponent--;
+        }
+
+        return sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    return sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+}
+
+/**
+ * @brief Build a json-c object from the next item at a nesting depth
+ */
+IoT_Error_t tc_cbor_read_object(tc_cbor_reader *reader, uint32_t depth, json_object **obj)
+{
+    *obj = NULL;
+
+    if (depth >= TC_CBOR_MAX_DEPTH)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    uint8_t major;
+    uint8_t info;
+    uint64_t argument;
+
+    IoT_Error_t rc = tc_cbor_read_head(reader, &major, &info, &argument);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    switch (major)
+    {
+    case TC_CBOR_UNSIGNED:
+        *obj = argument > INT64_MAX ? json_object_new_double((double)argument) : json_object_new_int64((int64_t)argument);
+        break;
+    case TC_CBOR_NEGATIVE:
+        *obj = argument > INT64_MAX ? json_object_new_double(-1 - (double)argument) : json_object_new_int64(-1 - (int64_t)argument);
+        break;
+    case TC_CBOR_BYTES:
+    case TC_CBOR_TEXT:
+        if (argument == TC_CBOR_INDEFINITE || !tc_cbor_fits(reader, argument) || argument > INT32_MAX)
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        *obj = json_object_new_string_len((const char *)reader->cursor, (int)argument);
+        reader->cursor += argument;
+        break;
+    case TC_CBOR_ARRAY:
+    case TC_CBOR_MAP:
+    {
+        if (argument != TC_CBOR_INDEFINITE && !tc_cbor_fits(reader, argument))
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        *obj = major == TC_CBOR_MAP ? json_object_new_object() : json_object_new_array();
+        if (*obj == NULL)
+        {
+            return FAILURE;
+        }
+
+        for (uint64_t i = 0; rc == SUCCESS; i++)
+        {
+            if (argument == TC_CBOR_INDEFINITE)
+            {
+                bool isBreak;
+                rc = tc_cbor_read_break(reader, &isBreak);
+                if (rc != SUCCESS || isBreak)
+                {
+                    break;
+                }
+            }
+            else if (i == argument)
+            {
+                break;
+            }
+
+            if (major == TC_CBOR_ARRAY)
+            {
+                json_object *element = NULL;
+                rc = tc_cbor_read_object(reader, depth + 1, &element);
+                if (rc == SUCCESS)
+                {
+                    json_object_array_add(*obj, element);
+                }
+                continue;
+            }
+
+            tc_json_type type;
+            tc_slice key;
+            rc = tc_cbor_read_value(reader, &type, &key);
+            if (rc != SUCCESS || type != TC_JSON_STRING)
+            {
+                rc = JSON_PARSE_ERROR;
+                break;
+            }
+
+            // json-c wants null terminated keys
+            char local[64];
+            char *name = key.len < sizeof(local) ? local : (char *)malloc(key.len + 1);
+            if (name == NULL)
+            {
+                rc = FAILURE;
+                break;
+            }
+            memcpy(name, key.data, key.len);
+            name[key.len] = '\0';
+
+            json_object *member = NULL;
+            rc = tc_cbor_read_object(reader, depth + 1, &member);
+            if (rc == SUCCESS)
+            {
+                json_object_object_add(*obj, name, member);
+            }
+
+            if (name != local)
+            {
+                free(name);
+            }
+        }
+
+        if (rc != SUCCESS)
+        {
+            json_object_put(*obj);
+            *obj = NULL;
+        }
+        return rc;
+    }
+    case TC_CBOR_TAG:
+        return tc_cbor_read_object(reader, depth + 1, obj);
+    default:
+        if (info == 31)
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        if (info == 20 || info == 21)
+        {
+            *obj = json_object_new_boolean(info == 21);
+        }
+        else if (info == 25)
+        {
+            const uint32_t bits = tc_cbor_half_to_single((uint16_t)argument);
+            float single;
+            memcpy(&single, &bits, sizeof(single));
+            *obj = json_object_new_double(single);
+        }
+        else if (info == 26)
+        {
+            const uint32_t bits = (uint32_t)argument;
+            float single;
+            memcpy(&single, &bits, sizeof(single));
+            *obj = json_object_new_double(single);
+        }
+        else if (info == 27)
+        {
+            double value;
+            memcpy(&value, &argument, sizeof(value));
+            *obj = json_object_new_double(value);
+        }
+        // null, undefined and unassigned simple values stay NULL
+        return SUCCESS;
+    }
+
+    return *obj == NULL ? FAILURE : SUCCESS;
+}
+
+/**
+ * @brief Parse a CBOR item into a json-c object
+ *
+ * Maps become objects, byte strings become strings, and tags are
+ * dropped. null yields a NULL object.
+ *
+ * @param[in]   value  Encoded item, as returned by tc_cbor_read_value.
+ * @param[out]  obj    Parsed object. The caller owns the result.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_cbor_parse_slice(tc_slice value, json_object **obj)
+{
+    tc_cbor_reader reader;
+    tc_cbor_reader_init(&reader, value.data, value.len);
+
+    IoT_Error_t rc = tc_cbor_read_object(&reader, 0, obj);
+    if (rc == SUCCESS)
+    {
+        rc = tc_cbor_reader_finish(&reader);
+    }
+
+    if (rc != SUCCESS)
+    {
+        json_object_put(*obj);
+        *obj = NULL;
+    }
+
+    return rc;
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_CBOR_ */
@@ -0,0 +1,533 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_INFLIGHT_
+#define THINCLOUD_EMBEDDED_C_SDK_INFLIGHT_
+
+/*
+ * Thincloud C Embedded SDK - QoS1 in-flight window
+ *
+ * aws_iot_mqtt_publish blocks on every QoS1 message until its PUBACK
+ * arrives. An in-flight window instead writes QoS1 PUBLISH packets
+ * directly and keeps up to a configurable number of them outstanding.
+ * PUBACKs are picked out of the inbound stream by wrapping the client's
+ * network read, so they are handled by the ordinary yield loop.
+ *
+ * Packet IDs encode the window slot in their low bits, which makes the
+ * packet-ID table a plain array. Don't mix a window with the SDK's own
+ * QoS1 publish on the same client: that waits for any PUBACK and could
+ * consume one meant for the window.
+ *
+ * The window lives with its client in a tc_inflight_client, so the
+ * wrapped read finds it from the network stack it is handed; tc_client
+ * overlays one on its MQTT client for the same reason. A CONNACK
+ * without a session, which every clean-session connect and reconnect
+ * gets, fails whatever was still outstanding on the old connection.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_mqtt_client_interface.h"
+
+#include "thincloud_mqtt.h"
+#include "thincloud_timer.h"
+
+/**
+ * Bits of a packet ID that select the window slot. At most 6, so the
+ * free slots fit a 64-bit mask.
+ */
+#ifndef TC_INFLIGHT_SLOT_BITS
+#define TC_INFLIGHT_SLOT_BITS 6
+#endif
+
+#if TC_INFLIGHT_SLOT_BITS < 1 || TC_INFLIGHT_SLOT_BITS > 6
+#error "TC_INFLIGHT_SLOT_BITS must be between 1 and 6"
+#endif
+
+#define TC_INFLIGHT_MAX_WINDOW (1 << TC_INFLIGHT_SLOT_BITS)
+
+typedef struct tc_inflight tc_inflight;
+
+/**
+ * @brief QoS1 publish completion callback
+ *
+ * Invoked from aws_iot_mqtt_yield when the PUBACK arrives, from tc_yield
+ * when the message runs out of retransmits, or from aws_iot_mqtt_connect
+ * when a clean session discards it.
+ *
+ * @param[in]  client    AWS IoT MQTT Client instance.
+ * @param[in]  rc        SUCCESS once acknowledged, MQTT_REQUEST_TIMEOUT_ERROR when out of
+ *                       retransmits, NETWORK_DISCONNECTED_ERROR when its session ended.
+ * @param[in]  packetId  Packet ID of the message.
+ * @param[in]  userData  Data blob passed to tc_inflight_publish.
+ */
+typedef void (*tc_publish_callback)(AWS_IoT_Client *client, IoT_Error_t rc, uint16_t packetId, void *userData);
+
+/**
+ * @brief Outstanding QoS1 message
+ */
+typedef struct
+{
+    uint16_t packetId;
+    uint16_t generation;
+    size_t packetLen;
+    uint8_t retriesLeft;
+    tc_timer timer;
+    tc_inflight *window;
+    tc_publish_callback callback;
+    void *userData;
+} tc_inflight_slot;
+
+/**
+ * @brief QoS1 in-flight window
+ */
+struct tc_inflight
+{
+    tc_inflight_slot slots[TC_INFLIGHT_MAX_WINDOW];
+    uint64_t freeSlots;
+    uint16_t window;
+    uint16_t count;
+    unsigned char *buffer;
+    size_t slotSize;
+    tc_timer_wheel *timers;
+    uint32_t retransmitMs;
+    uint8_t maxRetries;
+    AWS_IoT_Client *client;
+    IoT_Error_t (*read)(Network *, unsigned char *, size_t, Timer *, size_t *);
+
+    // Position in the inbound packet stream
+    uint8_t stage;
+    unsigned char type;
+    size_t remaining;
+    size_t multiplier;
+    size_t bodyRead;
+    unsigned char body[2];
+};
+
+/**
+ * @brief MQTT client that can carry a QoS1 in-flight window
+ *
+ * Declare clients that use a window as this type and pass &client.mqtt
+ * wherever an AWS_IoT_Client is expected.
+ */
+typedef struct
+{
+    AWS_IoT_Client mqtt;
+    tc_inflight *inflight;
+} tc_inflight_client;
+
+typedef enum
+{
+    TC_INFLIGHT_STAGE_TYPE = 0,
+    TC_INFLIGHT_STAGE_LENGTH,
+    TC_INFLIGHT_STAGE_BODY
+} tc_inflight_stage;
+
+/**
+ * @brief Initialize a QoS1 in-flight window
+ *
+ * buffer is split evenly between the slots of the window; each slot holds
+ * one encoded PUBLISH packet for retransmission.
+ *
+ * @param[out]  inflight      Window to initialize.
+ * @param[in]   buffer        Buffer for the outstanding packets.
+ * @param[in]   bufferLen     Size of buffer.
+ * @param[in]   window        Maximum number of outstanding messages, up to TC_INFLIGHT_MAX_WINDOW.
+ * @param[in]   timers        Optional. Timer wheel driving retransmits, usually the one in the
+ *                            client's tc_context. Without one, messages wait for their PUBACK forever.
+ * @param[in]   retransmitMs  Time to wait for a PUBACK before sending the message again.
+ * @param[in]   maxRetries    Number of retransmits before the message fails.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_inflight_init(tc_inflight *inflight, unsigned char *buffer, size_t bufferLen, uint16_t window, tc_timer_wheel *timers, uint32_t retransmitMs, uint8_t maxRetries)
+{
+    if (inflight == NULL || buffer == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    if (window == 0 || window > TC_INFLIGHT_MAX_WINDOW || bufferLen / window == 0)
+    {
+        return MAX_SIZE_ERROR;
+    }
+
+    memset(inflight, 0, sizeof(*inflight));
+
+    inflight->buffer = buffer;
+    inflight->slotSize = bufferLen / window;
+    inflight->window = window;
+    inflight->freeSlots = window == 64 ? UINT64_MAX : ((uint64_t)1 << window) - 1;
+    inflight->timers = timers;
+    inflight->retransmitMs = retransmitMs;
+    inflight->maxRetries = maxRetries;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Number of unacknowledged messages
+ */
+uint16_t tc_inflight_count(const tc_inflight *inflight)
+{
+    return inflight->count;
+}
+
+/**
+ * @brief Release a slot and report its outcome
+ */
+void tc_inflight_complete(tc_inflight *inflight, tc_inflight_slot *slot, IoT_Error_t rc)
+{
+    const uint32_t index = (uint32_t)(slot - inflight->slots);
+    const uint16_t packetId = slot->packetId;
+    const tc_publish_callback callback = slot->callback;
+    void *userData = slot->userData;
+
+    if (inflight->timers != NULL)
+    {
+        tc_timer_cancel(inflight->timers, &slot->timer);
+    }
+
+    slot->packetId = 0;
+    slot->callback = NULL;
+    inflight->freeSlots |= (uint64_t)1 << index;
+    inflight->count--;
+
+    if (callback != NULL)
+    {
+        callback(inflight->client, rc, packetId, userData);
+    }
+}
+
+/**
+ * @brief Acknowledge a message
+ *
+ * @param[in]  inflight  QoS1 in-flight window.
+ * @param[in]  packetId  Packet ID from a PUBACK.
+ *
+ * @return true if the packet ID was outstanding
+ */
+bool tc_inflight_ack(tc_inflight *inflight, uint16_t packetId)
+{
+    tc_inflight_slot *slot = &inflight->slots[packetId & (TC_INFLIGHT_MAX_WINDOW - 1)];
+    if (packetId == 0 || slot->packetId != packetId)
+    {
+        return false;
+    }
+
+    tc_inflight_complete(inflight, slot, SUCCESS);
+
+    return true;
+}
+
+/**
+ * @brief Fail every outstanding message
+ *
+ * @param[in]  inflight  QoS1 in-flight window.
+ * @param[in]  rc        Result passed to each message's callback.
+ */
+void tc_inflight_clear(tc_inflight *inflight, IoT_Error_t rc)
+{
+    for (int i = 0; i < TC_INFLIGHT_MAX_WINDOW; i++)
+    {
+        if (inflight->slots[i].packetId != 0)
+        {
+            tc_inflight_complete(inflight, &inflight->slots[i], rc);
+        }
+    }
+}
+
+/**
+ * @brief Feed bytes read from the network to the PUBACK scanner
+ *
+ * Tracks MQTT framing across reads of any size, so the stream can be
+ * chunked however the client reads it. Besides PUBACKs, it watches for
+ * an accepted CONNACK without a session and clears the window.
+ *
+ * @param[in]  inflight  QoS1 in-flight window.
+ * @param[in]  data      Bytes read from the network.
+ * @param[in]  len       Number of bytes.
+ */
+void tc_inflight_scan(tc_inflight *inflight, const unsigned char *data, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len)
+    {
+        if (inflight->stage == TC_INFLIGHT_STAGE_TYPE)
+        {
+            inflight->type = data[i++];
+            inflight->remaining = 0;
+            inflight->multiplier = 1;
+            inflight->stage = TC_INFLIGHT_STAGE_LENGTH;
+        }
+        else if (inflight->stage == TC_INFLIGHT_STAGE_LENGTH)
+        {
+            const unsigned char byte = data[i++];
+            inflight->remaining += (byte & 0x7F) * inflight->multiplier;
+            inflight->multiplier *= 128;
+
+            if ((byte & 0x80) == 0)
+            {
+                inflight->bodyRead = 0;
+                inflight->stage = inflight->remaining == 0 ? TC_INFLIGHT_STAGE_TYPE : TC_INFLIGHT_STAGE_BODY;
+            }
+            else if (inflight->multiplier > (size_t)128 * 128 * 128)
+            {
+                inflight->stage = TC_INFLIGHT_STAGE_TYPE;
+            }
+        }
+        else
+        {
+            const bool puback = (inflight->type & 0xF0) == TC_MQTT_PUBACK;
+            const bool connack = (inflight->type & 0xF0) == TC_MQTT_CONNACK;
+            if ((puback || connack) && inflight->bodyRead < 2)
+            {
+                inflight->body[inflight->bodyRead] = data[i];
+            }
+
+            // Skip the rest of other packets' bodies in one step
+            size_t step = inflight->remaining - inflight->bodyRead;
+            if (step > len - i)
+            {
+                step = len - i;
+            }
+            if (puback || connack)
+            {
+                step = 1;
+            }
+
+            i += step;
+            inflight->bodyRead += step;
+
+            if (inflight->bodyRead == inflight->remaining)
+            {
+                inflight->stage = TC_INFLIGHT_STAGE_TYPE;
+                if (puback && inflight->remaining >= 2)
+                {
+                    tc_inflight_ack(inflight, (uint16_t)(inflight->body[0] << 8 | inflight->body[1]));
+                }
+                else if (connack && inflight->remaining >= 2 && (inflight->body[0] & 0x01) == 0 && inflight->body[1] == 0)
+                {
+                    // The broker kept no session, so no PUBACK will come for the old connection's messages
+                    tc_inflight_clear(inflight, NETWORK_DISCONNECTED_ERROR);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Network read that passes inbound bytes to the PUBACK scanner
+ *
+ * Installed as the client's networkStack.read by tc_inflight_attach.
+ */
+IoT_Error_t tc_inflight_read(Network *network, unsigned char *buffer, size_t len, Timer *timer, size_t *read)
+{
+    tc_inflight_client *client = (tc_inflight_client *)(void *)((char *)network - offsetof(tc_inflight_client, mqtt.networkStack));
+    tc_inflight *inflight = client->inflight;
+
+    if (inflight == NULL)
+    {
+        return NETWORK_SSL_READ_ERROR;
+    }
+
+    const IoT_Error_t rc = inflight->read(network, buffer, len, timer, read);
+    if (rc == SUCCESS)
+    {
+        tc_inflight_scan(inflight, buffer, *read);
+    }
+    else if (rc != NETWORK_SSL_NOTHING_TO_READ)
+    {
+        // The client drops the connection on a failed read; start over with
+        // the next one
+        inflight->stage = TC_INFLIGHT_STAGE_TYPE;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Attach a window to a client
+ *
+ * Wraps the client's network read. Call after aws_iot_mqtt_init, which
+ * sets up the network stack.
+ *
+ * @param[in]  inflight  QoS1 in-flight window.
+ * @param[in]  client    Client to carry the window.
+ *
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the client already
+ *         carries a window, negative value otherwise
+ */
+IoT_Error_t tc_inflight_attach(tc_inflight *inflight, tc_inflight_client *client)
+{
+    if (inflight == NULL || client == NULL || client->mqtt.networkStack.read == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    if (client->inflight != NULL)
+    {
+        return LIMIT_EXCEEDED_ERROR;
+    }
+
+    inflight->client = &client->mqtt;
+    inflight->read = client->mqtt.networkStack.read;
+    inflight->stage = TC_INFLIGHT_STAGE_TYPE;
+    client->mqtt.networkStack.read = tc_inflight_read;
+    client->inflight = inflight;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Detach a window from its client
+ *
+ * Restores the client's network read. Outstanding messages are dropped
+ * without their callbacks.
+ */
+void tc_inflight_detach(tc_inflight *inflight)
+{
+    if (inflight->client != NULL)
+    {
+        tc_inflight_client *client = (tc_inflight_client *)(void *)((char *)inflight->client - offsetof(tc_inflight_client, mqtt));
+        client->mqtt.networkStack.read = inflight->read;
+        client->inflight = NULL;
+        inflight->client = NULL;
+    }
+
+    for (int i = 0; i < TC_INFLIGHT_MAX_WINDOW; i++)
+    {
+        if (inflight->slots[i].packetId != 0 && inflight->timers != NULL)
+        {
+            tc_timer_cancel(inflight->timers, &inflight->slots[i].timer);
+        }
+        inflight->slots[i].packetId = 0;
+    }
+
+    inflight->freeSlots = inflight->window == 64 ? UINT64_MAX : ((uint64_t)1 << inflight->window) - 1;
+    inflight->count = 0;
+}
+
+/**
+ * @brief Retransmit a message whose PUBACK is late
+ *
+ * Timer callback. Sends the packet again with DUP set until the slot runs
+ * out of retries, then fails it with MQTT_REQUEST_TIMEOUT_ERROR.
+ */
+void tc_inflight_retransmit(tc_timer *timer, void *data)
+{
+    tc_inflight_slot *slot = (tc_inflight_slot *)data;
+    tc_inflight *inflight = slot->window;
+
+    (void)timer;
+
+    if (slot->retriesLeft == 0)
+    {
+        tc_inflight_complete(inflight, slot, MQTT_REQUEST_TIMEOUT_ERROR);
+        return;
+    }
+
+    slot->retriesLeft--;
+    tc_timer_schedule(inflight->timers, &slot->timer, inflight->timers->now + inflight->retransmitMs);
+
+    unsigned char *packet = inflight->buffer + (size_t)(slot - inflight->slots) * inflight->slotSize;
+    packet[0] |= TC_MQTT_PUBLISH_DUP;
+
+    // A failed write is retried on the next timeout
+    tc_mqtt_write(inflight->client, packet, slot->packetLen);
+}
+
+/**
+ * @brief Publish a QoS1 message without waiting for its PUBACK
+ *
+ * @param[in]   inflight    QoS1 in-flight window attached to a client.
+ * @param[in]   topic       Topic to publish to.
+ * @param[in]   topicLen    Length of the topic.
+ * @param[in]   payload     Message payload.
+ * @param[in]   payloadLen  Length of the payload.
+ * @param[in]   callback    Optional. Called once the message is acknowledged or fails.
+ * @param[in]   userData    Data blob to be passed to the callback on invoke.
+ * @param[out]  packetId    Optional. Packet ID of the message.
+ *
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the window is full,
+ *         MQTT_TX_BUFFER_TOO_SHORT_ERROR if the message does not fit a slot,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_inflight_publish(tc_inflight *inflight, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen, tc_publish_callback callback, void *userData, uint16_t *packetId)
+{
+    if (inflight == NULL || inflight->client == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    if (inflight->freeSlots == 0)
+    {
+        return LIMIT_EXCEEDED_ERROR;
+    }
+
+    const uint32_t index = (uint32_t)__builtin_ctzll(inflight->freeSlots);
+    tc_inflight_slot *slot = &inflight->slots[index];
+
+    // The low bits of a packet ID select the slot, the rest count its reuses
+    uint16_t id = 0;
+    do
+    {
+        slot->generation = (uint16_t)((slot->generation + 1) & (0xFFFF >> TC_INFLIGHT_SLOT_BITS));
+        id = (uint16_t)(slot->generation << TC_INFLIGHT_SLOT_BITS | index);
+    } while (id == 0);
+
+    unsigned char *packet = inflight->buffer + (size_t)index * inflight->slotSize;
+
+    IoT_Error_t rc = tc_mqtt_serialize_publish(packet, inflight->slotSize, topic, topicLen, QOS1, false, id, payload, payloadLen, &slot->packetLen);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    rc = tc_mqtt_write(inflight->client, packet, slot->packetLen);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    slot->packetId = id;
+    slot->retriesLeft = inflight->maxRetries;
+    slot->window = inflight;
+    slot->callback = callback;
+    slot->userData = userData;
+    inflight->freeSlots &= ~((uint64_t)1 << index);
+    inflight->count++;
+
+    if (inflight->timers != NULL)
+    {
+        tc_timer_init(&slot->timer, tc_inflight_retransmit, slot);
+        tc_timer_schedule(inflight->timers, &slot->timer, tc_clock_ms() + inflight->retransmitMs);
+    }
+
+    if (packetId != NULL)
+    {
+        *packetId = id;
+    }
+
+    return SUCCESS;
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_INFLIGHT_ */
@@ -0,0 +1,1705 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_JSON_
+#define THINCLOUD_EMBEDDED_C_SDK_JSON_
+
+/*
+ * Thincloud C Embedded SDK - JSON
+ *
+ * Bounded, allocation-free streaming JSON writer used by the
+ * request and response marshallers, and a zero-copy pull tokenizer
+ * used by the unmarshallers.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-c/json.h>
+
+#include "aws_iot_error.h"
+
+#include "thincloud_scan.h"
+
+/**
+ * Maximum nesting depth of objects and arrays a writer can track
+ */
+#ifndef TC_JSON_MAX_DEPTH
+#define TC_JSON_MAX_DEPTH 32
+#endif
+
+/**
+ * @brief Streaming JSON writer
+ *
+ * Writes JSON text directly into a caller supplied buffer. Errors are
+ * sticky: once a call fails every following call is a no-op and the
+ * error is reported by tc_json_writer_finish. The writer keeps counting
+ * bytes after running out of space so the required size is known.
+ */
+typedef struct
+{
+    char *buffer;
+    size_t capacity;
+    size_t length;
+    uint32_t depth;
+    uint64_t hasValue;
+    bool expectValue;
+    IoT_Error_t rc;
+} tc_json_writer;
+
+/**
+ * @brief Initialize a JSON writer
+ *
+ * @param[out]  writer    Writer to initialize.
+ * @param[in]   buffer    Output buffer. May be NULL when capacity is zero to only measure.
+ * @param[in]   capacity  Size of the output buffer, including room for the null character.
+ */
+void tc_json_writer_init(tc_json_writer *writer, char *buffer, size_t capacity)
+{
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+    writer->length = 0;
+    writer->depth = 0;
+    writer->hasValue = 0;
+    writer->expectValue = false;
+    writer->rc = (buffer == NULL && capacity != 0) ? NULL_VALUE_ERROR : SUCCESS;
+}
+
+/**
+ * @brief Append raw bytes to the writer's buffer
+ *
+ * @param[in]  writer  JSON writer.
+ * @param[in]  data    Bytes to append.
+ * @param[in]  len     Number of bytes to append.
+ */
+void tc_json_put(tc_json_writer *writer, const char *data, size_t len)
+{
+    if (writer->rc == SUCCESS)
+    {
+        if (writer->length + len < writer->capacity)
+        {
+            memcpy(writer->buffer + writer->length, data, len);
+        }
+        else
+        {
+            writer->rc = MAX_SIZE_ERROR;
+        }
+    }
+
+    writer->length += len;
+}
+
+/**
+ * @brief Emit the separator required before a value
+ *
+ * @param[in]  writer  JSON writer.
+ */
+void tc_json_value_prefix(tc_json_writer *writer)
+{
+    if (writer->expectValue)
+    {
+        writer->expectValue = false;
+        return;
+    }
+
+    const uint64_t bit = (uint64_t)1 << writer->depth;
+    if (writer->hasValue & bit)
+    {
+        tc_json_put(writer, ",", 1);
+    }
+
+    writer->hasValue |= bit;
+}
+
+/**
+ * @brief Write an escaped, quoted string
+ *
+ * @param[in]  writer  JSON writer.
+ * @param[in]  value   String to write.
+ * @param[in]  len     Length of the string.
+ */
+void tc_json_put_escaped(tc_json_writer *writer, const char *value, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    tc_json_put(writer, "\"", 1);
+
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        const unsigned char c = (unsigned char)value[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+
+        tc_json_put(writer, value + start, i - start);
+        start = i + 1;
+
+        switch (c)
+        {
+        case '"':
+            tc_json_put(writer, "\\\"", 2);
+            break;
+        case '\\':
+            tc_json_put(writer, "\\\\", 2);
+            break;
+        case '\b':
+            tc_json_put(writer, "\\b", 2);
+            break;
+        case '\f':
+            tc_json_put(writer, "\\f", 2);
+            break;
+        case '\n':
+            tc_json_put(writer, "\\n", 2);
+            break;
+        case '\r':
+            tc_json_put(writer, "\\r", 2);
+            break;
+        case '\t':
+            tc_json_put(writer, "\\t", 2);
+            break;
+        default:
+        {
+            const char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            tc_json_put(writer, escaped, sizeof(escaped));
+            break;
+        }
+        }
+    }
+
+    tc_json_put(writer, value + start, len - start);
+    tc_json_put(writer, "\"", 1);
+}
+
+/**
+ * @brief Begin a JSON object
+ *
+ * @param[in]  writer  JSON writer.
+ */
+void tc_json_begin_object(tc_json_writer *writer)
+{
+    tc_json_value_prefix(writer);
+
+    if (writer->depth + 1 >= TC_JSON_MAX_DEPTH)
+    {
+        writer->rc = writer->rc == SUCCESS ? LIMIT_EXCEEDED_ERROR : writer->rc;
+        return;
+    }
+
+    tc_json_put(writer, "{", 1);
+    writer->depth++;
+    writer->hasValue &= ~((uint64_t)1 << writer->depth);
+}
+
+/**
+ * @brief End the current JSON object
+ *
+ * @param[in]  writer  JSON writer.
+ */
+void tc_json_end_object(tc_json_writer *writer)
+{
+    if (writer->depth == 0)
+    {
+        writer->rc = writer->rc == SUCCESS ? FAILURE : writer->rc;
+        return;
+    }
+
+    writer->depth--;
+    tc_json_put(writer, "}", 1);
+}
+
+/**
+ * @brief Begin a JSON array
+ *
+ * @param[in]  writer  JSON writer.
+ */
+void tc_json_begin_array(tc_json_writer *writer)
+{
+    tc_json_value_prefix(writer);
+
+    if (writer->depth + 1 >= TC_JSON_MAX_DEPTH)
+    {
+        writer->rc = writer->rc == SUCCESS ? LIMIT_EXCEEDED_ERROR : writer->rc;
+        return;
+    }
+
+    tc_json_put(writer, "[", 1);
+    writer->depth++;
+    writer->hasValue &= ~((uint64_t)1 << writer->depth);
+}
+
+/**
+ * @brief End the current JSON array
+ *
+ * @param[in]  writer  JSON writer.
+ */
+void tc_json_end_array(tc_json_writer *writer)
+{
+    if (writer->depth == 0)
+    {
+        writer->rc = writer->rc == SUCCESS ? FAILURE : writer->rc;
+        return;
+    }
+
+    writer->depth--;
+    tc_json_put(writer, "]", 1);
+}
+
+/**
+ * @brief Write an object member key
+ *
+ * The next value written becomes the member's value.
+ *
+ * @param[in]  writer  JSON writer.
+ * @param[in]  key     Member name.
+ */
+void tc_json_key(tc_json_writer *writer, const char *key)
+{
+    tc_json_value_prefix(writer);
+    tc_json_put_escaped(writer, key, strlen(key));
+    tc_json_put(writer, ":", 1);
+    writer->expectValue = true;
+}
+
+/**
+ * @brief Write a string value of a known length
+ *
+ * @param[in]  writer  JSON writer.
+ * @param[in]  value   String to write.
+ * @param[in]  len     Length of the string.
+ */
+void tc_json_string_len(tc_json_writer *writer, const char *value, size_t len)
+{
+    tc_json_value_prefix(writer);
+    tc_json_put_escaped(writer, value, len);
+}
+
+/**
+ * @brief Write a string value
+ *
+ * A NULL string is written as null.
+ *
+ * @param[in]  writer  JSON writer.
+ * @param[in]  value   Null terminated string to write.
+ */
+void tc_json_string(tc_json_writer *writer, const char *value)
+{
+    tc_json_value_prefix(writer);
+
+    if (value == NULL)
+    {
+        tc_json_put(writer, "null", 4);
+        return;
+    }
+
+    tc_json_put_escaped(writer, value, strlen(value));
+}
+
+/**
+ * @brief Write an integer value
+ *
+ * @param[in]  writer  JSON writer.
+ * @param[in]  value   Integer to write.
+ */
+void tc_json_int(tc_json_writer *writer, int64_t value)
+{
+    char digits[20];
+    size_t i = sizeof(digits);
+
+    uint64_t magnitude = value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+    do
+    {
+        digits[--i] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    tc_json_value_prefix(writer);
+
+    if (value < 0)
+    {
+        tc_json_put(writer, "-", 1);
+    }
+
+    tc_json_put(writer, digits + i, sizeof(digits) - i);
+}
+
+/**
+ * @brief Write a floating point value
+ *
+ * Written with the fewest significant digits that read back as the same
+ * value, and with '.' as the decimal point whatever the locale.
+ * Non-finite values have no JSON representation and are written as null.
+ *
+ * @param[in]  writer  JSON writer.
+ * @param[in]  value   Number to write.
+ */
+void tc_json_double(tc_json_writer *writer, double value)
+{
+    tc_json_value_prefix(writer);
+
+    if (value != value || value - value != 0)
+    {
+        tc_json_put(writer, "null", 4);
+        return;
+    }
+
+    // Shortest precision that reads back as the same value
+    char number[32];
+    int len = 0;
+    for (int precision = 15; precision <= 17; precision++)
+    {
+        len = snprintf(number, sizeof(number), "%.*g", precision, value);
+        if (strtod(number, NULL) == value)
+        {
+            break;
+        }
+    }
+
+    // The decimal point follows the locale; JSON always uses '.'
+    char *point = number + strspn(number, "-0123456789");
+    if (*point != '\0' && *point != 'e')
+    {
+        const size_t pointLen = strcspn(point, "0123456789");
+        *point = '.';
+        memmove(point + 1, point + pointLen, (size_t)len - (size_t)(point - number) - pointLen + 1);
+        len -= (int)pointLen - 1;
+    }
+
+    tc_json_put(writer, number, (size_t)len);
+
+    if (strpbrk(number, ".e") == NULL)
+    {
+        tc_json_put(writer, ".0", 2);
+    }
+}
+
+/**
+ * @brief Write a boolean value
+ *
+ * @param[in]  writer  JSON writer.
+ * @param[in]  value   Boolean to write.
+ */
+void tc_json_bool(tc_json_writer *writer, bool value)
+{
+    tc_json_value_prefix(writer);
+
+    if (value)
+    {
+        tc_json_put(writer, "true", 4);
+    }
+    else
+    {
+        tc_json_put(writer, "false", 5);
+    }
+}
+
+/**
+ * @brief Write a null value
+ *
+ * @param[in]  writer  JSON writer.
+ */
+void tc_json_null(tc_json_writer *writer)
+{
+    tc_json_value_prefix(writer);
+    tc_json_put(writer, "null", 4);
+}
+
+/**
+ * @brief Write a pre-serialized JSON value
+ *
+ * The value is copied verbatim and is not validated.
+ *
+ * @param[in]  writer  JSON writer.
+ * @param[in]  json    Serialized JSON value.
+ * @param[in]  len     Length of the serialized value.
+ */
+void tc_json_raw(tc_json_writer *writer, const char *json, size_t len)
+{
+    tc_json_value_prefix(writer);
+    tc_json_put(writer, json, len);
+}
+
+/**
+ * @brief Write a json-c object tree
+ *
+ * Walks the tree and writes it without asking json-c to serialize it,
+ * so no intermediate string buffer is allocated.
+ *
+ * @param[in]  writer  JSON writer.
+ * @param[in]  obj     Object to write. NULL is written as null.
+ */
+void tc_json_object(tc_json_writer *writer, json_object *obj)
+{
+    switch (json_object_get_type(obj))
+    {
+    case json_type_boolean:
+        tc_json_bool(writer, json_object_get_boolean(obj));
+        break;
+    case json_type_double:
+        tc_json_double(writer, json_object_get_double(obj));
+        break;
+    case json_type_int:
+        tc_json_int(writer, json_object_get_int64(obj));
+        break;
+    case json_type_string:
+        tc_json_string_len(writer, json_object_get_string(obj), (size_t)json_object_get_string_len(obj));
+        break;
+    case json_type_object:
+    {
+        tc_json_begin_object(writer);
+        if (writer->rc == LIMIT_EXCEEDED_ERROR)
+        {
+            return;
+        }
+
+        struct json_object_iterator it = json_object_iter_begin(obj);
+        const struct json_object_iterator end = json_object_iter_end(obj);
+        while (!json_object_iter_equal(&it, &end))
+        {
+            tc_json_key(writer, json_object_iter_peek_name(&it));
+            tc_json_object(writer, json_object_iter_peek_value(&it));
+            json_object_iter_next(&it);
+        }
+
+        tc_json_end_object(writer);
+        break;
+    }
+    case json_type_array:
+    {
+        tc_json_begin_array(writer);
+        if (writer->rc == LIMIT_EXCEEDED_ERROR)
+        {
+            return;
+        }
+
+        const size_t len = json_object_array_length(obj);
+        for (size_t i = 0; i < len; i++)
+        {
+            tc_json_object(writer, json_object_array_get_idx(obj, i));
+        }
+
+        tc_json_end_array(writer);
+        break;
+    }
+    default:
+        tc_json_null(writer);
+        break;
+    }
+}
+
+/**
+ * @brief Finish writing
+ *
+ * Null terminates the output when it fits.
+ *
+ * @param[in]  writer  JSON writer.
+ *
+ * @return Zero on success, MAX_SIZE_ERROR if the buffer was too small,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_json_writer_finish(tc_json_writer *writer)
+{
+    if (writer->rc == SUCCESS && writer->depth != 0)
+    {
+        writer->rc = FAILURE;
+    }
+
+    if (writer->rc == SUCCESS && writer->buffer != NULL && writer->length < writer->capacity)
+    {
+        writer->buffer[writer->length] = '\0';
+    }
+
+    return writer->rc;
+}
+
+/**
+ * @brief A view into a byte buffer
+ *
+ * Slices point into the buffer they were read from and are only valid
+ * as long as that buffer is.
+ */
+typedef struct
+{
+    const char *data;
+    size_t len;
+} tc_slice;
+
+/**
+ * @brief Slice of a null terminated string
+ *
+ * A NULL string gives a slice with NULL data.
+ */
+tc_slice tc_slice_of(const char *value)
+{
+    tc_slice slice = {value, value != NULL ? strlen(value) : 0};
+
+    return slice;
+}
+
+/**
+ * Compare a slice against a string literal
+ */
+#define TC_SLICE_EQUALS(slice, literal) \
+    ((slice).len == sizeof(literal) - 1 && memcmp((slice).data, literal, sizeof(literal) - 1) == 0)
+
+typedef enum
+{
+    TC_JSON_NONE = 0,
+    TC_JSON_OBJECT,
+    TC_JSON_ARRAY,
+    TC_JSON_STRING,
+    TC_JSON_NUMBER,
+    TC_JSON_TRUE,
+    TC_JSON_FALSE,
+    TC_JSON_NULL
+} tc_json_type;
+
+/**
+ * Length of a string scanned a byte at a time before the reader switches
+ * to the block kernel for the rest of it
+ */
+#ifndef TC_JSON_SHORT_STRING
+#define TC_JSON_SHORT_STRING 16
+#endif
+
+/**
+ * @brief Pull-style JSON tokenizer
+ *
+ * Scans a JSON document in place. Nothing is copied or allocated: values
+ * are returned as slices into the scanned buffer. String slices hold the
+ * raw contents between the quotes, see tc_json_unescape to decode them.
+ * Long strings and skipped objects and arrays are scanned a block at a
+ * time with the structural scanner.
+ *
+ * Readers are strict: only whitespace may follow the top-level value.
+ * Clearing strict ignores anything after it, as json-c does.
+ */
+typedef struct
+{
+    const char *cursor;
+    const char *end;
+    uint32_t depth;
+    uint64_t hasMember;
+    tc_scan_kernel scan;
+    bool strict;
+} tc_json_reader;
+
+/**
+ * @brief Initialize a JSON reader
+ *
+ * @param[out]  reader  Reader to initialize.
+ * @param[in]   json    JSON text to scan.
+ * @param[in]   len     Length of the JSON text.
+ */
+void tc_json_reader_init(tc_json_reader *reader, const char *json, size_t len)
+{
+    reader->cursor = json;
+    reader->end = json + len;
+    reader->depth = 0;
+    reader->hasMember = 0;
+    reader->scan = tc_scan_select();
+    reader->strict = true;
+}
+
+/**
+ * @brief Skip insignificant whitespace
+ *
+ * @param[in]  reader  JSON reader.
+ */
+void tc_json_skip_whitespace(tc_json_reader *reader)
+{
+    while (reader->cursor < reader->end &&
+           (*reader->cursor == ' ' || *reader->cursor == '\n' || *reader->cursor == '\r' || *reader->cursor == '\t'))
+    {
+        reader->cursor++;
+    }
+}
+
+/**
+ * @brief Scan a string token
+ *
+ * @param[in]   reader  JSON reader positioned on the opening quote.
+ * @param[out]  value   Raw string contents, without the quotes.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_scan_string(tc_json_reader *reader, tc_slice *value)
+{
+    if (reader->cursor >= reader->end || *reader->cursor != '"')
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    const char *start = ++reader->cursor;
+    while (reader->cursor < reader->end)
+    {
+        if (reader->cursor - start >= TC_JSON_SHORT_STRING && reader->end - reader->cursor >= TC_SCAN_BLOCK)
+        {
+            tc_scan_masks masks;
+            reader->scan(reader->cursor, &masks);
+
+            const uint64_t special = masks.quote | masks.backslash | masks.control;
+            if (special == 0)
+            {
+                reader->cursor += TC_SCAN_BLOCK;
+                continue;
+            }
+
+            reader->cursor += __builtin_ctzll(special);
+        }
+
+        const unsigned char c = (unsigned char)*reader->cursor;
+        if (c == '"')
+        {
+            value->data = start;
+            value->len = (size_t)(reader->cursor - start);
+            reader->cursor++;
+            return SUCCESS;
+        }
+
+        if (c < 0x20)
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        if (c == '\\' && reader->end - reader->cursor < 2)
+        {
+            break;
+        }
+
+        reader->cursor += c == '\\' ? 2 : 1;
+    }
+
+    return JSON_PARSE_ERROR;
+}
+
+/**
+ * @brief Scan a number token
+ *
+ * @param[in]   reader  JSON reader positioned on the number.
+ * @param[out]  value   Number token.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_scan_number(tc_json_reader *reader, tc_slice *value)
+{
+    const char *start = reader->cursor;
+
+    if (reader->cursor < reader->end && *reader->cursor == '-')
+    {
+        reader->cursor++;
+    }
+
+    const char *digits = reader->cursor;
+    while (reader->cursor < reader->end && *reader->cursor >= '0' && *reader->cursor <= '9')
+    {
+        reader->cursor++;
+    }
+
+    if (reader->cursor == digits)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    if (reader->cursor < reader->end && *reader->cursor == '.')
+    {
+        digits = ++reader->cursor;
+        while (reader->cursor < reader->end && *reader->cursor >= '0' && *reader->cursor <= '9')
+        {
+            reader->cursor++;
+        }
+
+        if (reader->cursor == digits)
+        {
+            return JSON_PARSE_ERROR;
+        }
+    }
+
+    if (reader->cursor < reader->end && (*reader->cursor == 'e' || *reader->cursor == 'E'))
+    {
+        reader->cursor++;
+        if (reader->cursor < reader->end && (*reader->cursor == '+' || *reader->cursor == '-'))
+        {
+            reader->cursor++;
+        }
+
+        digits = reader->cursor;
+        while (reader->cursor < reader->end && *reader->cursor >= '0' && *reader->cursor <= '9')
+        {
+            reader->cursor++;
+        }
+
+        if (reader->cursor == digits)
+        {
+            return JSON_PARSE_ERROR;
+        }
+    }
+
+    value->data = start;
+    value->len = (size_t)(reader->cursor - start);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Scan a literal token
+ *
+ * @param[in]  reader   JSON reader.
+ * @param[in]  literal  Expected literal.
+ * @param[in]  len      Length of the literal.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_scan_literal(tc_json_reader *reader, const char *literal, size_t len)
+{
+    if ((size_t)(reader->end - reader->cursor) < len || memcmp(reader->cursor, literal, len) != 0)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    reader->cursor += len;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Validate a scalar starting at a token
+ *
+ * @param[in]  start  First byte of the scalar.
+ * @param[in]  end    End of the JSON text.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_scan_scalar(const char *start, const char *end)
+{
+    tc_json_reader reader;
+    tc_slice ignored;
+    IoT_Error_t rc;
+
+    reader.cursor = start;
+    reader.end = end;
+
+    switch (*start)
+    {
+    case 't':
+        rc = tc_json_scan_literal(&reader, "true", 4);
+        break;
+    case 'f':
+        rc = tc_json_scan_literal(&reader, "false", 5);
+        break;
+    case 'n':
+        rc = tc_json_scan_literal(&reader, "null", 4);
+        break;
+    default:
+        rc = tc_json_scan_number(&reader, &ignored);
+        break;
+    }
+
+    if (rc != SUCCESS || reader.cursor == end)
+    {
+        return rc;
+    }
+
+    // The scalar must run up to the next token or whitespace
+    switch (*reader.cursor)
+    {
+    case ' ':
+    case '\n':
+    case '\r':
+    case '\t':
+    case ',':
+    case ':':
+    case '"':
+    case '{':
+    case '}':
+    case '[':
+    case ']':
+        return SUCCESS;
+    default:
+        return JSON_PARSE_ERROR;
+    }
+}
+
+typedef enum
+{
+    TC_JSON_EXPECT_VALUE,
+    TC_JSON_EXPECT_VALUE_OR_CLOSE,
+    TC_JSON_EXPECT_KEY,
+    TC_JSON_EXPECT_KEY_OR_CLOSE,
+    TC_JSON_EXPECT_COLON,
+    TC_JSON_EXPECT_NEXT
+} tc_json_expect;
+
+/**
+ * @brief Skip over an object or array
+ *
+ * Walks the structural index of the value rather than its bytes, so
+ * strings and whitespace are crossed a block at a time and each token
+ * is visited once. The grammar is checked as strictly as by the byte
+ * scanner.
+ *
+ * @param[in]   reader  JSON reader positioned on '{' or '['.
+ * @param[in]   depth   Current nesting depth.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_skip_container(tc_json_reader *reader, uint32_t depth)
+{
+    tc_scan_iterator iterator;
+    tc_json_expect expect = TC_JSON_EXPECT_VALUE;
+    uint64_t objects = 0;
+    uint32_t level = 0;
+    const char *block;
+    uint64_t tokens;
+
+    tc_scan_begin(&iterator, reader->scan, reader->cursor, reader->end);
+
+    while (tc_scan_next_block(&iterator, &block, &tokens))
+    {
+        for (; tokens != 0; tokens &= tokens - 1)
+        {
+            const char *token = block + __builtin_ctzll(tokens);
+            const bool expectValue = expect == TC_JSON_EXPECT_VALUE || expect == TC_JSON_EXPECT_VALUE_OR_CLOSE;
+            const bool inObject = (objects >> level) & 1;
+
+            switch (*token)
+            {
+            case '"':
+                if (expectValue)
+                {
+                    expect = TC_JSON_EXPECT_NEXT;
+                }
+                else if (expect == TC_JSON_EXPECT_KEY || expect == TC_JSON_EXPECT_KEY_OR_CLOSE)
+                {
+                    expect = TC_JSON_EXPECT_COLON;
+                }
+                else
+                {
+                    return JSON_PARSE_ERROR;
+                }
+                continue;
+            case ':':
+                if (expect != TC_JSON_EXPECT_COLON)
+                {
+                    return JSON_PARSE_ERROR;
+                }
+
+                expect = TC_JSON_EXPECT_VALUE;
+                continue;
+            case ',':
+                if (expect != TC_JSON_EXPECT_NEXT)
+                {
+                    return JSON_PARSE_ERROR;
+                }
+
+                expect = inObject ? TC_JSON_EXPECT_KEY : TC_JSON_EXPECT_VALUE;
+                continue;
+            case '{':
+            case '[':
+                if (!expectValue || depth + ++level >= TC_JSON_MAX_DEPTH)
+                {
+                    return JSON_PARSE_ERROR;
+                }
+
+                if (*token == '{')
+                {
+                    objects |= (uint64_t)1 << level;
+                    expect = TC_JSON_EXPECT_KEY_OR_CLOSE;
+                }
+                else
+                {
+                    objects &= ~((uint64_t)1 << level);
+                    expect = TC_JSON_EXPECT_VALUE_OR_CLOSE;
+                }
+                continue;
+            case '}':
+                if (!(expect == TC_JSON_EXPECT_KEY_OR_CLOSE || (expect == TC_JSON_EXPECT_NEXT && inObject)))
+                {
+                    return JSON_PARSE_ERROR;
+                }
+                break;
+            case ']':
+                if (!(expect == TC_JSON_EXPECT_VALUE_OR_CLOSE || (expect == TC_JSON_EXPECT_NEXT && !inObject)))
+                {
+                    return JSON_PARSE_ERROR;
+                }
+                break;
+            default:
+                // A scalar, or a control character inside a string
+                if (!expectValue || tc_json_scan_scalar(token, reader->end) != SUCCESS)
+                {
+                    return JSON_PARSE_ERROR;
+                }
+
+                expect = TC_JSON_EXPECT_NEXT;
+                continue;
+            }
+
+            // Closed the container at this level
+            if (--level == 0)
+            {
+                reader->cursor = token + 1;
+                return SUCCESS;
+            }
+
+            expect = TC_JSON_EXPECT_NEXT;
+        }
+    }
+
+    return JSON_PARSE_ERROR;
+}
+
+/**
+ * @brief Skip over a complete JSON value
+ *
+ * The value is validated while it is skipped.
+ *
+ * @param[in]   reader  JSON reader.
+ * @param[in]   depth   Current nesting depth.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_skip_value(tc_json_reader *reader, uint32_t depth)
+{
+    tc_slice ignored;
+
+    tc_json_skip_whitespace(reader);
+    if (reader->cursor >= reader->end)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    switch (*reader->cursor)
+    {
+    case '"':
+        return tc_json_scan_string(reader, &ignored);
+    case 't':
+        return tc_json_scan_literal(reader, "true", 4);
+    case 'f':
+        return tc_json_scan_literal(reader, "false", 5);
+    case 'n':
+        return tc_json_scan_literal(reader, "null", 4);
+    case '{':
+    case '[':
+        return tc_json_skip_container(reader, depth);
+    default:
+        return tc_json_scan_number(reader, &ignored);
+    }
+}
+
+/**
+ * @brief Read the next value
+ *
+ * Scalars are returned as their token; strings without their quotes.
+ * Objects and arrays are skipped and returned as their raw span,
+ * brackets included, so they can be scanned later with a new reader or
+ * handed to another parser as is.
+ *
+ * @param[in]   reader  JSON reader.
+ * @param[out]  type    Type of the value.
+ * @param[out]  value   Value token or span.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_read_value(tc_json_reader *reader, tc_json_type *type, tc_slice *value)
+{
+    tc_json_skip_whitespace(reader);
+    if (reader->cursor >= reader->end)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    const char *start = reader->cursor;
+    IoT_Error_t rc;
+
+    switch (*start)
+    {
+    case '"':
+        *type = TC_JSON_STRING;
+        return tc_json_scan_string(reader, value);
+    case '{':
+        *type = TC_JSON_OBJECT;
+        break;
+    case '[':
+        *type = TC_JSON_ARRAY;
+        break;
+    case 't':
+        *type = TC_JSON_TRUE;
+        break;
+    case 'f':
+        *type = TC_JSON_FALSE;
+        break;
+    case 'n':
+        *type = TC_JSON_NULL;
+        break;
+    default:
+        *type = TC_JSON_NUMBER;
+        break;
+    }
+
+    rc = tc_json_skip_value(reader, reader->depth);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    value->data = start;
+    value->len = (size_t)(reader->cursor - start);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Enter an object
+ *
+ * @param[in]  reader  JSON reader positioned on an object.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_object_begin(tc_json_reader *reader)
+{
+    tc_json_skip_whitespace(reader);
+    if (reader->cursor >= reader->end || *reader->cursor != '{' || reader->depth + 1 >= TC_JSON_MAX_DEPTH)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    reader->cursor++;
+    reader->depth++;
+    reader->hasMember &= ~((uint64_t)1 << reader->depth);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Advance to the next object member
+ *
+ * On success with hasMember set, the reader is positioned on the member's
+ * value, which must be consumed with tc_json_read_value or entered before
+ * calling again. When hasMember is false the object has been left.
+ *
+ * @param[in]   reader     JSON reader inside an object.
+ * @param[out]  key        Raw member name.
+ * @param[out]  hasMember  Set if a member was read.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_object_next(tc_json_reader *reader, tc_slice *key, bool *hasMember)
+{
+    const uint64_t bit = (uint64_t)1 << reader->depth;
+
+    tc_json_skip_whitespace(reader);
+    if (reader->cursor >= reader->end || reader->depth == 0)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    if (*reader->cursor == '}')
+    {
+        reader->cursor++;
+        reader->depth--;
+        *hasMember = false;
+        return SUCCESS;
+    }
+
+    if (reader->hasMember & bit)
+    {
+        if (*reader->cursor != ',')
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        reader->cursor++;
+        tc_json_skip_whitespace(reader);
+    }
+
+    IoT_Error_t rc = tc_json_scan_string(reader, key);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    tc_json_skip_whitespace(reader);
+    if (reader->cursor >= reader->end || *reader->cursor != ':')
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    reader->cursor++;
+    reader->hasMember |= bit;
+    *hasMember = true;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Check that the top-level value is complete
+ *
+ * Strict readers also check that nothing but whitespace is left.
+ *
+ * @param[in]  reader  JSON reader.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_reader_finish(tc_json_reader *reader)
+{
+    if (reader->depth != 0)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    if (!reader->strict)
+    {
+        return SUCCESS;
+    }
+
+    tc_json_skip_whitespace(reader);
+
+    return reader->cursor == reader->end ? SUCCESS : JSON_PARSE_ERROR;
+}
+
+/**
+ * @brief Convert an integer token
+ *
+ * @param[in]   value   Number token.
+ * @param[out]  number  Parsed integer.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR if the token is not an integer
+ */
+IoT_Error_t tc_json_slice_to_int(tc_slice value, int64_t *number)
+{
+    size_t i = 0;
+    bool negative = false;
+    uint64_t magnitude = 0;
+
+    if (value.len > 0 && value.data[0] == '-')
+    {
+        negative = true;
+        i++;
+    }
+
+    if (i == value.len || value.len - i > 18)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    for (; i < value.len; i++)
+    {
+        const char c = value.data[i];
+        if (c < '0' || c > '9')
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        magnitude = magnitude * 10 + (uint64_t)(c - '0');
+    }
+
+    *number = negative ? -(int64_t)magnitude : (int64_t)magnitude;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Convert a value to an integer the way json_object_get_int does
+ *
+ * Numbers are truncated toward zero, strings are parsed for a leading
+ * integer, true is one, and anything else is zero. The result is clamped
+ * to the range of a 32-bit int.
+ *
+ * @param[in]  type   Type of the value.
+ * @param[in]  value  Value as read by tc_json_read_value.
+ *
+ * @return The converted integer
+ */
+int32_t tc_json_slice_coerce_int(tc_json_type type, tc_slice value)
+{
+    int64_t integer = 0;
+    double number = 0;
+    char text[64];
+
+    if (type == TC_JSON_TRUE)
+    {
+        return 1;
+    }
+    else if ((type != TC_JSON_NUMBER && type != TC_JSON_STRING) || value.len >= sizeof(text))
+    {
+        return 0;
+    }
+    else if (type == TC_JSON_NUMBER && tc_json_slice_to_int(value, &integer) == SUCCESS)
+    {
+        number = (double)integer;
+    }
+    else
+    {
+        // strtod and strtoll need a terminated copy of the value
+        memcpy(text, value.data, value.len);
+        text[value.len] = '\0';
+        number = type == TC_JSON_NUMBER ? strtod(text, NULL) : (double)strtoll(text, NULL, 10);
+    }
+
+    if (number != number)
+    {
+        return 0;
+    }
+    else if (number <= INT32_MIN)
+    {
+        return INT32_MIN;
+    }
+    else if (number >= INT32_MAX)
+    {
+        return INT32_MAX;
+    }
+
+    return (int32_t)number;
+}
+
+/**
+ * @brief Parse four hex digits
+ *
+ * @param[in]   hex    Hex digits.
+ * @param[out]  value  Parsed value.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_parse_hex4(const char *hex, uint32_t *value)
+{
+    *value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        const char c = hex[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+        {
+            digit = (uint32_t)(c - '0');
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            digit = (uint32_t)(c - 'a' + 10);
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            digit = (uint32_t)(c - 'A' + 10);
+        }
+        else
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        *value = (*value << 4) | digit;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Decode a raw string slice
+ *
+ * Resolves escape sequences, encoding \u escapes as UTF-8, and null
+ * terminates the result.
+ *
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ * @param[in]   value      Raw string contents from the reader.
+ * @param[out]  written    Optional. Length of the decoded string.
+ *
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         JSON_PARSE_ERROR on an invalid escape
+ */
+IoT_Error_t tc_json_unescape(char *buffer, size_t bufferLen, tc_slice value, size_t *written)
+{
+    size_t out = 0;
+    size_t i = 0;
+
+    if (buffer == NULL || bufferLen == 0)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    while (i < value.len)
+    {
+        const char *run = (const char *)memchr(value.data + i, '\\', value.len - i);
+        const size_t runLen = run == NULL ? value.len - i : (size_t)(run - (value.data + i));
+
+        if (out + runLen >= bufferLen)
+        {
+            return MAX_SIZE_ERROR;
+        }
+
+        memcpy(buffer + out, value.data + i, runLen);
+        out += runLen;
+        i += runLen;
+
+        if (run == NULL)
+        {
+            break;
+        }
+
+        if (i + 1 >= value.len)
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        char decoded[4];
+        size_t decodedLen = 1;
+        const char escape = value.data[i + 1];
+        i += 2;
+
+        switch (escape)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            decoded[0] = escape;
+            break;
+        case 'b':
+            decoded[0] = '\b';
+            break;
+        case 'f':
+            decoded[0] = '\f';
+            break;
+        case 'n':
+            decoded[0] = '\n';
+            break;
+        case 'r':
+            decoded[0] = '\r';
+            break;
+        case 't':
+            decoded[0] = '\t';
+            break;
+        case 'u':
+        {
+            uint32_t codepoint;
+            if (i + 4 > value.len || tc_json_parse_hex4(value.data + i, &codepoint) != SUCCESS)
+            {
+                return JSON_PARSE_ERROR;
+            }
+            i += 4;
+
+            if (codepoint >= 0xD800 && codepoint <= 0xDBFF)
+            {
+                uint32_t low;
+                if (i + 6 > value.len || value.data[i] != '\\' || value.data[i + 1] != 'u' ||
+                    tc_json_parse_hex4(value.data + i + 2, &low) != SUCCESS || low < 0xDC00 || low > 0xDFFF)
+                {
+                    return JSON_PARSE_ERROR;
+                }
+                i += 6;
+                codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+            }
+
+            if (codepoint < 0x80)
+            {
+                decoded[0] = (char)codepoint;
+            }
+            else if (codepoint < 0x800)
+            {
+                decoded[0] = (char)(0xC0 | (codepoint >> 6));
+                decoded[1] = (char)(0x80 | (codepoint & 0x3F));
+                decodedLen = 2;
+            }
+            else if (codepoint < 0x10000)
+            {
+                decoded[0] = (char)(0xE0 | (codepoint >> 12));
+                decoded[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                decoded[2] = (char)(0x80 | (codepoint & 0x3F));
+                decodedLen = 3;
+            }
+            else
+            {
+                decoded[0] = (char)(0xF0 | (codepoint >> 18));
+                decoded[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+                decoded[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                decoded[3] = (char)(0x80 | (codepoint & 0x3F));
+                decodedLen = 4;
+            }
+            break;
+        }
+        default:
+            return JSON_PARSE_ERROR;
+        }
+
+        if (out + decodedLen >= bufferLen)
+        {
+            return MAX_SIZE_ERROR;
+        }
+
+        memcpy(buffer + out, decoded, decodedLen);
+        out += decodedLen;
+    }
+
+    buffer[out] = '\0';
+    if (written != NULL)
+    {
+        *written = out;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Enter an array
+ *
+ * @param[in]  reader  JSON reader positioned on an array.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_array_begin(tc_json_reader *reader)
+{
+    tc_json_skip_whitespace(reader);
+    if (reader->cursor >= reader->end || *reader->cursor != '[' || reader->depth + 1 >= TC_JSON_MAX_DEPTH)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    reader->cursor++;
+    reader->depth++;
+    reader->hasMember &= ~((uint64_t)1 << reader->depth);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Advance to the next array element
+ *
+ * On success with hasElement set, the reader is positioned on the
+ * element, which must be consumed before calling again. When hasElement
+ * is false the array has been left.
+ *
+ * @param[in]   reader      JSON reader inside an array.
+ * @param[out]  hasElement  Set if an element follows.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_array_next(tc_json_reader *reader, bool *hasElement)
+{
+    const uint64_t bit = (uint64_t)1 << reader->depth;
+
+    tc_json_skip_whitespace(reader);
+    if (reader->cursor >= reader->end || reader->depth == 0)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    if (*reader->cursor == ']')
+    {
+        reader->cursor++;
+        reader->depth--;
+        *hasElement = false;
+        return SUCCESS;
+    }
+
+    if (reader->hasMember & bit)
+    {
+        if (*reader->cursor != ',')
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        reader->cursor++;
+    }
+
+    reader->hasMember |= bit;
+    *hasElement = true;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Consume a null value
+ *
+ * @param[in]  reader  JSON reader positioned on a value.
+ *
+ * @return true if the value was null and has been consumed
+ */
+bool tc_json_skip_null(tc_json_reader *reader)
+{
+    tc_json_skip_whitespace(reader);
+
+    return tc_json_scan_literal(reader, "null", 4) == SUCCESS;
+}
+
+/**
+ * @brief Read a boolean value
+ *
+ * @param[in]   reader  JSON reader positioned on the value.
+ * @param[out]  value   Boolean read.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR if the value is not a boolean
+ */
+IoT_Error_t tc_json_read_bool(tc_json_reader *reader, bool *value)
+{
+    tc_json_skip_whitespace(reader);
+    if (tc_json_scan_literal(reader, "true", 4) == SUCCESS)
+    {
+        *value = true;
+        return SUCCESS;
+    }
+
+    if (tc_json_scan_literal(reader, "false", 5) == SUCCESS)
+    {
+        *value = false;
+        return SUCCESS;
+    }
+
+    return JSON_PARSE_ERROR;
+}
+
+/**
+ * @brief Read an integer value
+ *
+ * @param[in]   reader  JSON reader positioned on the value.
+ * @param[out]  value   Integer read.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR if the value is not an integer
+ */
+IoT_Error_t tc_json_read_int(tc_json_reader *reader, int64_t *value)
+{
+    tc_slice token;
+
+    tc_json_skip_whitespace(reader);
+    const IoT_Error_t rc = tc_json_scan_number(reader, &token);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    return tc_json_slice_to_int(token, value);
+}
+
+/**
+ * @brief Read a number value
+ *
+ * @param[in]   reader  JSON reader positioned on the value.
+ * @param[out]  value   Number read.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR if the value is not a number
+ */
+IoT_Error_t tc_json_read_double(tc_json_reader *reader, double *value)
+{
+    tc_slice token;
+    char number[64];
+
+    tc_json_skip_whitespace(reader);
+    const IoT_Error_t rc = tc_json_scan_number(reader, &token);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    // strtod needs a terminated copy of the token
+    if (token.len >= sizeof(number))
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    memcpy(number, token.data, token.len);
+    number[token.len] = '\0';
+    *value = strtod(number, NULL);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Read and decode a string value
+ *
+ * @param[in]   reader     JSON reader positioned on the value.
+ * @param[out]  buffer     Pointer to a string buffer to write to.
+ * @param[in]   bufferLen  Size of buffer, including room for the null character.
+ *
+ * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,
+ *         JSON_PARSE_ERROR if the value is not a string
+ */
+IoT_Error_t tc_json_read_string(tc_json_reader *reader, char *buffer, size_t bufferLen)
+{
+    tc_slice value;
+
+    tc_json_skip_whitespace(reader);
+    const IoT_Error_t rc = tc_json_scan_string(reader, &value);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+
+    return tc_json_unescape(buffer, bufferLen, value, NULL);
+}
+
+/**
+ * Key of each thread's tokener for tc_json_parse_slice
+ */
+static pthread_key_t tc_json_tokener_key;
+static pthread_once_t tc_json_tokener_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Create the key of the per-thread tokeners
+ *
+ * Tokeners are freed when their thread exits.
+ */
+void tc_json_tokener_key_create(void)
+{
+    pthread_key_create(&tc_json_tokener_key, (void (*)(void *))json_tokener_free);
+}
+
+/**
+ * @brief Parse a JSON span into a json-c object
+ *
+ * Each thread reuses one tokener, allocated on its first parse. A parse
+ * from inside another, e.g. in a json-c callback, uses a one-off tokener.
+ *
+ * @param[in]   value  Raw JSON value, as returned by tc_json_read_value.
+ * @param[out]  obj    Parsed object. The caller owns the result.
+ *
+ * @return Zero on success, JSON_PARSE_ERROR otherwise
+ */
+IoT_Error_t tc_json_parse_slice(tc_slice value, json_object **obj)
+{
+    pthread_once(&tc_json_tokener_once, tc_json_tokener_key_create);
+
+    // Taken out of the key while in use
+    json_tokener *tok = (json_tokener *)pthread_getspecific(tc_json_tokener_key);
+    if (tok != NULL)
+    {
+        pthread_setspecific(tc_json_tokener_key, NULL);
+    }
+    else
+    {
+        tok = json_tokener_new();
+        if (tok == NULL)
+        {
+            return FAILURE;
+        }
+    }
+
+    *obj = json_tokener_parse_ex(tok, value.data, (int)value.len);
+
+    if (pthread_getspecific(tc_json_tokener_key) == NULL)
+    {
+        json_tokener_reset(tok);
+        pthread_setspecific(tc_json_tokener_key, tok);
+    }
+    else
+    {
+        json_tokener_free(tok);
+    }
+
+    return *obj == NULL ? JSON_PARSE_ERROR : SUCCESS;
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_JSON_ */
@@ -0,0 +1,611 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_LZ_
+#define THINCLOUD_EMBEDDED_C_SDK_LZ_
+
+/*
+ * Thincloud C Embedded SDK - Compression
+ *
+ * Self-contained LZ77 codec for message payloads, with an optional
+ * preset dictionary the compressor and decompressor treat as if it
+ * preceded the data. Blocks use the LZ4 sequence layout: a token with
+ * literal and match lengths, the literals, then a 16-bit little-endian
+ * match offset. Compressed payloads are wrapped in an envelope whose
+ * first byte is TC_LZ_MARKER, which never starts a JSON or CBOR message.
+ * Malformed compressed data is reported as JSON_PARSE_ERROR.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aws_iot_error.h"
+
+/**
+ * Size of the compressor's match table, as a power of two. The table
+ * lives on the stack and takes four bytes per entry.
+ */
+#ifndef TC_LZ_HASH_BITS
+#define TC_LZ_HASH_BITS 11
+#endif
+
+#define TC_LZ_MIN_MATCH 4
+#define TC_LZ_MAX_OFFSET 65535
+
+/**
+ * First byte of a compressed payload
+ */
+#define TC_LZ_MARKER 0xff
+
+/**
+ * @brief Preset dictionary
+ *
+ * Both ends must use the same dictionary. The id is written to the
+ * envelope so a receiver can tell a mismatched dictionary from corrupt
+ * data; zero is reserved for no dictionary.
+ */
+typedef struct
+{
+    uint8_t id;
+    const char *data;
+    size_t len;
+} tc_lz_dictionary;
+
+/**
+ * @brief Dictionary of ThinCloud message shapes
+ *
+ * Keys and structure of the JSON and CBOR messages, with the most
+ * frequent matches nearest the end where their offsets are smallest.
+ */
+const char TC_LZ_THINCLOUD_DICTIONARY[] =
+    "\x62" "id" "\x66" "method" "\x66" "params" "\x64" "data" "\x66" "result" "\x6a" "statusCode"
+    "\x64" "body" "\x65" "error" "\x67" "message" "\x6a" "deviceType" "\x6a" "physicalId"
+    "\x6e" "relatedDevices" "\x68" "deviceId" "\x6a" "commission"
+    "{\"id\":\"\",\"error\":{\"statusCode\":500,\"message\":\"\"}}"
+    "{\"id\":\"\",\"method\":\"commission\",\"params\":[{\"data\":{\"deviceType\":\"\",\"physicalId\":\"\",\"relatedDevices\":[{\"deviceId\":\"\"}]}}]}"
+    "\"name\":\"\",\"value\":\"\",\"type\":\"\",\"enabled\":true,\"enabled\":false,\"timestamp\":\"20"
+    "\"level\":\"info\",\"level\":\"error\",\"level\":\"debug\",\"level\":\"warn\",\"message\":\"\",\"time\":"
+    "{\"id\":\"\",\"method\":\"GET\",\"params\":{\"data\":{\"PUT\",\"params\":{\"data\":{\"POST\",\"params\":{\"data\":{"
+    "{\"id\":\"\",\"result\":{\"statusCode\":200,\"body\":{\"data\":{\"},{\"\":\"\",\"\":true,\"\":false,\"\":null,\"\":[{\"";
+
+const tc_lz_dictionary tc_lz_thincloud_dictionary = {1, TC_LZ_THINCLOUD_DICTIONARY, sizeof(TC_LZ_THINCLOUD_DICTIONARY) - 1};
+
+/**
+ * @brief Compressor window: the dictionary followed by the input
+ */
+typedef struct
+{
+    const uint8_t *dictionary;
+    size_t dictionaryLen;
+    const uint8_t *data;
+} tc_lz_window;
+
+/**
+ * @brief Byte at a window position
+ */
+uint8_t tc_lz_byte(const tc_lz_window *window, size_t position)
+{
+    return position < window->dictionaryLen ? window->dictionary[position] : window->data[position - window->dictionaryLen];
+}
+
+/**
+ * @brief Four bytes at a window position
+ */
+uint32_t tc_lz_read32(const tc_lz_window *window, size_t position)
+{
+    uint32_t value;
+    if (position >= window->dictionaryLen)
+    {
+        memcpy(&value, window->data + (position - window->dictionaryLen), sizeof(value));
+        return value;
+    }
+
+    if (position + sizeof(value) <= window->dictionaryLen)
+    {
+        memcpy(&value, window->dictionary + position, sizeof(value));
+        return value;
+    }
+
+    uint8_t bytes[4];
+    for (size_t i = 0; i < sizeof(bytes); i++)
+    {
+        bytes[i] = tc_lz_byte(window, position + i);
+    }
+
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+uint32_t tc_lz_hash(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - TC_LZ_HASH_BITS);
+}
+
+/**
+ * @brief Bounded output of the compressor
+ */
+typedef struct
+{
+    uint8_t *data;
+    size_t capacity;
+    size_t length;
+    IoT_Error_t rc;
+} tc_lz_output;
+
+void tc_lz_put(tc_lz_output *output, const void *data, size_t len)
+{
+    if (output->rc != SUCCESS)
+    {
+        return;
+    }
+
+    if (len > output->capacity - output->length)
+    {
+        output->rc = MAX_SIZE_ERROR;
+        return;
+    }
+
+    memcpy(output->data + output->length, data, len);
+    output->length += len;
+}
+
+void tc_lz_put_byte(tc_lz_output *output, uint8_t value)
+{
+    tc_lz_put(output, &value, 1);
+}
+
+/**
+ * @brief Write the remainder of a length that did not fit its token nibble
+ */
+void tc_lz_put_length(tc_lz_output *output, size_t len)
+{
+    while (len >= 255)
+    {
+        tc_lz_put_byte(output, 255);
+        len -= 255;
+    }
+
+    tc_lz_put_byte(output, (uint8_t)len);
+}
+
+/**
+ * @brief Write a sequence of literals followed by an optional match
+ *
+ * A matchLen of zero writes the final, literal-only sequence.
+ */
+void tc_lz_put_sequence(tc_lz_output *output, const uint8_t *literals, size_t literalLen, size_t offset, size_t matchLen)
+{
+    const size_t matchCode = matchLen > 0 ? matchLen - TC_LZ_MIN_MATCH : 0;
+    const uint8_t token = (uint8_t)((literalLen < 15 ? literalLen : 15) << 4 | (matchCode < 15 ? matchCode : 15));
+
+    tc_lz_put_byte(output, token);
+    if (literalLen >= 15)
+    {
+        tc_lz_put_length(output, literalLen - 15);
+    }
+
+    tc_lz_put(output, literals, literalLen);
+
+    if (matchLen == 0)
+    {
+        return;
+    }
+
+    tc_lz_put_byte(output, (uint8_t)(offset & 0xff));
+    tc_lz_put_byte(output, (uint8_t)(offset >> 8));
+    if (matchCode >= 15)
+    {
+        tc_lz_put_length(output, matchCode - 15);
+    }
+}
+
+/**
+ * @brief Compress a block
+ *
+ * Greedy single-pass compressor. Uses no heap, and a stack table of
+ * 1 << TC_LZ_HASH_BITS entries.
+ *
+ * @param[in]   dictionary  Optional. Preset dictionary.
+ * @param[in]   src         Data to compress.
+ * @param[in]   srcLen      Length of the data.
+ * @param[out]  dst         Output buffer.
+ * @param[in]   dstLen      Size of the output buffer.
+ * @param[out]  written     Length of the compressed block.
+ *
+ * @return Zero on success, MAX_SIZE_ERROR if the block does not fit,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_lz_compress(const tc_lz_dictionary *dictionary, const char *src, size_t srcLen, char *dst, size_t dstLen, size_t *written)
+{
+    if ((src == NULL && srcLen > 0) || dst == NULL || written == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    tc_lz_window window;
+    window.dictionary = dictionary != NULL ? (const uint8_t *)dictionary->data : NULL;
+    window.dictionaryLen = dictionary != NULL ? dictionary->len : 0;
+    window.data = (const uint8_t *)src;
+
+    tc_lz_output output = {(uint8_t *)dst, dstLen, 0, SUCCESS};
+
+    uint32_t table[1 << TC_LZ_HASH_BITS];
+    memset(table, 0xff, sizeof(table));
+
+    // Only the dictionary's last 64 KB can be matched
+    const size_t start = window.dictionaryLen;
+    const size_t end = start + srcLen;
+    size_t position = start > TC_LZ_MAX_OFFSET ? start - TC_LZ_MAX_OFFSET : 0;
+
+    for (; position + TC_LZ_MIN_MATCH <= start; position++)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, window.dictionary + position, sizeof(sequence));
+        table[tc_lz_hash(sequence)] = (uint32_t)position;
+    }
+
+    size_t anchor = start;
+    position = start;
+
+    while (position + TC_LZ_MIN_MATCH <= end && output.rc == SUCCESS)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, window.data + (position - start), sizeof(sequence));
+        const uint32_t hash = tc_lz_hash(sequence);
+        const uint32_t candidate = table[hash];
+        table[hash] = (uint32_t)position;
+
+        if (candidate == UINT32_MAX || position - candidate > TC_LZ_MAX_OFFSET)
+        {
+            position++;
+            continue;
+        }
+
+        uint32_t found;
+        if (candidate >= start)
+        {
+            memcpy(&found, window.data + (candidate - start), sizeof(found));
+        }
+        else
+        {
+            found = tc_lz_read32(&window, candidate);
+        }
+
+        if (found != sequence)
+        {
+            position++;
+            continue;
+        }
+
+        // Byte by byte while the match reads from the dictionary, then directly from the input
+        size_t matchLen = TC_LZ_MIN_MATCH;
+        while (candidate + matchLen < start && position + matchLen < end && window.dictionary[candidate + matchLen] == window.data[position + matchLen - start])
+        {
+            matchLen++;
+        }
+
+        if (candidate + matchLen >= start)
+        {
+            const uint8_t *from = window.data + (candidate + matchLen - start);
+            const uint8_t *to = window.data + (position + matchLen - start);
+            const uint8_t *limit = window.data + srcLen;
+
+            // Eight bytes at a time, then the differing word byte by byte
+            while (to + sizeof(uint64_t) <= limit)
+            {
+                uint64_t a;
+                uint64_t b;
+                memcpy(&a, from, sizeof(a));
+                memcpy(&b, to, sizeof(b));
+                if (a != b)
+                {
+                    break;
+                }
+                from += sizeof(a);
+                to += sizeof(b);
+            }
+            while (to < limit && *from == *to)
+            {
+                from++;
+                to++;
+            }
+            matchLen = (size_t)(to - window.data) + start - position;
+        }
+
+        tc_lz_put_sequence(&output, window.data + (anchor - start), position - anchor, position - candidate, matchLen);
+
+        position += matchLen;
+        anchor = position;
+    }
+
+    tc_lz_put_sequence(&output, window.data + (anchor - start), end - anchor, 0, 0);
+
+    *written = output.length;
+
+    return output.rc;
+}
+
+/**
+ * @brief Read the remainder of a length that did not fit its token nibble
+ */
+IoT_Error_t tc_lz_read_length(const uint8_t **cursor, const uint8_t *end, size_t *len)
+{
+    uint8_t byte;
+
+    do
+    {
+        if (*cursor >= end)
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        byte = *(*cursor)++;
+        *len += byte;
+    } while (byte == 255);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Decompress a block
+ *
+ * @param[in]   dictionary  Optional. The dictionary the block was compressed with.
+ * @param[in]   src         Compressed block.
+ * @param[in]   srcLen      Length of the block.
+ * @param[out]  dst         Output buffer.
+ * @param[in]   dstLen      Size of the output buffer.
+ * @param[out]  written     Length of the decompressed data.
+ *
+ * @return Zero on success, MAX_SIZE_ERROR if the data does not fit,
+ *         JSON_PARSE_ERROR if the block is malformed, negative value otherwise
+ */
+IoT_Error_t tc_lz_decompress(const tc_lz_dictionary *dictionary, const char *src, size_t srcLen, char *dst, size_t dstLen, size_t *written)
+{
+    if (src == NULL || (dst == NULL && dstLen > 0) || written == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    const uint8_t *cursor = (const uint8_t *)src;
+    const uint8_t *end = cursor + srcLen;
+    const uint8_t *dictionaryData = dictionary != NULL ? (const uint8_t *)dictionary->data : NULL;
+    const size_t dictionaryLen = dictionary != NULL ? dictionary->len : 0;
+    uint8_t *out = (uint8_t *)dst;
+    size_t length = 0;
+    IoT_Error_t rc = SUCCESS;
+
+    *written = 0;
+
+    while (cursor < end)
+    {
+        const uint8_t token = *cursor++;
+
+        size_t literalLen = token >> 4;
+        if (literalLen == 15)
+        {
+            rc = tc_lz_read_length(&cursor, end, &literalLen);
+            if (rc != SUCCESS)
+            {
+                return rc;
+            }
+        }
+
+        if (literalLen > (size_t)(end - cursor))
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        if (literalLen > dstLen - length)
+        {
+            return MAX_SIZE_ERROR;
+        }
+
+        memcpy(out + length, cursor, literalLen);
+        cursor += literalLen;
+        length += literalLen;
+
+        // The last sequence has no match
+        if (cursor == end)
+        {
+            break;
+        }
+
+        if (end - cursor < 2)
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        const size_t offset = (size_t)cursor[0] | (size_t)cursor[1] << 8;
+        cursor += 2;
+
+        size_t matchLen = token & 15;
+        if (matchLen == 15)
+        {
+            rc = tc_lz_read_length(&cursor, end, &matchLen);
+            if (rc != SUCCESS)
+            {
+                return rc;
+            }
+        }
+        matchLen += TC_LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > length + dictionaryLen)
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        if (matchLen > dstLen - length)
+        {
+            return MAX_SIZE_ERROR;
+        }
+
+        // Copy the part of the match that lies in the dictionary first
+        size_t copied = 0;
+        if (offset > length)
+        {
+            const size_t fromDictionary = offset - length;
+            copied = fromDictionary < matchLen ? fromDictionary : matchLen;
+            memcpy(out + length, dictionaryData + dictionaryLen - fromDictionary, copied);
+        }
+
+        // Matches may overlap their own output
+        if (offset >= matchLen - copied)
+        {
+            memcpy(out + length + copied, out + length + copied - offset, matchLen - copied);
+        }
+        else
+        {
+            for (; copied < matchLen; copied++)
+            {
+                out[length + copied] = out[length + copied - offset];
+            }
+        }
+
+        length += matchLen;
+    }
+
+    *written = length;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Check if a payload is compressed
+ */
+bool tc_lz_is_packed(const char *payload, size_t payloadLen)
+{
+    return payload != NULL && payloadLen > 0 && (uint8_t)payload[0] == TC_LZ_MARKER;
+}
+
+/**
+ * @brief Compress a payload into an envelope
+ *
+ * The envelope holds TC_LZ_MARKER, the dictionary id, the uncompressed
+ * length as a base 128 varint and the compressed block.
+ *
+ * @param[in]   dictionary  Optional. Preset dictionary.
+ * @param[in]   src         Payload to compress.
+ * @param[in]   srcLen      Length of the payload.
+ * @param[out]  dst         Output buffer.
+ * @param[in]   dstLen      Size of the output buffer. Pass less than srcLen
+ *                          to only accept envelopes smaller than the payload.
+ * @param[out]  written     Length of the envelope.
+ *
+ * @return Zero on success, MAX_SIZE_ERROR if the envelope does not fit,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_lz_pack(const tc_lz_dictionary *dictionary, const char *src, size_t srcLen, char *dst, size_t dstLen, size_t *written)
+{
+    if (dst == NULL || written == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    uint8_t header[2 + 10];
+    size_t headerLen = 0;
+
+    header[headerLen++] = TC_LZ_MARKER;
+    header[headerLen++] = dictionary != NULL ? dictionary->id : 0;
+    for (size_t len = srcLen;; len >>= 7)
+    {
+        header[headerLen++] = (uint8_t)((len & 0x7f) | (len > 0x7f ? 0x80 : 0));
+        if (len <= 0x7f)
+        {
+            break;
+        }
+    }
+
+    if (headerLen > dstLen)
+    {
+        return MAX_SIZE_ERROR;
+    }
+
+    memcpy(dst, header, headerLen);
+
+    size_t blockLen = 0;
+    const IoT_Error_t rc = tc_lz_compress(dictionary, src, srcLen, dst + headerLen, dstLen - headerLen, &blockLen);
+
+    *written = headerLen + blockLen;
+
+    return rc;
+}
+
+/**
+ * @brief Decompress an envelope
+ *
+ * @param[in]   dictionary  Optional. Dictionary of the receiver.
+ * @param[in]   src         Envelope, as written by tc_lz_pack.
+ * @param[in]   srcLen      Length of the envelope.
+ * @param[out]  dst         Output buffer.
+ * @param[in]   dstLen      Size of the output buffer.
+ * @param[out]  written     Length of the payload.
+ *
+ * @return Zero on success, MAX_SIZE_ERROR if the payload does not fit,
+ *         FAILURE if it was compressed with another dictionary,
+ *         JSON_PARSE_ERROR if the envelope is malformed
+ */
+IoT_Error_t tc_lz_unpack(const tc_lz_dictionary *dictionary, const char *src, size_t srcLen, char *dst, size_t dstLen, size_t *written)
+{
+    if (written == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    if (srcLen < 3 || !tc_lz_is_packed(src, srcLen))
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    const uint8_t id = (uint8_t)src[1];
+    if (id != (dictionary != NULL ? dictionary->id : 0))
+    {
+        return FAILURE;
+    }
+
+    size_t expected = 0;
+    size_t position = 2;
+    for (uint32_t shift = 0;; shift += 7)
+    {
+        if (position >= srcLen || shift > 63)
+        {
+            return JSON_PARSE_ERROR;
+        }
+
+        const uint8_t byte = (uint8_t)src[position++];
+        expected |= (size_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            break;
+        }
+    }
+
+    if (expected > dstLen)
+    {
+        return MAX_SIZE_ERROR;
+    }
+
+    const IoT_Error_t rc = tc_lz_decompress(id != 0 ? dictionary : NULL, src + position, srcLen - position, dst, expected, written);
+    if (rc == SUCCESS && *written != expected)
+    {
+        return JSON_PARSE_ERROR;
+    }
+
+    return rc == MAX_SIZE_ERROR ? JSON_PARSE_ERROR : rc;
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_LZ_ */
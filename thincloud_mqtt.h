@@ -0,0 +1,281 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_MQTT_
+#define THINCLOUD_EMBEDDED_C_SDK_MQTT_
+
+/*
+ * Thincloud C Embedded SDK - MQTT wire format
+ *
+ * MQTT 3.1.1 packet encoding used by the paths that write to the
+ * client's network stack directly instead of going through
+ * aws_iot_mqtt_publish.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_mqtt_client_interface.h"
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+#include "aws_iot_mqtt_client_common_internal.h"
+#endif
+
+#define TC_MQTT_CONNECT 0x10
+#define TC_MQTT_CONNACK 0x20
+#define TC_MQTT_PUBLISH 0x30
+#define TC_MQTT_PUBACK 0x40
+#define TC_MQTT_SUBSCRIBE 0x80
+#define TC_MQTT_SUBACK 0x90
+#define TC_MQTT_UNSUBSCRIBE 0xA0
+#define TC_MQTT_UNSUBACK 0xB0
+#define TC_MQTT_PINGREQ 0xC0
+#define TC_MQTT_PINGRESP 0xD0
+#define TC_MQTT_DISCONNECT 0xE0
+#define TC_MQTT_PUBLISH_DUP 0x08
+#define TC_MQTT_PUBLISH_QOS1 0x02
+#define TC_MQTT_PUBLISH_RETAIN 0x01
+
+/**
+ * Largest remaining length an MQTT packet can carry
+ */
+#define TC_MQTT_MAX_REMAINING_LENGTH 268435455
+
+/**
+ * @brief Encoded size of an MQTT remaining length
+ */
+size_t tc_mqtt_remaining_length_size(size_t length)
+{
+    if (length < 128)
+    {
+        return 1;
+    }
+    else if (length < 16384)
+    {
+        return 2;
+    }
+    else if (length < 2097152)
+    {
+        return 3;
+    }
+
+    return 4;
+}
+
+/**
+ * @brief Encode an MQTT remaining length
+ *
+ * @param[out]  buffer  Buffer with room for tc_mqtt_remaining_length_size(length) bytes.
+ * @param[in]   length  Remaining length.
+ *
+ * @return Number of bytes written
+ */
+size_t tc_mqtt_encode_remaining_length(unsigned char *buffer, size_t length)
+{
+    size_t written = 0;
+
+    do
+    {
+        unsigned char byte = (unsigned char)(length % 128);
+        length /= 128;
+        if (length > 0)
+        {
+            byte |= 0x80;
+        }
+        buffer[written++] = byte;
+    } while (length > 0);
+
+    return written;
+}
+
+/**
+ * @brief Decode an MQTT remaining length
+ *
+ * @param[in]   buffer     Bytes following the packet's first byte.
+ * @param[in]   available  Number of bytes available.
+ * @param[out]  length     Remaining length.
+ * @param[out]  size       Number of bytes the remaining length took.
+ *
+ * @return Zero on success, MQTT_NOTHING_TO_READ if more bytes are needed,
+ *         MQTT_DECODE_REMAINING_LENGTH_ERROR if the encoding is invalid
+ */
+IoT_Error_t tc_mqtt_decode_remaining_length(const unsigned char *buffer, size_t available, size_t *length, size_t *size)
+{
+    size_t value = 0;
+    size_t multiplier = 1;
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        if (i >= available)
+        {
+            return MQTT_NOTHING_TO_READ;
+        }
+
+        value += (buffer[i] & 0x7F) * multiplier;
+        multiplier *= 128;
+
+        if ((buffer[i] & 0x80) == 0)
+        {
+            *length = value;
+            *size = i + 1;
+            return SUCCESS;
+        }
+    }
+
+    return MQTT_DECODE_REMAINING_LENGTH_ERROR;
+}
+
+/**
+ * @brief Size of an encoded PUBLISH packet
+ */
+size_t tc_mqtt_publish_size(uint16_t topicLen, QoS qos, size_t payloadLen)
+{
+    const size_t remaining = 2 + (size_t)topicLen + (qos == QOS0 ? 0 : 2) + payloadLen;
+
+    return 1 + tc_mqtt_remaining_length_size(remaining) + remaining;
+}
+
+/**
+ * @brief Encode a PUBLISH packet
+ *
+ * @param[out]  buffer      Buffer to write to.
+ * @param[in]   bufferLen   Size of buffer.
+ * @param[in]   topic       Topic to publish to.
+ * @param[in]   topicLen    Length of the topic.
+ * @param[in]   qos         QOS0 or QOS1.
+ * @param[in]   dup         Sets the DUP flag on a retransmitted QOS1 packet.
+ * @param[in]   packetId    Packet ID, ignored for QOS0.
+ * @param[in]   payload     Message payload.
+ * @param[in]   payloadLen  Length of the payload.
+ * @param[out]  written     Optional. Length of the packet, or the length needed when buffer is too small.
+ *
+ * @return Zero on success, MQTT_TX_BUFFER_TOO_SHORT_ERROR if buffer is too small,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_mqtt_serialize_publish(unsigned char *buffer, size_t bufferLen, const char *topic, uint16_t topicLen, QoS qos, bool dup, uint16_t packetId, const void *payload, size_t payloadLen, size_t *written)
+{
+    if (buffer == NULL || topic == NULL || topicLen == 0 || (payload == NULL && payloadLen > 0))
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    const size_t remaining = 2 + (size_t)topicLen + (qos == QOS0 ? 0 : 2) + payloadLen;
+    if (remaining > TC_MQTT_MAX_REMAINING_LENGTH)
+    {
+        return MAX_SIZE_ERROR;
+    }
+
+    const size_t size = tc_mqtt_publish_size(topicLen, qos, payloadLen);
+    if (written != NULL)
+    {
+        *written = size;
+    }
+
+    if (size > bufferLen)
+    {
+        return MQTT_TX_BUFFER_TOO_SHORT_ERROR;
+    }
+
+    unsigned char *cursor = buffer;
+    *cursor++ = (unsigned char)(TC_MQTT_PUBLISH | (qos == QOS0 ? 0 : TC_MQTT_PUBLISH_QOS1) | (dup && qos != QOS0 ? TC_MQTT_PUBLISH_DUP : 0));
+    cursor += tc_mqtt_encode_remaining_length(cursor, remaining);
+
+    *cursor++ = (unsigned char)(topicLen >> 8);
+    *cursor++ = (unsigned char)(topicLen & 0xFF);
+    memcpy(cursor, topic, topicLen);
+    cursor += topicLen;
+
+    if (qos != QOS0)
+    {
+        *cursor++ = (unsigned char)(packetId >> 8);
+        *cursor++ = (unsigned char)(packetId & 0xFF);
+    }
+
+    if (payloadLen > 0)
+    {
+        memcpy(cursor, payload, payloadLen);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Write encoded packets to a client's network stack
+ *
+ * Writes the whole buffer, in as few transport writes as the network
+ * stack allows, within the client's command timeout. Must be called from
+ * the thread that yields the client.
+ *
+ * @param[in]  client  Connected AWS IoT MQTT Client instance.
+ * @param[in]  buffer  Encoded packets.
+ * @param[in]  length  Length of buffer.
+ *
+ * @return Zero on success, NETWORK_DISCONNECTED_ERROR if the client is not
+ *         connected, negative value otherwise
+ */
+IoT_Error_t tc_mqtt_write(AWS_IoT_Client *client, const unsigned char *buffer, size_t length)
+{
+    if (client == NULL || buffer == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    if (!aws_iot_mqtt_is_client_connected(client))
+    {
+        return NETWORK_DISCONNECTED_ERROR;
+    }
+
+    Timer timer;
+    init_timer(&timer);
+    countdown_ms(&timer, client->clientData.commandTimeoutMs);
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+    IoT_Error_t rc = aws_iot_mqtt_client_lock_mutex(client, &client->clientData.tls_write_mutex);
+    if (rc != SUCCESS)
+    {
+        return rc;
+    }
+#else
+    IoT_Error_t rc = SUCCESS;
+#endif
+
+    size_t sent = 0;
+    while (sent < length && !has_timer_expired(&timer))
+    {
+        size_t written = 0;
+        rc = client->networkStack.write(&client->networkStack, (unsigned char *)buffer + sent, length - sent, &timer, &written);
+        if (rc != SUCCESS)
+        {
+            break;
+        }
+        sent += written;
+    }
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+    aws_iot_mqtt_client_unlock_mutex(client, &client->clientData.tls_write_mutex);
+#endif
+
+    if (rc == SUCCESS && sent < length)
+    {
+        rc = NETWORK_SSL_WRITE_TIMEOUT_ERROR;
+    }
+
+    return rc;
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_MQTT_ */
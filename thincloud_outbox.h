@@ -0,0 +1,600 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_OUTBOX_
+#define THINCLOUD_EMBEDDED_C_SDK_OUTBOX_
+
+/*
+ * Thincloud C Embedded SDK - Offline outbox
+ *
+ * Fixed-size ring of (topic, payload, qos) records in a memory-mapped
+ * file. Messages that cannot be sent while the link is down are appended
+ * and replayed in order once the client reconnects.
+ *
+ * The file starts with a header page holding two copies of the ring
+ * state, written alternately and each protected by a CRC. A record is
+ * written in full before the state that makes it visible, and a record
+ * stays in the ring until it has been published, so a crash at any point
+ * loses nothing that was appended; at worst the last record replayed
+ * before the crash is published twice.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_mqtt_client_interface.h"
+
+#include "thincloud_json.h"
+
+#define TC_OUTBOX_MAGIC 0x54434f42
+#define TC_OUTBOX_VERSION 1
+#define TC_OUTBOX_HEADER_LENGTH 4096
+#define TC_OUTBOX_RECORD_HEADER_LENGTH 16
+#define TC_OUTBOX_ALIGNMENT 8
+
+/**
+ * @brief Ring state, stored twice in the header page
+ *
+ * head and tail are byte positions that only grow; their offset in the
+ * ring is the position modulo the capacity.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t sequence;
+    uint64_t head;
+    uint64_t tail;
+    uint32_t count;
+    uint32_t crc;
+} tc_outbox_state;
+
+/**
+ * @brief Offline outbox
+ */
+typedef struct
+{
+    int fd;
+    unsigned char *map;
+    size_t mapLen;
+    unsigned char *ring;
+    tc_outbox_state state;
+    bool sync;
+} tc_outbox;
+
+/**
+ * @brief Record read from an outbox
+ *
+ * Slices point into the mapped file and are valid until the record is popped.
+ */
+typedef struct
+{
+    tc_slice topic;
+    tc_slice payload;
+    QoS qos;
+} tc_outbox_record;
+
+/**
+ * @brief CRC-32 (IEEE) lookup table, reflected polynomial 0xEDB88320
+ */
+static const uint32_t tc_crc32_table[256] = {
+        0x00000000u, 0x77073096u, 0xee0e612cu, 0x990951bau, 0x076dc419u, 0x706af48fu,
+        0xe963a535u, 0x9e6495a3u, 0x0edb8832u, 0x79dcb8a4u, 0xe0d5e91eu, 0x97d2d988u,
+        0x09b64c2bu, 0x7eb17cbdu, 0xe7b82d07u, 0x90bf1d91u, 0x1db71064u, 0x6ab020f2u,
+        0xf3b97148u, 0x84be41deu, 0x1adad47du, 0x6ddde4ebu, 0xf4d4b551u, 0x83d385c7u,
+        0x136c9856u, 0x646ba8c0u, 0xfd62f97au, 0x8a65c9ecu, 0x14015c4fu, 0x63066cd9u,
+        0xfa0f3d63u, 0x8d080df5u, 0x3b6e20c8u, 0x4c69105eu, 0xd56041e4u, 0xa2677172u,
+        0x3c03e4d1u, 0x4b04d447u, 0xd20d85fdu, 0xa50ab56bu, 0x35b5a8fau, 0x42b2986cu,
+        0xdbbbc9d6u, 0xacbcf940u, 0x32d86ce3u, 0x45df5c75u, 0xdcd60dcfu, 0xabd13d59u,
+        0x26d930acu, 0x51de003au, 0xc8d75180u, 0xbfd06116u, 0x21b4f4b5u, 0x56b3c423u,
+        0xcfba9599u, 0xb8bda50fu, 0x2802b89eu, 0x5f058808u, 0xc60cd9b2u, 0xb10be924u,
+        0x2f6f7c87u, 0x58684c11u, 0xc1611dabu, 0xb6662d3du, 0x76dc4190u, 0x01db7106u,
+        0x98d220bcu, 0xefd5102au, 0x71b18589u, 0x06b6b51fu, 0x9fbfe4a5u, 0xe8b8d433u,
+        0x7807c9a2u, 0x0f00f934u, 0x9609a88eu, 0xe10e9818u, 0x7f6a0dbbu, 0x086d3d2du,
+        0x91646c97u, 0xe6635c01u, 0x6b6b51f4u, 0x1c6c6162u, 0x856530d8u, 0xf262004eu,
+        0x6c0695edu, 0x1b01a57bu, 0x8208f4c1u, 0xf50fc457u, 0x65b0d9c6u, 0x12b7e950u,
+        0x8bbeb8eau, 0xfcb9887cu, 0x62dd1ddfu, 0x15da2d49u, 0x8cd37cf3u, 0xfbd44c65u,
+        0x4db26158u, 0x3ab551ceu, 0xa3bc0074u, 0xd4bb30e2u, 0x4adfa541u, 0x3dd895d7u,
+        0xa4d1c46du, 0xd3d6f4fbu, 0x4369e96au, 0x346ed9fcu, 0xad678846u, 0xda60b8d0u,
+        0x44042d73u, 0x33031de5u, 0xaa0a4c5fu, 0xdd0d7cc9u, 0x5005713cu, 0x270241aau,
+        0xbe0b1010u, 0xc90c2086u, 0x5768b525u, 0x206f85b3u, 0xb966d409u, 0xce61e49fu,
+        0x5edef90eu, 0x29d9c998u, 0xb0d09822u, 0xc7d7a8b4u, 0x59b33d17u, 0x2eb40d81u,
+        0xb7bd5c3bu, 0xc0ba6cadu, 0xedb88320u, 0x9abfb3b6u, 0x03b6e20cu, 0x74b1d29au,
+        0xead54739u, 0x9dd277afu, 0x04db2615u, 0x73dc1683u, 0xe3630b12u, 0x94643b84u,
+        0x0d6d6a3eu, 0x7a6a5aa8u, 0xe40ecf0bu, 0x9309ff9du, 0x0a00ae27u, 0x7d079eb1u,
+        0xf00f9344u, 0x8708a3d2u, 0x1e01f268u, 0x6906c2feu, 0xf762575du, 0x806567cbu,
+        0x196c3671u, 0x6e6b06e7u, 0xfed41b76u, 0x89d32be0u, 0x10da7a5au, 0x67dd4accu,
+        0xf9b9df6fu, 0x8ebeeff9u, 0x17b7be43u, 0x60b08ed5u, 0xd6d6a3e8u, 0xa1d1937eu,
+        0x38d8c2c4u, 0x4fdff252u, 0xd1bb67f1u, 0xa6bc5767u, 0x3fb506ddu, 0x48b2364bu,
+        0xd80d2bdau, 0xaf0a1b4cu, 0x36034af6u, 0x41047a60u, 0xdf60efc3u, 0xa867df55u,
+        0x316e8eefu, 0x4669be79u, 0xcb61b38cu, 0xbc66831au, 0x256fd2a0u, 0x5268e236u,
+        0xcc0c7795u, 0xbb0b4703u, 0x220216b9u, 0x5505262fu, 0xc5ba3bbeu, 0xb2bd0b28u,
+        0x2bb45a92u, 0x5cb36a04u, 0xc2d7ffa7u, 0xb5d0cf31u, 0x2cd99e8bu, 0x5bdeae1du,
+        0x9b64c2b0u, 0xec63f226u, 0x756aa39cu, 0x026d930au, 0x9c0906a9u, 0xeb0e363fu,
+        0x72076785u, 0x05005713u, 0x95bf4a82u, 0xe2b87a14u, 0x7bb12baeu, 0x0cb61b38u,
+        0x92d28e9bu, 0xe5d5be0du, 0x7cdcefb7u, 0x0bdbdf21u, 0x86d3d2d4u, 0xf1d4e242u,
+        0x68ddb3f8u, 0x1fda836eu, 0x81be16cdu, 0xf6b9265bu, 0x6fb077e1u, 0x18b74777u,
+        0x88085ae6u, 0xff0f6a70u, 0x66063bcau, 0x11010b5cu, 0x8f659effu, 0xf862ae69u,
+        0x616bffd3u, 0x166ccf45u, 0xa00ae278u, 0xd70dd2eeu, 0x4e048354u, 0x3903b3c2u,
+        0xa7672661u, 0xd06016f7u, 0x4969474du, 0x3e6e77dbu, 0xaed16a4au, 0xd9d65adcu,
+        0x40df0b66u, 0x37d83bf0u, 0xa9bcae53u, 0xdebb9ec5u, 0x47b2cf7fu, 0x30b5ffe9u,
+        0xbdbdf21cu, 0xcabac28au, 0x53b39330u, 0x24b4a3a6u, 0xbad03605u, 0xcdd70693u,
+        0x54de5729u, 0x23d967bfu, 0xb3667a2eu, 0xc4614ab8u, 0x5d681b02u, 0x2a6f2b94u,
+        0xb40bbe37u, 0xc30c8ea1u, 0x5a05df1bu, 0x2d02ef8du
+};
+
+/**
+ * @brief CRC-32 (IEEE) of a byte string
+ */
+uint32_t tc_crc32(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = tc_crc32_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+/**
+ * @brief Flush a range of the mapping to the file when the outbox syncs
+ */
+void tc_outbox_sync(tc_outbox *outbox, const unsigned char *start, size_t len)
+{
+    if (!outbox->sync || len == 0)
+    {
+        return;
+    }
+
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t offset = (size_t)(start - outbox->map);
+    const size_t aligned = offset - offset % page;
+
+    msync(outbox->map + aligned, offset - aligned + len, MS_SYNC);
+}
+
+/**
+ * @brief Persist the ring state
+ *
+ * Writes the next sequence number to the older of the two state copies,
+ * so a torn write leaves the newer one intact.
+ */
+void tc_outbox_commit(tc_outbox *outbox)
+{
+    outbox->state.sequence++;
+    outbox->state.crc = tc_crc32(0, &outbox->state, offsetof(tc_outbox_state, crc));
+
+    unsigned char *copy = outbox->map + (outbox->state.sequence % 2) * sizeof(tc_outbox_state);
+    memcpy(copy, &outbox->state, sizeof(outbox->state));
+
+    tc_outbox_sync(outbox, copy, sizeof(outbox->state));
+}
+
+/**
+ * @brief Open or create an outbox file
+ *
+ * An existing outbox keeps its capacity and contents.
+ *
+ * @param[out]  outbox    Outbox to open.
+ * @param[in]   path      Path of the ring file.
+ * @param[in]   capacity  Size of the ring in bytes for a new file, rounded up to 8 bytes.
+ * @param[in]   sync      Flush every append and removal to storage with msync, surviving
+ *                        power loss as well as crashes at the cost of throughput.
+ *
+ * @return Zero on success, FAILURE if the file cannot be opened or mapped,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_outbox_open(tc_outbox *outbox, const char *path, size_t capacity, bool sync)
+{
+    if (outbox == NULL || path == NULL)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    memset(outbox, 0, sizeof(*outbox));
+    outbox->fd = -1;
+    outbox->sync = sync;
+
+    capacity = (capacity + TC_OUTBOX_ALIGNMENT - 1) & ~(size_t)(TC_OUTBOX_ALIGNMENT - 1);
+    if (capacity < 2 * TC_OUTBOX_RECORD_HEADER_LENGTH)
+    {
+        return MAX_SIZE_ERROR;
+    }
+
+    const int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+    {
+        return FAILURE;
+    }
+
+    // Recover the newest valid state, if the file has one
+    tc_outbox_state copies[2];
+    tc_outbox_state *recovered = NULL;
+
+    if (pread(fd, copies, sizeof(copies), 0) == (ssize_t)sizeof(copies))
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            if (copies[i].magic == TC_OUTBOX_MAGIC &&
+                copies[i].version == TC_OUTBOX_VERSION &&
+                copies[i].crc == tc_crc32(0, &copies[i], offsetof(tc_outbox_state, crc)) &&
+                (recovered == NULL || copies[i].sequence > recovered->sequence))
+            {
+                recovered = &copies[i];
+            }
+        }
+    }
+
+    if (recovered != NULL)
+    {
+        outbox->state = *recovered;
+        capacity = (size_t)recovered->capacity;
+    }
+
+    outbox->mapLen = TC_OUTBOX_HEADER_LENGTH + capacity;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || ((size_t)info.st_size < outbox->mapLen && ftruncate(fd, (off_t)outbox->mapLen) != 0))
+    {
+        close(fd);
+        return FAILURE;
+    }
+
+    void *map = mmap(NULL, outbox->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return FAILURE;
+    }
+
+    outbox->fd = fd;
+    outbox->map = (unsigned char *)map;
+    outbox->ring = outbox->map + TC_OUTBOX_HEADER_LENGTH;
+
+    if (recovered == NULL)
+    {
+        outbox->state.magic = TC_OUTBOX_MAGIC;
+        outbox->state.version = TC_OUTBOX_VERSION;
+        outbox->state.capacity = capacity;
+        tc_outbox_commit(outbox);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Close an outbox
+ *
+ * Unmaps the file; its contents stay on disk for the next open.
+ */
+void tc_outbox_close(tc_outbox *outbox)
+{
+    if (outbox->map != NULL)
+    {
+        munmap(outbox->map, outbox->mapLen);
+        outbox->map = NULL;
+    }
+
+    if (outbox->fd >= 0)
+    {
+        close(outbox->fd);
+        outbox->fd = -1;
+    }
+}
+
+/**
+ * @brief Number of records in an outbox
+ */
+uint32_t tc_outbox_count(const tc_outbox *outbox)
+{
+    return outbox->state.count;
+}
+
+/**
+ * @brief Append a message
+ *
+ * @param[in]  outbox      Outbox.
+ * @param[in]  topic       Topic to publish to.
+ * @param[in]  topicLen    Length of the topic.
+ * @param[in]  payload     Message payload.
+ * @param[in]  payloadLen  Length of the payload.
+ * @param[in]  qos         QoS to publish with.
+ *
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the outbox is full,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_outbox_append(tc_outbox *outbox, const char *topic, uint16_t topicLen, const char *payload, size_t payloadLen, QoS qos)
+{
+    if (outbox == NULL || outbox->map == NULL || topic == NULL || (payload == NULL && payloadLen > 0))
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    const uint64_t capacity = outbox->state.capacity;
+    const uint64_t size = (TC_OUTBOX_RECORD_HEADER_LENGTH + topicLen + payloadLen + TC_OUTBOX_ALIGNMENT - 1) & ~(uint64_t)(TC_OUTBOX_ALIGNMENT - 1);
+    if (size > capacity || payloadLen > UINT32_MAX)
+    {
+        return MAX_SIZE_ERROR;
+    }
+
+    // Records never wrap; a record that does not fit before the end of the
+    // ring starts over at offset zero and the rest of the ring is skipped
+    uint64_t tail = outbox->state.tail;
+
+    // An empty ring starts over at offset zero, so a large record never has
+    // to skip more of it than is free
+    if (outbox->state.count == 0 && tail % capacity != 0)
+    {
+        tail += capacity - tail % capacity;
+        outbox->state.head = tail;
+    }
+
+    const uint64_t offset = tail % capacity;
+    const uint64_t skip = offset + size > capacity ? capacity - offset : 0;
+
+    if (tail + skip + size - outbox->state.head > capacity)
+    {
+        return LIMIT_EXCEEDED_ERROR;
+    }
+
+    if (skip > 0)
+    {
+        const uint32_t wrap = 0;
+        memcpy(outbox->ring + offset, &wrap, sizeof(wrap));
+        tail += skip;
+    }
+
+    unsigned char *record = outbox->ring + tail % capacity;
+    const uint32_t recordLen = (uint32_t)size;
+    const uint32_t length = (uint32_t)payloadLen;
+
+    memcpy(record, &recordLen, 4);
+    record[8] = (unsigned char)qos;
+    record[9] = 0;
+    memcpy(record + 10, &topicLen, 2);
+    memcpy(record + 12, &length, 4);
+    memcpy(record + TC_OUTBOX_RECORD_HEADER_LENGTH, topic, topicLen);
+    if (payloadLen > 0)
+    {
+        memcpy(record + TC_OUTBOX_RECORD_HEADER_LENGTH + topicLen, payload, payloadLen);
+    }
+
+    const uint32_t crc = tc_crc32(0, record + 8, TC_OUTBOX_RECORD_HEADER_LENGTH - 8 + topicLen + payloadLen);
+    memcpy(record + 4, &crc, 4);
+
+    tc_outbox_sync(outbox, record, (size_t)size);
+
+    outbox->state.tail = tail + size;
+    outbox->state.count++;
+    tc_outbox_commit(outbox);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Read the record at a ring position
+ *
+ * Positions come from the ring state: the head, or the next position
+ * returned for an earlier record. The caller keeps the position within
+ * the records in the ring.
+ *
+ * @param[in]   outbox    Outbox.
+ * @param[in]   position  Ring position of the record.
+ * @param[out]  record    Record at position.
+ * @param[out]  next      Optional. Ring position of the record after it.
+ *
+ * @return Zero on success, FAILURE if the record is corrupt
+ */
+IoT_Error_t tc_outbox_read(tc_outbox *outbox, uint64_t position, tc_outbox_record *record, uint64_t *next)
+{
+    const uint64_t capacity = outbox->state.capacity;
+    uint64_t offset = position % capacity;
+
+    // A stale head after a power loss can point anywhere in the ring, so
+    // check each field fits before reading it
+    uint32_t recordLen = 0;
+    if (offset + 4 <= capacity)
+    {
+        memcpy(&recordLen, outbox->ring + offset, 4);
+    }
+    if (recordLen == 0)
+    {
+        position += capacity - offset;
+        offset = 0;
+        memcpy(&recordLen, outbox->ring, 4);
+    }
+
+    const unsigned char *data = outbox->ring + offset;
+
+    uint32_t crc = 0;
+    uint16_t topicLen = 0;
+    uint32_t payloadLen = 0;
+    bool valid = recordLen >= TC_OUTBOX_RECORD_HEADER_LENGTH && offset + recordLen <= capacity;
+    if (valid)
+    {
+        memcpy(&crc, data + 4, 4);
+        memcpy(&topicLen, data + 10, 2);
+        memcpy(&payloadLen, data + 12, 4);
+
+        valid = (uint64_t)TC_OUTBOX_RECORD_HEADER_LENGTH + topicLen + payloadLen <= recordLen &&
+                crc == tc_crc32(0, data + 8, TC_OUTBOX_RECORD_HEADER_LENGTH - 8 + topicLen + (size_t)payloadLen);
+    }
+
+    if (!valid)
+    {
+        return FAILURE;
+    }
+
+    record->qos = data[8] == QOS1 ? QOS1 : QOS0;
+    record->topic.data = (const char *)data + TC_OUTBOX_RECORD_HEADER_LENGTH;
+    record->topic.len = topicLen;
+    record->payload.data = record->topic.data + topicLen;
+    record->payload.len = payloadLen;
+
+    if (next != NULL)
+    {
+        *next = position + recordLen;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Read the oldest record without removing it
+ *
+ * @param[in]   outbox   Outbox.
+ * @param[out]  record   Oldest record.
+ * @param[out]  corrupt  Optional. Set when the record fails its length or CRC check.
+ *
+ * @return Zero on success, MQTT_NOTHING_TO_READ if the outbox is empty,
+ *         FAILURE if the record is corrupt
+ */
+IoT_Error_t tc_outbox_peek(tc_outbox *outbox, tc_outbox_record *record, bool *corrupt)
+{
+    if (corrupt != NULL)
+    {
+        *corrupt = false;
+    }
+
+    if (outbox->state.count == 0)
+    {
+        return MQTT_NOTHING_TO_READ;
+    }
+
+    const IoT_Error_t rc = tc_outbox_read(outbox, outbox->state.head, record, NULL);
+    if (rc != SUCCESS && corrupt != NULL)
+    {
+        *corrupt = true;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Ring position of the oldest record
+ */
+uint64_t tc_outbox_head(const tc_outbox *outbox)
+{
+    return outbox->state.head;
+}
+
+/**
+ * @brief Remove the oldest record
+ *
+ * @param[in]  outbox  Outbox.
+ *
+ * @return Zero on success, MQTT_NOTHING_TO_READ if the outbox is empty
+ */
+IoT_Error_t tc_outbox_pop(tc_outbox *outbox)
+{
+    if (outbox->state.count == 0)
+    {
+        return MQTT_NOTHING_TO_READ;
+    }
+
+    const uint64_t capacity = outbox->state.capacity;
+    uint64_t head = outbox->state.head;
+
+    uint32_t recordLen = 0;
+    if (head % capacity + 4 <= capacity)
+    {
+        memcpy(&recordLen, outbox->ring + head % capacity, 4);
+    }
+    if (recordLen == 0)
+    {
+        head += capacity - head % capacity;
+        memcpy(&recordLen, outbox->ring, 4);
+    }
+
+    outbox->state.head = head + recordLen;
+    outbox->state.count--;
+
+    if (outbox->state.count == 0)
+    {
+        outbox->state.head = outbox->state.tail;
+    }
+
+    tc_outbox_commit(outbox);
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Discard every record
+ */
+void tc_outbox_clear(tc_outbox *outbox)
+{
+    outbox->state.head = outbox->state.tail;
+    outbox->state.count = 0;
+    tc_outbox_commit(outbox);
+}
+
+/**
+ * @brief Publish every record in order
+ *
+ * Stops at the first failed publish and leaves that record at the head.
+ * A corrupt ring, which can only follow a power loss without sync, is
+ * discarded.
+ *
+ * @param[in]  outbox  Outbox.
+ * @param[in]  client  Connected AWS IoT MQTT Client instance.
+ *
+ * @return Zero once the outbox is empty, negative value otherwise
+ */
+IoT_Error_t tc_outbox_drain(tc_outbox *outbox, AWS_IoT_Client *client)
+{
+    tc_outbox_record record;
+    IoT_Error_t rc = SUCCESS;
+    bool corrupt = false;
+
+    while ((rc = tc_outbox_peek(outbox, &record, &corrupt)) == SUCCESS)
+    {
+        IoT_Publish_Message_Params params;
+        params.qos = record.qos;
+        params.isRetained = false;
+        params.payload = (void *)record.payload.data;
+        params.payloadLen = record.payload.len;
+
+        rc = aws_iot_mqtt_publish(client, record.topic.data, (uint16_t)record.topic.len, &params);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+
+        tc_outbox_pop(outbox);
+    }
+
+    if (corrupt)
+    {
+        tc_outbox_clear(outbox);
+        return rc;
+    }
+
+    return SUCCESS;
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_OUTBOX_ */
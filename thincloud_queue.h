@@ -0,0 +1,238 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_QUEUE_
+#define THINCLOUD_EMBEDDED_C_SDK_QUEUE_
+
+/*
+ * Thincloud C Embedded SDK - Multi-producer, single-consumer queue
+ *
+ * Bounded lock-free queue of caller-owned slots. Producers on any thread
+ * reserve a slot, fill it in place and commit it; a single consumer
+ * takes committed slots in reservation order. Each slot carries a
+ * sequence number that tells producers and the consumer whose turn it
+ * is, so neither side ever waits on a lock.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// C++ has the same atomics under std, but not stdatomic.h before C++23
+#ifdef __cplusplus
+#include <atomic>
+using std::atomic_bool;
+using std::atomic_compare_exchange_strong_explicit;
+using std::atomic_compare_exchange_weak_explicit;
+using std::atomic_exchange_explicit;
+using std::atomic_init;
+using std::atomic_load_explicit;
+using std::atomic_size_t;
+using std::atomic_store_explicit;
+using std::memory_order_acq_rel;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+#define TC_ALIGNAS(alignment) alignas(alignment)
+#else
+#include <stdatomic.h>
+#define TC_ALIGNAS(alignment) _Alignas(alignment)
+#endif
+
+#include "aws_iot_error.h"
+
+/**
+ * Assumed cache line size, used to keep the producer and consumer
+ * positions apart
+ */
+#ifndef TC_CACHE_LINE_SIZE
+#define TC_CACHE_LINE_SIZE 64
+#endif
+
+/**
+ * @brief Queue slot header
+ *
+ * Must be the first member of each slot.
+ */
+typedef struct
+{
+    atomic_size_t sequence;
+} tc_queue_cell;
+
+/**
+ * @brief Multi-producer, single-consumer queue
+ */
+typedef struct
+{
+    unsigned char *cells;
+    size_t stride;
+    size_t mask;
+    TC_ALIGNAS(TC_CACHE_LINE_SIZE) atomic_size_t tail;
+    TC_ALIGNAS(TC_CACHE_LINE_SIZE) size_t head;
+} tc_queue;
+
+/**
+ * @brief Slot header at a queue position
+ */
+tc_queue_cell *tc_queue_cell_at(const tc_queue *queue, size_t position)
+{
+    return (tc_queue_cell *)(void *)(queue->cells + (position & queue->mask) * queue->stride);
+}
+
+/**
+ * @brief Initialize an empty queue
+ *
+ * @param[out]  queue     Queue to initialize.
+ * @param[in]   cells     First of capacity slots, each starting with a tc_queue_cell.
+ * @param[in]   stride    Size of a slot.
+ * @param[in]   capacity  Number of slots. Must be a power of two.
+ *
+ * @return Zero on success, negative value otherwise
+ */
+IoT_Error_t tc_queue_init(tc_queue *queue, tc_queue_cell *cells, size_t stride, size_t capacity)
+{
+    if (queue == NULL || cells == NULL || stride < sizeof(tc_queue_cell))
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        return MAX_SIZE_ERROR;
+    }
+
+    queue->cells = (unsigned char *)cells;
+    queue->stride = stride;
+    queue->mask = capacity - 1;
+    atomic_init(&queue->tail, 0);
+    queue->head = 0;
+
+    for (size_t i = 0; i < capacity; i++)
+    {
+        atomic_init(&tc_queue_cell_at(queue, i)->sequence, i);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Reserve a slot to fill
+ *
+ * Safe to call from any thread. The slot must be committed once filled,
+ * or cancelled.
+ *
+ * @param[in]   queue     Queue.
+ * @param[out]  position  Position of the reserved slot.
+ *
+ * @return true if a slot was reserved, false if the queue is full
+ */
+bool tc_queue_reserve(tc_queue *queue, size_t *position)
+{
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    for (;;)
+    {
+        const size_t sequence = atomic_load_explicit(&tc_queue_cell_at(queue, tail)->sequence, memory_order_acquire);
+        const intptr_t diff = (intptr_t)sequence - (intptr_t)tail;
+
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &tail, tail + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                *position = tail;
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Hand a filled slot to the consumer
+ */
+void tc_queue_commit(tc_queue *queue, size_t position)
+{
+    atomic_store_explicit(&tc_queue_cell_at(queue, position)->sequence, position + 1, memory_order_release);
+}
+
+/**
+ * @brief Give back a reserved slot without filling it
+ *
+ * Succeeds only while no later slot has been reserved; otherwise the
+ * consumer is waiting on this position and the slot must be committed.
+ *
+ * @param[in]  queue     Queue.
+ * @param[in]  position  Position of the reserved slot.
+ *
+ * @return true if the reservation was undone
+ */
+bool tc_queue_cancel(tc_queue *queue, size_t position)
+{
+    size_t tail = position + 1;
+
+    return atomic_compare_exchange_strong_explicit(&queue->tail, &tail, position, memory_order_relaxed, memory_order_relaxed);
+}
+
+/**
+ * @brief Oldest committed slot
+ *
+ * Consumer only. A slot reserved earlier but not yet committed holds back
+ * the slots after it.
+ *
+ * @param[in]   queue     Queue.
+ * @param[out]  position  Position of the slot.
+ *
+ * @return true if a committed slot is available
+ */
+bool tc_queue_peek(tc_queue *queue, size_t *position)
+{
+    const size_t head = queue->head;
+    const size_t sequence = atomic_load_explicit(&tc_queue_cell_at(queue, head)->sequence, memory_order_acquire);
+
+    if (sequence != head + 1)
+    {
+        return false;
+    }
+
+    *position = head;
+
+    return true;
+}
+
+/**
+ * @brief Return the oldest slot to the producers
+ *
+ * Consumer only.
+ */
+void tc_queue_release(tc_queue *queue, size_t position)
+{
+    atomic_store_explicit(&tc_queue_cell_at(queue, position)->sequence, position + queue->mask + 1, memory_order_release);
+    queue->head = position + 1;
+}
+
+/**
+ * @brief Slot at a queue position
+ */
+#define TC_QUEUE_SLOT(queue, position, type) ((type *)(void *)tc_queue_cell_at((queue), (position)))
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_QUEUE_ */
@@ -0,0 +1,422 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_SCAN_
+#define THINCLOUD_EMBEDDED_C_SDK_SCAN_
+
+/*
+ * Thincloud C Embedded SDK - Structural scanner
+ *
+ * Classifies JSON text 64 bytes at a time into bitmasks of quotes,
+ * backslashes, control characters, whitespace and structural
+ * characters, then resolves escapes and string spans with bit
+ * arithmetic, as simdjson's first stage does. The result is iterated as
+ * a stream of token positions, so a parser visits each string and
+ * scalar once instead of each byte. Nothing is stored beyond the
+ * current block.
+ *
+ * On x86 the block is classified with SSE2 or AVX2, picked at run time
+ * from what the CPU supports. Other targets use the portable kernel.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(TC_SCAN_NO_SIMD)
+#define TC_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#define TC_SCAN_BLOCK 64
+
+/**
+ * @brief Character classes of a 64-byte block, one bit per byte
+ */
+typedef struct
+{
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t control;
+    uint64_t whitespace;
+    uint64_t structural;
+} tc_scan_masks;
+
+/**
+ * @brief Classify the TC_SCAN_BLOCK bytes at block
+ */
+typedef void (*tc_scan_kernel)(const char *block, tc_scan_masks *masks);
+
+typedef enum
+{
+    TC_SCAN_SCALAR = 0,
+    TC_SCAN_SSE2,
+    TC_SCAN_AVX2
+} tc_scan_isa;
+
+/**
+ * Widest instruction set the CPU supports, detected once
+ */
+static tc_scan_isa tc_scan_cpu_isa = TC_SCAN_SCALAR;
+static pthread_once_t tc_scan_cpu_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Widest instruction set tc_scan_select may pick, see tc_scan_set_max_isa
+ */
+static tc_scan_isa tc_scan_max_isa = TC_SCAN_AVX2;
+
+/**
+ * @brief Portable block kernel
+ */
+void tc_scan_block_scalar(const char *block, tc_scan_masks *masks)
+{
+    uint64_t quote = 0;
+    uint64_t backslash = 0;
+    uint64_t control = 0;
+    uint64_t whitespace = 0;
+    uint64_t structural = 0;
+
+    for (uint32_t i = 0; i < TC_SCAN_BLOCK; i++)
+    {
+        const unsigned char c = (unsigned char)block[i];
+        const uint64_t bit = (uint64_t)1 << i;
+
+        if (c == '"')
+        {
+            quote |= bit;
+        }
+        else if (c == '\\')
+        {
+            backslash |= bit;
+        }
+        else if (c == ' ')
+        {
+            whitespace |= bit;
+        }
+        else if (c < 0x20)
+        {
+            control |= bit;
+            whitespace |= (c == '\n' || c == '\r' || c == '\t') ? bit : 0;
+        }
+        else if ((c | 0x20) == '{' || (c | 0x20) == '}' || c == ':' || c == ',')
+        {
+            // Setting bit 5 folds '[' onto '{' and ']' onto '}'
+            structural |= bit;
+        }
+    }
+
+    masks->quote = quote;
+    masks->backslash = backslash;
+    masks->control = control;
+    masks->whitespace = whitespace;
+    masks->structural = structural;
+}
+
+#ifdef TC_SCAN_X86
+
+/**
+ * @brief SSE2 block kernel
+ */
+__attribute__((target("sse2"))) void tc_scan_block_sse2(const char *block, tc_scan_masks *masks)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i lastControl = _mm_set1_epi8(0x1f);
+    const __m128i fold = _mm_set1_epi8(0x20);
+    const __m128i openBracket = _mm_set1_epi8('{');
+    const __m128i closeBracket = _mm_set1_epi8('}');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i carriageReturn = _mm_set1_epi8('\r');
+
+    uint64_t quoteBits = 0;
+    uint64_t backslashBits = 0;
+    uint64_t controlBits = 0;
+    uint64_t whitespaceBits = 0;
+    uint64_t structuralBits = 0;
+
+    for (uint32_t i = 0; i < TC_SCAN_BLOCK; i += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128((const __m128i *)(block + i));
+        const __m128i folded = _mm_or_si128(bytes, fold);
+        const __m128i structural = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, openBracket), _mm_cmpeq_epi8(folded, closeBracket)),
+                                                _mm_or_si128(_mm_cmpeq_epi8(bytes, colon), _mm_cmpeq_epi8(bytes, comma)));
+        const __m128i whitespace = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, space), _mm_cmpeq_epi8(bytes, tab)),
+                                                _mm_or_si128(_mm_cmpeq_epi8(bytes, newline), _mm_cmpeq_epi8(bytes, carriageReturn)));
+
+        quoteBits |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quote)) << i;
+        backslashBits |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, backslash)) << i;
+        controlBits |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(bytes, lastControl), lastControl)) << i;
+        whitespaceBits |= (uint64_t)(uint32_t)_mm_movemask_epi8(whitespace) << i;
+        structuralBits |= (uint64_t)(uint32_t)_mm_movemask_epi8(structural) << i;
+    }
+
+    masks->quote = quoteBits;
+    masks->backslash = backslashBits;
+    masks->control = controlBits;
+    masks->whitespace = whitespaceBits;
+    masks->structural = structuralBits;
+}
+
+/**
+ * @brief AVX2 block kernel
+ */
+__attribute__((target("avx2"))) void tc_scan_block_avx2(const char *block, tc_scan_masks *masks)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i lastControl = _mm256_set1_epi8(0x1f);
+    const __m256i fold = _mm256_set1_epi8(0x20);
+    const __m256i openBracket = _mm256_set1_epi8('{');
+    const __m256i closeBracket = _mm256_set1_epi8('}');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i carriageReturn = _mm256_set1_epi8('\r');
+
+    uint64_t quoteBits = 0;
+    uint64_t backslashBits = 0;
+    uint64_t controlBits = 0;
+    uint64_t whitespaceBits = 0;
+    uint64_t structuralBits = 0;
+
+    for (uint32_t i = 0; i < TC_SCAN_BLOCK; i += 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256((const __m256i *)(block + i));
+        const __m256i folded = _mm256_or_si256(bytes, fold);
+        const __m256i structural = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(folded, openBracket), _mm256_cmpeq_epi8(folded, closeBracket)),
+                                                   _mm256_or_si256(_mm256_cmpeq_epi8(bytes, colon), _mm256_cmpeq_epi8(bytes, comma)));
+        const __m256i whitespace = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, space), _mm256_cmpeq_epi8(bytes, tab)),
+                                                   _mm256_or_si256(_mm256_cmpeq_epi8(bytes, newline), _mm256_cmpeq_epi8(bytes, carriageReturn)));
+
+        quoteBits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, quote)) << i;
+        backslashBits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, backslash)) << i;
+        controlBits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(bytes, lastControl), lastControl)) << i;
+        whitespaceBits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(whitespace) << i;
+        structuralBits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(structural) << i;
+    }
+
+    masks->quote = quoteBits;
+    masks->backslash = backslashBits;
+    masks->control = controlBits;
+    masks->whitespace = whitespaceBits;
+    masks->structural = structuralBits;
+}
+
+#endif
+
+/**
+ * @brief Probe the CPU for the instruction sets the kernels use
+ *
+ * Run once, through tc_scan_supported.
+ */
+void tc_scan_detect_cpu(void)
+{
+#ifdef TC_SCAN_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        tc_scan_cpu_isa = TC_SCAN_AVX2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        tc_scan_cpu_isa = TC_SCAN_SSE2;
+    }
+#endif
+}
+
+/**
+ * @brief Widest instruction set both the CPU and tc_scan_max_isa allow
+ */
+tc_scan_isa tc_scan_supported(void)
+{
+    pthread_once(&tc_scan_cpu_once, tc_scan_detect_cpu);
+
+    return tc_scan_cpu_isa < tc_scan_max_isa ? tc_scan_cpu_isa : tc_scan_max_isa;
+}
+
+/**
+ * @brief Limit the instruction set tc_scan_select may pick
+ *
+ * Lower it to compare kernels, or where wide vectors cost more in clock
+ * speed than they save. Set it before readers are initialized on other
+ * threads.
+ *
+ * @param[in]  isa  Widest instruction set to use, TC_SCAN_AVX2 to lift the limit.
+ */
+void tc_scan_set_max_isa(tc_scan_isa isa)
+{
+    tc_scan_max_isa = isa;
+}
+
+/**
+ * @brief Pick the block kernel for this CPU
+ *
+ * Cheap enough to call per document: the CPU is only probed the first
+ * time.
+ */
+tc_scan_kernel tc_scan_select(void)
+{
+#ifdef TC_SCAN_X86
+    switch (tc_scan_supported())
+    {
+    case TC_SCAN_AVX2:
+        return tc_scan_block_avx2;
+    case TC_SCAN_SSE2:
+        return tc_scan_block_sse2;
+    default:
+        break;
+    }
+#endif
+
+    return tc_scan_block_scalar;
+}
+
+/**
+ * @brief Streaming structural index over a JSON text
+ *
+ * Produces, a block at a time, the positions of: each of {}[]:, outside
+ * strings, the opening quote of each string, the first byte of each run
+ * of other bytes outside strings, which starts a scalar or is an error,
+ * and each unescaped control character inside a string, which is always
+ * an error. Closing quotes and whitespace are not indexed. Scanning must
+ * start outside a string.
+ */
+typedef struct
+{
+    const char *next;
+    const char *end;
+    uint64_t inString;
+    uint64_t escaped;
+    uint64_t inScalar;
+    tc_scan_kernel kernel;
+} tc_scan_iterator;
+
+/**
+ * @brief Bits of the block escaped by a backslash
+ *
+ * Runs of backslashes escape every other byte, starting after the
+ * first. Adding the start of each odd-aligned run to the backslash mask
+ * carries through the run, which tells odd-length runs from even ones
+ * without a loop. carry holds whether the previous block's last byte
+ * escapes this block's first and is updated for the next block.
+ */
+uint64_t tc_scan_escaped(uint64_t backslash, uint64_t *carry)
+{
+    const uint64_t evenBits = 0x5555555555555555ULL;
+
+    backslash &= ~*carry;
+    const uint64_t followsEscape = backslash << 1 | *carry;
+    const uint64_t oddStarts = backslash & ~evenBits & ~followsEscape;
+    const uint64_t evenStarts = oddStarts + backslash;
+
+    *carry = evenStarts < oddStarts;
+
+    return (evenBits ^ (evenStarts << 1)) & followsEscape;
+}
+
+/**
+ * @brief Set every bit from each set bit up to the next one, exclusive
+ */
+uint64_t tc_scan_prefix_xor(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+
+    return bits;
+}
+
+/**
+ * @brief Start a structural index
+ *
+ * @param[out]  iterator  Iterator to initialize.
+ * @param[in]   kernel    Block kernel, see tc_scan_select.
+ * @param[in]   start     First byte to scan, outside any string.
+ * @param[in]   end       End of the text.
+ */
+void tc_scan_begin(tc_scan_iterator *iterator, tc_scan_kernel kernel, const char *start, const char *end)
+{
+    iterator->next = start;
+    iterator->end = end;
+    iterator->inString = 0;
+    iterator->escaped = 0;
+    iterator->inScalar = 0;
+    iterator->kernel = kernel;
+}
+
+/**
+ * @brief Index the next block
+ *
+ * Callers walk the token bits lowest first, for example with
+ * __builtin_ctzll, and stop at the first token past what they need.
+ *
+ * @param[in]   iterator  Structural index.
+ * @param[out]  block     Start of the block; bit n of tokens is block[n].
+ * @param[out]  tokens    Token positions in the block.
+ *
+ * @return false once the end of the text is reached
+ */
+bool tc_scan_next_block(tc_scan_iterator *iterator, const char **block, uint64_t *tokens)
+{
+    tc_scan_masks masks;
+
+    if (iterator->next >= iterator->end)
+    {
+        return false;
+    }
+
+    if (iterator->end - iterator->next >= TC_SCAN_BLOCK)
+    {
+        iterator->kernel(iterator->next, &masks);
+    }
+    else
+    {
+        // Pad the tail with whitespace, which is never indexed
+        char tail[TC_SCAN_BLOCK];
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, iterator->next, (size_t)(iterator->end - iterator->next));
+        iterator->kernel(tail, &masks);
+    }
+
+    const uint64_t escaped = tc_scan_escaped(masks.backslash, &iterator->escaped);
+    const uint64_t quote = masks.quote & ~escaped;
+    const uint64_t inString = tc_scan_prefix_xor(quote) ^ iterator->inString;
+    const uint64_t scalar = ~(masks.structural | masks.whitespace | quote | inString);
+    const uint64_t scalarStart = scalar & ~(scalar << 1 | iterator->inScalar);
+
+    iterator->inString = (uint64_t)0 - (inString >> 63);
+    iterator->inScalar = scalar >> 63;
+
+    *block = iterator->next;
+    *tokens = (masks.structural & ~inString) | (quote & inString) | scalarStart | (masks.control & inString & ~escaped);
+    iterator->next += TC_SCAN_BLOCK;
+
+    return true;
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_SCAN_ */
@@ -0,0 +1,468 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_STATS_
+#define THINCLOUD_EMBEDDED_C_SDK_STATS_
+
+/*
+ * Thincloud C Embedded SDK - Statistics
+ *
+ * Message, byte and error counters and latency histograms for a client.
+ * Every counter is a relaxed atomic, so the paths that update them never
+ * lock and another thread can copy them out at any time with
+ * tc_stats_snapshot.
+ *
+ * Latencies are kept in log-linear histograms: each power of two of
+ * nanoseconds is split into TC_STATS_SUB_BUCKETS equal buckets, so every
+ * bucket is within 1/TC_STATS_SUB_BUCKETS of its values.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// C++ has the same atomics under std, but not stdatomic.h before C++23
+#ifdef __cplusplus
+#include <atomic>
+using std::atomic_fetch_add_explicit;
+using std::atomic_init;
+using std::atomic_load_explicit;
+using std::atomic_uint_least64_t;
+using std::memory_order_relaxed;
+#else
+#include <stdatomic.h>
+#endif
+
+#include "aws_iot_error.h"
+
+/**
+ * Number of buckets each power of two of nanoseconds is split into
+ */
+#define TC_STATS_SUB_BUCKETS 8
+
+/**
+ * log2 of TC_STATS_SUB_BUCKETS
+ */
+#define TC_STATS_SUB_BUCKET_BITS 3
+
+/**
+ * Number of buckets in a latency histogram. The last bucket holds every
+ * latency from about 17 seconds up.
+ */
+#define TC_STATS_BUCKETS 256
+
+/**
+ * Number of error counters. Errors are counted by their negated
+ * IoT_Error_t; the last counter holds any error beyond it.
+ */
+#define TC_STATS_ERROR_COUNT 64
+
+/**
+ * @brief Kind of message
+ */
+typedef enum
+{
+    TC_STATS_COMMAND_REQUEST = 0,
+    TC_STATS_COMMAND_RESPONSE,
+    TC_STATS_SERVICE_REQUEST,
+    TC_STATS_SERVICE_RESPONSE,
+    TC_STATS_COMMISSIONING_REQUEST,
+    TC_STATS_COMMISSIONING_RESPONSE,
+    TC_STATS_OTHER,
+    TC_STATS_KIND_COUNT
+} tc_stats_kind;
+
+/**
+ * @brief Timed stage of handling a message
+ *
+ * TC_STATS_PARSE covers decompressing and scanning an inbound payload,
+ * TC_STATS_HANDLER the callback it is passed to, and TC_STATS_PUBLISH
+ * handing an outbound message to the batch, in-flight window, outbox or
+ * MQTT client.
+ */
+typedef enum
+{
+    TC_STATS_PARSE = 0,
+    TC_STATS_HANDLER,
+    TC_STATS_PUBLISH,
+    TC_STATS_STAGE_COUNT
+} tc_stats_stage;
+
+/**
+ * @brief Latency histogram
+ */
+typedef struct
+{
+    atomic_uint_least64_t sumNs;
+    atomic_uint_least64_t buckets[TC_STATS_BUCKETS];
+} tc_stats_histogram;
+
+/**
+ * @brief Client statistics
+ *
+ * Attach to a context with tc_context_set_stats and to a dispatcher with
+ * tc_dispatcher_set_stats; statistics can be shared between them, and
+ * between clients.
+ */
+typedef struct
+{
+    atomic_uint_least64_t messagesIn[TC_STATS_KIND_COUNT];
+    atomic_uint_least64_t messagesOut[TC_STATS_KIND_COUNT];
+    atomic_uint_least64_t bytesIn;
+    atomic_uint_least64_t bytesOut;
+    atomic_uint_least64_t errors[TC_STATS_ERROR_COUNT];
+    tc_stats_histogram latency[TC_STATS_STAGE_COUNT];
+} tc_stats;
+
+/**
+ * @brief Copy of a latency histogram
+ */
+typedef struct
+{
+    uint64_t count;
+    uint64_t sumNs;
+    uint64_t buckets[TC_STATS_BUCKETS];
+} tc_stats_histogram_report;
+
+/**
+ * @brief Copy of client statistics
+ */
+typedef struct
+{
+    uint64_t messagesIn[TC_STATS_KIND_COUNT];
+    uint64_t messagesOut[TC_STATS_KIND_COUNT];
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t errors[TC_STATS_ERROR_COUNT];
+    tc_stats_histogram_report latency[TC_STATS_STAGE_COUNT];
+} tc_stats_report;
+
+/**
+ * @brief Initialize statistics to zero
+ *
+ * @param[out]  stats  Statistics to initialize.
+ */
+void tc_stats_init(tc_stats *stats)
+{
+    for (uint32_t i = 0; i < TC_STATS_KIND_COUNT; i++)
+    {
+        atomic_init(&stats->messagesIn[i], 0);
+        atomic_init(&stats->messagesOut[i], 0);
+    }
+
+    atomic_init(&stats->bytesIn, 0);
+    atomic_init(&stats->bytesOut, 0);
+
+    for (uint32_t i = 0; i < TC_STATS_ERROR_COUNT; i++)
+    {
+        atomic_init(&stats->errors[i], 0);
+    }
+
+    for (uint32_t i = 0; i < TC_STATS_STAGE_COUNT; i++)
+    {
+        atomic_init(&stats->latency[i].sumNs, 0);
+
+        for (uint32_t j = 0; j < TC_STATS_BUCKETS; j++)
+        {
+            atomic_init(&stats->latency[i].buckets[j], 0);
+        }
+    }
+}
+
+/**
+ * @brief Monotonic clock in nanoseconds
+ */
+uint64_t tc_stats_clock_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Histogram bucket of a latency
+ */
+uint32_t tc_stats_bucket(uint64_t ns)
+{
+    if (ns < TC_STATS_SUB_BUCKETS)
+    {
+        return (uint32_t)ns;
+    }
+
+    const uint32_t magnitude = 63 - (uint32_t)__builtin_clzll(ns);
+    const uint32_t sub = (uint32_t)(ns >> (magnitude - TC_STATS_SUB_BUCKET_BITS)) & (TC_STATS_SUB_BUCKETS - 1);
+    const uint32_t bucket = (magnitude - TC_STATS_SUB_BUCKET_BITS + 1) * TC_STATS_SUB_BUCKETS + sub;
+
+    return bucket < TC_STATS_BUCKETS ? bucket : TC_STATS_BUCKETS - 1;
+}
+
+/**
+ * @brief Smallest latency in a histogram bucket
+ */
+uint64_t tc_stats_bucket_floor(uint32_t bucket)
+{
+    if (bucket < TC_STATS_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    const uint32_t magnitude = bucket / TC_STATS_SUB_BUCKETS + TC_STATS_SUB_BUCKET_BITS - 1;
+    const uint64_t sub = bucket % TC_STATS_SUB_BUCKETS;
+
+    return (TC_STATS_SUB_BUCKETS + sub) << (magnitude - TC_STATS_SUB_BUCKET_BITS);
+}
+
+/**
+ * @brief Record a latency
+ *
+ * @param[in]  stats  Statistics.
+ * @param[in]  stage  Stage the latency was measured over.
+ * @param[in]  ns     Latency in nanoseconds.
+ */
+void tc_stats_record(tc_stats *stats, tc_stats_stage stage, uint64_t ns)
+{
+    tc_stats_histogram *histogram = &stats->latency[stage];
+
+    atomic_fetch_add_explicit(&histogram->buckets[tc_stats_bucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sumNs, ns, memory_order_relaxed);
+}
+
+/**
+ * @brief Start timing a stage
+ *
+ * @param[in]  stats  Optional. Statistics.
+ *
+ * @return Start time to pass to tc_stats_lap, or zero without statistics
+ */
+uint64_t tc_stats_start(const tc_stats *stats)
+{
+    return stats != NULL ? tc_stats_clock_ns() : 0;
+}
+
+/**
+ * @brief Record the latency of a stage and start timing the next
+ *
+ * @param[in]  stats  Optional. Statistics.
+ * @param[in]  stage  Stage that ended.
+ * @param[in]  start  Time the stage started, from tc_stats_start or tc_stats_lap.
+ *
+ * @return Time the stage ended
+ */
+uint64_t tc_stats_lap(tc_stats *stats, tc_stats_stage stage, uint64_t start)
+{
+    if (stats == NULL)
+    {
+        return 0;
+    }
+
+    const uint64_t now = tc_stats_clock_ns();
+    tc_stats_record(stats, stage, now - start);
+
+    return now;
+}
+
+/**
+ * @brief Error counter of an IoT_Error_t
+ */
+uint32_t tc_stats_error_index(IoT_Error_t rc)
+{
+    const int64_t index = -(int64_t)rc;
+
+    return index < TC_STATS_ERROR_COUNT ? (uint32_t)index : TC_STATS_ERROR_COUNT - 1;
+}
+
+/**
+ * @brief Count an error
+ *
+ * @param[in]  stats  Statistics.
+ * @param[in]  rc     Error. Values that are not errors are ignored.
+ */
+void tc_stats_error(tc_stats *stats, IoT_Error_t rc)
+{
+    if (rc < 0)
+    {
+        atomic_fetch_add_explicit(&stats->errors[tc_stats_error_index(rc)], 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Count a received message
+ *
+ * @param[in]  stats       Optional. Statistics.
+ * @param[in]  kind        Kind of message.
+ * @param[in]  payloadLen  Length of the payload.
+ * @param[in]  rc          Result of handling the message, counted if it is an error.
+ *
+ * @return rc
+ */
+IoT_Error_t tc_stats_received(tc_stats *stats, tc_stats_kind kind, size_t payloadLen, IoT_Error_t rc)
+{
+    if (stats != NULL)
+    {
+        atomic_fetch_add_explicit(&stats->messagesIn[kind], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->bytesIn, payloadLen, memory_order_relaxed);
+        tc_stats_error(stats, rc);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Count a sent message
+ *
+ * Messages that failed to send only count as errors.
+ *
+ * @param[in]  stats       Optional. Statistics.
+ * @param[in]  kind        Kind of message.
+ * @param[in]  payloadLen  Length of the payload.
+ * @param[in]  rc          Result of sending the message.
+ *
+ * @return rc
+ */
+IoT_Error_t tc_stats_sent(tc_stats *stats, tc_stats_kind kind, size_t payloadLen, IoT_Error_t rc)
+{
+    if (stats == NULL)
+    {
+        return rc;
+    }
+
+    if (rc < 0)
+    {
+        tc_stats_error(stats, rc);
+    }
+    else
+    {
+        atomic_fetch_add_explicit(&stats->messagesOut[kind], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->bytesOut, payloadLen, memory_order_relaxed);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Kind of an outbound message, from its ThinCloud topic
+ */
+tc_stats_kind tc_stats_outbound_kind(const char *topic, size_t topicLen)
+{
+    const char registration[] = "thincloud/registration/";
+    const char requests[] = "/requests";
+    const char response[] = "/response";
+
+    if (topicLen >= sizeof(requests) - 1 && memcmp(topic + topicLen - (sizeof(requests) - 1), requests, sizeof(requests) - 1) == 0)
+    {
+        const bool commissioning = topicLen >= sizeof(registration) - 1 && memcmp(topic, registration, sizeof(registration) - 1) == 0;
+        return commissioning ? TC_STATS_COMMISSIONING_REQUEST : TC_STATS_SERVICE_REQUEST;
+    }
+
+    if (topicLen >= sizeof(response) - 1 && memcmp(topic + topicLen - (sizeof(response) - 1), response, sizeof(response) - 1) == 0)
+    {
+        return TC_STATS_COMMAND_RESPONSE;
+    }
+
+    return TC_STATS_OTHER;
+}
+
+/**
+ * @brief Copy statistics out
+ *
+ * Reads each counter once without stopping the threads updating them, so
+ * counters read a moment apart can disagree by the messages handled in
+ * that moment.
+ *
+ * @param[in]   stats   Statistics.
+ * @param[out]  report  Copy of the statistics.
+ */
+void tc_stats_snapshot(const tc_stats *stats, tc_stats_report *report)
+{
+    // The const atomics are only loaded
+    tc_stats *counters = (tc_stats *)stats;
+
+    for (uint32_t i = 0; i < TC_STATS_KIND_COUNT; i++)
+    {
+        report->messagesIn[i] = atomic_load_explicit(&counters->messagesIn[i], memory_order_relaxed);
+        report->messagesOut[i] = atomic_load_explicit(&counters->messagesOut[i], memory_order_relaxed);
+    }
+
+    report->bytesIn = atomic_load_explicit(&counters->bytesIn, memory_order_relaxed);
+    report->bytesOut = atomic_load_explicit(&counters->bytesOut, memory_order_relaxed);
+
+    for (uint32_t i = 0; i < TC_STATS_ERROR_COUNT; i++)
+    {
+        report->errors[i] = atomic_load_explicit(&counters->errors[i], memory_order_relaxed);
+    }
+
+    for (uint32_t i = 0; i < TC_STATS_STAGE_COUNT; i++)
+    {
+        tc_stats_histogram *histogram = &counters->latency[i];
+        tc_stats_histogram_report *copy = &report->latency[i];
+
+        copy->sumNs = atomic_load_explicit(&histogram->sumNs, memory_order_relaxed);
+        copy->count = 0;
+
+        // The count is derived rather than kept, which saves recording an atomic add
+        for (uint32_t j = 0; j < TC_STATS_BUCKETS; j++)
+        {
+            copy->buckets[j] = atomic_load_explicit(&histogram->buckets[j], memory_order_relaxed);
+            copy->count += copy->buckets[j];
+        }
+    }
+}
+
+/**
+ * @brief Errors of one kind in a report
+ */
+uint64_t tc_stats_errors(const tc_stats_report *report, IoT_Error_t rc)
+{
+    return rc < 0 ? report->errors[tc_stats_error_index(rc)] : 0;
+}
+
+/**
+ * @brief Latency percentile of a histogram
+ *
+ * @param[in]  histogram  Histogram from a report.
+ * @param[in]  quantile   Quantile between 0 and 1, e.g. 0.99.
+ *
+ * @return Upper bound of the bucket holding the quantile in nanoseconds,
+ *         zero if the histogram is empty
+ */
+uint64_t tc_stats_percentile(const tc_stats_histogram_report *histogram, double quantile)
+{
+    const uint64_t total = histogram->count;
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(quantile * (double)total);
+    rank = rank == 0 ? 1 : rank > total ? total : rank;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < TC_STATS_BUCKETS - 1; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+        {
+            return tc_stats_bucket_floor(i + 1) - 1;
+        }
+    }
+
+    return tc_stats_bucket_floor(TC_STATS_BUCKETS - 1);
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_STATS_ */
@@ -0,0 +1,360 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_TIMER_
+#define THINCLOUD_EMBEDDED_C_SDK_TIMER_
+
+/*
+ * Thincloud C Embedded SDK - Timer wheel
+ *
+ * Hierarchical timer wheel with millisecond ticks. Scheduling and
+ * cancelling a timer are O(1); advancing the wheel costs one slot per
+ * elapsed tick plus the timers that fire or move down a level.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define TC_TIMER_WHEEL_BITS 6
+#define TC_TIMER_WHEEL_SLOTS (1 << TC_TIMER_WHEEL_BITS)
+#define TC_TIMER_WHEEL_MASK (TC_TIMER_WHEEL_SLOTS - 1)
+#define TC_TIMER_WHEEL_LEVELS 4
+
+/**
+ * Longest delay the wheel holds directly, in ticks. Later timers are
+ * parked at the top level and rescheduled when it cascades.
+ */
+#define TC_TIMER_WHEEL_RANGE ((uint64_t)1 << (TC_TIMER_WHEEL_BITS * TC_TIMER_WHEEL_LEVELS))
+
+typedef struct tc_timer tc_timer;
+
+/**
+ * @brief Timer callback
+ *
+ * Invoked from tc_timer_wheel_advance. The callback may reschedule or
+ * free its timer.
+ *
+ * @param[in]  timer  Timer that expired.
+ * @param[in]  data   Data blob set on tc_timer_init.
+ */
+typedef void (*tc_timer_callback)(tc_timer *timer, void *data);
+
+/**
+ * @brief Timer
+ *
+ * Timers are intrusive and owned by the caller; the wheel only links them.
+ */
+struct tc_timer
+{
+    tc_timer *next;
+    tc_timer **pprev;
+    uint64_t expires;
+    uint16_t slot;
+    tc_timer_callback callback;
+    void *data;
+};
+
+/**
+ * @brief Hierarchical timer wheel
+ */
+typedef struct
+{
+    tc_timer *slots[TC_TIMER_WHEEL_LEVELS][TC_TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TC_TIMER_WHEEL_LEVELS];
+    uint64_t now;
+    uint32_t count;
+} tc_timer_wheel;
+
+/**
+ * @brief Monotonic clock in milliseconds
+ */
+uint64_t tc_clock_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Initialize a timer
+ *
+ * @param[out]  timer     Timer to initialize.
+ * @param[in]   callback  Expiry callback.
+ * @param[in]   data      Data blob to be passed to the callback on invoke.
+ */
+void tc_timer_init(tc_timer *timer, tc_timer_callback callback, void *data)
+{
+    memset(timer, 0, sizeof(*timer));
+
+    timer->callback = callback;
+    timer->data = data;
+}
+
+/**
+ * @brief Check if a timer is scheduled
+ */
+bool tc_timer_pending(const tc_timer *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/**
+ * @brief Initialize an empty timer wheel
+ *
+ * @param[out]  wheel  Wheel to initialize.
+ * @param[in]   now    Current time, usually tc_clock_ms().
+ */
+void tc_timer_wheel_init(tc_timer_wheel *wheel, uint64_t now)
+{
+    memset(wheel, 0, sizeof(*wheel));
+
+    wheel->now = now;
+}
+
+/**
+ * @brief Link a timer into the slot for its expiry
+ *
+ * Timers that are already due go to the slot for earliest.
+ */
+void tc_timer_wheel_link(tc_timer_wheel *wheel, tc_timer *timer, uint64_t earliest)
+{
+    uint64_t expires = timer->expires;
+    if (expires < earliest)
+    {
+        expires = earliest;
+    }
+    else if (expires - wheel->now >= TC_TIMER_WHEEL_RANGE)
+    {
+        expires = wheel->now + TC_TIMER_WHEEL_RANGE - 1;
+    }
+
+    const uint64_t delta = expires - wheel->now;
+
+    uint32_t level = 0;
+    while (level < TC_TIMER_WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << (TC_TIMER_WHEEL_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    const uint32_t index = (uint32_t)(expires >> (TC_TIMER_WHEEL_BITS * level)) & TC_TIMER_WHEEL_MASK;
+    tc_timer **head = &wheel->slots[level][index];
+
+    timer->next = *head;
+    if (*head != NULL)
+    {
+        (*head)->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    timer->slot = (uint16_t)(level * TC_TIMER_WHEEL_SLOTS + index);
+    *head = timer;
+
+    wheel->occupied[level] |= (uint64_t)1 << index;
+}
+
+/**
+ * @brief Unlink a timer from its slot
+ */
+void tc_timer_wheel_unlink(tc_timer_wheel *wheel, tc_timer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+
+    const uint32_t level = timer->slot / TC_TIMER_WHEEL_SLOTS;
+    const uint32_t index = timer->slot % TC_TIMER_WHEEL_SLOTS;
+    if (wheel->slots[level][index] == NULL)
+    {
+        wheel->occupied[level] &= ~((uint64_t)1 << index);
+    }
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * @brief Schedule a timer
+ *
+ * Reschedules the timer if it is already pending.
+ *
+ * @param[in]  wheel    Timer wheel.
+ * @param[in]  timer    Initialized timer.
+ * @param[in]  expires  Time at which the timer fires.
+ */
+void tc_timer_schedule(tc_timer_wheel *wheel, tc_timer *timer, uint64_t expires)
+{
+    if (tc_timer_pending(timer))
+    {
+        tc_timer_wheel_unlink(wheel, timer);
+        wheel->count--;
+    }
+
+    timer->expires = expires;
+    tc_timer_wheel_link(wheel, timer, wheel->now + 1);
+    wheel->count++;
+}
+
+/**
+ * @brief Cancel a timer
+ *
+ * Does nothing if the timer is not pending.
+ *
+ * @param[in]  wheel  Timer wheel.
+ * @param[in]  timer  Timer to cancel.
+ */
+void tc_timer_cancel(tc_timer_wheel *wheel, tc_timer *timer)
+{
+    if (tc_timer_pending(timer))
+    {
+        tc_timer_wheel_unlink(wheel, timer);
+        wheel->count--;
+    }
+}
+
+/**
+ * @brief Move the timers of a higher level slot down the wheel
+ */
+void tc_timer_wheel_cascade(tc_timer_wheel *wheel, uint32_t level)
+{
+    const uint32_t index = (uint32_t)(wheel->now >> (TC_TIMER_WHEEL_BITS * level)) & TC_TIMER_WHEEL_MASK;
+
+    tc_timer *timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    wheel->occupied[level] &= ~((uint64_t)1 << index);
+
+    while (timer != NULL)
+    {
+        tc_timer *next = timer->next;
+        tc_timer_wheel_link(wheel, timer, wheel->now);
+        timer = next;
+    }
+}
+
+/**
+ * @brief Advance a timer wheel
+ *
+ * Fires every timer that expires up to and including now, in expiry order.
+ * Call from the thread that yields the client, e.g. through tc_yield.
+ *
+ * @param[in]  wheel  Timer wheel.
+ * @param[in]  now    Current time, usually tc_clock_ms().
+ *
+ * @return Number of timers fired
+ */
+uint32_t tc_timer_wheel_advance(tc_timer_wheel *wheel, uint64_t now)
+{
+    uint32_t fired = 0;
+
+    while (wheel->now < now)
+    {
+        if (wheel->count == 0)
+        {
+            wheel->now = now;
+            break;
+        }
+
+        // Skip to the next cascade when nothing is due at the lowest level
+        if (wheel->occupied[0] == 0)
+        {
+            const uint64_t boundary = wheel->now | TC_TIMER_WHEEL_MASK;
+            wheel->now = boundary < now ? boundary : now;
+            if (wheel->now == now)
+            {
+                break;
+            }
+        }
+
+        wheel->now++;
+
+        for (uint32_t level = 1; level < TC_TIMER_WHEEL_LEVELS; level++)
+        {
+            if ((wheel->now & (((uint64_t)1 << (TC_TIMER_WHEEL_BITS * level)) - 1)) != 0)
+            {
+                break;
+            }
+            tc_timer_wheel_cascade(wheel, level);
+        }
+
+        tc_timer **head = &wheel->slots[0][wheel->now & TC_TIMER_WHEEL_MASK];
+        while (*head != NULL)
+        {
+            tc_timer *timer = *head;
+            tc_timer_wheel_unlink(wheel, timer);
+            wheel->count--;
+            fired++;
+
+            timer->callback(timer, timer->data);
+        }
+    }
+
+    return fired;
+}
+
+/**
+ * @brief Time the wheel next needs to be advanced
+ *
+ * Exact for timers due within the next 64 ticks. Later timers report
+ * the time their slot cascades, which is never after they expire;
+ * advancing the wheel then and asking again narrows it down.
+ *
+ * @param[in]  wheel  Timer wheel.
+ *
+ * @return Time of the next expiry or cascade, UINT64_MAX if the wheel is empty
+ */
+uint64_t tc_timer_wheel_next(const tc_timer_wheel *wheel)
+{
+    uint64_t next = UINT64_MAX;
+
+    if (wheel->count == 0)
+    {
+        return next;
+    }
+
+    for (uint32_t level = 0; level < TC_TIMER_WHEEL_LEVELS; level++)
+    {
+        const uint64_t occupied = wheel->occupied[level];
+        if (occupied == 0)
+        {
+            continue;
+        }
+
+        // Rotate the slot after the current one down to bit zero
+        const uint32_t shift = TC_TIMER_WHEEL_BITS * level;
+        const uint32_t start = (uint32_t)((wheel->now >> shift) + 1) & TC_TIMER_WHEEL_MASK;
+        const uint64_t rotated = start == 0 ? occupied : (occupied >> start) | (occupied << (TC_TIMER_WHEEL_SLOTS - start));
+        const uint64_t distance = (uint64_t)__builtin_ctzll(rotated) + 1;
+
+        const uint64_t due = ((wheel->now >> shift) + distance) << shift;
+        if (due < next)
+        {
+            next = due;
+        }
+    }
+
+    return next;
+}
+
+/**
+ * @brief Container of an embedded timer
+ */
+#define TC_TIMER_CONTAINER(timer, type, member) ((type *)(void *)((char *)(timer)-offsetof(type, member)))
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_TIMER_ */
@@ -0,0 +1,423 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_TOPIC_
+#define THINCLOUD_EMBEDDED_C_SDK_TOPIC_
+
+/*
+ * Thincloud C Embedded SDK - Topic trie
+ *
+ * Precompiled trie of MQTT topic filters. Matching a topic walks the
+ * trie segment by segment, and returns the route of the matching filter
+ * along with the topic segments matched by its wildcards.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aws_iot_error.h"
+
+#include "thincloud_json.h"
+
+/**
+ * Maximum number of nodes in a topic trie
+ */
+#ifndef TC_TOPIC_TRIE_MAX_NODES
+#define TC_TOPIC_TRIE_MAX_NODES 32
+#endif
+
+/**
+ * Bytes reserved for the literal segments of a topic trie
+ */
+#ifndef TC_TOPIC_TRIE_SEGMENT_BYTES
+#define TC_TOPIC_TRIE_SEGMENT_BYTES 256
+#endif
+
+/**
+ * Maximum number of wildcard captures returned by a match
+ */
+#ifndef TC_TOPIC_MAX_CAPTURES
+#define TC_TOPIC_MAX_CAPTURES 4
+#endif
+
+/**
+ * Maximum number of leading topic segments returned by a match
+ */
+#ifndef TC_TOPIC_MAX_SEGMENTS
+#define TC_TOPIC_MAX_SEGMENTS 8
+#endif
+
+#define TC_TOPIC_NO_NODE -1
+#define TC_TOPIC_NO_ROUTE -1
+
+typedef enum
+{
+    TC_TOPIC_LITERAL = 0,
+    TC_TOPIC_SINGLE_LEVEL,
+    TC_TOPIC_MULTI_LEVEL
+} tc_topic_segment_type;
+
+typedef struct
+{
+    uint16_t segmentOffset;
+    uint16_t segmentLen;
+    uint8_t type;
+    int16_t firstChild;
+    int16_t nextSibling;
+    int16_t route;
+} tc_topic_node;
+
+/**
+ * @brief Topic filter trie
+ *
+ * Node 0 is the root. Children of a node are kept in a sibling list,
+ * literal segments before '+' before '#', so the most literal branch is
+ * tried first.
+ */
+typedef struct
+{
+    tc_topic_node nodes[TC_TOPIC_TRIE_MAX_NODES];
+    uint16_t nodeCount;
+    char segments[TC_TOPIC_TRIE_SEGMENT_BYTES];
+    uint16_t segmentsLen;
+} tc_topic_trie;
+
+/**
+ * @brief Result of a topic match
+ */
+typedef struct
+{
+    int route;
+    tc_slice captures[TC_TOPIC_MAX_CAPTURES];
+    uint32_t captureCount;
+    tc_slice segments[TC_TOPIC_MAX_SEGMENTS];
+    uint32_t segmentCount;
+} tc_topic_match;
+
+/**
+ * @brief Initialize an empty topic trie
+ *
+ * @param[out]  trie  Trie to initialize.
+ */
+void tc_topic_trie_init(tc_topic_trie *trie)
+{
+    memset(trie, 0, sizeof(*trie));
+
+    trie->nodes[0].firstChild = TC_TOPIC_NO_NODE;
+    trie->nodes[0].nextSibling = TC_TOPIC_NO_NODE;
+    trie->nodes[0].route = TC_TOPIC_NO_ROUTE;
+    trie->nodeCount = 1;
+}
+
+/**
+ * @brief Find or add the child of a node for a filter segment
+ *
+ * @param[in]   trie        Topic trie.
+ * @param[in]   parent      Parent node.
+ * @param[in]   segment     Filter segment.
+ * @param[in]   segmentLen  Length of the segment.
+ * @param[out]  child       Child node.
+ *
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the trie is full
+ */
+IoT_Error_t tc_topic_trie_child(tc_topic_trie *trie, int16_t parent, const char *segment, size_t segmentLen, int16_t *child)
+{
+    uint8_t type = TC_TOPIC_LITERAL;
+    if (segmentLen == 1 && segment[0] == '+')
+    {
+        type = TC_TOPIC_SINGLE_LEVEL;
+    }
+    else if (segmentLen == 1 && segment[0] == '#')
+    {
+        type = TC_TOPIC_MULTI_LEVEL;
+    }
+
+    int16_t previous = TC_TOPIC_NO_NODE;
+    for (int16_t i = trie->nodes[parent].firstChild; i != TC_TOPIC_NO_NODE; i = trie->nodes[i].nextSibling)
+    {
+        const tc_topic_node *node = &trie->nodes[i];
+        if (node->type == type &&
+            (type != TC_TOPIC_LITERAL ||
+             (node->segmentLen == segmentLen && memcmp(trie->segments + node->segmentOffset, segment, segmentLen) == 0)))
+        {
+            *child = i;
+            return SUCCESS;
+        }
+
+        if (node->type <= type)
+        {
+            previous = i;
+        }
+    }
+
+    if (trie->nodeCount >= TC_TOPIC_TRIE_MAX_NODES)
+    {
+        return LIMIT_EXCEEDED_ERROR;
+    }
+
+    if (type == TC_TOPIC_LITERAL && trie->segmentsLen + segmentLen > TC_TOPIC_TRIE_SEGMENT_BYTES)
+    {
+        return LIMIT_EXCEEDED_ERROR;
+    }
+
+    const int16_t index = (int16_t)trie->nodeCount++;
+    tc_topic_node *node = &trie->nodes[index];
+    node->type = type;
+    node->firstChild = TC_TOPIC_NO_NODE;
+    node->route = TC_TOPIC_NO_ROUTE;
+    node->segmentOffset = trie->segmentsLen;
+    node->segmentLen = type == TC_TOPIC_LITERAL ? (uint16_t)segmentLen : 0;
+
+    if (type == TC_TOPIC_LITERAL)
+    {
+        memcpy(trie->segments + trie->segmentsLen, segment, segmentLen);
+        trie->segmentsLen += (uint16_t)segmentLen;
+    }
+
+    // Keep literals ahead of wildcards in the sibling list
+    if (previous == TC_TOPIC_NO_NODE)
+    {
+        node->nextSibling = trie->nodes[parent].firstChild;
+        trie->nodes[parent].firstChild = index;
+    }
+    else
+    {
+        node->nextSibling = trie->nodes[previous].nextSibling;
+        trie->nodes[previous].nextSibling = index;
+    }
+
+    *child = index;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Add a topic filter to a trie
+ *
+ * @param[in]  trie       Topic trie.
+ * @param[in]  filter     MQTT topic filter. '+' and a trailing '#' are supported.
+ * @param[in]  filterLen  Length of the filter.
+ * @param[in]  route      Non-negative value returned when a topic matches the filter.
+ *
+ * @return Zero on success, LIMIT_EXCEEDED_ERROR if the trie is full,
+ *         negative value otherwise
+ */
+IoT_Error_t tc_topic_trie_insert(tc_topic_trie *trie, const char *filter, size_t filterLen, int route)
+{
+    if (trie == NULL || filter == NULL || filterLen == 0 || route < 0)
+    {
+        return NULL_VALUE_ERROR;
+    }
+
+    int16_t node = 0;
+    size_t start = 0;
+
+    while (start <= filterLen)
+    {
+        const char *slash = (const char *)memchr(filter + start, '/', filterLen - start);
+        const size_t end = slash == NULL ? filterLen : (size_t)(slash - filter);
+
+        if (trie->nodes[node].type == TC_TOPIC_MULTI_LEVEL)
+        {
+            return INVALID_TOPIC_TYPE_ERROR;
+        }
+
+        const IoT_Error_t rc = tc_topic_trie_child(trie, node, filter + start, end - start, &node);
+        if (rc != SUCCESS)
+        {
+            return rc;
+        }
+
+        start = end + 1;
+    }
+
+    trie->nodes[node].route = (int16_t)route;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Find the end of a topic segment
+ *
+ * Segments are located once and kept in the match, so backtracking to a
+ * sibling branch does not scan them again.
+ *
+ * @param[in]      topic     Topic name.
+ * @param[in]      topicLen  Length of the topic.
+ * @param[in]      start     Offset of the segment.
+ * @param[in]      depth     Index of the segment in the topic.
+ * @param[in,out]  match     Leading topic segments found so far.
+ *
+ * @return Offset just past the segment
+ */
+size_t tc_topic_segment_end(const char *topic, size_t topicLen, size_t start, uint32_t depth, tc_topic_match *match)
+{
+    if (depth < match->segmentCount)
+    {
+        return start + match->segments[depth].len;
+    }
+
+    const char *slash = (const char *)memchr(topic + start, '/', topicLen - start);
+    const size_t end = slash == NULL ? topicLen : (size_t)(slash - topic);
+
+    if (depth < TC_TOPIC_MAX_SEGMENTS)
+    {
+        match->segments[depth].data = topic + start;
+        match->segments[depth].len = end - start;
+        match->segmentCount = depth + 1;
+    }
+
+    return end;
+}
+
+/**
+ * @brief Match the rest of a topic below a trie node
+ *
+ * Tries literal children first, then '+' and '#', backtracking to the
+ * next sibling when a branch fails further down.
+ *
+ * @param[in]      trie      Topic trie.
+ * @param[in]      node      Node matched by the previous segments.
+ * @param[in]      topic     Topic name.
+ * @param[in]      topicLen  Length of the topic.
+ * @param[in]      start     Offset of the segment to match, past topicLen once all are matched.
+ * @param[in]      depth     Index of the segment to match.
+ * @param[in,out]  match     Route, wildcard captures and leading segments.
+ *
+ * @return true if the rest of the topic matched a filter
+ */
+bool tc_topic_trie_match_node(const tc_topic_trie *trie, int16_t node, const char *topic, size_t topicLen, size_t start, uint32_t depth, tc_topic_match *match)
+{
+    const uint32_t captureCount = match->captureCount;
+
+    if (start > topicLen)
+    {
+        match->route = trie->nodes[node].route;
+        if (match->route != TC_TOPIC_NO_ROUTE)
+        {
+            return true;
+        }
+
+        // "a/#" also matches "a"
+        for (int16_t i = trie->nodes[node].firstChild; i != TC_TOPIC_NO_NODE; i = trie->nodes[i].nextSibling)
+        {
+            if (trie->nodes[i].type == TC_TOPIC_MULTI_LEVEL && trie->nodes[i].route != TC_TOPIC_NO_ROUTE)
+            {
+                if (captureCount < TC_TOPIC_MAX_CAPTURES)
+                {
+                    match->captures[captureCount].data = topic + topicLen;
+                    match->captures[captureCount].len = 0;
+                    match->captureCount = captureCount + 1;
+                }
+
+                match->route = trie->nodes[i].route;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    const size_t end = tc_topic_segment_end(topic, topicLen, start, depth, match);
+    const size_t segmentLen = end - start;
+
+    for (int16_t i = trie->nodes[node].firstChild; i != TC_TOPIC_NO_NODE; i = trie->nodes[i].nextSibling)
+    {
+        const tc_topic_node *child = &trie->nodes[i];
+        match->captureCount = captureCount;
+
+        if (child->type == TC_TOPIC_LITERAL)
+        {
+            if (child->segmentLen != segmentLen || memcmp(trie->segments + child->segmentOffset, topic + start, segmentLen) != 0)
+            {
+                continue;
+            }
+        }
+        else if (captureCount < TC_TOPIC_MAX_CAPTURES)
+        {
+            tc_slice *capture = &match->captures[captureCount];
+            capture->data = topic + start;
+            capture->len = child->type == TC_TOPIC_MULTI_LEVEL ? topicLen - start : segmentLen;
+            match->captureCount = captureCount + 1;
+        }
+
+        if (child->type == TC_TOPIC_MULTI_LEVEL)
+        {
+            if (child->route != TC_TOPIC_NO_ROUTE)
+            {
+                match->route = child->route;
+                return true;
+            }
+            continue;
+        }
+
+        if (tc_topic_trie_match_node(trie, i, topic, topicLen, end + 1, depth + 1, match))
+        {
+            return true;
+        }
+    }
+
+    match->captureCount = captureCount;
+    match->route = TC_TOPIC_NO_ROUTE;
+
+    return false;
+}
+
+/**
+ * @brief Match a topic against a trie
+ *
+ * Walks the topic segment by segment, preferring literal segments over
+ * '+' and '+' over '#', and backtracks when a preferred branch fails
+ * further down, so every filter that matches is found. Segments matched
+ * by '+' are returned as captures, in order; '#' captures the remainder
+ * of the topic. The leading segments of the topic, such as the device
+ * and request IDs of ThinCloud topics, are returned as well, so fields at
+ * a fixed position can be read whether the filter matched them literally
+ * or with a wildcard. They are recorded during the walk, which scans each
+ * segment once; only the part of a topic matched by '#' is split
+ * afterwards.
+ *
+ * @param[in]   trie      Topic trie.
+ * @param[in]   topic     Topic name.
+ * @param[in]   topicLen  Length of the topic.
+ * @param[out]  match     Route and wildcard captures.
+ *
+ * @return true if the topic matched a filter
+ */
+bool tc_topic_trie_match(const tc_topic_trie *trie, const char *topic, size_t topicLen, tc_topic_match *match)
+{
+    match->route = TC_TOPIC_NO_ROUTE;
+    match->captureCount = 0;
+    match->segmentCount = 0;
+
+    if (!tc_topic_trie_match_node(trie, 0, topic, topicLen, 0, 0, match))
+    {
+        return false;
+    }
+
+    // A '#' stops the walk before the last segments
+    const tc_slice *last = &match->segments[match->segmentCount - 1];
+    size_t start = (size_t)(last->data - topic) + last->len + 1;
+    while (start <= topicLen && match->segmentCount < TC_TOPIC_MAX_SEGMENTS)
+    {
+        start = tc_topic_segment_end(topic, topicLen, start, match->segmentCount, match) + 1;
+    }
+
+    return true;
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_TOPIC_ */
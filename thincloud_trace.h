@@ -0,0 +1,424 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_TRACE_
+#define THINCLOUD_EMBEDDED_C_SDK_TRACE_
+
+/*
+ * Thincloud C Embedded SDK - Tracing
+ *
+ * Trace points mark where each stage of sending and receiving a message
+ * begins and ends. They compile to nothing unless TC_ENABLE_TRACE is
+ * defined. When it is, each thread records its trace points as 16-byte
+ * records in a ring of its own, overwriting the oldest, so recording
+ * never locks or allocates. tc_trace_dump writes every thread's ring to
+ * a file descriptor, and tools/tc_trace.py converts the dump to Chrome
+ * trace JSON for chrome://tracing or Perfetto.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// C++ has the same atomics under std, but not stdatomic.h before C++23
+#ifdef __cplusplus
+#include <atomic>
+using std::atomic_fetch_add_explicit;
+using std::atomic_init;
+using std::atomic_load_explicit;
+using std::atomic_store_explicit;
+using std::atomic_thread_fence;
+using std::atomic_uint_least32_t;
+using std::atomic_uint_least64_t;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+#define TC_TRACE_THREAD_LOCAL thread_local
+#else
+#include <stdatomic.h>
+#define TC_TRACE_THREAD_LOCAL _Thread_local
+#endif
+
+#include "aws_iot_error.h"
+
+/**
+ * Records kept per thread. Older records are overwritten.
+ */
+#ifndef TC_TRACE_RING_SIZE
+#define TC_TRACE_RING_SIZE 4096
+#endif
+
+#if (TC_TRACE_RING_SIZE & (TC_TRACE_RING_SIZE - 1)) != 0
+#error "TC_TRACE_RING_SIZE must be a power of two"
+#endif
+
+/**
+ * Threads that can record trace points. Threads beyond it record nothing.
+ */
+#ifndef TC_TRACE_MAX_THREADS
+#define TC_TRACE_MAX_THREADS 16
+#endif
+
+/**
+ * Version of the dump format
+ */
+#define TC_TRACE_VERSION 1
+
+/**
+ * @brief Traced stage
+ *
+ * tools/tc_trace.py names stages by these values.
+ */
+typedef enum
+{
+    TC_TRACE_TOPIC = 0,
+    TC_TRACE_MARSHAL,
+    TC_TRACE_PUBLISH,
+    TC_TRACE_CALLBACK,
+    TC_TRACE_UNMARSHAL,
+    TC_TRACE_HANDLER,
+    TC_TRACE_STAGE_COUNT
+} tc_trace_stage;
+
+/**
+ * @brief Whether a record begins or ends a stage, as Chrome trace phases
+ */
+typedef enum
+{
+    TC_TRACE_PHASE_BEGIN = 'B',
+    TC_TRACE_PHASE_END = 'E'
+} tc_trace_phase;
+
+/**
+ * @brief Trace record
+ *
+ * arg is the length of the message when a stage begins and the stage's
+ * IoT_Error_t when it ends.
+ */
+typedef struct
+{
+    uint64_t timestampNs;
+    uint32_t arg;
+    uint16_t thread;
+    uint8_t stage;
+    uint8_t phase;
+} tc_trace_record;
+
+/**
+ * @brief Ring of trace records
+ *
+ * Written by one thread and read by any. head counts every record ever
+ * written; the record at position p is in slot p % TC_TRACE_RING_SIZE.
+ * started runs one ahead of head while a record is being written.
+ */
+typedef struct
+{
+    atomic_uint_least64_t head;
+    atomic_uint_least64_t started;
+    tc_trace_record records[TC_TRACE_RING_SIZE];
+} tc_trace_ring;
+
+/**
+ * @brief Header of a dump
+ *
+ * A dump is this header followed by records. Both are in the byte order
+ * of the device.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+} tc_trace_header;
+
+/**
+ * @brief Initialize an empty ring
+ *
+ * Rings in static storage start empty without it.
+ */
+void tc_trace_ring_init(tc_trace_ring *ring)
+{
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->started, 0);
+}
+
+/**
+ * @brief Monotonic clock in nanoseconds
+ */
+uint64_t tc_trace_clock_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Write a record to a ring
+ *
+ * Only the ring's own thread may write to it.
+ *
+ * @param[in]  ring   Ring.
+ * @param[in]  stage  Traced stage.
+ * @param[in]  phase  Whether the stage begins or ends.
+ * @param[in]  arg    Message length or result, see tc_trace_record.
+ */
+void tc_trace_ring_push(tc_trace_ring *ring, tc_trace_stage stage, tc_trace_phase phase, uint32_t arg)
+{
+    const uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    tc_trace_record *record = &ring->records[head & (TC_TRACE_RING_SIZE - 1)];
+
+    // Readers drop the record being overwritten once they see started move
+    atomic_store_explicit(&ring->started, head + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    record->timestampNs = tc_trace_clock_ns();
+    record->arg = arg;
+    record->thread = 0;
+    record->stage = (uint8_t)stage;
+    record->phase = (uint8_t)phase;
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Copy records out of a ring
+ *
+ * Safe to call while the ring's thread writes to it. Records the thread
+ * overwrote before or while they were copied are skipped.
+ *
+ * @param[in]      ring     Ring.
+ * @param[in,out]  cursor   Position of the next record to read, advanced past the records read.
+ * @param[in]      end      Position to stop at, e.g. the ring's head when reading began.
+ * @param[out]     records  Copied records, oldest first.
+ * @param[in]      count    Capacity of records.
+ *
+ * @return Number of records copied
+ */
+size_t tc_trace_ring_read(tc_trace_ring *ring, uint64_t *cursor, uint64_t end, tc_trace_record *records, size_t count)
+{
+    const uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    end = end < head ? end : head;
+
+    if (end >= TC_TRACE_RING_SIZE && *cursor < end - TC_TRACE_RING_SIZE)
+    {
+        *cursor = end - TC_TRACE_RING_SIZE;
+    }
+
+    size_t n = *cursor < end ? (size_t)(end - *cursor) : 0;
+    n = n < count ? n : count;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        records[i] = ring->records[(*cursor + i) & (TC_TRACE_RING_SIZE - 1)];
+    }
+
+    // Anything the writer has started overwriting since may be torn
+    atomic_thread_fence(memory_order_acquire);
+    const uint64_t started = atomic_load_explicit(&ring->started, memory_order_relaxed);
+    const uint64_t valid = started >= TC_TRACE_RING_SIZE ? started - TC_TRACE_RING_SIZE : 0;
+
+    size_t skipped = valid > *cursor ? (size_t)(valid - *cursor) : 0;
+    skipped = skipped < n ? skipped : n;
+
+    memmove(records, records + skipped, (n - skipped) * sizeof(tc_trace_record));
+    *cursor += n;
+
+    return n - skipped;
+}
+
+/**
+ * @brief Write a whole buffer to a file descriptor
+ */
+bool tc_trace_write_all(int fd, const void *data, size_t len)
+{
+    const char *cursor = (const char *)data;
+
+    while (len > 0)
+    {
+        const ssize_t written = write(fd, cursor, len);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (written <= 0)
+        {
+            return false;
+        }
+
+        cursor += written;
+        len -= (size_t)written;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Write the header of a dump
+ *
+ * @param[in]  fd  File descriptor to write to.
+ *
+ * @return Zero on success, FAILURE if the write fails
+ */
+IoT_Error_t tc_trace_write_header(int fd)
+{
+    tc_trace_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "TCTRACE", sizeof("TCTRACE"));
+    header.version = TC_TRACE_VERSION;
+    header.recordSize = sizeof(tc_trace_record);
+
+    return tc_trace_write_all(fd, &header, sizeof(header)) ? SUCCESS : FAILURE;
+}
+
+/**
+ * @brief Write the records of a ring
+ *
+ * Writes the records in the ring when called, oldest first, through a
+ * buffer on the stack. Only calls write(2), so it is safe to call from a
+ * signal handler.
+ *
+ * @param[in]  fd      File descriptor to write to.
+ * @param[in]  ring    Ring.
+ * @param[in]  thread  Thread number to label the records with.
+ *
+ * @return Zero on success, FAILURE if a write fails
+ */
+IoT_Error_t tc_trace_write_ring(int fd, tc_trace_ring *ring, uint16_t thread)
+{
+    tc_trace_record records[64];
+    const uint64_t end = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t cursor = 0;
+
+    while (cursor < end)
+    {
+        const size_t n = tc_trace_ring_read(ring, &cursor, end, records, sizeof(records) / sizeof(records[0]));
+
+        for (size_t i = 0; i < n; i++)
+        {
+            records[i].thread = thread;
+        }
+
+        if (!tc_trace_write_all(fd, records, n * sizeof(tc_trace_record)))
+        {
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+#ifdef TC_ENABLE_TRACE
+
+/**
+ * Rings of the threads that have recorded trace points
+ */
+tc_trace_ring tc_trace_rings[TC_TRACE_MAX_THREADS];
+
+/**
+ * Number of rings claimed, which can run past TC_TRACE_MAX_THREADS
+ */
+atomic_uint_least32_t tc_trace_ring_count;
+
+/**
+ * This thread's ring plus one, zero before it claims one, UINT32_MAX if
+ * there were none left
+ */
+TC_TRACE_THREAD_LOCAL uint32_t tc_trace_thread_slot;
+
+/**
+ * @brief The calling thread's ring
+ *
+ * @return Ring, NULL if every ring was claimed by other threads
+ */
+tc_trace_ring *tc_trace_thread_ring(void)
+{
+    if (tc_trace_thread_slot == 0)
+    {
+        const uint32_t claimed = atomic_fetch_add_explicit(&tc_trace_ring_count, 1, memory_order_relaxed);
+        tc_trace_thread_slot = claimed < TC_TRACE_MAX_THREADS ? claimed + 1 : UINT32_MAX;
+    }
+
+    return tc_trace_thread_slot <= TC_TRACE_MAX_THREADS ? &tc_trace_rings[tc_trace_thread_slot - 1] : NULL;
+}
+
+/**
+ * @brief Record a trace point on the calling thread
+ */
+void tc_trace_event(tc_trace_stage stage, tc_trace_phase phase, uint32_t arg)
+{
+    tc_trace_ring *ring = tc_trace_thread_ring();
+    if (ring != NULL)
+    {
+        tc_trace_ring_push(ring, stage, phase, arg);
+    }
+}
+
+/**
+ * @brief Dump every thread's trace records
+ *
+ * Threads are numbered from 1 in the order they first recorded a trace
+ * point. Rings outlive their threads, so the records of threads that
+ * have exited are dumped too. Safe to call from a signal handler, e.g.
+ * one a watchdog raises when the client stalls.
+ *
+ * @param[in]  fd  File descriptor to write to.
+ *
+ * @return Zero on success, FAILURE if a write fails
+ */
+IoT_Error_t tc_trace_dump(int fd)
+{
+    IoT_Error_t rc = tc_trace_write_header(fd);
+
+    uint32_t count = atomic_load_explicit(&tc_trace_ring_count, memory_order_relaxed);
+    count = count < TC_TRACE_MAX_THREADS ? count : TC_TRACE_MAX_THREADS;
+
+    for (uint32_t i = 0; i < count && rc == SUCCESS; i++)
+    {
+        rc = tc_trace_write_ring(fd, &tc_trace_rings[i], (uint16_t)(i + 1));
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Begin a traced stage
+ *
+ * @param[in]  stage  tc_trace_stage.
+ * @param[in]  arg    Length of the message.
+ */
+#define TC_TRACE_BEGIN(stage, arg) tc_trace_event((stage), TC_TRACE_PHASE_BEGIN, (uint32_t)(arg))
+
+/**
+ * @brief End a traced stage
+ *
+ * @param[in]  stage  tc_trace_stage.
+ * @param[in]  rc     Result of the stage.
+ */
+#define TC_TRACE_END(stage, rc) tc_trace_event((stage), TC_TRACE_PHASE_END, (uint32_t)(rc))
+
+#else
+
+#define TC_TRACE_BEGIN(stage, arg) ((void)0)
+#define TC_TRACE_END(stage, rc) ((void)0)
+
+#endif /* TC_ENABLE_TRACE */
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_TRACE_ */
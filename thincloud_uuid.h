@@ -0,0 +1,306 @@
+/*
+ * Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THINCLOUD_EMBEDDED_C_SDK_UUID_
+#define THINCLOUD_EMBEDDED_C_SDK_UUID_
+
+/*
+ * Thincloud C Embedded SDK - UUIDs
+ *
+ * Version 4 UUIDs from a xoshiro256** generator seeded once from the
+ * kernel, so generating an ID never blocks or makes a system call. IDs
+ * are held as 16 bytes and converted to and from their 36-character
+ * text form without branching on the digits.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Length of a UUID's text form, without the null character
+ */
+#define TC_UUID_TEXT_LENGTH 36
+
+#ifdef __cplusplus
+#define TC_UUID_THREAD_LOCAL thread_local
+#else
+#define TC_UUID_THREAD_LOCAL _Thread_local
+#endif
+
+/**
+ * @brief UUID as two big-endian halves
+ *
+ * hi holds the first eight bytes of the UUID, so comparing halves as
+ * integers orders UUIDs as their text does.
+ */
+typedef struct
+{
+    uint64_t hi;
+    uint64_t lo;
+} tc_uuid;
+
+/**
+ * @brief UUID generator
+ *
+ * Not thread-safe; give each thread its own.
+ */
+typedef struct
+{
+    uint64_t state[4];
+} tc_uuid_generator;
+
+/**
+ * @brief splitmix64 step, used to expand a seed into generator state
+ */
+uint64_t tc_uuid_splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Seed a generator deterministically
+ *
+ * @param[out]  generator  Generator to seed.
+ * @param[in]   seed       Seed. Generators with the same seed produce the same IDs.
+ */
+void tc_uuid_generator_seed(tc_uuid_generator *generator, uint64_t seed)
+{
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        generator->state[i] = tc_uuid_splitmix64(&seed);
+    }
+}
+
+/**
+ * @brief Seed a generator from the kernel's entropy pool
+ *
+ * Reads /dev/urandom, which does not block. Where it cannot be read the
+ * seed falls back to the clocks, process ID and stack address, which
+ * keeps generators on different devices and in different processes
+ * apart but is predictable.
+ *
+ * @param[out]  generator  Generator to seed.
+ */
+void tc_uuid_generator_init(tc_uuid_generator *generator)
+{
+    const int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        const ssize_t len = read(fd, generator->state, sizeof(generator->state));
+        close(fd);
+
+        // xoshiro must not start from all zeros
+        if (len == (ssize_t)sizeof(generator->state) && (generator->state[0] | generator->state[1] | generator->state[2] | generator->state[3]) != 0)
+        {
+            return;
+        }
+    }
+
+    struct timespec realtime;
+    struct timespec monotonic;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+    uint64_t seed = (uint64_t)realtime.tv_sec * 1000000000ULL + (uint64_t)realtime.tv_nsec;
+    seed ^= ((uint64_t)monotonic.tv_nsec << 32) ^ ((uint64_t)getpid() << 16) ^ (uint64_t)(uintptr_t)&realtime;
+
+    tc_uuid_generator_seed(generator, seed);
+}
+
+/**
+ * @brief Next 64 random bits, xoshiro256**
+ */
+uint64_t tc_uuid_random(tc_uuid_generator *generator)
+{
+    uint64_t *s = generator->state;
+    const uint64_t x = s[1] * 5;
+    const uint64_t result = ((x << 7) | (x >> 57)) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+
+    return result;
+}
+
+/**
+ * @brief Generate a random (version 4) UUID
+ *
+ * @param[in]   generator  Seeded generator.
+ * @param[out]  id         Generated UUID.
+ */
+void tc_uuid_generate(tc_uuid_generator *generator, tc_uuid *id)
+{
+    // Version 4 in the high nibble of byte 6, variant 10 in the top bits of byte 8
+    id->hi = (tc_uuid_random(generator) & ~0xf000ULL) | 0x4000ULL;
+    id->lo = (tc_uuid_random(generator) & ~(0xc0ULL << 56)) | (0x80ULL << 56);
+}
+
+/**
+ * @brief Compare two UUIDs
+ */
+bool tc_uuid_equals(const tc_uuid *a, const tc_uuid *b)
+{
+    return ((a->hi ^ b->hi) | (a->lo ^ b->lo)) == 0;
+}
+
+/**
+ * Position of each of a UUID's 32 hex digits in its text form
+ */
+static const uint8_t TC_UUID_DIGIT_POSITIONS[32] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 14, 15, 16, 17,
+    19, 20, 21, 22, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35};
+
+/**
+ * @brief Write the 16 hex digits of half a UUID
+ */
+void tc_uuid_put_hex(char *text, uint64_t half, const uint8_t *positions)
+{
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        const uint32_t nibble = (uint32_t)((half >> (60 - 4 * i)) & 0xf);
+
+        // Digits above 9 skip the punctuation between '9' and 'a'
+        const uint32_t letter = 0u - ((9u - nibble) >> 31);
+        text[positions[i]] = (char)('0' + nibble + (letter & ('a' - '0' - 10)));
+    }
+}
+
+/**
+ * @brief Read the 16 hex digits of half a UUID
+ *
+ * @return Nonzero if any digit is not a hex digit
+ */
+uint32_t tc_uuid_get_hex(const char *text, const uint8_t *positions, uint64_t *half)
+{
+    uint64_t value = 0;
+    uint32_t invalid = 0;
+
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        const uint8_t c = (uint8_t)text[positions[i]];
+        const uint8_t decimal = (uint8_t)(c - '0');
+        const uint8_t letter = (uint8_t)((c | 0x20) - 'a');
+
+        invalid |= (uint32_t)(decimal > 9) & (uint32_t)(letter > 5);
+
+        // Low nibble of '0'-'9' is the digit, of 'a'-'f' and 'A'-'F' is the digit less 9
+        value = value << 4 | (uint64_t)((c & 0xf) + 9 * (c >> 6));
+    }
+
+    *half = value;
+
+    return invalid;
+}
+
+/**
+ * @brief Format a UUID as lowercase text
+ *
+ * @param[in]   id    UUID.
+ * @param[out]  text  Buffer of at least TC_UUID_TEXT_LENGTH + 1 bytes. Null-terminated.
+ */
+void tc_uuid_format(const tc_uuid *id, char *text)
+{
+    tc_uuid_put_hex(text, id->hi, TC_UUID_DIGIT_POSITIONS);
+    tc_uuid_put_hex(text, id->lo, TC_UUID_DIGIT_POSITIONS + 16);
+
+    text[8] = '-';
+    text[13] = '-';
+    text[18] = '-';
+    text[23] = '-';
+    text[TC_UUID_TEXT_LENGTH] = '\0';
+}
+
+/**
+ * @brief Parse the text form of a UUID
+ *
+ * Accepts the canonical 8-4-4-4-12 form in either case.
+ *
+ * @param[in]   text  Text to parse.
+ * @param[in]   len   Length of the text.
+ * @param[out]  id    Parsed UUID. Unchanged unless the text is a UUID.
+ *
+ * @return true if the text is a UUID
+ */
+bool tc_uuid_parse(const char *text, size_t len, tc_uuid *id)
+{
+    if (len != TC_UUID_TEXT_LENGTH || text[8] != '-' || text[13] != '-' || text[18] != '-' || text[23] != '-')
+    {
+        return false;
+    }
+
+    uint64_t hi;
+    uint64_t lo;
+    if (tc_uuid_get_hex(text, TC_UUID_DIGIT_POSITIONS, &hi) | tc_uuid_get_hex(text, TC_UUID_DIGIT_POSITIONS + 16, &lo))
+    {
+        return false;
+    }
+
+    id->hi = hi;
+    id->lo = lo;
+
+    return true;
+}
+
+/**
+ * @brief Generate a random UUID in text form
+ *
+ * @param[in]   generator  Seeded generator.
+ * @param[out]  text       Buffer of at least TC_UUID_TEXT_LENGTH + 1 bytes. Null-terminated.
+ */
+void tc_uuid_generate_text(tc_uuid_generator *generator, char *text)
+{
+    tc_uuid id;
+    tc_uuid_generate(generator, &id);
+    tc_uuid_format(&id, text);
+}
+
+/**
+ * @brief The calling thread's generator
+ *
+ * Each thread gets a generator of its own, seeded with
+ * tc_uuid_generator_init the first time it asks for one.
+ *
+ * @return Seeded generator, valid until the thread exits
+ */
+tc_uuid_generator *tc_uuid_thread_generator(void)
+{
+    static TC_UUID_THREAD_LOCAL tc_uuid_generator generator;
+    static TC_UUID_THREAD_LOCAL bool seeded = false;
+
+    if (!seeded)
+    {
+        tc_uuid_generator_init(&generator);
+        seeded = true;
+    }
+
+    return &generator;
+}
+
+#endif /* THINCLOUD_EMBEDDED_C_SDK_UUID_ */
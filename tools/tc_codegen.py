@@ -0,0 +1,645 @@
+#!/usr/bin/env python3
+#
+# Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Generate typed structs, parsers and serializers from a message schema.
+
+Usage: tc_codegen.py SCHEMA.json [-o OUTPUT.h]
+
+The schema is a JSON document:
+
+    {
+        "prefix": "lock",
+        "types": {
+            "step": {"deviceId": "string(37)", "level": "int"}
+        },
+        "commands": {
+            "startRoutine": {
+                "params": {"routineId": "string(37)", "steps": "step[8]", "delay": "double"},
+                "body": {"started": "bool"}
+            }
+        },
+        "services": {
+            "schedule": {
+                "method": "GET",
+                "request": {"day": "int"},
+                "response": {"on": "string(6)", "off": "string(6)"}
+            }
+        }
+    }
+
+Field types are bool, int (int64_t), double, string(N) (a char[N] buffer,
+including the null character), the name of an entry in "types" declared
+before it, or an inline object of fields. Any type but an inline object
+can be made a bounded array with a [N] suffix.
+
+For every command the generated header has a struct for its params and a
+parser that decodes them from a tc_command_request_view without building
+a json-c tree, and, when the command has a body, a struct for it and a
+marshaller for the command response. For every service it has a request
+struct and marshaller and a response struct and parser. A dispatching
+tc_command_request_handler calls one typed handler per command method.
+
+Members absent from a payload, or null, are left zeroed and their bit in
+the struct's present mask clear. Unknown members are skipped.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+IDENTIFIER = re.compile(r"^[A-Za-z_][A-Za-z0-9_]*$")
+TYPE = re.compile(r"^(?P<base>[A-Za-z_][A-Za-z0-9_]*)(?:\((?P<size>[0-9]+)\))?(?:\[(?P<count>[0-9]+)\])?$")
+SCALARS = ("bool", "int", "double", "string")
+METHODS = ("GET", "POST", "PUT", "DELETE")
+MAX_FIELDS = 32
+
+
+class SchemaError(Exception):
+    pass
+
+
+def snake(name):
+    """Convert a camelCase schema name to snake_case."""
+    name = re.sub(r"([a-z0-9])([A-Z])", r"\1_\2", name)
+    return re.sub(r"([A-Z]+)([A-Z][a-z])", r"\1_\2", name).lower()
+
+
+def c_string(value):
+    return '"' + value.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
+class Field:
+    def __init__(self, name, kind, size=None, struct=None, count=None):
+        self.name = name
+        self.kind = kind  # one of SCALARS, or "struct"
+        self.size = size  # string buffer size
+        self.struct = struct  # Struct of a struct field
+        self.count = count  # array bound, None for a single value
+
+
+class Struct:
+    def __init__(self, name, title, fields):
+        self.name = name
+        self.title = title
+        self.fields = fields
+
+    def bit(self, field):
+        return "%s_%s" % (self.name.upper(), snake(field.name).upper())
+
+
+class Schema:
+    def __init__(self, document):
+        if not isinstance(document, dict):
+            raise SchemaError("schema must be an object")
+
+        self.prefix = document.get("prefix", "")
+        if not IDENTIFIER.match(self.prefix):
+            raise SchemaError("prefix must be a C identifier")
+
+        # Structs in dependency order, so each is defined before its use
+        self.structs = []
+        self.names = set()
+        self.types = {}
+        self.commands = []
+        self.services = []
+
+        for name, fields in document.get("types", {}).items():
+            self.types[name] = self.struct(self.prefix + "_" + snake(name), "a " + name, fields)
+
+        for method, command in document.get("commands", {}).items():
+            if not IDENTIFIER.match(method):
+                raise SchemaError("command %s: method must be a C identifier" % method)
+
+            self.check_object(command, "command " + method, ("params", "body"))
+            base = self.prefix + "_" + snake(method)
+            params = self.struct(base + "_params", method + " command params", command["params"]) if "params" in command else None
+            body = self.struct(base + "_body", method + " command response body", command["body"]) if "body" in command else None
+            self.commands.append((method, base, params, body))
+
+        for name, service in document.get("services", {}).items():
+            if not IDENTIFIER.match(name):
+                raise SchemaError("service %s: name must be a C identifier" % name)
+
+            self.check_object(service, "service " + name, ("method", "request", "response"))
+            method = service.get("method", "GET")
+            if method not in METHODS:
+                raise SchemaError("service %s: method must be one of %s" % (name, ", ".join(METHODS)))
+
+            base = self.prefix + "_" + snake(name)
+            request = self.struct(base + "_request", name + " service request params", service["request"]) if "request" in service else None
+            response = self.struct(base + "_response", name + " service response body", service["response"]) if "response" in service else None
+            self.services.append((name, base, method, request, response))
+
+        if not self.commands and not self.services:
+            raise SchemaError("schema has no commands or services")
+
+    @staticmethod
+    def check_object(value, what, keys):
+        if not isinstance(value, dict):
+            raise SchemaError(what + " must be an object")
+
+        for key in value:
+            if key not in keys:
+                raise SchemaError("%s: unknown key %s" % (what, key))
+
+    def claim(self, name):
+        if name in self.names:
+            raise SchemaError("generated name %s is used twice" % name)
+
+        self.names.add(name)
+
+    def struct(self, name, title, fields):
+        if not isinstance(fields, dict) or not fields:
+            raise SchemaError(name + ": fields must be a non-empty object")
+
+        if len(fields) > MAX_FIELDS:
+            raise SchemaError("%s: more than %d fields" % (name, MAX_FIELDS))
+
+        self.claim(name)
+        parsed = []
+        for field, spec in fields.items():
+            if not IDENTIFIER.match(field):
+                raise SchemaError("%s: field %s is not a C identifier" % (name, field))
+
+            parsed.append(self.field(name, title, field, spec))
+
+        struct = Struct(name, title, parsed)
+        self.structs.append(struct)
+        return struct
+
+    def field(self, owner, title, name, spec):
+        if isinstance(spec, dict):
+            return Field(name, "struct", struct=self.struct(owner + "_" + snake(name), name + " of " + title, spec))
+
+        match = TYPE.match(spec) if isinstance(spec, str) else None
+        if match is None:
+            raise SchemaError("%s.%s: invalid type %r" % (owner, name, spec))
+
+        base = match.group("base")
+        size = match.group("size")
+        count = int(match.group("count")) if match.group("count") is not None else None
+        if count == 0:
+            raise SchemaError("%s.%s: arrays need at least one element" % (owner, name))
+
+        if (base == "string") != (size is not None) or (size is not None and int(size) < 2):
+            raise SchemaError("%s.%s: strings are declared as string(N), N >= 2" % (owner, name))
+
+        if base in SCALARS:
+            return Field(name, base, size=int(size) if size else None, count=count)
+
+        if base not in self.types:
+            raise SchemaError("%s.%s: unknown type %s" % (owner, name, base))
+
+        return Field(name, "struct", struct=self.types[base], count=count)
+
+
+class Writer:
+    def __init__(self):
+        self.lines = []
+
+    def __call__(self, line="", indent=0):
+        self.lines.append(("    " * indent + line) if line else "")
+
+    def text(self):
+        return "\n".join(self.lines) + "\n"
+
+
+def c_type(field):
+    return {"bool": "bool", "int": "int64_t", "double": "double", "string": "char"}.get(field.kind) or field.struct.name
+
+
+def emit_struct(out, struct):
+    out("/**")
+    out(" * @brief Fields of %s" % struct.title)
+    out(" */")
+    out("typedef struct")
+    out("{")
+    for field in struct.fields:
+        suffix = "[%d]" % field.size if field.kind == "string" else ""
+        if field.count is not None:
+            out("%s %s[%d]%s;" % (c_type(field), field.name, field.count, suffix), 1)
+            out("uint32_t %sCount;" % field.name, 1)
+        else:
+            out("%s %s%s;" % (c_type(field), field.name, suffix), 1)
+    out("uint32_t present;", 1)
+    out("} %s;" % struct.name)
+    out()
+    for index, field in enumerate(struct.fields):
+        out("#define %s (1u << %d)" % (struct.bit(field), index))
+    out()
+
+
+def read_value(field, target, indent, out):
+    """Emit statements reading one value of field into target, setting rc."""
+    if field.kind == "bool":
+        out("rc = tc_json_read_bool(reader, &%s);" % target, indent)
+    elif field.kind == "int":
+        out("rc = tc_json_read_int(reader, &%s);" % target, indent)
+    elif field.kind == "double":
+        out("rc = tc_json_read_double(reader, &%s);" % target, indent)
+    elif field.kind == "string":
+        out("rc = tc_json_read_string(reader, %s, sizeof(%s));" % (target, target), indent)
+    else:
+        out("rc = %s_read(reader, &%s);" % (field.struct.name, target), indent)
+
+
+def read_field(field, indent, out):
+    target = "out->" + field.name
+    if field.count is None:
+        read_value(field, target, indent, out)
+        return
+
+    out("bool hasElement = false;", indent)
+    out("rc = tc_json_array_begin(reader);", indent)
+    out("while (rc == SUCCESS)", indent)
+    out("{", indent)
+    out("rc = tc_json_array_next(reader, &hasElement);", indent + 1)
+    out("if (rc != SUCCESS || !hasElement)", indent + 1)
+    out("{", indent + 1)
+    out("break;", indent + 2)
+    out("}", indent + 1)
+    out()
+    out("if (%sCount == %d)" % (target, field.count), indent + 1)
+    out("{", indent + 1)
+    out("rc = LIMIT_EXCEEDED_ERROR;", indent + 2)
+    out("break;", indent + 2)
+    out("}", indent + 1)
+    out()
+    read_value(field, "%s[%sCount]" % (target, target), indent + 1, out)
+    out("%sCount++;" % target, indent + 1)
+    out("}", indent)
+
+
+def emit_read(out, struct):
+    out("/**")
+    out(" * @brief Read %s" % struct.title)
+    out(" */")
+    out("IoT_Error_t %s_read(tc_json_reader *reader, %s *out)" % (struct.name, struct.name))
+    out("{")
+    out("memset(out, 0, sizeof(*out));", 1)
+    out()
+    out("IoT_Error_t rc = tc_json_object_begin(reader);", 1)
+    out("tc_slice key;", 1)
+    out("bool hasMember = false;", 1)
+    out()
+    out("while (rc == SUCCESS)", 1)
+    out("{", 1)
+    out("rc = tc_json_object_next(reader, &key, &hasMember);", 2)
+    out("if (rc != SUCCESS || !hasMember)", 2)
+    out("{", 2)
+    out("break;", 3)
+    out("}", 2)
+    out()
+    out("if (tc_json_skip_null(reader))", 2)
+    out("{", 2)
+    out("continue;", 3)
+    out("}", 2)
+    out()
+    out("// Members are matched by length first, then by name", 2)
+    out("switch (key.len)", 2)
+    out("{", 2)
+
+    by_length = {}
+    for field in struct.fields:
+        by_length.setdefault(len(field.name), []).append(field)
+
+    for length in sorted(by_length):
+        out("case %d:" % length, 2)
+        for field in by_length[length]:
+            out("if (memcmp(key.data, %s, %d) == 0)" % (c_string(field.name), length), 3)
+            out("{", 3)
+            read_field(field, 4, out)
+            out("out->present |= %s;" % struct.bit(field), 4)
+            out("continue;", 4)
+            out("}", 3)
+        out("break;", 3)
+
+    out("}", 2)
+    out()
+    out("rc = tc_json_skip_value(reader, reader->depth);", 2)
+    out("}", 1)
+    out()
+    out("return rc;", 1)
+    out("}")
+    out()
+
+
+def write_value(field, source, indent, out):
+    if field.kind == "bool":
+        out("tc_json_bool(writer, %s);" % source, indent)
+    elif field.kind == "int":
+        out("tc_json_int(writer, %s);" % source, indent)
+    elif field.kind == "double":
+        out("tc_json_double(writer, %s);" % source, indent)
+    elif field.kind == "string":
+        out("tc_json_string(writer, %s);" % source, indent)
+    else:
+        out("%s_write(writer, &%s);" % (field.struct.name, source), indent)
+
+
+def emit_write(out, struct):
+    out("/**")
+    out(" * @brief Write %s" % struct.title)
+    out(" */")
+    out("void %s_write(tc_json_writer *writer, const %s *in)" % (struct.name, struct.name))
+    out("{")
+    out("tc_json_begin_object(writer);", 1)
+    for field in struct.fields:
+        out("if (in->present & %s)" % struct.bit(field), 1)
+        out("{", 1)
+        out("tc_json_key(writer, %s);" % c_string(field.name), 2)
+        if field.count is None:
+            write_value(field, "in->" + field.name, 2, out)
+        else:
+            out("tc_json_begin_array(writer);", 2)
+            out("for (uint32_t i = 0; i < in->%sCount && i < %d; i++)" % (field.name, field.count), 2)
+            out("{", 2)
+            write_value(field, "in->%s[i]" % field.name, 3, out)
+            out("}", 2)
+            out("tc_json_end_array(writer);", 2)
+        out("}", 1)
+    out("tc_json_end_object(writer);", 1)
+    out("}")
+    out()
+
+
+def emit_parse(out, struct, view, member, message):
+    out("/**")
+    out(" * @brief Decode %s from a %s" % (struct.title, message))
+    out(" * ")
+    out(" * @param[in]   view  Scanned %s." % message)
+    out(" * @param[out]  out   Decoded fields.")
+    out(" * ")
+    out(" * @return Zero on success, MAX_SIZE_ERROR if a string does not fit,")
+    out(" *         LIMIT_EXCEEDED_ERROR if an array does not fit, negative value otherwise")
+    out(" */")
+    out("IoT_Error_t %s_parse(const %s *view, %s *out)" % (struct.name, view, struct.name))
+    out("{")
+    out("tc_slice data;", 1)
+    out("IoT_Error_t rc = tc_data_slice(view->%s, &data);" % member, 1)
+    out("if (rc != SUCCESS || data.data == NULL)", 1)
+    out("{", 1)
+    out("memset(out, 0, sizeof(*out));", 2)
+    out("return rc;", 2)
+    out("}", 1)
+    out()
+    out("tc_json_reader reader;", 1)
+    out("tc_json_reader_init(&reader, data.data, data.len);", 1)
+    out()
+    out("rc = %s_read(&reader, out);" % struct.name, 1)
+    out("if (rc != SUCCESS)", 1)
+    out("{", 1)
+    out("return rc;", 2)
+    out("}", 1)
+    out()
+    out("return tc_json_reader_finish(&reader);", 1)
+    out("}")
+    out()
+
+
+def emit_finish(out):
+    out("const IoT_Error_t rc = tc_json_writer_finish(&writer);", 1)
+    out("if (written != NULL)", 1)
+    out("{", 1)
+    out("*written = writer.length;", 2)
+    out("}", 1)
+    out()
+    out("return rc;", 1)
+    out("}")
+    out()
+
+
+def emit_command_response(out, method, base, body):
+    out("/**")
+    out(" * @brief Marshal a %s command response into a bounded buffer" % method)
+    out(" * ")
+    out(" * @param[out]  buffer      Pointer to a string buffer to write to.")
+    out(" * @param[in]   bufferLen   Size of buffer, including room for the null character.")
+    out(" * @param[in]   requestId   Command request's ID.")
+    out(" * @param[in]   statusCode  Command's response status.")
+    out(" * @param[in]   body        Optional. Response body.")
+    out(" * @param[out]  written     Optional. Length of the message, or the length needed when buffer is too small.")
+    out(" * ")
+    out(" * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,")
+    out(" *         a negative value otherwise")
+    out(" */")
+    out("IoT_Error_t %s_response_n(char *buffer, size_t bufferLen, const char *requestId, uint16_t statusCode, const %s *body, size_t *written)" % (base, body.name))
+    out("{")
+    out("tc_json_writer writer;", 1)
+    out("tc_json_writer_init(&writer, buffer, bufferLen);", 1)
+    out()
+    out("tc_json_begin_object(&writer);", 1)
+    out("if (requestId != NULL)", 1)
+    out("{", 1)
+    out('tc_json_key(&writer, "id");', 2)
+    out("tc_json_string(&writer, requestId);", 2)
+    out("}", 1)
+    out('tc_json_key(&writer, "result");', 1)
+    out("tc_json_begin_object(&writer);", 1)
+    out('tc_json_key(&writer, "statusCode");', 1)
+    out("tc_json_int(&writer, statusCode);", 1)
+    out("if (body != NULL)", 1)
+    out("{", 1)
+    out('tc_json_key(&writer, "body");', 2)
+    out("tc_json_begin_object(&writer);", 2)
+    out('tc_json_key(&writer, "data");', 2)
+    out("%s_write(&writer, body);" % body.name, 2)
+    out("tc_json_end_object(&writer);", 2)
+    out("}", 1)
+    out("tc_json_end_object(&writer);", 1)
+    out("tc_json_end_object(&writer);", 1)
+    out()
+    emit_finish(out)
+
+
+def emit_service_request(out, name, base, method, request):
+    out("/**")
+    out(" * @brief Marshal a %s service request into a bounded buffer" % name)
+    out(" * ")
+    out(" * @param[out]  buffer     Pointer to a string buffer to write to.")
+    out(" * @param[in]   bufferLen  Size of buffer, including room for the null character.")
+    out(" * @param[in]   requestId  Unique ID for the request.")
+    out(" * @param[in]   params     Request parameters.")
+    out(" * @param[out]  written    Optional. Length of the message, or the length needed when buffer is too small.")
+    out(" * ")
+    out(" * @return Zero on success, MAX_SIZE_ERROR if buffer is too small,")
+    out(" *         a negative value otherwise")
+    out(" */")
+    out("IoT_Error_t %s_request_n(char *buffer, size_t bufferLen, const char *requestId, const %s *params, size_t *written)" % (base, request.name))
+    out("{")
+    out("tc_json_writer writer;", 1)
+    out("tc_json_writer_init(&writer, buffer, bufferLen);", 1)
+    out()
+    out("tc_json_begin_object(&writer);", 1)
+    out("if (requestId != NULL)", 1)
+    out("{", 1)
+    out('tc_json_key(&writer, "id");', 2)
+    out("tc_json_string(&writer, requestId);", 2)
+    out("}", 1)
+    out('tc_json_key(&writer, "method");', 1)
+    out("tc_json_string(&writer, REQUEST_METHOD_%s);" % method, 1)
+    out('tc_json_key(&writer, "params");', 1)
+    out("tc_json_begin_object(&writer);", 1)
+    out('tc_json_key(&writer, "data");', 1)
+    out("%s_write(&writer, params);" % request.name, 1)
+    out("tc_json_end_object(&writer);", 1)
+    out("tc_json_end_object(&writer);", 1)
+    out()
+    emit_finish(out)
+
+
+def emit_dispatch(out, schema):
+    prefix = schema.prefix
+    for method, base, params, _ in schema.commands:
+        args = "AWS_IoT_Client *client, tc_slice deviceId, tc_slice requestId"
+        if params is not None:
+            args += ", const %s *params" % params.name
+        out("/**")
+        out(" * @brief Handler of %s commands" % method)
+        out(" */")
+        out("typedef void (*%s_handler)(%s, void *userData);" % (base, args))
+        out()
+    out("/**")
+    out(" * @brief Typed handlers of %s commands" % prefix)
+    out(" * ")
+    out(" * Unset handlers are skipped. onError, when set, is called for unknown")
+    out(" * methods with FAILURE and for params that fail to decode.")
+    out(" */")
+    out("typedef struct")
+    out("{")
+    for method, base, _, _ in schema.commands:
+        out("%s_handler %s;" % (base, method), 1)
+    out("void (*onError)(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, IoT_Error_t rc, void *userData);", 1)
+    out("void *userData;", 1)
+    out("} %s_command_handlers;" % prefix)
+    out()
+    out("/**")
+    out(" * @brief Decode a command request and call its method's typed handler")
+    out(" * ")
+    out(" * A tc_command_request_handler for tc_dispatcher_subscribe_command_requests.")
+    out(" * userData is a %s_command_handlers." % prefix)
+    out(" */")
+    out("void %s_command_handler(AWS_IoT_Client *client, tc_slice deviceId, const tc_command_request_view *request, void *userData)" % prefix)
+    out("{")
+    out("const %s_command_handlers *handlers = (const %s_command_handlers *)userData;" % (prefix, prefix), 1)
+    out("const tc_slice method = request->method;", 1)
+    out("IoT_Error_t rc = FAILURE;", 1)
+    out()
+    out("switch (method.len)", 1)
+    out("{", 1)
+
+    by_length = {}
+    for command in schema.commands:
+        by_length.setdefault(len(command[0]), []).append(command)
+
+    for length in sorted(by_length):
+        out("case %d:" % length, 1)
+        for method, base, params, _ in by_length[length]:
+            out("if (memcmp(method.data, %s, %d) == 0)" % (c_string(method), length), 2)
+            out("{", 2)
+            if params is not None:
+                out("%s params;" % params.name, 3)
+                out("rc = %s_parse(request, &params);" % params.name, 3)
+                out("if (rc == SUCCESS && handlers->%s != NULL)" % method, 3)
+                out("{", 3)
+                out("handlers->%s(client, deviceId, request->requestId, &params, handlers->userData);" % method, 4)
+                out("}", 3)
+            else:
+                out("rc = SUCCESS;", 3)
+                out("if (handlers->%s != NULL)" % method, 3)
+                out("{", 3)
+                out("handlers->%s(client, deviceId, request->requestId, handlers->userData);" % method, 4)
+                out("}", 3)
+            out("break;", 3)
+            out("}", 2)
+        out("break;", 2)
+
+    out("}", 1)
+    out()
+    out("if (rc != SUCCESS && handlers->onError != NULL)", 1)
+    out("{", 1)
+    out("handlers->onError(client, deviceId, request, rc, handlers->userData);", 2)
+    out("}", 1)
+    out("}")
+    out()
+
+
+def generate(schema, source):
+    out = Writer()
+    guard = "THINCLOUD_GENERATED_%s_" % schema.prefix.upper()
+
+    out("/*")
+    out(" * Generated by tools/tc_codegen.py from %s. Do not edit." % source)
+    out(" */")
+    out()
+    out("#ifndef %s" % guard)
+    out("#define %s" % guard)
+    out()
+    out('#include "thincloud.h"')
+    out()
+
+    for struct in schema.structs:
+        emit_struct(out, struct)
+
+    for struct in schema.structs:
+        emit_read(out, struct)
+        emit_write(out, struct)
+
+    for method, base, params, body in schema.commands:
+        if params is not None:
+            emit_parse(out, params, "tc_command_request_view", "params", "command request")
+        if body is not None:
+            emit_command_response(out, method, base, body)
+
+    for name, base, method, request, response in schema.services:
+        if request is not None:
+            emit_service_request(out, name, base, method, request)
+        if response is not None:
+            emit_parse(out, response, "tc_service_response_view", "body", "service response")
+
+    if schema.commands:
+        emit_dispatch(out, schema)
+
+    out("#endif /* %s */" % guard)
+    return out.text()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate typed ThinCloud message code from a schema.")
+    parser.add_argument("schema", help="schema JSON file")
+    parser.add_argument("-o", "--output", help="header to write, stdout by default")
+    args = parser.parse_args()
+
+    try:
+        with open(args.schema) as f:
+            schema = Schema(json.load(f))
+    except (OSError, ValueError, SchemaError) as e:
+        print("%s: %s" % (args.schema, e), file=sys.stderr)
+        return 1
+
+    text = generate(schema, args.schema.replace("\\", "/").split("/")[-1])
+    if args.output is None:
+        sys.stdout.write(text)
+    else:
+        with open(args.output, "w") as f:
+            f.write(text)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
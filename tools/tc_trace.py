@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+#
+# Copyright 2019 Yonomi, Inc. or its affiliates. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Convert a trace dump to Chrome trace JSON.
+
+Usage: tc_trace.py DUMP [-o OUTPUT.json] [--summary]
+
+DUMP is what tc_trace_dump wrote from an SDK built with TC_ENABLE_TRACE.
+The output opens in chrome://tracing or https://ui.perfetto.dev, with one
+track per thread and one slice per stage of each message sent or
+received.
+
+Stages still open at the end of the dump are reported on stderr, since a
+stalled client is stuck in one of them. --summary also prints each
+stage's count and latency percentiles.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+# Must match tc_trace_stage in thincloud_trace.h
+STAGES = ("topic", "marshal", "publish", "callback", "unmarshal", "handler")
+MAGIC = b"TCTRACE\0"
+VERSION = 1
+HEADER = "8sII"
+RECORD = "QIHBB"
+
+
+class DumpError(Exception):
+    pass
+
+
+def read_dump(data):
+    """Return the records of a dump as (timestamp, arg, thread, stage, phase) tuples."""
+    if len(data) < struct.calcsize(HEADER):
+        raise DumpError("too short for a header")
+
+    # Dumps are in the byte order of the device that wrote them
+    for order in ("<", ">"):
+        magic, version, size = struct.unpack_from(order + HEADER, data)
+        if magic == MAGIC and version == VERSION:
+            break
+    else:
+        raise DumpError("not a version %d trace dump" % VERSION)
+
+    record = struct.Struct(order + RECORD)
+    if size != record.size:
+        raise DumpError("records are %d bytes, expected %d" % (size, record.size))
+
+    offset = struct.calcsize(HEADER)
+    body = len(data) - offset
+    if body % size != 0:
+        print("warning: ignoring %d trailing bytes" % (body % size), file=sys.stderr)
+
+    return [record.unpack_from(data, offset + i * size) for i in range(body // size)]
+
+
+def stage_name(stage):
+    return STAGES[stage] if stage < len(STAGES) else "stage %d" % stage
+
+
+def signed(value):
+    return value - (1 << 32) if value >= 1 << 31 else value
+
+
+def convert(records):
+    """Pair begin and end records into Chrome trace events.
+
+    Returns the events, the stages left open as (thread, stage, begin)
+    tuples, and the durations of each stage in nanoseconds.
+    """
+    if not records:
+        return [], [], {}
+
+    start = min(r[0] for r in records)
+    threads = {}
+    for r in records:
+        threads.setdefault(r[2], []).append(r)
+
+    events = []
+    open_stages = []
+    durations = {}
+
+    for thread, thread_records in sorted(threads.items()):
+        events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": thread, "args": {"name": "thread %d" % thread}})
+
+        stack = []
+        for timestamp, arg, _, stage, phase in sorted(thread_records, key=lambda r: r[0]):
+            if phase == ord("B"):
+                stack.append((timestamp, arg, stage))
+                continue
+
+            # An end whose begin was overwritten has nothing to pair with
+            if not any(s[2] == stage for s in stack):
+                continue
+
+            while stack[-1][2] != stage:
+                stack.pop()
+
+            begin, length, _ = stack.pop()
+            events.append({
+                "name": stage_name(stage),
+                "cat": "thincloud",
+                "ph": "X",
+                "pid": 1,
+                "tid": thread,
+                "ts": (begin - start) / 1000.0,
+                "dur": (timestamp - begin) / 1000.0,
+                "args": {"bytes": length, "rc": signed(arg)},
+            })
+            durations.setdefault(stage, []).append(timestamp - begin)
+
+        for begin, length, stage in stack:
+            events.append({
+                "name": stage_name(stage),
+                "cat": "thincloud",
+                "ph": "B",
+                "pid": 1,
+                "tid": thread,
+                "ts": (begin - start) / 1000.0,
+                "args": {"bytes": length},
+            })
+            open_stages.append((thread, stage, begin))
+
+    return events, open_stages, durations
+
+
+def percentile(values, quantile):
+    return values[min(len(values) - 1, int(quantile * len(values)))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert a ThinCloud trace dump to Chrome trace JSON.")
+    parser.add_argument("dump", help="dump written by tc_trace_dump")
+    parser.add_argument("-o", "--output", help="JSON file to write, stdout by default")
+    parser.add_argument("--summary", action="store_true", help="print stage latencies on stderr")
+    args = parser.parse_args()
+
+    try:
+        with open(args.dump, "rb") as f:
+            records = read_dump(f.read())
+    except (OSError, DumpError) as e:
+        print("%s: %s" % (args.dump, e), file=sys.stderr)
+        return 1
+
+    events, open_stages, durations = convert(records)
+
+    end = max((r[0] for r in records), default=0)
+    for thread, stage, begin in open_stages:
+        print("thread %d: in %s for %.3f ms at the end of the dump" % (thread, stage_name(stage), (end - begin) / 1e6), file=sys.stderr)
+
+    if args.summary:
+        print("%-10s %8s %10s %10s %10s" % ("stage", "count", "p50 us", "p99 us", "max us"), file=sys.stderr)
+        for stage, values in sorted(durations.items()):
+            values.sort()
+            print("%-10s %8d %10.2f %10.2f %10.2f" % (stage_name(stage), len(values), percentile(values, 0.5) / 1e3, percentile(values, 0.99) / 1e3, values[-1] / 1e3), file=sys.stderr)
+
+    text = json.dumps({"traceEvents": events, "displayTimeUnit": "ns"}, indent=1)
+    if args.output is None:
+        sys.stdout.write(text + "\n")
+    else:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())